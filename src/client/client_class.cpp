@@ -274,6 +274,25 @@ void AsyncClient::ReceiveHandler(uint32_t len, uint32_t tag) {
             cout << "From UID:" << from_uid << '\n';
             cout << content << '\n';
         } break;
+        case GROUP_CHAT_MSG_TOCLI: {
+            uint64_t group_id = ReadNetField64(recv_buf_.GetContent());
+            uint64_t from_uid = ReadNetField64(recv_buf_.GetContent() + sizeof(uint64_t));
+            content = content.substr(2 * sizeof(uint64_t));
+            cout << "Group " << group_id << ", from UID:" << from_uid << '\n';
+            cout << content << '\n';
+        } break;
+        case SERVER_MIGRATE: {
+            // [uint16_t：地址长度][目标服务器地址][token]
+            if (len < sizeof(uint16_t)) break;
+            uint16_t addr_len = ReadNetField16(recv_buf_.GetContent());
+            if (addr_len > len - sizeof(uint16_t)) break;
+            string addr = content.substr(sizeof(uint16_t), addr_len);
+            string token = content.substr(sizeof(uint16_t) + addr_len);
+            spdlog::info("Server is draining, migrating to {}", addr);
+            if (on_migrate_) {
+                on_migrate_(std::move(addr), std::move(token));
+            }
+        } break;
         default:
             spdlog::warn("Client received unknown message type: {}", TagTypeStr((TagType)tag));
     }
@@ -321,6 +340,10 @@ void AsyncClient::Verify(uint64_t uid, const string &token) {
     Send(msg.c_str(), msg.size(), VERIFY);
 }
 
-void AsyncClient::WorkerJoin() { worker_.join(); }
+void AsyncClient::WorkerJoin() {
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+}
 bool AsyncClient::Running() const { return running_; }
 }  // namespace chatroom::client
\ No newline at end of file
@@ -1,6 +1,11 @@
+#include <condition_variable>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <thread>
+#include <utility>
 
 #include "client/client_class.hpp"
 #include "common/timer.hpp"
@@ -13,6 +18,46 @@ using namespace boost::asio;
 using namespace std;
 using namespace chatroom;
 
+// 与一个后台服务器的连接，每个连接有自己的io_context和接收线程
+struct Connection {
+    std::unique_ptr<boost::asio::io_context> ctx;
+    std::shared_ptr<client::AsyncClient> cli;
+    std::thread receiver;
+};
+
+// @brief 连接到后台服务器（x.x.x.x:xxxx格式）并发送验证报文
+static bool Connect(Connection &conn, const string &server_addr, uint64_t uid, const string &token,
+                    client::AsyncClient::MigrateHandler on_migrate) {
+    size_t pos = server_addr.find(':');
+    if (pos == string::npos) {
+        spdlog::error("Invalid server address format: {}", server_addr);
+        return false;
+    }
+    ip::tcp::endpoint remote;
+    try {
+        remote = ip::tcp::endpoint(ip::make_address(server_addr.substr(0, pos)), stoi(server_addr.substr(pos + 1)));
+    } catch (const std::exception &e) {
+        spdlog::error("Invalid server address {}: {}", server_addr, e.what());
+        return false;
+    }
+    conn.ctx = std::make_unique<boost::asio::io_context>();
+    conn.cli = make_shared<client::AsyncClient>(*conn.ctx);
+    conn.cli->SetMigrateHandler(std::move(on_migrate));
+    // 使用异步线程来接收消息，简单处理
+    conn.receiver = std::thread([cli = conn.cli, remote]() { cli->Start(remote); });
+    conn.cli->Verify(uid, token);
+    return true;
+}
+
+static void Disconnect(Connection &conn) {
+    if (!conn.cli) return;
+    conn.cli->Close();
+    conn.cli->WorkerJoin();
+    if (conn.receiver.joinable()) {
+        conn.receiver.join();
+    }
+}
+
 int main() {
     spdlog::set_level(spdlog::level::debug);
 
@@ -71,30 +116,54 @@ int main() {
         }
     }
 
-    // try {
-    auto sess = make_shared<client::AsyncClient>(ctx);
-    assert(sess);
-    // 指定远程端口
+    // 当前连接的后台服务器；服务器排空时发来SERVER_MIGRATE，迁移线程连接目标服务器并替换当前连接
+    std::mutex conn_mtx;
+    Connection conn;
+    std::mutex migrate_mtx;
+    std::condition_variable migrate_cv;
+    std::optional<std::pair<string, string>> migrate_req;  // (目标服务器地址, token)
+    bool exiting = false;
+    client::AsyncClient::MigrateHandler on_migrate = [&](string addr, string resume_token) {
+        std::unique_lock lock(migrate_mtx);
+        migrate_req.emplace(std::move(addr), std::move(resume_token));
+        migrate_cv.notify_one();
+    };
+    auto current = [&] {
+        std::unique_lock lock(conn_mtx);
+        return conn.cli;
+    };
+
     spdlog::info("Connecting to remote server {}", server_addr);
-    // 得到的server_addr是x.x.x.x:xxxx格式
-    string server_host, server_port;
-    size_t pos = server_addr.find(':');
-    if (pos != string::npos) {
-        server_host = server_addr.substr(0, pos);
-        server_port = server_addr.substr(pos + 1);
-    } else {
-        spdlog::error("Invalid server address format: {}", server_addr);
+    if (!Connect(conn, server_addr, uid, token, on_migrate)) {
         return -1;
     }
+    std::thread migrator([&] {
+        while (true) {
+            std::unique_lock lock(migrate_mtx);
+            migrate_cv.wait(lock, [&] { return exiting || migrate_req.has_value(); });
+            if (exiting) break;
+            auto [addr, resume_token] = std::move(*migrate_req);
+            migrate_req.reset();
+            lock.unlock();
+
+            // 先连接目标服务器并用token发送验证报文，再关闭旧连接，旧服务器据此确认迁移完成
+            Connection next;
+            if (!Connect(next, addr, uid, resume_token, on_migrate)) {
+                continue;  // 旧服务器会在排空期限到达时关闭连接
+            }
+            {
+                std::unique_lock conn_lock(conn_mtx);
+                std::swap(conn, next);
+            }
+            Disconnect(next);
+            cout << "Migrated to server " << addr << "\n";
+        }
+    });
 
-    ip::tcp::endpoint remote(ip::make_address(server_host), stoi(server_port));
-    // 使用异步线程来接收消息，简单处理
-    std::thread receiver([sess, remote]() { sess->Start(remote); });
-    sess->Verify(uid, token);
     // Timer task用来发送心跳包
     TimerTaskManager tm_mgr;
-    auto task = tm_mgr.CreateTimer(std::chrono::milliseconds(5000), [sess] {
-        sess->Send("PING", 4, PING);  // 心跳包
+    auto task = tm_mgr.CreateTimer(std::chrono::milliseconds(5000), [&current] {
+        current()->Send("PING", 4, PING);  // 心跳包
     });
     (*task)->Activate();
     std::array<char, 255> inp;
@@ -103,6 +172,7 @@ int main() {
         cin.getline(inp.data(), inp.size());
         end_pos = strlen(inp.data());
         if (end_pos == 0) continue;
+        auto sess = current();
         if (!sess->Running()) {
             cout << "Connection closed\n";
             break;
@@ -145,6 +215,23 @@ int main() {
                     sess->Send(msg_data.data(), msg_data.size(), CHAT_MSG);
                     cout << "Message sent to user with UID: " << whom_uid << "\n";
                 }
+            } else if (command == "gsend") {
+                if (args.size() != 2) {
+                    cout << "usage: gsend [group id] [message]\n";
+                } else {
+                    uint64_t group_id;
+                    try {
+                        group_id = stoull(args[0]);
+                    } catch (...) {
+                        cout << "Invalid group ID: " << args[0] << "\n";
+                        continue;
+                    }
+                    string msg_data(args[1].size() + sizeof(uint64_t), 0);
+                    WriteNetField64(msg_data.data(), group_id);
+                    memcpy(msg_data.data() + sizeof(uint64_t), args[1].c_str(), args[1].size());
+                    sess->Send(msg_data.data(), msg_data.size(), GROUP_CHAT_MSG);
+                    cout << "Message sent to group: " << group_id << "\n";
+                }
             } else if (command == "exit") {
                 cout << "bye\n";
                 break;
@@ -158,9 +245,13 @@ int main() {
     printf("Closing\n");
     tm_mgr.RemoveTimer(task);
 
-    sess->Close();
-    sess->WorkerJoin();
-    receiver.join();
+    {
+        std::unique_lock lock(migrate_mtx);
+        exiting = true;
+    }
+    migrate_cv.notify_one();
+    migrator.join();
+    Disconnect(conn);
     // } catch (std::exception& e) {
     //     cerr << "Exception: " << e.what() << endl;
     // }
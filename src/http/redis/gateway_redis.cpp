@@ -1,7 +1,9 @@
 #include "http/redis/gateway_redis.hpp"
 
+#include <array>
 #include <chrono>
 
+#include "common/mq_envelope.hpp"
 #include "log/log_manager.hpp"
 #include "utils/util_func.hpp"
 
@@ -46,10 +48,16 @@ std::pair<bool, std::optional<std::string>> RedisMgr::UserLoginAttempt(std::stri
     std::string key("status:");
     key += user_id;
 
+    // 租约模式下写入的在线状态带有lease_epoch字段，其服务器的租约已经失效（过期或者服务器已重启）时视为离线，
+    // 直接覆盖（见common/presence_lease.hpp）
     static const std::string lua_script = R"(
-            if redis.call("HEXISTS", KEYS[1], "server_id") == 1 then
-                local old_server = redis.call("HGET", KEYS[1], "server_id")
-                return old_server
+            local v = redis.call("HMGET", KEYS[1], "server_id", "lease_epoch")
+            if v[1] and v[2] and redis.call("GET", "lease:server:" .. v[1]) ~= v[2] then
+                redis.call("DEL", KEYS[1])
+                v[1] = false
+            end
+            if v[1] then
+                return v[1]
             else
                 redis.call("HSET", KEYS[1], "server_id", "unset", "status", "verifyed")
                 redis.call("PEXPIRE", KEYS[1], ARGV[1])
@@ -86,8 +94,8 @@ std::pair<bool, std::optional<std::string>> RedisMgr::UserLoginAttempt(std::stri
 std::string RedisMgr::SendServerKickCmd(std::string_view server_id, uint64_t uid, int queue_max_len) {
     std::string mq2_key = "stream:serverctl:";
     mq2_key += server_id;
-    std::string uid_str = std::to_string(uid);
-    std::vector<std::pair<std::string_view, std::string_view>> msg = {{"type", "kick"}, {"uid", uid_str}};
+    std::string envelope = EncodeEnvelope(EnvelopeType::KICK, 0, uid);
+    std::array<std::pair<std::string_view, std::string_view>, 1> msg = {{{MQ_ENVELOPE_FIELD, envelope}}};
     // approx = true
     return GetRedis().xadd(mq2_key, "*", msg.begin(), msg.end(), queue_max_len, true);
 }
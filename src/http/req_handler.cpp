@@ -96,17 +96,11 @@ boost::beast::http::message_generator chatroom::gateway::ReqHandler::LoginLogic(
             return ServerError(std::move(req), "Server error");
     }
 
-    // 验证成功，通过RPC获取服务器信息
-    auto stub = rpc_->GetStatusStub();
-    grpc::ClientContext ctx;
-    chatroom::status::MinimalLoadServerReq rpc_req;
-    chatroom::status::ServerAddrResp rpc_resp;
-    grpc::Status rpc_status = stub->CheckMinimalLoadServer(&ctx, rpc_req, &rpc_resp);
-    if (!rpc_status.ok()) {
-        spdlog::error("Status RPC call failed: {}", rpc_status.error_message());
+    // 验证成功，获取服务器信息
+    string addr;
+    if (!PickServer(addr)) {
         return ServerError(std::move(req), "Server error");  // 对客户隐藏具体的错误信息
     }
-    auto addr = rpc_resp.server_addr();
 
     // 更新用户在Redis缓存中的信息
     if (!redis_->UpdateUserInfo(std::to_string(uid), username)) {
@@ -171,6 +165,24 @@ boost::beast::http::message_generator chatroom::gateway::ReqHandler::LoginLogic(
     return resp;
 }
 
+bool chatroom::gateway::ReqHandler::PickServer(std::string &addr) {
+    uint32_t server_id = 0;
+    if (replica_ && replica_->Pick(server_id, addr)) {
+        return true;
+    }
+    auto stub = rpc_->GetStatusStub();
+    grpc::ClientContext ctx;
+    chatroom::status::MinimalLoadServerReq rpc_req;
+    chatroom::status::ServerAddrResp rpc_resp;
+    grpc::Status rpc_status = stub->CheckMinimalLoadServer(&ctx, rpc_req, &rpc_resp);
+    if (!rpc_status.ok()) {
+        spdlog::error("Status RPC call failed: {}", rpc_status.error_message());
+        return false;
+    }
+    addr = rpc_resp.server_addr();
+    return true;
+}
+
 boost::beast::http::message_generator chatroom::gateway::ReqHandler::PostRegisterLogic(
     http::request<boost::beast::http::string_body> &&req) {
     http::response<http::string_body> resp;
@@ -0,0 +1,127 @@
+#include "http/server_replica.hpp"
+
+#include <grpcpp/support/sync_stream.h>
+
+#include "log/log_manager.hpp"
+#include "protocpp/status.grpc.pb.h"
+
+void chatroom::gateway::ServerReplica::Start() {
+    if (th_.joinable()) {
+        return;
+    }
+    {
+        std::unique_lock lock(mtx_);
+        stop_ = false;
+    }
+    th_ = std::thread([this] { WatchFn(); });
+}
+
+void chatroom::gateway::ServerReplica::Stop() {
+    {
+        std::unique_lock lock(mtx_);
+        stop_ = true;
+        if (ctx_ != nullptr) {
+            ctx_->TryCancel();  // 使订阅线程上阻塞的Read()返回
+        }
+    }
+    stop_cv_.notify_all();
+    if (th_.joinable()) {
+        th_.join();
+    }
+}
+
+bool chatroom::gateway::ServerReplica::Pick(uint32_t &id, std::string &addr) {
+    std::unique_lock lock(mtx_);
+    if (!synced_ || std::chrono::steady_clock::now() - last_update_ > stale_after_) {
+        ++stats_.stale_picks;
+        return false;
+    }
+    std::pair<const uint32_t, Server> *best = nullptr;
+    double best_score = 0;
+    for (auto &item : servers_) {
+        const Server &srv = item.second;
+        double score = srv.score + srv.session_cost * srv.reserved;
+        if (best != nullptr) {
+            if (srv.draining != best->second.draining) {
+                if (srv.draining) continue;  // 正在排空的服务器排在其他服务器之后
+            } else if (score >= best_score) {
+                continue;
+            }
+        }
+        best = &item;
+        best_score = score;
+    }
+    if (best == nullptr) {
+        ++stats_.stale_picks;
+        return false;  // 没有可用的服务器，交给状态服务器判断
+    }
+    ++best->second.reserved;
+    ++stats_.local_picks;
+    id = best->first;
+    addr = best->second.addr;
+    return true;
+}
+
+void chatroom::gateway::ServerReplica::Apply(const status::ServerListUpdate &update) {
+    std::unique_lock lock(mtx_);
+    if (update.full()) {
+        servers_.clear();
+        synced_ = true;
+        ++stats_.resyncs;
+    }
+    for (uint32_t id : update.removed()) {
+        servers_.erase(id);
+    }
+    for (const auto &item : update.servers()) {
+        Server &srv = servers_[item.id()];
+        srv.addr = item.addr();
+        srv.draining = item.draining();
+        srv.score = item.score();
+        srv.session_cost = item.session_cost();
+        srv.reserved = 0;  // 新的得分已经包含了之前分配出去的登录
+    }
+    last_update_ = std::chrono::steady_clock::now();
+    ++stats_.updates;
+}
+
+chatroom::gateway::ReplicaStats chatroom::gateway::ServerReplica::GetStats() {
+    std::unique_lock lock(mtx_);
+    return stats_;
+}
+
+void chatroom::gateway::ServerReplica::MarkStale() {
+    std::unique_lock lock(mtx_);
+    synced_ = false;
+    servers_.clear();
+}
+
+void chatroom::gateway::ServerReplica::WatchFn() {
+    auto stub = status::StatusService::NewStub(rpc_->GetChannel());
+    while (true) {
+        grpc::ClientContext ctx;
+        {
+            std::unique_lock lock(mtx_);
+            if (stop_) {
+                break;
+            }
+            ctx_ = &ctx;
+        }
+        status::WatchServersReq req;
+        auto reader = stub->WatchServers(&ctx, req);
+        status::ServerListUpdate update;
+        while (reader->Read(&update)) {
+            Apply(update);
+        }
+        grpc::Status status = reader->Finish();
+        MarkStale();
+
+        std::unique_lock lock(mtx_);
+        ctx_ = nullptr;
+        if (stop_) {
+            break;
+        }
+        spdlog::warn("ServerReplica: watch stream ended ({}), falling back to status RPC until it is re-established",
+                     status.error_message());
+        stop_cv_.wait_for(lock, WATCH_RETRY_INTERVAL, [this] { return stop_; });
+    }
+}
@@ -7,6 +7,7 @@
 #include <common/msgnode.hpp>
 #include <condition_variable>
 #include <deque>
+#include <functional>
 #include <memory>
 #include <string>
 #include <thread>
@@ -31,7 +32,13 @@ class GatewayHelper {
 // FIXME: strand，似乎异步操作同时读写sock会导致奇怪的问题
 class AsyncClient : public std::enable_shared_from_this<AsyncClient> {
    public:
+    // 收到SERVER_MIGRATE时的回调，参数为目标服务器地址和恢复用的token；在接收线程上调用
+    using MigrateHandler = std::function<void(std::string addr, std::string token)>;
+
     explicit AsyncClient(boost::asio::io_context &ctx) : sock_(ctx), ctx_(ctx), strand_(ctx_.get_executor()) {}
+
+    // @brief 设置服务器排空时的迁移回调，需要在Start()之前调用
+    void SetMigrateHandler(MigrateHandler handler) { on_migrate_ = std::move(handler); }
     // 启动连接
     void Start(const boost::asio::ip::tcp::endpoint &remote);
     void ConnectedHandler();
@@ -69,6 +76,7 @@ class AsyncClient : public std::enable_shared_from_this<AsyncClient> {
     std::thread worker_;
     std::condition_variable cv_;
     std::atomic_bool running_{false};
+    MigrateHandler on_migrate_;
 };
 }  // namespace chatroom::client
 
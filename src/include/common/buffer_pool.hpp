@@ -0,0 +1,264 @@
+#ifndef COMMON_BUFFER_POOL_HEADER
+#define COMMON_BUFFER_POOL_HEADER
+
+// buffer_pool.hpp: MsgNode使用的分级（size-classed）缓冲区内存池
+// **********************************************
+//  内存池把请求的长度向上取整到固定的几个尺寸等级（64B ~ 64KiB），每个等级维护各自的空闲块链表：
+//  - 每个线程有自己的线程缓存（ThreadCache），分配/释放优先在线程缓存中完成，不需要加锁；
+//  - 线程缓存为空时，从中心空闲链表（加锁）批量取回一批内存块；中心链表也为空时，一次性分配一整块slab并切分；
+//  - 线程缓存中的块过多时，把一半归还给中心链表，这样跨线程释放（A线程分配，B线程释放）的块也能被重新利用。
+//  超过最大等级的请求直接使用new[]/delete[]，并记为未命中（miss）。
+//
+//  slab内存在进程退出前不会归还给操作系统，内存池的占用等于运行期间的峰值占用。
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "utils/util_class.hpp"
+
+namespace chatroom {
+// 内存池的统计信息
+struct BufferPoolStats {
+    uint64_t hits;         // 从线程缓存或中心链表中直接得到内存块的次数
+    uint64_t misses;       // 需要分配新slab或者超出等级上限的分配次数
+    uint64_t slab_allocs;  // 向系统申请slab的次数
+    uint64_t oversize;     // 超出最大等级、直接使用new[]的次数
+};
+
+class BufferPool : public Noncopyable {
+   public:
+    static constexpr std::size_t CLASS_COUNT = 6;
+    static constexpr std::array<uint32_t, CLASS_COUNT> CLASS_SIZE = {64, 256, 1024, 4096, 16384, 65536};
+    static constexpr std::size_t SLAB_BYTES = 256 * 1024;  // 每次向系统申请的slab大小
+    static constexpr std::size_t OVERSIZE = CLASS_COUNT;   // 超出等级上限时ClassOf()的返回值
+    static constexpr uint64_t STATS_FLUSH_OPS = 1024;      // 线程缓存每累计多少次命中就汇总一次统计
+
+    // @brief 获取全局唯一的内存池对象
+    static BufferPool &Instance() {
+        static BufferPool inst;
+        return inst;
+    }
+
+    // @brief 计算长度对应的尺寸等级
+    // @return 等级下标；超出最大等级时返回OVERSIZE
+    static std::size_t ClassOf(uint32_t len) {
+        for (std::size_t i = 0; i < CLASS_COUNT; ++i) {
+            if (len <= CLASS_SIZE[i]) return i;
+        }
+        return OVERSIZE;
+    }
+
+    // @brief 计算长度为len的请求实际能得到的缓冲区大小
+    static uint32_t Capacity(uint32_t len) {
+        std::size_t cls = ClassOf(len);
+        return cls == OVERSIZE ? len : CLASS_SIZE[cls];
+    }
+
+    // @brief 分配一块至少len字节的缓冲区，其实际大小为Capacity(len)
+    // @warning 释放时必须调用Deallocate，并传入相同的len（或者Capacity(len)）
+    static char *Allocate(uint32_t len) {
+        std::size_t cls = ClassOf(len);
+        if (cls == OVERSIZE) {
+            Instance().oversize_.fetch_add(1, std::memory_order_relaxed);
+            return new char[len];
+        }
+        return LocalCache().Pop(cls);
+    }
+
+    // @brief 归还由Allocate分配的缓冲区
+    static void Deallocate(char *ptr, uint32_t len) {
+        if (!ptr) return;
+        std::size_t cls = ClassOf(len);
+        if (cls == OVERSIZE) {
+            delete[] ptr;
+            return;
+        }
+        LocalCache().Push(cls, ptr);
+    }
+
+    // @brief 返回内存池的统计信息
+    // @ 线程缓存中的命中计数每STATS_FLUSH_OPS次（或者与中心链表交互时）才汇总，每个线程至多滞后STATS_FLUSH_OPS次
+    BufferPoolStats GetStats() const {
+        uint64_t oversize = oversize_.load(std::memory_order_relaxed);
+        return {hits_.load(std::memory_order_relaxed), misses_.load(std::memory_order_relaxed) + oversize,
+                slab_allocs_.load(std::memory_order_relaxed), oversize};
+    }
+
+    ~BufferPool() {
+        for (void *slab : slabs_) {
+            ::operator delete(slab);
+        }
+    }
+
+   private:
+    // 空闲块链表的节点，直接复用空闲内存块的前8个字节
+    struct FreeBlock {
+        FreeBlock *next;
+    };
+
+    // 每个等级的中心空闲链表
+    struct FreeList {
+        FreeBlock *head{nullptr};
+        std::size_t count{0};
+    };
+
+    // 线程缓存：单个线程独占，不需要加锁
+    class ThreadCache {
+       public:
+        ThreadCache() : pool_(BufferPool::Instance()) {}  // 保证内存池先于线程缓存构造、后于其析构
+
+        ~ThreadCache() {
+            for (std::size_t cls = 0; cls < CLASS_COUNT; ++cls) {
+                pool_.Release(cls, lists_[cls], lists_[cls].count);
+            }
+            Flush();
+        }
+
+        char *Pop(std::size_t cls) {
+            FreeList &list = lists_[cls];
+            if (!list.head) {
+                // 线程缓存为空，从中心链表批量获取
+                if (pool_.Fetch(cls, list, BatchOf(cls))) {
+                    ++misses_;
+                } else {
+                    ++hits_;
+                }
+                Flush();
+            } else if (++hits_ >= STATS_FLUSH_OPS) {
+                // 只在线程缓存中命中的线程不会与中心链表交互，定期汇总，避免统计值一直停留在旧值上
+                Flush();
+            }
+            FreeBlock *blk = list.head;
+            list.head = blk->next;
+            --list.count;
+            return reinterpret_cast<char *>(blk);  // NOLINT
+        }
+
+        void Push(std::size_t cls, char *ptr) {
+            FreeList &list = lists_[cls];
+            auto *blk = reinterpret_cast<FreeBlock *>(ptr);  // NOLINT
+            blk->next = list.head;
+            list.head = blk;
+            ++list.count;
+            if (list.count > 2 * BatchOf(cls)) {
+                // 缓存的空闲块过多，归还一半给中心链表
+                pool_.Release(cls, list, BatchOf(cls));
+            }
+        }
+
+       private:
+        // 每次与中心链表交换的块数：小块多交换一些，大块少交换一些
+        static std::size_t BatchOf(std::size_t cls) {
+            std::size_t n = 64 * 1024 / CLASS_SIZE[cls];
+            return n < 4 ? 4 : (n > 256 ? 256 : n);
+        }
+
+        void Flush() {
+            pool_.hits_.fetch_add(hits_, std::memory_order_relaxed);
+            pool_.misses_.fetch_add(misses_, std::memory_order_relaxed);
+            hits_ = 0;
+            misses_ = 0;
+        }
+
+        BufferPool &pool_;
+        std::array<FreeList, CLASS_COUNT> lists_{};
+        uint64_t hits_{0};
+        uint64_t misses_{0};
+    };
+
+    BufferPool() = default;
+
+    static ThreadCache &LocalCache() {
+        thread_local ThreadCache cache;
+        return cache;
+    }
+
+    // @brief 从中心链表中取出至多n个块放入out；中心链表为空时分配新的slab
+    // @return 是否分配了新的slab
+    bool Fetch(std::size_t cls, FreeList &out, std::size_t n) {
+        std::unique_lock lock(mtx_);
+        bool new_slab = false;
+        FreeList &central = central_[cls];
+        if (!central.head) {
+            // 分配新的slab，并把它切分成若干块
+            std::size_t blk_size = CLASS_SIZE[cls];
+            std::size_t slab_size = SLAB_BYTES < blk_size * 4 ? blk_size * 4 : SLAB_BYTES;
+            char *slab = static_cast<char *>(::operator new(slab_size));
+            slabs_.push_back(slab);
+            slab_allocs_.fetch_add(1, std::memory_order_relaxed);
+            for (std::size_t off = 0; off + blk_size <= slab_size; off += blk_size) {
+                auto *blk = reinterpret_cast<FreeBlock *>(slab + off);  // NOLINT
+                blk->next = central.head;
+                central.head = blk;
+                ++central.count;
+            }
+            new_slab = true;
+        }
+        while (n > 0 && central.head) {
+            FreeBlock *blk = central.head;
+            central.head = blk->next;
+            --central.count;
+            blk->next = out.head;
+            out.head = blk;
+            ++out.count;
+            --n;
+        }
+        return new_slab;
+    }
+
+    // @brief 把in中的n个块归还给中心链表
+    void Release(std::size_t cls, FreeList &in, std::size_t n) {
+        std::unique_lock lock(mtx_);
+        FreeList &central = central_[cls];
+        while (n > 0 && in.head) {
+            FreeBlock *blk = in.head;
+            in.head = blk->next;
+            --in.count;
+            blk->next = central.head;
+            central.head = blk;
+            ++central.count;
+            --n;
+        }
+    }
+
+    std::mutex mtx_;  // 保护central_和slabs_
+    std::array<FreeList, CLASS_COUNT> central_{};
+    std::vector<void *> slabs_;
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+    std::atomic<uint64_t> slab_allocs_{0};
+    std::atomic<uint64_t> oversize_{0};
+};
+
+// 基于BufferPool的分配器，可用于std::allocate_shared，使得shared_ptr的控制块和对象本身也从内存池分配
+template <typename T>
+class PoolAllocator {
+   public:
+    using value_type = T;
+
+    PoolAllocator() noexcept = default;
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U> & /*unused*/) noexcept {}  // NOLINT
+
+    T *allocate(std::size_t n) {
+        static_assert(alignof(T) <= alignof(std::max_align_t), "PoolAllocator doesn't support over-aligned types");
+        return reinterpret_cast<T *>(BufferPool::Allocate(static_cast<uint32_t>(n * sizeof(T))));  // NOLINT
+    }
+
+    void deallocate(T *ptr, std::size_t n) noexcept {
+        BufferPool::Deallocate(reinterpret_cast<char *>(ptr), static_cast<uint32_t>(n * sizeof(T)));  // NOLINT
+    }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U> & /*unused*/) const noexcept {
+        return true;
+    }
+};
+}  // namespace chatroom
+
+#endif
@@ -0,0 +1,183 @@
+#ifndef COMMON_MPSC_QUEUE_HEADER
+#define COMMON_MPSC_QUEUE_HEADER
+
+// mpsc_queue.hpp: 有界无锁多生产者单消费者队列，以及配合其使用的EventCount
+// **********************************************
+//  MpscQueue基于Dmitry Vyukov的有界队列算法：环形数组中的每个槽位带有一个序号，
+//  生产者通过CAS抢占入队位置后写入数据，再发布槽位的序号；唯一的消费者按顺序检查槽位序号并取出数据。
+//  整个过程不需要任何互斥锁，生产者之间只在入队位置上竞争一次CAS。
+//
+//  EventCount用于在队列为空时让消费者休眠（C++20 std::atomic::wait，Linux下即futex），
+//  没有等待者时生产者的Notify()只是一次原子读，空闲的消费者不消耗CPU，繁忙时也不会产生多余的唤醒。
+//  消费者的使用方式：
+//      auto key = ec.PrepareWait();
+//      if (队列非空) { ec.CancelWait(); 继续处理; }
+//      else ec.Wait(key);
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "utils/util_class.hpp"
+
+namespace chatroom {
+constexpr std::size_t CACHE_LINE_SIZE = 64;
+
+// 队列的统计信息
+struct MpscQueueStats {
+    uint64_t depth;       // 当前队列中的元素个数（近似值）
+    uint64_t high_water;  // 运行以来队列深度的最大值
+};
+
+// @tparam T 元素类型，需要可默认构造和移动赋值
+template <typename T>
+class MpscQueue : public Noncopyable {
+   public:
+    // @param capacity 队列容量，会被向上取整到2的幂（最小为2）
+    explicit MpscQueue(std::size_t capacity) {
+        std::size_t cap = 2;
+        while (cap < capacity) cap <<= 1;
+        mask_ = cap - 1;
+        cells_ = std::make_unique<Cell[]>(cap);
+        for (std::size_t i = 0; i < cap; ++i) {
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // @brief 尝试入队，可被多个线程同时调用
+    // @return 队列已满时返回false，此时item不会被移动
+    bool TryPush(T &&item) {
+        Cell *cell;
+        uint64_t pos = tail_.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = &cells_[pos & mask_];
+            uint64_t seq = cell->seq.load(std::memory_order_acquire);
+            auto dif = static_cast<int64_t>(seq - pos);
+            if (dif == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (dif < 0) {
+                return false;  // 槽位尚未被消费者释放，队列已满
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data = std::move(item);
+        cell->seq.store(pos + 1, std::memory_order_release);
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        if (head <= pos) {
+            UpdateHighWater(std::min<uint64_t>(pos + 1 - head, mask_ + 1));
+        }
+        return true;
+    }
+
+    // @brief 尝试出队，只能由唯一的消费者线程调用
+    // @return 队列为空（或者队首元素的生产者尚未写完）时返回false
+    bool TryPop(T &out) {
+        uint64_t pos = head_.load(std::memory_order_relaxed);
+        Cell &cell = cells_[pos & mask_];
+        if (cell.seq.load(std::memory_order_acquire) != pos + 1) {
+            return false;
+        }
+        out = std::move(cell.data);
+        cell.data = T();  // 立即释放元素持有的资源
+        cell.seq.store(pos + mask_ + 1, std::memory_order_release);
+        head_.store(pos + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // @brief 一次性取出至多max_count个元素，追加到out中，只能由唯一的消费者线程调用
+    // @return 取出的元素个数
+    std::size_t PopBatch(std::vector<T> &out, std::size_t max_count) {
+        std::size_t n = 0;
+        T item;
+        while (n < max_count && TryPop(item)) {
+            out.push_back(std::move(item));
+            ++n;
+        }
+        return n;
+    }
+
+    // @brief 队列是否为空，只有在消费者线程中调用时结果才是准确的
+    bool Empty() const {
+        uint64_t pos = head_.load(std::memory_order_relaxed);
+        return cells_[pos & mask_].seq.load(std::memory_order_acquire) != pos + 1;
+    }
+
+    std::size_t Capacity() const { return mask_ + 1; }
+
+    MpscQueueStats GetStats() const {
+        uint64_t tail = tail_.load(std::memory_order_relaxed);
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        return {tail > head ? tail - head : 0, high_water_.load(std::memory_order_relaxed)};
+    }
+
+   private:
+    struct alignas(CACHE_LINE_SIZE) Cell {
+        std::atomic<uint64_t> seq{0};
+        T data{};
+    };
+
+    void UpdateHighWater(uint64_t depth) {
+        uint64_t cur = high_water_.load(std::memory_order_relaxed);
+        while (depth > cur && !high_water_.compare_exchange_weak(cur, depth, std::memory_order_relaxed)) {
+        }
+    }
+
+    std::unique_ptr<Cell[]> cells_;
+    std::size_t mask_;
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> tail_{0};  // 生产者竞争的入队位置
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head_{0};  // 只由消费者写入，原子类型仅用于统计
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> high_water_{0};
+};
+
+// 基于C++20 std::atomic::wait/notify的EventCount
+class EventCount : public Noncopyable {
+   public:
+    using Key = uint32_t;
+
+    // @brief 准备等待：登记为等待者并取得当前的纪元
+    // @note 调用后必须再次检查等待条件，然后调用Wait()或者CancelWait()之一
+    Key PrepareWait() {
+        waiters_.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);  // 与Notify()中的栅栏配对，保证之后对条件的检查不会被提前
+        return epoch_.load(std::memory_order_seq_cst);
+    }
+
+    // @brief 放弃等待
+    void CancelWait() { waiters_.fetch_sub(1, std::memory_order_seq_cst); }
+
+    // @brief 阻塞直到纪元发生变化（即PrepareWait()之后有人调用了Notify）
+    void Wait(Key key) {
+        epoch_.wait(key, std::memory_order_seq_cst);
+        waiters_.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    // @brief 唤醒一个等待者；没有等待者时只有一次原子读的开销
+    // @note 调用前需要已经使等待条件成立（如元素已入队）
+    void Notify() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);  // 与PrepareWait()中的登记构成全序
+        if (waiters_.load(std::memory_order_relaxed) != 0) {
+            epoch_.fetch_add(1, std::memory_order_seq_cst);
+            epoch_.notify_one();
+        }
+    }
+
+    // @brief 无条件唤醒所有等待者，用于停止等场合
+    void NotifyAll() {
+        epoch_.fetch_add(1, std::memory_order_seq_cst);
+        epoch_.notify_all();
+    }
+
+   private:
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> epoch_{0};
+    std::atomic<uint32_t> waiters_{0};
+};
+}  // namespace chatroom
+
+#endif
@@ -0,0 +1,170 @@
+#ifndef COMMON_MQ_ENVELOPE_HEADER
+#define COMMON_MQ_ENVELOPE_HEADER
+
+// mq_envelope.hpp: 服务器之间消息队列（Redis Stream）条目的二进制编码，后台服务器和网关共用
+// **********************************************
+//  每个条目只有一个字段"e"，值为（网络字节序）：
+//  | ver(1) | type(1) | flags(2) | from(8) | to(8) | len(4) | payload(len) |
+//  - CHAT:         from为发送者，to为接收者，payload为消息内容
+//  - GROUP_CHAT:   from为发送者，to为群ID，payload为 [uint32_t：n][n个uint64_t：该服务器上的接收者][消息内容]
+//  - KICK:         to为要下线的用户
+//  - LOC_INVALIDATE: to为位置已过时的用户
+//  - GROUP_INVALIDATE: to为成员发生变化的群
+//  flags中设置了ENVELOPE_FLAG_ORIGIN时，payload以 [uint16_t：长度][来源服务器的server_id] 开头。
+//
+//  解码器只接受不高于MQ_ENVELOPE_VERSION的版本；同一版本中payload之后的多余字节会被忽略，留作扩展。
+//  OutboundRelay的"pack"字段（一个条目打包多条消息）与本编码并存，见outbound_relay.hpp。
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "common/msgnode.hpp"
+#include "utils/field_op.hpp"
+
+namespace chatroom {
+constexpr std::string_view MQ_ENVELOPE_FIELD = "e";  // 条目中保存编码的字段名
+constexpr uint8_t MQ_ENVELOPE_VERSION = 1;
+constexpr std::size_t MQ_ENVELOPE_HEAD_LEN = 24;
+constexpr uint16_t ENVELOPE_FLAG_ORIGIN = 0x1;  // payload以来源服务器的ID开头
+
+enum class EnvelopeType : uint8_t {
+    CHAT = 1,
+    GROUP_CHAT = 2,
+    KICK = 3,
+    LOC_INVALIDATE = 4,
+    GROUP_INVALIDATE = 5,
+};
+
+// 解码后的条目，string_view均指向被解码的数据
+struct MQEnvelope {
+    uint8_t version;
+    EnvelopeType type;
+    uint16_t flags;
+    uint64_t from;
+    uint64_t to;
+    std::string_view origin;      // 来源服务器的ID，未设置ENVELOPE_FLAG_ORIGIN时为空
+    std::string_view recipients;  // GROUP_CHAT的接收者列表（n个网络字节序的uint64_t），其他类型为空
+    std::string_view content;     // 消息内容
+};
+
+// @brief 编码一个条目
+// @param origin 来源服务器的ID，为空时不写入
+// @param recipients GROUP_CHAT的接收者列表，其他类型为nullptr
+inline std::string EncodeEnvelope(EnvelopeType type, uint64_t from, uint64_t to, std::string_view content = {},
+                                  std::string_view origin = {}, const std::vector<uint64_t> *recipients = nullptr) {
+    uint16_t flags = origin.empty() ? 0 : ENVELOPE_FLAG_ORIGIN;
+    std::size_t origin_len = origin.empty() ? 0 : sizeof(uint16_t) + origin.size();
+    std::size_t list_len = type == EnvelopeType::GROUP_CHAT
+                               ? sizeof(uint32_t) + (recipients ? recipients->size() : 0) * sizeof(uint64_t)
+                               : 0;
+    std::size_t payload_len = origin_len + list_len + content.size();
+    std::string out(MQ_ENVELOPE_HEAD_LEN + payload_len, '\0');
+    char *ptr = out.data();
+    ptr[0] = static_cast<char>(MQ_ENVELOPE_VERSION);
+    ptr[1] = static_cast<char>(type);
+    WriteNetField16(ptr + 2, flags);
+    WriteNetField64(ptr + 4, from);
+    WriteNetField64(ptr + 12, to);
+    WriteNetField32(ptr + 20, payload_len);
+    ptr += MQ_ENVELOPE_HEAD_LEN;
+    if (!origin.empty()) {
+        WriteNetField16(ptr, origin.size());
+        std::memcpy(ptr + sizeof(uint16_t), origin.data(), origin.size());
+        ptr += origin_len;
+    }
+    if (type == EnvelopeType::GROUP_CHAT) {
+        std::size_t n = recipients ? recipients->size() : 0;
+        WriteNetField32(ptr, n);
+        ptr += sizeof(uint32_t);
+        for (std::size_t i = 0; i < n; ++i) {
+            WriteNetField64(ptr, (*recipients)[i]);
+            ptr += sizeof(uint64_t);
+        }
+    }
+    std::memcpy(ptr, content.data(), content.size());
+    return out;
+}
+
+// @brief 解码一个条目
+// @return 版本不支持或者格式错误时返回std::nullopt
+inline std::optional<MQEnvelope> DecodeEnvelope(std::string_view data) {
+    if (data.size() < MQ_ENVELOPE_HEAD_LEN) {
+        return std::nullopt;
+    }
+    MQEnvelope env;
+    env.version = static_cast<uint8_t>(data[0]);
+    if (env.version == 0 || env.version > MQ_ENVELOPE_VERSION) {
+        return std::nullopt;
+    }
+    env.type = static_cast<EnvelopeType>(data[1]);
+    env.flags = ReadNetField16(data.data() + 2);
+    env.from = ReadNetField64(data.data() + 4);
+    env.to = ReadNetField64(data.data() + 12);
+    uint32_t payload_len = ReadNetField32(data.data() + 20);
+    if (payload_len > data.size() - MQ_ENVELOPE_HEAD_LEN) {
+        return std::nullopt;
+    }
+    std::string_view payload = data.substr(MQ_ENVELOPE_HEAD_LEN, payload_len);
+    if (env.flags & ENVELOPE_FLAG_ORIGIN) {
+        if (payload.size() < sizeof(uint16_t)) return std::nullopt;
+        uint16_t origin_len = ReadNetField16(payload.data());
+        if (origin_len > payload.size() - sizeof(uint16_t)) return std::nullopt;
+        env.origin = payload.substr(sizeof(uint16_t), origin_len);
+        payload.remove_prefix(sizeof(uint16_t) + origin_len);
+    }
+    if (env.type == EnvelopeType::GROUP_CHAT) {
+        if (payload.size() < sizeof(uint32_t)) return std::nullopt;
+        uint32_t n = ReadNetField32(payload.data());
+        payload.remove_prefix(sizeof(uint32_t));
+        if (n > payload.size() / sizeof(uint64_t)) return std::nullopt;
+        env.recipients = payload.substr(0, n * sizeof(uint64_t));
+        payload.remove_prefix(n * sizeof(uint64_t));
+    }
+    env.content = payload;
+    return env;
+}
+
+// @brief 构造发送给客户端的单聊报文：[uint64_t：发送者id][消息内容]，缓冲区从内存池中分配，只拷贝一次内容
+inline std::shared_ptr<MsgNode> MakeChatToClientFrame(uint64_t from, std::string_view content) {
+    uint32_t content_len = sizeof(uint64_t) + content.size();
+    auto node = MakeMsgNode(HEAD_LEN + content_len);
+    WriteNetField64(node->GetContent(), from);
+    std::memcpy(node->GetContent() + sizeof(uint64_t), content.data(), content.size());
+    node->SetTagField(CHAT_MSG_TOCLI);
+    node->SetContentLenField(content_len);
+    return node;
+}
+
+// @brief 构造发送给客户端的群聊报文：[uint64_t：group_id][uint64_t：发送者id][消息内容]
+inline std::shared_ptr<MsgNode> MakeGroupToClientFrame(uint64_t gid, uint64_t from, std::string_view content) {
+    constexpr uint32_t PREFIX_LEN = 2 * sizeof(uint64_t);
+    uint32_t content_len = PREFIX_LEN + content.size();
+    auto node = MakeMsgNode(HEAD_LEN + content_len);
+    WriteNetField64(node->GetContent(), gid);
+    WriteNetField64(node->GetContent() + sizeof(uint64_t), from);
+    std::memcpy(node->GetContent() + PREFIX_LEN, content.data(), content.size());
+    node->SetTagField(GROUP_CHAT_MSG_TOCLI);
+    node->SetContentLenField(content_len);
+    return node;
+}
+
+// @brief 把聊天条目直接解码为发送给客户端的报文（头部已就位）
+// @return 非聊天类型的条目返回nullptr
+inline std::shared_ptr<MsgNode> MakeClientFrame(const MQEnvelope &env) {
+    switch (env.type) {
+        case EnvelopeType::CHAT:
+            return MakeChatToClientFrame(env.from, env.content);
+        case EnvelopeType::GROUP_CHAT:
+            return MakeGroupToClientFrame(env.to, env.from, env.content);
+        default:
+            return nullptr;
+    }
+}
+}  // namespace chatroom
+
+#endif
@@ -19,19 +19,26 @@
 #include <cassert>
 #include <cstdint>
 #include <cstring>
+#include <memory>
 #include <stdexcept>
 
+#include "common/buffer_pool.hpp"
 #include "utils/field_op.hpp"
 
 namespace chatroom {
 enum TagType {
-    DEBUG = 0,       // 用于调试的消息格式，收到后把消息显示在日志上
-    VERIFY,          // JSON格式的身份验证消息
-    VERIFY_DONE,     // 完成验证的消息
-    CHAT_MSG,        // 格式：[uint64_t: 目标id][消息内容]
-    CHAT_MSG_TOCLI,  // 发送给客户端的聊天消息，格式：[uint64_t：发送者id][消息内容]
-    GROUP_CHAT_MSG,  // 格式：[uint64_t：目标组的group_id][消息内容]
-    PING,            // 心跳包
+    DEBUG = 0,             // 用于调试的消息格式，收到后把消息显示在日志上
+    VERIFY,                // JSON格式的身份验证消息
+    VERIFY_DONE,           // 完成验证的消息
+    CHAT_MSG,              // 格式：[uint64_t: 目标id][消息内容]
+    CHAT_MSG_TOCLI,        // 发送给客户端的聊天消息，格式：[uint64_t：发送者id][消息内容]
+    GROUP_CHAT_MSG,        // 格式：[uint64_t：目标组的group_id][消息内容]
+    PING,                  // 心跳包
+    GROUP_CHAT_MSG_TOCLI,  // 发送给客户端的群聊消息，格式：[uint64_t：group_id][uint64_t：发送者id][消息内容]
+    PEER_HELLO,            // 后台服务器直连链路的握手，格式：[发送方的server_id]
+    SERVER_RELAY,          // 后台服务器直连链路上的一批跨服消息，格式见UnpackRelayBatch()
+    SERVER_MIGRATE,        // 服务器排空时发送给客户端，格式：[uint16_t：地址长度][目标服务器地址][恢复用的token]
+    PEER_ACK,              // 直连链路上接收方的确认，格式：[uint64_t：本次连接中已投递的SERVER_RELAY报文数]
     RESERVED
 };
 
@@ -50,6 +57,18 @@ inline std::string_view TagTypeStr(enum TagType e) {
             return "CHAT_MSG_TOCLI";
         case GROUP_CHAT_MSG:
             return "GROUP_CHAT_MSG";
+        case PING:
+            return "PING";
+        case GROUP_CHAT_MSG_TOCLI:
+            return "GROUP_CHAT_MSG_TOCLI";
+        case PEER_HELLO:
+            return "PEER_HELLO";
+        case SERVER_RELAY:
+            return "SERVER_RELAY";
+        case SERVER_MIGRATE:
+            return "SERVER_MIGRATE";
+        case PEER_ACK:
+            return "PEER_ACK";
         case RESERVED:
             return "RESERVED";
         default:
@@ -62,20 +81,30 @@ const int LENGTH_LEN = 4;
 const int HEAD_LEN = TAG_LEN + LENGTH_LEN;
 const uint32_t MAX_CTX_LEN = 1024 * 1024;  // 消息长度上限，实际应用应该不会发送如此大的消息
 
+// MsgNode缓冲区的来源，决定了析构时如何释放缓冲区
+enum class BufSource : uint8_t {
+    POOL,  // 来自BufferPool，max_len_为其实际容量
+    HEAP,  // 通过new[]分配
+    VIEW,  // 指向其他对象持有的内存（见MsgNodeView），MsgNode本身不负责释放
+};
+
 // 会话层用来存储数据的MsgNode节点类
 //  | Tag(4字节，网络序) | Len(4字节，网络序) | Content(Len字节) |
+//  缓冲区默认从BufferPool中分配（定义MSGNODE_DISABLE_POOL宏时退化为new[]/delete[]）
 class MsgNode {
    public:
     // Ctors
 
     // @brief 通过最大长度构造空节点对象
     // @param max_len 该节点分配缓冲区的内存大小，注意这是包括头部的，一般使用时要求max_len > HEAD_LEN，但这里不做检查
-    // @ 构造的对象中，整个缓冲区长度应为max_len, 当前指针和内容长度均为0
+    // @ 构造的对象中，整个缓冲区长度至少为max_len（内存池会向上取整到所在等级的大小）, 当前指针和内容长度均为0
     explicit MsgNode(uint32_t max_len)
-        : data_(max_len > 0 ? new char[max_len] : nullptr),
+        : data_(nullptr),
           cur_pos_(0),
           ctx_len_(0),  // 我们实际上不知道内容长度是多少，设为0
-          max_len_(max_len) {}
+          max_len_(0) {
+        AllocBuffer(max_len);
+    }
 
     // @brief 通过字符串和最大长度构造带有消息的节点对象，函数內部会进行消息的拷贝，同时根据msg_len和tag的值设定头部
     // @param content   要发送的消息的字符串
@@ -83,13 +112,14 @@ class MsgNode {
     // msg_len），这会写入消息格式的头部以及成员变量中
     // @param tag       消息的标记，这会写入消息格式的头部
     MsgNode(const char *content, uint32_t msg_len, uint32_t tag = 0)
-        : data_(msg_len > 0 ? new char[HEAD_LEN + msg_len] : nullptr),
+        : data_(nullptr),
           cur_pos_(0),  // 当前指针指向起点
           ctx_len_(msg_len),
-          max_len_(HEAD_LEN + msg_len) {
+          max_len_(0) {
         assert(TAG_LEN == sizeof(uint32_t));
         assert(LENGTH_LEN == sizeof(uint32_t));
         if (msg_len > 0) {
+            AllocBuffer(HEAD_LEN + msg_len);
             // uint32_t net_msg_len = htonl(msg_len);
             // uint32_t net_tag = htonl(tag);
             // memcpy(data_, &net_tag, TAG_LEN);
@@ -107,20 +137,16 @@ class MsgNode {
     // @param data_len 该缓冲区的长度
     [[deprecated("Initializing MsgNode by raw pointer is unsafe and may cause problems if misused.")]] MsgNode(
         char *data_ptr, uint32_t data_len)
-        : data_(data_ptr), cur_pos_(0), ctx_len_(0), max_len_(data_len) {}
+        : data_(data_ptr), cur_pos_(0), ctx_len_(0), max_len_(data_len), src_(BufSource::HEAP) {}
 
     // dtor
-    ~MsgNode() {
-        if (data_) delete[] data_;
-    }
+    ~MsgNode() { FreeBuffer(); }
 
     // @brief 销毁缓冲区，清除缓冲区中内容，释放内存
     void Clear() {
-        if (data_) delete[] data_;
-        data_ = nullptr;
+        FreeBuffer();
         cur_pos_ = 0;
         ctx_len_ = 0;
-        max_len_ = 0;
     }
 
     // @brief 重新设定当前读写指针，不会对实际数据造成任何影响
@@ -139,21 +165,22 @@ class MsgNode {
     // @ 如果原先的缓冲区大小 >= 新的缓冲区大小，该函数什么都不做
     // @ 否则会新分配一段内存，并把原先的内容全部拷贝至新内存
     void Reallocate(uint32_t new_len) {
-        // new/delete实现中没有realloc()类似的函数，只能删了重新分配
-        // 扩展空间的情况
-        if (data_ && new_len > max_len_) {
-            char *tmp = new char[new_len];
-            memcpy(tmp, data_, max_len_);
-            delete[] data_;
-            data_ = tmp;
-        }
         // data_为空的情况
         if (!data_) {
-            data_ = new char[new_len];
+            AllocBuffer(new_len);
             cur_pos_ = 0;
             ctx_len_ = 0;
+            return;
+        }
+        // 扩展空间的情况，内存池中没有realloc()类似的函数，只能重新分配后拷贝
+        if (new_len > max_len_) {
+            char *old_data = data_;
+            uint32_t old_len = max_len_;
+            BufSource old_src = src_;
+            AllocBuffer(new_len);
+            memcpy(data_, old_data, old_len);
+            FreeBuffer(old_data, old_len, old_src);
         }
-        max_len_ = std::max(max_len_, new_len);
     }
 
     // @Copy assign && Copy ctor
@@ -166,22 +193,19 @@ class MsgNode {
         }
 
         if (!data_ || rhs.max_len_ > max_len_) {
-            if (data_) {
-                delete[] data_;
-            }
-            data_ = new char[rhs.max_len_];
+            FreeBuffer();
+            AllocBuffer(rhs.max_len_);
         }
         memcpy(data_, rhs.data_, rhs.max_len_);
-        max_len_ = std::max(max_len_, rhs.max_len_);
         cur_pos_ = rhs.cur_pos_;
         ctx_len_ = rhs.ctx_len_;
         return *this;
     }
-    [[deprecated("Please be wary that you are copying a MsgNode object.")]] MsgNode(const MsgNode &rhs) {
-        data_ = new char[rhs.max_len_];
+    [[deprecated("Please be wary that you are copying a MsgNode object.")]] MsgNode(const MsgNode &rhs)
+        : data_(nullptr), max_len_(0) {
+        AllocBuffer(rhs.max_len_);
 
         memcpy(data_, rhs.data_, rhs.max_len_);
-        max_len_ = rhs.max_len_;
         cur_pos_ = rhs.cur_pos_;
         ctx_len_ = rhs.ctx_len_;
     }
@@ -239,7 +263,75 @@ class MsgNode {
         cur_pos_;  // 当前读取/写入的位置（包括头部在内），用于读取（表示当前读取的位置）或写入（表示当前写入的位置）
     uint32_t ctx_len_;  // 内容的长度（不包括头部），注：这部分实际上也存储在格式头部中，但那部分是网络字节序的
     uint32_t max_len_;  // 当前缓冲区的长度，这是分配的整个内存块的实际长度（包括格式中的头部）
+
+   protected:
+    // @brief 构造一个指向外部内存的节点，仅供MsgNodeView使用
+    MsgNode(char *view_data, uint32_t view_len, BufSource src)
+        : data_(view_data), cur_pos_(0), ctx_len_(0), max_len_(view_len), src_(src) {}
+
+   private:
+    // @brief 分配至少len字节的缓冲区，并设置data_, max_len_和src_；len为0时不分配
+    void AllocBuffer(uint32_t len) {
+        if (len == 0) {
+            data_ = nullptr;
+            max_len_ = 0;
+            return;
+        }
+#ifndef MSGNODE_DISABLE_POOL
+        data_ = BufferPool::Allocate(len);
+        max_len_ = BufferPool::Capacity(len);
+        src_ = BufSource::POOL;
+#else
+        data_ = new char[len];
+        max_len_ = len;
+        src_ = BufSource::HEAP;
+#endif
+    }
+
+    // @brief 按缓冲区的来源释放缓冲区
+    static void FreeBuffer(char *data, uint32_t len, BufSource src) {
+        if (!data) return;
+        if (src == BufSource::POOL) {
+            BufferPool::Deallocate(data, len);
+        } else if (src == BufSource::HEAP) {
+            delete[] data;
+        }
+    }
+
+    void FreeBuffer() {
+        FreeBuffer(data_, max_len_, src_);
+        data_ = nullptr;
+        max_len_ = 0;
+    }
+
+    BufSource src_{BufSource::HEAP};  // 缓冲区的来源
 };
+
+// 零拷贝的帧视图：data_直接指向一块共享缓冲区（如Session的接收环形缓冲区）中的一个完整报文，
+// 并通过owner_保证该缓冲区在视图存活期间不会被释放或复用。
+// 对视图调用Reallocate()扩容时，内容会被拷贝到新分配的缓冲区中，之后与普通MsgNode无异。
+class MsgNodeView : public MsgNode {
+   public:
+    // @param owner 持有缓冲区的shared_ptr
+    // @param frame 报文在缓冲区中的起始位置（指向头部）
+    // @param frame_len 报文的总长度（HEAD_LEN + 内容长度）
+    MsgNodeView(std::shared_ptr<char> owner, char *frame, uint32_t frame_len)
+        : MsgNode(frame, frame_len, BufSource::VIEW), owner_(std::move(owner)) {}
+
+   private:
+    std::shared_ptr<char> owner_;
+};
+
+// @brief 构造一个MsgNode（或MsgNodeView）的shared_ptr，其控制块和对象本身均从内存池中分配
+// @ 用法与std::make_shared<MsgNode>(...)相同，构造视图时使用MakeMsgNode<MsgNodeView>(...)
+template <typename Node = MsgNode, typename... Args>
+std::shared_ptr<Node> MakeMsgNode(Args &&...args) {
+#ifndef MSGNODE_DISABLE_POOL
+    return std::allocate_shared<Node>(PoolAllocator<Node>(), std::forward<Args>(args)...);
+#else
+    return std::make_shared<Node>(std::forward<Args>(args)...);
+#endif
+}
 }  // namespace chatroom
 
 #endif
\ No newline at end of file
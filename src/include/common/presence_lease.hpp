@@ -0,0 +1,99 @@
+#ifndef COMMON_PRESENCE_LEASE_HEADER
+#define COMMON_PRESENCE_LEASE_HEADER
+
+// presence_lease.hpp: 服务器租约模式下的用户在线状态，后台服务器和网关共用
+// **********************************************
+//  默认模式下，后台服务器每个周期为每个活跃用户的status:<uid>执行一次HEXPIRE，命令数与在线用户数成正比。
+//  租约模式（CMake选项USE_SERVER_LEASE）下：
+//  - 每个后台服务器启动时从lease:epoch:<server_id>（INCR）取得一个新的纪元，写入lease:server:<server_id>
+//    并设置SERVER_LEASE_TTL的过期时间，之后每SERVER_LEASE_RENEW_INTERVAL续约一次，命令数与服务器数成正比；
+//  - status:<uid>中额外保存lease_epoch字段（写入时服务器的纪元），过期时间为远长于租约的LEASE_STATUS_TTL，
+//    活跃用户的键每LEASE_STATUS_REFRESH刷新一次；服务器崩溃或者下线而没有清理时，其用户的键最终也会过期；
+//  - 读取者（查询用户位置、网关的登录检查）在同一个Lua脚本中比较lease_epoch与服务器当前的纪元，
+//    不一致（租约过期或者服务器已经重启）时把该用户视为离线。
+//  没有lease_epoch字段的status:<uid>按默认模式处理，因此两种模式的服务器可以共存。
+//
+//  注意：脚本访问了不在KEYS中的lease:server:<server_id>键，不适用于Redis Cluster。
+
+#include <chrono>
+#include <string>
+#include <string_view>
+
+namespace chatroom {
+constexpr std::string_view SERVER_LEASE_KEY_PREFIX = "lease:server:";  // 值为服务器当前的纪元
+constexpr std::string_view LEASE_EPOCH_KEY_PREFIX = "lease:epoch:";    // 纪元计数器，不过期
+constexpr std::string_view LEASE_EPOCH_FIELD = "lease_epoch";           // status:<uid>中保存纪元的字段
+constexpr std::chrono::milliseconds SERVER_LEASE_TTL{15000};
+constexpr std::chrono::milliseconds SERVER_LEASE_RENEW_INTERVAL{5000};
+constexpr std::chrono::seconds LEASE_STATUS_TTL{1800};           // 租约模式下status:<uid>的过期时间
+constexpr std::chrono::milliseconds LEASE_STATUS_REFRESH{600000};  // 租约模式下活跃用户刷新过期时间的间隔
+
+inline std::string ServerLeaseKey(std::string_view server_id) {
+    std::string key(SERVER_LEASE_KEY_PREFIX);
+    key += server_id;
+    return key;
+}
+
+inline std::string LeaseEpochKey(std::string_view server_id) {
+    std::string key(LEASE_EPOCH_KEY_PREFIX);
+    key += server_id;
+    return key;
+}
+
+// 查询用户所在的服务器，KEYS[1]为status:<uid>；用户不在线或者其服务器的租约已经失效时返回nil
+constexpr std::string_view GET_USER_LOCATION_SCRIPT = R"(
+    local v = redis.call("HMGET", KEYS[1], "server_id", "lease_epoch")
+    if not v[1] then
+        return nil
+    end
+    if v[2] and redis.call("GET", "lease:server:" .. v[1]) ~= v[2] then
+        return nil
+    end
+    return v[1]
+)";
+
+// 扫描一批群成员并查询他们所在的服务器，KEYS[1]为group:<gid>，ARGV[1]为SSCAN的游标，ARGV[2]为COUNT，
+// 判断方式与GET_USER_LOCATION_SCRIPT相同；每次调用只处理一批成员，大群由调用者按返回的游标分多次调用
+// 返回[下一个游标, uid1, server_id1, uid2, server_id2, ...]，游标为"0"表示扫描完毕；不在线的成员的server_id为空串，
+// 同一个成员可能在不同批次中重复出现
+constexpr std::string_view GET_GROUP_LOCATIONS_SCRIPT = R"(
+    local r = redis.call("SSCAN", KEYS[1], ARGV[1], "COUNT", ARGV[2])
+    local out = {r[1]}
+    for _, uid in ipairs(r[2]) do
+        local v = redis.call("HMGET", "status:" .. uid, "server_id", "lease_epoch")
+        local sid = v[1] or ""
+        if v[1] and v[2] and redis.call("GET", "lease:server:" .. v[1]) ~= v[2] then
+            sid = ""
+        end
+        out[#out + 1] = uid
+        out[#out + 1] = sid
+    end
+    return out
+)";
+
+// 续约，KEYS[1]为lease:server:<server_id>，KEYS[2]为lease:epoch:<server_id>，ARGV[1]为纪元，ARGV[2]为有效期（毫秒）
+// 只有租约仍属于该纪元时才续约；租约已经过期、且没有更新的纪元时重新写入。被挂起过的旧进程不会覆盖重启后的新纪元
+// 返回1：续约成功；0：租约曾经过期，已重新写入；-1：已经有更新的纪元（同一server_id的新进程）
+constexpr std::string_view RENEW_SERVER_LEASE_SCRIPT = R"(
+    local cur = redis.call("GET", KEYS[1])
+    if cur == ARGV[1] then
+        redis.call("PEXPIRE", KEYS[1], ARGV[2])
+        return 1
+    end
+    if not cur and redis.call("GET", KEYS[2]) == ARGV[1] then
+        redis.call("SET", KEYS[1], ARGV[1], "PX", ARGV[2])
+        return 0
+    end
+    return -1
+)";
+
+// 释放租约：只有纪元一致时才删除，避免删除重启后的新租约
+constexpr std::string_view RELEASE_SERVER_LEASE_SCRIPT = R"(
+    if redis.call("GET", KEYS[1]) == ARGV[1] then
+        return redis.call("DEL", KEYS[1])
+    end
+    return 0
+)";
+}  // namespace chatroom
+
+#endif
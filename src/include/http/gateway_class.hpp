@@ -14,6 +14,7 @@
 #include "http/redis/gateway_redis.hpp"
 #include "http/req_handler.hpp"
 #include "http/rpc/status_rpc_client.hpp"
+#include "http/server_replica.hpp"
 #include "utils/util_class.hpp"
 
 namespace chatroom::gateway {
@@ -49,11 +50,23 @@ class GatewayClass : public Noncopyable /* 或者GatewayApp */ {
         redis_mgr_ = std::make_shared<RedisMgr>();
         redis_mgr_->ConnectTo(redis_conn_opt, redis_pool_opt);
         status_rpc_ = std::make_shared<StatusRPCClient>(status_ep);
-        handler_ = std::make_shared<ReqHandler>(dbm_, redis_mgr_, status_rpc_);
+        if (GATEWAY_SERVER_WATCH) {
+            replica_ = std::make_shared<ServerReplica>(status_rpc_);
+            replica_->Start();
+        }
+        handler_ = std::make_shared<ReqHandler>(dbm_, redis_mgr_, status_rpc_, replica_);
         http_ = std::make_shared<HTTPServer>(http_ctx_, http_ep, handler_);
     }
 
-    ~GatewayClass() { spdlog::info("GatewayClass terminating"); }
+    ~GatewayClass() {
+        spdlog::info("GatewayClass terminating");
+        if (replica_) {
+            replica_->Stop();
+            ReplicaStats stats = replica_->GetStats();
+            spdlog::info("Server replica: {} local picks, {} fallbacks to status RPC, {} updates, {} resyncs",
+                         stats.local_picks, stats.stale_picks, stats.updates, stats.resyncs);
+        }
+    }
 
    private:
     boost::asio::io_context &http_ctx_;
@@ -64,6 +77,8 @@ class GatewayClass : public Noncopyable /* 或者GatewayApp */ {
     std::shared_ptr<RedisMgr> redis_mgr_;
     // status service (远程RPC，需要状态服务器在线)
     std::shared_ptr<StatusRPCClient> status_rpc_;
+    // 本地的服务器列表副本（未开启USE_GATEWAY_SERVER_WATCH时为空）
+    std::shared_ptr<ServerReplica> replica_;
 
     // 请求处理对象
     std::shared_ptr<ReqHandler> handler_;
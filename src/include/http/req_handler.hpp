@@ -11,6 +11,7 @@
 #include "http/dbm/gateway_dbm.hpp"
 #include "http/redis/gateway_redis.hpp"
 #include "http/rpc/status_rpc_client.hpp"
+#include "http/server_replica.hpp"
 #include "log/log_manager.hpp"
 #include "utils/snowflake_id.hpp"
 
@@ -21,11 +22,13 @@ namespace chatroom::gateway {
 
 class ReqHandler : public std::enable_shared_from_this<ReqHandler> {
    public:
+    // @param replica 本地的服务器列表副本，为空时每次登录都通过RPC向状态服务器查询
     explicit ReqHandler(std::shared_ptr<DBM> dbm, std::shared_ptr<RedisMgr> redis, std::shared_ptr<StatusRPCClient> rpc,
-                        uint pool_size = 4, uint16_t worker_id = 0)
+                        std::shared_ptr<ServerReplica> replica = nullptr, uint pool_size = 4, uint16_t worker_id = 0)
         : dbm_(std::move(dbm)),
           redis_(std::move(redis)),
           rpc_(std::move(rpc)),
+          replica_(std::move(replica)),
           uid_gen_(worker_id, 1577836800000),
           pool_(pool_size) {}
 
@@ -51,6 +54,7 @@ class ReqHandler : public std::enable_shared_from_this<ReqHandler> {
     std::shared_ptr<DBM> dbm_;
     std::shared_ptr<RedisMgr> redis_;
     std::shared_ptr<StatusRPCClient> rpc_;
+    std::shared_ptr<ServerReplica> replica_;
 
     // 雪花uid生成器
     chatroom::UIDGenerator uid_gen_;
@@ -73,6 +77,9 @@ class ReqHandler : public std::enable_shared_from_this<ReqHandler> {
     boost::beast::http::message_generator PostRegisterLogic(
         boost::beast::http::request<boost::beast::http::string_body> &&req);
     boost::beast::http::message_generator PingLogic(boost::beast::http::request<boost::beast::http::string_body> &&req);
+
+    // @brief 为登录选择后台服务器：优先使用本地副本，副本过期时通过RPC向状态服务器查询
+    bool PickServer(std::string &addr);
 };
 
 // Returns a bad request response (400)
@@ -24,6 +24,9 @@ class StatusRPCClient {
     // dtor
     ~StatusRPCClient() = default;
 
+    // @brief 获取底层的Channel，用于创建独立的Stub（例如订阅服务器列表的线程）
+    std::shared_ptr<grpc::Channel> GetChannel() const { return ch_status_; }
+
     // @warning Client对象持有该对象的生命周期，不要尝试delete返回的指针
     // @warning Stub对象不是线程安全的
     status::StatusService::Stub *GetStatusStub() {
@@ -0,0 +1,98 @@
+#ifndef HTTP_SERVER_REPLICA_HEADER
+#define HTTP_SERVER_REPLICA_HEADER
+
+// server_replica: 网关本地的后台服务器列表副本，通过状态服务器的WatchServers订阅保持更新
+// **********************************************
+//  - 订阅线程读取状态服务器推送的服务器列表变化并合并到本地副本，订阅断开后等待一段时间重新订阅；
+//  - 登录时直接在本地副本上选择得分最低的服务器，不需要任何RPC；与LoadBalancer相同，每次选择都为该服务器增加一个
+//    本地的预留数并计入得分，该服务器的下一次推送到达时清零（每次负载上报都会在WATCH_POLL_INTERVAL内推送一次，
+//    即使负载没有变化）；
+//  - 还没有收到完整列表、订阅已经断开，或者超过stale_after没有收到任何推送（状态服务器至少每5s推送一次）时，
+//    副本视为过期，Pick()返回false，调用者回退到CheckMinimalLoadServer。
+
+#include <grpcpp/client_context.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "http/rpc/status_rpc_client.hpp"
+#include "protocpp/status.pb.h"
+#include "utils/util_class.hpp"
+
+namespace chatroom::gateway {
+#ifdef USING_GATEWAY_SERVER_WATCH
+constexpr bool GATEWAY_SERVER_WATCH = true;
+#else
+constexpr bool GATEWAY_SERVER_WATCH = false;
+#endif
+constexpr std::chrono::milliseconds REPLICA_STALE_AFTER{15000};  // 超过该时间没有收到推送时副本视为过期
+constexpr std::chrono::milliseconds WATCH_RETRY_INTERVAL{1000};  // 订阅断开后重新订阅的间隔
+
+struct ReplicaStats {
+    uint64_t local_picks{0};  // 在本地副本上完成的选择
+    uint64_t stale_picks{0};  // 副本过期（需要回退到RPC）的选择
+    uint64_t updates{0};      // 收到的推送数
+    uint64_t resyncs{0};      // 收到的完整列表数
+};
+
+class ServerReplica : public Noncopyable {
+   public:
+    explicit ServerReplica(std::shared_ptr<StatusRPCClient> rpc,
+                           std::chrono::milliseconds stale_after = REPLICA_STALE_AFTER)
+        : rpc_(std::move(rpc)), stale_after_(stale_after) {}
+
+    ~ServerReplica() { Stop(); }
+
+    // @brief 启动订阅线程
+    void Start();
+
+    // @brief 取消订阅并等待订阅线程退出
+    void Stop();
+
+    // @brief 在本地副本上选择一个服务器，并为其增加一个预留数；正在排空的服务器只在没有其他服务器时才会被选择
+    // @return 副本过期或者没有可用的服务器时返回false
+    bool Pick(uint32_t &id, std::string &addr);
+
+    // @brief 把一条推送合并到本地副本上，由订阅线程调用
+    void Apply(const status::ServerListUpdate &update);
+
+    ReplicaStats GetStats();
+
+   private:
+    struct Server {
+        std::string addr;
+        bool draining{false};
+        double score{0};         // 不含预留数的得分
+        double session_cost{0};  // 每个会话（预留数）的得分
+        uint32_t reserved{0};    // 本网关在该服务器下一次推送之前分配出去的登录数
+    };
+
+    // @brief 订阅线程的执行函数
+    void WatchFn();
+
+    // @brief 订阅断开，副本立即视为过期
+    void MarkStale();
+
+    std::shared_ptr<StatusRPCClient> rpc_;
+    std::chrono::milliseconds stale_after_;
+
+    std::mutex mtx_;  // 保护下面的所有成员
+    std::unordered_map<uint32_t, Server> servers_;
+    bool synced_{false};
+    std::chrono::steady_clock::time_point last_update_;
+    ReplicaStats stats_;
+    bool stop_{false};
+    std::condition_variable stop_cv_;
+    grpc::ClientContext *ctx_{nullptr};  // 当前订阅的上下文，用于Stop()时取消
+
+    std::thread th_;
+};
+}  // namespace chatroom::gateway
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef SERVER_GROUP_CHAT_HEADER
+#define SERVER_GROUP_CHAT_HEADER
+
+// group_chat.hpp: 群聊功能使用的群成员索引以及消息扇出（fan-out）工具
+// **********************************************
+//  GroupIndex在内存中缓存 group_id -> 有序的成员UID数组，每个群只占用一块连续内存，成员判断使用二分查找。
+//  成员列表以shared_ptr<const>的形式发布，读者拿到的是一个不可变的快照，更新时整体替换而不修改原数组。
+//  缓存未命中或者过期时通过加载函数（通常是读取Redis中的group:<gid>集合）重新加载。
+//  过期的条目在写入时顺带清理（每个有效期至多扫描一次），不再活跃的群不会一直占用内存。
+//
+//  群聊消息的扇出过程：
+//  - 对每条群聊消息只构造一个GROUP_CHAT_MSG_TOCLI报文，所有本地接收者的发送队列共享这一个报文（只增加引用计数）；
+//  - 不在本服务器上的成员按其所在的服务器分组，每个服务器只需要一条携带接收者列表的消息队列条目。
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "common/msgnode.hpp"
+#include "server/location_cache.hpp"
+#include "utils/util_class.hpp"
+
+namespace chatroom::backend {
+using GroupMembers = std::vector<uint64_t>;  // 有序的成员UID数组
+using GroupMembersPtr = std::shared_ptr<const GroupMembers>;
+
+constexpr std::chrono::seconds DEFAULT_GROUP_TTL{60};  // 群成员列表在内存中的有效期
+
+class GroupIndex : public Noncopyable {
+   public:
+    // @brief 加载群成员的函数，成员不需要有序；返回false表示群不存在或加载失败
+    using Loader = std::function<bool(uint64_t gid, GroupMembers &out)>;
+
+    explicit GroupIndex(Loader loader, std::chrono::milliseconds ttl = DEFAULT_GROUP_TTL)
+        : loader_(std::move(loader)), ttl_(ttl) {}
+
+    // @brief 获取群成员列表，未缓存或者已过期时调用加载函数
+    // @return 群不存在时返回nullptr
+    GroupMembersPtr GetMembers(uint64_t gid);
+
+    // @brief 只查询缓存的群成员列表，不调用加载函数
+    // @return 未缓存或者已过期时返回nullptr
+    GroupMembersPtr Find(uint64_t gid);
+
+    // @brief 直接设置群成员列表（会被排序去重）
+    // @return 设置后的成员列表
+    GroupMembersPtr SetMembers(uint64_t gid, GroupMembers members);
+
+    // @brief 使群的缓存失效，下一次访问时重新加载
+    void Invalidate(uint64_t gid);
+
+    // @brief 判断uid是否为成员列表中的一员
+    static bool IsMember(const GroupMembers &members, uint64_t uid);
+
+   private:
+    struct Entry {
+        GroupMembersPtr members;
+        std::chrono::steady_clock::time_point expire;
+    };
+
+    Loader loader_;
+    std::chrono::milliseconds ttl_;
+    std::shared_mutex mtx_;
+    std::unordered_map<uint64_t, Entry> groups_;
+    std::chrono::steady_clock::time_point next_sweep_{};  // 下一次清理过期条目的时间，由mtx_保护
+};
+
+// @brief 构造发送给客户端的群聊报文：[uint64_t：group_id][uint64_t：发送者id][消息内容]
+std::shared_ptr<MsgNode> BuildGroupFrame(uint64_t gid, uint64_t from, std::string_view content);
+
+// @brief 把不在本服务器上的成员按照位置缓存分组
+// @param uids 需要分组的成员
+// @param own_server_id 本服务器的ID，缓存的位置为本服务器的成员（缓存已过时）会被失效并视为未命中
+// @param remote 输出：server_id -> 该服务器上的接收者列表
+// @param unresolved 输出：位置缓存未命中的成员
+void GroupByServer(const std::vector<uint64_t> &uids, LocationCache &loc_cache, std::string_view own_server_id,
+                   std::unordered_map<std::string, std::vector<uint64_t>> &remote, std::vector<uint64_t> &unresolved);
+
+// @brief 把UID列表编码为紧凑的二进制形式（每个UID为8字节网络字节序），用于消息队列条目中的接收者列表
+std::string PackUidList(const std::vector<uint64_t> &uids);
+
+// @brief PackUidList的逆操作
+// @return 数据长度不是8的倍数时返回false
+bool UnpackUidList(std::string_view data, std::vector<uint64_t> &out);
+}  // namespace chatroom::backend
+
+#endif
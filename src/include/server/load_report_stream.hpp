@@ -0,0 +1,80 @@
+#ifndef SERVER_LOAD_REPORT_STREAM_HEADER
+#define SERVER_LOAD_REPORT_STREAM_HEADER
+
+// load_report_stream.hpp: 后台服务器到状态服务器的长连接负载上报流（ReportLoadStream）
+// **********************************************
+//  - 流建立后的第一条消息携带服务器ID、地址和所有字段，状态服务器据此登记本服务器；
+//  - 之后每次上报只发送与上一条相比发生变化的字段（增量），完全没有变化时最多每heartbeat发送一条空消息；
+//  - 流断开（写入失败或者状态服务器结束了流）后，下一次上报时重新建立流并发送完整状态；
+//  - 状态服务器在流结束时立即移除本服务器，因此Close()相当于离开。
+//  Report()和Close()可以在不同的线程上调用；另有一个线程读取状态服务器的回复，并检测流的结束。
+
+#include <grpcpp/client_context.h>
+#include <grpcpp/support/sync_stream.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "protocpp/status.grpc.pb.h"
+#include "protocpp/status.pb.h"
+#include "server/rpc/status_rpc_client.hpp"
+#include "utils/util_class.hpp"
+
+namespace chatroom::backend {
+struct LoadStreamStats {
+    uint64_t opens{0};       // 建立流的次数
+    uint64_t messages{0};    // 发送的消息数（含心跳）
+    uint64_t bytes{0};       // 发送的消息序列化后的字节数
+    uint64_t full_bytes{0};  // 同样的消息都发送完整状态时序列化后的字节数
+};
+
+class LoadReportStream : public Noncopyable {
+   public:
+    // @param heartbeat 没有变化时发送空消息的间隔
+    LoadReportStream(std::shared_ptr<StatusRPCClient> rpc_cli, uint32_t server_id, std::string server_addr,
+                     std::chrono::milliseconds heartbeat);
+
+    ~LoadReportStream() { Close(); }
+
+    // @brief 上报一次完整状态（不需要设置server_id和server_addr），流上实际只发送变化的字段
+    // @return 发送成功或者不需要发送时返回true，流建立失败或者写入失败时返回false
+    bool Report(const status::LoadReport &state);
+
+    // @brief 关闭流，状态服务器随即移除本服务器；之后不要再调用Report()
+    void Close();
+
+    LoadStreamStats GetStats();
+
+   private:
+    // @brief 建立新的流并启动读线程，需要持有mtx_
+    bool Open();
+
+    // @brief 回收已经断开的流，需要持有mtx_
+    void Reset();
+
+    // @brief 读线程：读取状态服务器的回复直到流结束
+    void ReaderFn();
+
+    std::shared_ptr<StatusRPCClient> rpc_cli_;
+    uint32_t server_id_;
+    std::string server_addr_;
+    std::chrono::milliseconds heartbeat_;
+
+    std::mutex mtx_;
+    std::unique_ptr<grpc::ClientContext> ctx_;
+    std::unique_ptr<grpc::ClientReaderWriter<status::LoadReport, status::LoadReportAck>> stream_;
+    std::thread reader_;
+    std::atomic_bool broken_{false};  // 读线程发现流已经结束
+    bool closed_{false};
+    status::LoadReport last_;  // 状态服务器一侧合并之后的完整状态
+    std::chrono::steady_clock::time_point last_send_;
+    LoadStreamStats stats_;
+};
+}  // namespace chatroom::backend
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef SERVER_LOAD_SAMPLER_HEADER
+#define SERVER_LOAD_SAMPLER_HEADER
+
+// load_sampler.hpp: 采集后台服务器除会话数以外的负载指标，随负载报告一起上报给状态服务器
+// **********************************************
+//  - CPU使用率：两次采样之间/proc/self/stat中utime+stime的增量，除以经过的时间和CPU核数；
+//  - 内存：/proc/self/statm中的常驻页数（RSS）；
+//  - 消息处理速率、p99处理耗时：两次采样之间MsgHandler处理的消息数与其耗时（从投递到处理完成）的分布；
+//  - 队列深度：采样时MsgHandler所有分片队列中的消息数。
+//  读取/proc失败时（如非Linux系统）对应的指标为0。
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+#include "server/msg_handler.hpp"
+#include "utils/util_class.hpp"
+
+namespace chatroom::backend {
+// 一次采样的结果，单位与status.proto中StatusReportReq的字段一致
+struct LoadSample {
+    uint32_t cpu_usage{0};    // 进程的CPU使用率，占整机的百分比（0-100）
+    uint32_t mem_usage{0};    // 进程的常驻内存，MiB
+    uint32_t msg_rate{0};     // 每秒处理的消息数
+    uint32_t queue_depth{0};  // MsgHandler队列中等待处理的消息数
+    uint32_t p99_us{0};       // 消息处理耗时的p99，微秒
+};
+
+class LoadSampler : public Noncopyable {
+   public:
+    explicit LoadSampler(std::shared_ptr<MsgHandler> handler);
+
+    // @brief 采样一次，速率类指标按上次采样以来的区间计算；只在一个线程上调用（StatusReporter的定时任务）
+    LoadSample Sample();
+
+   private:
+    // @brief 读取进程累计使用的CPU时间（utime + stime），单位为时钟周期
+    static bool ReadCpuTicks(uint64_t &ticks);
+
+    // @brief 读取进程的常驻页数
+    static bool ReadRssPages(uint64_t &pages);
+
+    std::shared_ptr<MsgHandler> handler_;
+    std::chrono::steady_clock::time_point last_ts_;
+    uint64_t last_ticks_{0};
+    long ticks_per_sec_;   // NOLINT
+    long page_size_;       // NOLINT
+    uint32_t cpu_count_;
+};
+}  // namespace chatroom::backend
+
+#endif
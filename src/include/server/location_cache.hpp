@@ -0,0 +1,99 @@
+#ifndef SERVER_LOCATION_CACHE_HEADER
+#define SERVER_LOCATION_CACHE_HEADER
+
+// location_cache.hpp: 进程内的用户位置缓存（uid -> server_id）
+// **********************************************
+//  向不在本服务器上的用户发送消息时，需要先查询Redis中的status:<uid>得到其所在的服务器。
+//  LocationCache缓存这一查询结果，两个用户持续聊天时只有第一条消息需要查询Redis。
+//  缓存有容量上限（按分片LRU淘汰）和TTL，并在以下情况下失效：
+//  - 用户在本服务器上完成验证或者断开连接（其之前缓存的位置一定已经过时）；
+//  - 收到其他服务器通过stream:serverctl:<id>发来的"locinv"控制消息（对方发现该用户已不在它那里，即缓存命中了过时的位置）；
+//  - 向缓存中的服务器投递消息失败。
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "utils/util_class.hpp"
+
+namespace chatroom::backend {
+constexpr std::size_t DEFAULT_LOCATION_CACHE_SIZE = 65536;    // 缓存的最大条目数
+constexpr std::chrono::seconds DEFAULT_LOCATION_TTL{30};       // 与status:<uid>键的过期时间一致
+constexpr std::size_t LOCATION_CACHE_SHARDS = 16;              // 分片数，降低多个工作线程之间的锁竞争
+
+// 位置缓存的统计信息
+struct LocationCacheStats {
+    uint64_t hits;           // 命中次数
+    uint64_t misses;         // 未命中（包括已过期）次数
+    uint64_t stale_hits;     // 命中后被对方服务器告知位置已过时的次数
+    uint64_t invalidations;  // 失效的总次数（包括stale_hits）
+    uint64_t evictions;      // 因容量上限被淘汰的条目数
+};
+
+class LocationCache : public Noncopyable {
+   public:
+    using Clock = std::chrono::steady_clock;
+
+    // @param capacity 缓存的最大条目数
+    // @param ttl 条目的有效期
+    explicit LocationCache(std::size_t capacity = DEFAULT_LOCATION_CACHE_SIZE,
+                           std::chrono::milliseconds ttl = DEFAULT_LOCATION_TTL);
+
+    // @brief 查询用户所在的服务器
+    // @return 缓存未命中或者已过期时返回nullopt
+    std::optional<std::string> Get(uint64_t uid);
+
+    // @brief 写入（或者刷新）用户所在的服务器
+    void Put(uint64_t uid, const std::string &server_id);
+
+    // @brief 使用户的缓存条目失效
+    // @return 条目是否存在
+    bool Invalidate(uint64_t uid);
+
+    // @brief 其他服务器告知该用户已不在其上时调用，条目存在时同时计为一次stale hit
+    bool InvalidateStale(uint64_t uid);
+
+    // @brief 当前缓存中的条目数
+    std::size_t Size();
+
+    LocationCacheStats GetStats() const {
+        return {hits_.load(std::memory_order_relaxed), misses_.load(std::memory_order_relaxed),
+                stale_hits_.load(std::memory_order_relaxed), invalidations_.load(std::memory_order_relaxed),
+                evictions_.load(std::memory_order_relaxed)};
+    }
+
+   private:
+    struct Entry {
+        uint64_t uid;
+        std::string server_id;
+        Clock::time_point expire;
+    };
+
+    // 每个分片是一个LRU链表，链表头部为最近使用的条目
+    struct Shard {
+        std::mutex mtx;
+        std::list<Entry> lru;
+        std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+    };
+
+    Shard &ShardOf(uint64_t uid) { return shards_[uid % shards_.size()]; }
+
+    std::vector<Shard> shards_;
+    std::size_t shard_capacity_;
+    std::chrono::milliseconds ttl_;
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+    std::atomic<uint64_t> stale_hits_{0};
+    std::atomic<uint64_t> invalidations_{0};
+    std::atomic<uint64_t> evictions_{0};
+};
+}  // namespace chatroom::backend
+
+#endif
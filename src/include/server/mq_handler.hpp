@@ -1,36 +1,197 @@
 #ifndef BACKEND_MSGQUEUE_HANDLER_HEADER
 #define BACKEND_MSGQUEUE_HANDLER_HEADER
 
+// mq_handler.hpp: 消息队列（Redis Stream）的消费者，接收其他服务器发来的跨服消息和控制消息
+//  - 使用带BLOCK参数的XREADGROUP读取，队列为空时请求挂起在Redis服务端，不会空转
+//  - 每次读取的COUNT随积压情况自适应调整：读满时加倍，读到的条目很少时减半
+//  - 一批条目的所有接收者通过一次SessionManager::LookupSessions()调用（逐个获取分片锁）得到对应的Session
+//  - 条目使用二进制编码（"e"字段，见common/mq_envelope.hpp），同时兼容"pack"字段和旧的多字段格式
+//  - 经直连链路（PeerLinkManager）收到的跨服消息通过DeliverPacked()走同样的投递过程
+//  - 接收者不在本服务器上时（发送方使用了过时的位置），通知发送方使其缓存失效（一批的通知在同一个Pipeline中发送），
+//    并重新查询接收者的位置：在其他服务器上时经OutboundRelay转发过去，只有不在线（或者其状态仍指向本服务器）时
+//    才存入本服务器的离线存储。查询或者转发失败时：确认模式下不确认对应的条目，每隔MQ_RETRY_INTERVAL重新认领
+//    并处理；其他情况（直连链路、非确认模式）下重新写入本服务器的消息队列，由之后的处理重新查询
+//  - 确认模式（CMake选项USE_MQ_ACK，默认开启）：读到的条目进入消费者组的待确认列表，一批条目投递完毕
+//    （放入Session的发送队列，或者提交到离线存储）后，用一次Pipeline对它们XACK。重启时先用XAUTOCLAIM
+//    认领并处理所有待确认的条目，再从消费者组记录的位置继续读取，重放的只是崩溃前未确认的部分，而不是整个队列。
+//    崩溃前已投递但未确认的条目会被再次投递（至少一次）。
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <string_view>
+
 #include "common/msgnode.hpp"
+#include "server/group_chat.hpp"
+#include "server/location_cache.hpp"
+#include "server/offline_store.hpp"
+#include "server/outbound_relay.hpp"
 #include "server/redis/server_redis.hpp"
 #include "server/session_manager.hpp"
 #include "utils/field_op.hpp"
 
 namespace chatroom::backend {
+constexpr uint32_t MQ_BLOCK_MS = 1000;        // 队列为空时服务端阻塞的最长时间，需要小于Redis连接的socket_timeout
+constexpr uint32_t MQ_MIN_RECV_COUNT = 16;    // 自适应COUNT的下限
+constexpr uint32_t MQ_MAX_RECV_COUNT = 1024;  // 自适应COUNT的上限
+constexpr uint32_t MQ_CLAIM_COUNT = 256;      // 恢复时每次XAUTOCLAIM认领的条目数
+constexpr std::chrono::seconds MQ_RETRY_INTERVAL{5};    // 重新处理未能投递的条目的间隔（确认模式）
+constexpr std::chrono::seconds MQ_FORWARD_TIMEOUT{3};   // 确认模式下等待转发完成的最长时间，超时视为转发失败
+#ifdef USING_MQ_ACK
+constexpr bool MQ_ACK_MODE = true;
+#else
+constexpr bool MQ_ACK_MODE = false;
+#endif
+
+// 消息队列消费者的统计信息
+struct MQConsumerStats {
+    uint64_t reads;           // XREADGROUP的调用次数
+    uint64_t idle_reads;      // 阻塞到超时仍没有读到条目的次数
+    uint64_t entries;         // 读到的条目数
+    uint64_t latency_ms_sum;  // 条目从写入队列到被处理的延迟之和（由条目ID中的时间戳计算）
+    uint64_t latency_ms_max;  // 最大延迟
+    uint32_t recv_count;      // 当前的COUNT
+    uint64_t acked;           // 已确认的条目数（确认模式）
+    uint64_t recovered;       // 启动时从待确认列表中认领并重新处理的条目数（确认模式）
+};
+
+// @brief 根据本次读到的条目数决定下一次读取的COUNT：读满时加倍，不足四分之一时减半
+inline uint32_t NextRecvCount(uint32_t cur, std::size_t received) {
+    if (received >= cur) {
+        return std::min(cur * 2, MQ_MAX_RECV_COUNT);
+    }
+    if (received < cur / 4) {
+        return std::max(cur / 2, MQ_MIN_RECV_COUNT);
+    }
+    return cur;
+}
+
+// @brief 从Stream条目ID（<毫秒时间戳>-<序号>）中取出条目写入时Redis服务器的时间
+inline std::optional<uint64_t> StreamIdMillis(std::string_view id) {
+    uint64_t ms;
+    auto [ptr, ec] = std::from_chars(id.data(), id.data() + id.size(), ms);
+    if (ec != std::errc() || ptr == id.data()) {
+        return std::nullopt;
+    }
+    return ms;
+}
+
 class MQHandler {
    public:
-    MQHandler(uint32_t server_id, std::shared_ptr<SessionManager> sess, std::shared_ptr<RedisMgr> redis)
-        : server_id_(std::to_string(server_id)), sess_(std::move(sess)), redis_(std::move(redis)) {
+    // @param ack 是否使用确认模式；不使用时读取即确认，崩溃时已读取但未投递的条目会丢失
+    // @param relay 转发接收者已经移动到其他服务器的消息，需要在本对象析构之后再停止
+    MQHandler(uint32_t server_id, std::shared_ptr<SessionManager> sess, std::shared_ptr<RedisMgr> redis,
+              std::shared_ptr<LocationCache> loc_cache, std::shared_ptr<GroupIndex> group_index,
+              std::shared_ptr<OfflineStore> offline, std::shared_ptr<OutboundRelay> relay, bool ack = MQ_ACK_MODE)
+        : ack_(ack),
+          server_id_(std::to_string(server_id)),
+          mq_key_("stream:server:" + server_id_),
+          ctl_key_("stream:serverctl:" + server_id_),
+          sess_(std::move(sess)),
+          redis_(std::move(redis)),
+          loc_cache_(std::move(loc_cache)),
+          group_index_(std::move(group_index)),
+          offline_(std::move(offline)),
+          relay_(std::move(relay)) {
         running_ = true;
-        redis_->RegisterMsgQueue(server_id_, true);
+        // 确认模式下首次创建消费者组时从队列末尾开始，之后总是从消费者组记录的位置继续
+        redis_->RegisterMsgQueue(server_id_, !ack_);
         worker_ = std::thread([this] { this->WorkerFn(); });
     }
     ~MQHandler() {
         running_ = false;
         if (worker_.joinable()) {
-            worker_.join();
+            worker_.join();  // 最多等待一次阻塞读取的时间
         }
     }
 
+    MQConsumerStats GetStats() const;
+
+    // @brief 投递经直连链路收到的一批跨服消息，可以与工作线程并发调用
+    // @param origin 发送方的server_id
+    // @param packed 编码后的消息，见UnpackRelayBatch()
+    void DeliverPacked(const std::string &origin, std::string_view packed);
+
    private:
+    // 一条跨服消息及其接收者在uids中的范围
+    struct Delivery {
+        std::size_t entry;     // 所在的条目在本批条目中的下标（直连链路上的消息没有条目，为0）
+        std::string_view srv;  // 来源服务器的ID，可能为空
+        uint64_t from;
+        std::optional<uint64_t> gid;  // 群聊消息的群ID
+        std::string_view content;
+        std::size_t first;
+        std::size_t count;
+    };
+
+    // 一个不在本服务器上的接收者
+    struct Miss {
+        std::size_t delivery;  // 在deliveries中的下标
+        uint64_t uid;
+    };
+
     void WorkerFn();
-    void MessageHandler(RedisMgr::Item &item);
+    // @brief 按所在的队列处理读到的一批条目
+    // @return 写入离线存储的消息数
+    std::size_t StreamHandler(const std::string &mq_key, RedisMgr::ItemStream &items);
+    // @brief 确认已处理的条目（确认模式）
+    // @param flush_offline 是否需要先等待离线存储提交，写入离线存储的消息在确认之前必须落盘；提交失败时不确认
+    void AckEntries(const std::unordered_map<std::string, RedisMgr::ItemStream> &stms, bool flush_offline);
+    // @brief 认领并处理崩溃前未确认的条目，以及之前未能投递而没有确认的条目（确认模式）
+    void RecoverPending();
+    // @brief 处理一批跨服消息条目；确认模式下，未能投递的条目从items中移除，不会被确认
+    // @return 因接收者不在本服务器而写入离线存储的消息数
+    std::size_t MessageBatchHandler(RedisMgr::ItemStream &items);
     void CtrlMsgHandler(RedisMgr::Item &item);
+    // @brief 把解码后的消息追加到deliveries中，接收者追加到uids中
+    // @param entry 消息所在的条目的下标
+    void AppendRelayRecords(std::size_t entry, std::string_view srv, const std::vector<RelayRecord> &records,
+                            std::vector<Delivery> &deliveries, std::vector<uint64_t> &uids);
+    // @brief 先一次性查找所有接收者的Session，再按顺序投递
+    // @param failed 不为空时等待转发给其他服务器的消息写入完成（确认模式下，条目在确认之前必须已经转发或者
+    //        存入离线存储），未能投递的消息在deliveries中的下标写入其中；为空时未能投递的消息重新写入本服务器的队列
+    // @return 写入离线存储的消息数
+    std::size_t Deliver(const std::vector<Delivery> &deliveries, const std::vector<uint64_t> &uids,
+                        std::vector<std::size_t> *failed);
+    // @brief 重新查询不在本服务器上的接收者的位置，转发给其当前所在的服务器，不在线时存入离线存储
+    // @param frames 与deliveries一一对应的发送给客户端的报文，用于离线存储
+    // @param failed 见Deliver()
+    // @return 写入离线存储的消息数
+    std::size_t Reroute(const std::vector<Delivery> &deliveries, const std::vector<std::shared_ptr<MsgNode>> &frames,
+                        const std::vector<Miss> &misses, std::vector<std::size_t> *failed);
+    // @brief 记录条目的投递延迟
+    void RecordLatency(std::string_view id, uint64_t now_ms);
+    // @brief 通知消息的来源服务器：这些用户不在本服务器上
+    // @param stale (来源服务器的ID, uid)列表，来源为空或者为本服务器的会被跳过
+    void NotifyStaleLocations(const std::vector<std::pair<std::string_view, uint64_t>> &stale);
+    bool ack_;
+    // 确认模式下是否有未能投递而没有确认的条目，以及下一次重新处理的时间，只由工作线程访问
+    bool retry_{false};
+    std::chrono::steady_clock::time_point retry_at_;
     std::atomic_bool running_;
     std::thread worker_;
     std::string server_id_;
+    std::string mq_key_;   // 跨服消息队列
+    std::string ctl_key_;  // 控制消息队列
     std::shared_ptr<SessionManager> sess_;
     std::shared_ptr<RedisMgr> redis_;
+    std::shared_ptr<LocationCache> loc_cache_;
+    std::shared_ptr<GroupIndex> group_index_;
+    std::shared_ptr<OfflineStore> offline_;
+    std::shared_ptr<OutboundRelay> relay_;
+
+    // 统计信息，只由工作线程写入
+    std::atomic<uint64_t> reads_{0};
+    std::atomic<uint64_t> idle_reads_{0};
+    std::atomic<uint64_t> entries_{0};
+    std::atomic<uint64_t> latency_ms_sum_{0};
+    std::atomic<uint64_t> latency_ms_max_{0};
+    std::atomic<uint32_t> recv_count_{MQ_MIN_RECV_COUNT};
+    std::atomic<uint64_t> acked_{0};
+    std::atomic<uint64_t> recovered_{0};
 };
 
 }  // namespace chatroom::backend
@@ -1,22 +1,27 @@
 #ifndef SERVER_MESSAGE_HANDLER_HEADER
 #define SERVER_MESSAGE_HANDLER_HEADER
 
-// msg_handler.hpp: 消息处理器，其由单个工作线程（或线程池）异步处理这些消息
+// msg_handler.hpp: 消息处理器，其由N个分片的工作线程异步处理这些消息
+//  同一个Session的消息总是被路由到同一个分片，因此单个发送者的消息保持顺序；不同用户的消息可以并行处理
 //  其也负责Redis服务中用户在线状态的更新
 
-#include <condition_variable>
+#include <atomic>
 #include <cstdint>
-#include <deque>
 #include <memory>
 #include <mutex>
-#include <queue>
-#include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include "common/msgnode.hpp"
+#include "server/group_chat.hpp"
+#include "server/location_cache.hpp"
+#include "server/offline_store.hpp"
 #include "server/online_status_upload.hpp"
+#include "server/outbound_relay.hpp"
+#include "server/redis/async_redis.hpp"
 #include "server/redis/server_redis.hpp"
 #include "server/session_manager.hpp"
+#include "server/shard_executor.hpp"
 #include "utils/util_class.hpp"
 
 namespace chatroom::backend {
@@ -27,38 +32,102 @@ using RcvdMsgType = std::shared_ptr<chatroom::MsgNode>;  // ReceiveMsg
 // 对于特定tag消息的回调函数，传入参数为Session和MsgNode
 using FuncCallback = std::function<void(CbSessType, RcvdMsgType)>;
 
+constexpr uint32_t DEFAULT_HANDLER_SHARDS = 4;  // MsgHandler默认的分片（工作线程）个数
+
 class MsgHandler {
    public:
     MsgHandler(uint32_t server_id, std::shared_ptr<SessionManager> sess_mgr, std::shared_ptr<RedisMgr> redis,
-               std::shared_ptr<OnlineStatusUploader> status_uploader)
+               std::shared_ptr<AsyncRedis> async_redis, std::shared_ptr<OutboundRelay> relay,
+               std::shared_ptr<LocationCache> loc_cache, std::shared_ptr<GroupIndex> group_index,
+               std::shared_ptr<OfflineStore> offline, std::shared_ptr<OnlineStatusUploader> status_uploader,
+               uint32_t shard_count = DEFAULT_HANDLER_SHARDS)
         : server_id_(std::to_string(server_id)),
           sess_mgr_(std::move(sess_mgr)),
           redis_(std::move(redis)),
-          status_uploader_(std::move(status_uploader)) {}
+          async_redis_(std::move(async_redis)),
+          relay_(std::move(relay)),
+          loc_cache_(std::move(loc_cache)),
+          group_index_(std::move(group_index)),
+          offline_(std::move(offline)),
+          status_uploader_(std::move(status_uploader)),
+          exec_(shard_count, [this](MsgItem &&item) { Processor(std::move(item.first), std::move(item.second)); }) {}
 
     // @brief 异步向处理队列投递一个消息，并进行处理
     // @param sess 指向Session对象的指针
     // @param msg  指向消息节点的指针；特别的，msg为空指针时，表示一个Session下线了
     bool PostMessage(CbSessType sess, RcvdMsgType msg);
 
-    // @brief 启动消息处理器的工作线程
+    // @brief 异步向处理队列投递同一个Session的一批消息，只需要唤醒一次工作线程
+    // @param sess 指向Session对象的指针
+    // @param msgs 按接收顺序排列的消息节点
+    bool PostMessages(const CbSessType &sess, std::vector<RcvdMsgType> &&msgs);
+
+    // @brief 启动消息处理器所有分片的工作线程
     bool Start();
 
     // @brief 关闭消息处理器，停止其工作线程并join
     bool Stop();
 
+    // @brief 获取处理队列的统计信息（所有分片的总深度和最大高水位）
+    MpscQueueStats GetQueueStats() const { return exec_.GetQueueStats(); }
+
+    // @brief 取出上次调用以来消息的处理耗时分布（从投递到处理完成，微秒），out.Count()即处理的消息数
+    void TakeLatency(LatencyHistogram &out) { exec_.TakeLatency(out); }
+
    private:
-    void Worker();
+    using MsgItem = std::pair<CbSessType, RcvdMsgType>;
+
+    // @brief 计算Session的路由key，同一个Session的消息总是落在同一个分片上
+    static uint64_t RouteKey(const CbSessType &sess) { return reinterpret_cast<uintptr_t>(sess.get()); }  // NOLINT
+
     void Processor(CbSessType &&, RcvdMsgType &&);
+
+    // @brief 记录/完成一个发送者在AsyncRedis回调中才会发出的跨服消息（等待位置查询的消息）
+    //        HasPendingRelay()为true时，该发送者之后的跨服消息也需要经AsyncRedis::Post()以发送者UID为key发出，
+    //        排在这些消息之后，否则命中缓存的消息可能先于之前等待查询的消息发出
+    void AddPendingRelay(uint64_t from_uid);
+    void DonePendingRelay(uint64_t from_uid);
+    bool HasPendingRelay(uint64_t from_uid);
+
+    // @brief 把聊天消息通过消息队列发给目标用户所在的服务器，投递失败时使其位置缓存失效
+    void RelayChatMsg(const std::string &sid, uint64_t from_uid, uint64_t target_uid, const RcvdMsgType &msg);
+
+    // @brief 把群聊消息扇出给群内所有其他成员：本地成员共享同一个报文，远程成员按服务器分组发送
+    //        群成员未缓存、有成员的位置需要查询，或者该发送者还有跨服消息在等待Redis回复时，
+    //        发送作为AsyncRedis上以发送者UID为key的后续操作完成，不阻塞分片
+    void FanOutGroupMsg(const CbSessType &sess, uint64_t gid, std::string_view content);
+
+    // @brief 群成员未缓存时的后续操作：缓存加载的群成员，并按查询到的位置发送
+    // @param members 加载的(uid, server_id)列表，加载失败时为nullopt
+    void FanOutLoadedGroupMsg(uint64_t gid, uint64_t from_uid, const std::shared_ptr<MsgNode> &frame,
+                              std::optional<std::vector<std::pair<uint64_t, std::string>>> members);
+
+    // @brief 发送一条已经确定了所有接收者的群聊消息
+    // @param local 本地成员的Session
+    // @param remote server_id -> 该服务器上的接收者
+    // @param offline 不在线的成员，报文存入其离线收件箱
+    void SendGroupMsg(uint64_t gid, uint64_t from_uid, const std::shared_ptr<MsgNode> &frame,
+                      const std::vector<std::shared_ptr<Session>> &local,
+                      const std::unordered_map<std::string, std::vector<uint64_t>> &remote,
+                      const std::vector<uint64_t> &offline);
+
+    // @brief 把聊天消息转换为发给客户端的格式，并存入目标用户的离线收件箱
+    void StoreOfflineChatMsg(uint64_t from_uid, uint64_t target_uid, const RcvdMsgType &msg);
+
     std::string server_id_;
-    std::mutex lck_;
-    std::condition_variable cv_;
-    std::thread worker_;
-    std::queue<std::pair<CbSessType, RcvdMsgType>> q_;
     std::shared_ptr<SessionManager> sess_mgr_;               // SessionManager本身保证线程安全
     std::shared_ptr<RedisMgr> redis_;                        // backend的redis管理器
+    std::shared_ptr<AsyncRedis> async_redis_;                // 消息处理路径上使用的异步流水线Redis接口
+    std::shared_ptr<OutboundRelay> relay_;                   // 跨服消息的发送阶段
+    std::shared_ptr<LocationCache> loc_cache_;               // 其他服务器上用户的位置缓存
+    std::shared_ptr<GroupIndex> group_index_;                // 群成员索引
+    std::shared_ptr<OfflineStore> offline_;                  // 离线消息存储
     std::shared_ptr<OnlineStatusUploader> status_uploader_;  // 更新用户在线状态的对象
-    bool running_{false};
+    ShardExecutor<MsgItem> exec_;                            // 按Session分片的工作线程
+
+    std::mutex pending_mtx_;
+    std::unordered_map<uint64_t, uint32_t> pending_relays_;  // 发送者UID -> 等待Redis回复、尚未发出的跨服消息数
+    std::atomic<uint32_t> pending_total_{0};                 // 所有发送者的总数，为0时不需要加锁检查
 };
 }  // namespace chatroom::backend
 
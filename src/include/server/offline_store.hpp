@@ -0,0 +1,227 @@
+#ifndef SERVER_OFFLINE_STORE_HEADER
+#define SERVER_OFFLINE_STORE_HEADER
+
+// offline_store.hpp: 离线消息存储（离线收件箱）
+// **********************************************
+//  无法投递的聊天消息（接收者不在线）会以完整的TLV报文的形式追加写入本地磁盘上的段文件（segment）中，
+//  接收者在本服务器上完成验证后，其所有离线消息被一次性取出并作为一批报文发送给它。
+//
+//  - 存储格式：目录下的若干个段文件seg-<编号>.log，每个段文件预分配为固定大小，记录只追加写入；
+//    记录分为MSG（一条离线消息）和DRAIN（某用户序号不大于seq的消息已被取走）两种，每条记录带有校验和。
+//  - 写入：Append()只把记录放入内存中的待写缓冲区；写线程每次把积累的所有记录用一次pwrite写入并fdatasync（组提交），
+//    提交之后记录才对Drain()可见。
+//  - 读取：段文件被整个mmap到内存中，Drain()返回的报文直接指向映射区域（MsgNodeView），不需要逐条read。
+//    DrainAsync()不等待提交，而是由写线程在提交完此前追加的记录之后取走并回调，调用者（如消息处理的分片）不会被
+//    fdatasync阻塞。
+//  - 恢复：启动时按顺序扫描所有段文件重建内存索引（uid -> 未取走的记录位置列表），遇到校验失败的记录即视为段的末尾；
+//    之后的写入总是从一个新的段开始。
+//  - 过期：MSG记录带有写入时间，超过ttl仍未被取走的消息由写线程定期（OFFLINE_EXPIRE_INTERVAL）从索引中移除，
+//    恢复时也会跳过；不需要额外的记录。否则一个从不回来取消息的用户会使其消息所在的段以及之后所有的段都无法回收。
+//  - 回收：最旧的段中所有消息都已被取走（或者过期）时，删除该段文件（只从最旧的段开始删除，保证DRAIN记录不会先于
+//    其对应的消息被删除）。因此磁盘占用的上限大约是ttl时间内写入的消息量。
+//
+//  每个后台服务器各自拥有自己的离线存储，消息存放在发现其无法投递的服务器上，用户下次登录到该服务器时收到。
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "common/msgnode.hpp"
+#include "utils/util_class.hpp"
+
+namespace chatroom::backend {
+constexpr uint32_t DEFAULT_SEGMENT_BYTES = 64 * 1024 * 1024;  // 每个段文件的大小
+constexpr std::chrono::seconds DEFAULT_OFFLINE_TTL{7 * 24 * 3600};  // 离线消息的保存时间
+constexpr std::chrono::seconds OFFLINE_EXPIRE_INTERVAL{60};         // 写线程检查过期消息的间隔
+
+// 离线存储的统计信息
+struct OfflineStoreStats {
+    uint64_t appended;  // 已提交的离线消息数
+    uint64_t drained;   // 已被取走的离线消息数
+    uint64_t expired;   // 超过保存时间而被丢弃的离线消息数
+    uint64_t commits;   // 包含离线消息的组提交的次数，appended / commits即平均每次提交的消息数
+    uint64_t segments;  // 当前的段文件个数
+};
+
+class OfflineStore : public Noncopyable {
+   public:
+    // @param dir 段文件所在的目录，不存在时会被创建
+    // @param segment_bytes 每个段文件的大小，需要能容纳最大的一条报文
+    // @param sync 每次组提交后是否调用fdatasync
+    // @param ttl 离线消息的保存时间，为0时永不过期
+    explicit OfflineStore(std::string dir, uint32_t segment_bytes = DEFAULT_SEGMENT_BYTES, bool sync = true,
+                          std::chrono::seconds ttl = DEFAULT_OFFLINE_TTL);
+
+    ~OfflineStore() { Close(); }
+
+    // @brief 打开存储：恢复已有的段文件，并启动写线程
+    // @return 目录或文件无法访问时返回false
+    bool Open();
+
+    // @brief 写入所有待写的记录，然后停止写线程
+    void Close();
+
+    // @brief 追加一条离线消息
+    // @param uid 接收者
+    // @param frame 完整的TLV报文（包括头部），会被原样发送给接收者
+    // @return 存储未打开或者报文过大时返回false
+    bool Append(uint64_t uid, std::string_view frame);
+
+    // @brief 追加一条离线消息，node的内容长度成员需要与头部一致
+    bool Append(uint64_t uid, const MsgNode &node) {
+        return Append(uid, std::string_view(node.GetContent() - HEAD_LEN, HEAD_LEN + node.GetContentLen()));
+    }
+
+    // @brief 取走某个用户的所有离线消息，按写入顺序排列
+    // @ 取走前会等待已追加的记录提交完毕；返回的报文指向段文件的映射区域，其存活期间映射不会被释放
+    std::vector<std::shared_ptr<MsgNode>> Drain(uint64_t uid);
+
+    // @brief 取走结果的回调函数，参数同Drain()的返回值
+    using DrainCallback = std::function<void(std::vector<std::shared_ptr<MsgNode>>)>;
+
+    // @brief 异步取走某个用户的所有离线消息，不阻塞调用者
+    // @ 写线程提交完此前追加的所有记录之后取走，并在写线程上调用cb；存储未在运行时在调用者的线程上立即取走
+    void DrainAsync(uint64_t uid, DrainCallback cb);
+
+    // @brief 等待此前追加的所有记录提交完毕
+    // @return 上一次Flush()之后追加的记录中有提交失败（这些记录已经丢失）的，或者存储已经停止时返回false；
+    //         以上一次调用为界，因此只应由一个调用者（消息队列的消费者）使用，调用者据此决定是否可以确认消息来源
+    bool Flush();
+
+    // @brief 某个用户已提交、尚未取走的离线消息数
+    std::size_t PendingCount(uint64_t uid);
+
+    OfflineStoreStats GetStats();
+
+   private:
+    enum RecordType : uint8_t {
+        REC_NONE = 0,  // 段文件中尚未写入的区域
+        REC_MSG = 1,
+        REC_DRAIN = 2,
+    };
+
+    // 记录头部，其后紧跟len字节的报文；整条记录按8字节对齐
+    struct RecordHeader {
+        uint32_t len;
+        uint8_t type;
+        uint8_t pad[3];
+        uint64_t uid;
+        uint64_t seq;
+        uint32_t checksum;  // 头部（除checksum外）和报文的FNV-1a校验和
+        uint32_t ts;        // MSG记录写入时的Unix时间（秒），旧版本写入的记录为0
+    };
+    static_assert(sizeof(RecordHeader) == 32);
+
+    // 一个已映射的段文件
+    struct Segment {
+        Segment(uint32_t id, int fd, char *base, uint32_t size, std::string path)
+            : id(id), fd(fd), base(base), size(size), path(std::move(path)) {}
+        ~Segment();
+        uint32_t id;
+        int fd;      // 只有当前写入的段需要保持打开，恢复出的段为-1
+        char *base;  // 只读映射
+        uint32_t size;
+        std::string path;
+        uint32_t write_pos{0};  // 下一条记录的写入位置，只由写线程修改
+        uint64_t live{0};       // 尚未取走的消息数，由idx_mtx_保护
+    };
+
+    // 索引中一条消息的位置
+    struct Location {
+        uint64_t seq;
+        uint32_t seg_id;
+        uint32_t offset;  // 报文（不是记录头部）在段中的偏移
+        uint32_t len;
+        uint32_t ts;  // 写入时间，用于判断是否过期
+    };
+
+    // 待写入的记录
+    struct PendingRecord {
+        RecordType type;
+        uint64_t uid;
+        uint64_t seq;
+        uint32_t buf_offset;  // 报文在pending_buf_中的偏移
+        uint32_t len;
+    };
+
+    static uint32_t RecordSize(uint32_t len) { return (sizeof(RecordHeader) + len + 7) & ~7U; }
+    static uint32_t Checksum(const RecordHeader &hdr, const char *data);
+    std::string SegmentPath(uint32_t id) const;
+
+    // @brief 创建并映射一个新的段文件
+    std::shared_ptr<Segment> CreateSegment(uint32_t id);
+    // @brief 映射并扫描一个已有的段文件，把其中的记录应用到索引中
+    std::shared_ptr<Segment> RecoverSegment(uint32_t id);
+
+    // @brief 放入待写缓冲区，MSG记录的序号在这里分配
+    bool Enqueue(RecordType type, uint64_t uid, uint64_t seq, std::string_view data);
+    // @brief 取走某个用户已提交的所有离线消息（不等待提交），并追加DRAIN记录
+    std::vector<std::shared_ptr<MsgNode>> TakeCommitted(uint64_t uid);
+    // @brief 从索引中移除某个用户序号不大于seq的消息，调用时需要持有idx_mtx_
+    void DropIndex(uint64_t uid, uint64_t seq);
+    void WriterFn();
+    // @brief 把一批记录写入段文件并更新索引
+    // @return 写入失败时返回false，这一批记录全部丢失
+    bool Commit(std::vector<PendingRecord> &records, const std::string &buf);
+    // @brief 等待编号不大于target的记录被写线程处理（提交或者失败），调用时需要持有pending_mtx_
+    void WaitProcessed(std::unique_lock<std::mutex> &lock, uint64_t target);
+    // @brief 删除最旧的、所有消息都已被取走的段，调用时需要持有idx_mtx_
+    void ReclaimSegments();
+    // @brief 从索引中移除所有过期的消息，并回收因此不再有消息的段
+    void Expire();
+    // @brief 写入时间为ts的消息在now时是否已经过期
+    bool Expired(uint32_t ts, uint32_t now) const { return ttl_.count() > 0 && now >= ts + ttl_.count(); }
+    static uint32_t NowSeconds();
+
+    std::string dir_;
+    uint32_t segment_bytes_;
+    bool sync_;
+    std::chrono::seconds ttl_;
+    bool opened_{false};
+
+    // 等待提交的异步取走请求
+    struct DrainRequest {
+        uint64_t uid;
+        uint64_t target;  // 请求时的enqueued_，processed_达到该值之后取走
+        DrainCallback cb;
+    };
+
+    // 待写缓冲区，由pending_mtx_保护
+    std::mutex pending_mtx_;
+    std::condition_variable pending_cv_;  // 有新的待写记录或者取走请求
+    std::condition_variable commit_cv_;   // 有记录被提交
+    std::string pending_buf_;
+    std::vector<PendingRecord> pending_;
+    uint64_t next_seq_{1};   // 下一条MSG记录的序号
+    uint64_t enqueued_{0};     // 已放入待写缓冲区的记录数，记录按放入的顺序从1开始编号
+    uint64_t processed_{0};    // 写线程已经处理（提交或者提交失败）的记录数
+    uint64_t failed_upto_{0};  // 最近一次提交失败的一批记录中最大的编号
+    uint64_t flushed_{0};      // 上一次Flush()等待的编号
+    std::vector<DrainRequest> drains_;
+    bool running_{false};
+
+    // 段和索引，由idx_mtx_保护
+    std::mutex idx_mtx_;
+    std::map<uint32_t, std::shared_ptr<Segment>> segments_;
+    std::unordered_map<uint64_t, std::vector<Location>> index_;
+    std::shared_ptr<Segment> active_;  // 当前写入的段，只由写线程（以及Open()）修改
+
+    std::thread writer_;
+    std::atomic<uint64_t> appended_{0};
+    std::atomic<uint64_t> drained_{0};
+    std::atomic<uint64_t> expired_{0};
+    std::atomic<uint64_t> commits_{0};
+};
+}  // namespace chatroom::backend
+
+#endif
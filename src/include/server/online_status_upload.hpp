@@ -2,20 +2,47 @@
 #define BACKEND_USER_STATUS_UPLOAD_HEADER
 
 // online_status_upload.hpp: 保存每个活跃的用户uid，并定时更新它们的在线状态
+// 活跃用户由PresenceTracker记录（见presence_tracker.hpp），每条消息只需要两次relaxed读取；
+// 下线的用户很少，仍然用互斥锁保护的集合记录。
+// 租约模式（CMake选项USE_SERVER_LEASE，见common/presence_lease.hpp）下每个周期只续约一次服务器的租约，
+// 活跃用户的status:<uid>只每LEASE_STATUS_REFRESH刷新一次过期时间。
 #include <cstdint>
 #include <unordered_set>
+#include <vector>
 
+#include "common/presence_lease.hpp"
 #include "common/timer.hpp"
 #include "log/log_manager.hpp"
+#include "server/presence_tracker.hpp"
 #include "server/redis/server_redis.hpp"
 
 namespace chatroom::backend {
+#ifdef USING_SERVER_LEASE
+constexpr bool SERVER_LEASE_MODE = true;
+#else
+constexpr bool SERVER_LEASE_MODE = false;
+#endif
+
+// 删除用户的在线状态，KEYS[1]为status:<uid>，ARGV[1]为本服务器的ID；状态已经指向其他服务器时不删除
+constexpr std::string_view REMOVE_STATUS_SCRIPT = R"(
+    if redis.call("HGET", KEYS[1], "server_id") == ARGV[1] then
+        return redis.call("DEL", KEYS[1])
+    end
+    return 0
+)";
+
+// 租约模式下每隔多少次续约刷新一次活跃用户的过期时间
+constexpr uint32_t LEASE_STATUS_REFRESH_TICKS = LEASE_STATUS_REFRESH / SERVER_LEASE_RENEW_INTERVAL;
+
 class OnlineStatusUploader {
    public:
-    OnlineStatusUploader(std::shared_ptr<RedisMgr> redis, TimerTaskManager *timer_mgr, uint32_t interval_sec = 10)
-        : redis_(std::move(redis)), timer_mgr_(timer_mgr) {
+    // @param server_id 本服务器的ID
+    // @param lease 是否使用服务器租约模式；租约模式下上传周期固定为SERVER_LEASE_RENEW_INTERVAL
+    OnlineStatusUploader(std::shared_ptr<RedisMgr> redis, TimerTaskManager *timer_mgr, std::string server_id,
+                         bool lease = SERVER_LEASE_MODE, uint32_t interval_sec = 10)
+        : redis_(std::move(redis)), timer_mgr_(timer_mgr), server_id_(std::move(server_id)), lease_(lease) {
         task_iter_ = timer_mgr_->CreateTimer(
-            std::chrono::milliseconds(interval_sec * 1000),
+            lease_ ? SERVER_LEASE_RENEW_INTERVAL : std::chrono::milliseconds(interval_sec * 1000),
             [this] {
                 spdlog::debug("OnlineStatusUploader: Uploading online status (timed)");
                 UploadImpl();
@@ -24,16 +51,38 @@ class OnlineStatusUploader {
         (*task_iter_)->Activate();
     }
 
-    ~OnlineStatusUploader() { timer_mgr_->RemoveTimer(task_iter_); }
+    ~OnlineStatusUploader() {
+        timer_mgr_->RemoveTimer(task_iter_);
+        uint64_t epoch = lease_epoch_.load();
+        if (epoch != 0) {
+            // 释放租约，本服务器上的所有用户立即被视为离线
+            try {
+                redis_->ReleaseServerLease(server_id_, epoch);
+            } catch (const sw::redis::Error &e) {
+                spdlog::warn("OnlineStatusUploader: Failed to release server lease: {}", e.what());
+            }
+        }
+    }
 
-    bool AddSession(uint64_t uid) {
-        std::unique_lock lock(lck_);
-        return sess_.insert(uid).second;
+    // @brief 租约模式下取得服务器的租约，需要在Redis连接建立之后、接受用户验证之前调用；默认模式下不做任何事
+    void Start() {
+        if (lease_) {
+            lease_epoch_.store(redis_->AcquireServerLease(server_id_, SERVER_LEASE_TTL));
+            spdlog::info("OnlineStatusUploader: Acquired server lease, epoch {}", lease_epoch_.load());
+        }
+    }
+
+    // @brief 写入用户在线状态时使用的租约纪元，默认模式下为0
+    uint64_t LeaseEpoch() const { return lease_epoch_.load(std::memory_order_relaxed); }
+
+    // @brief 用户发送了消息，在下一次上传时刷新其在线状态；每条消息都会调用，不获取任何锁
+    // @param last_epoch 用户Session中保存的纪元，见Session::PresenceEpoch()
+    bool AddSession(uint64_t uid, std::atomic<uint32_t> &last_epoch) {
+        return tracker_.MarkActive(uid, last_epoch);
     }
 
     bool RemoveSession(uint64_t uid) {
         std::unique_lock lock(lck_);
-        sess_.erase(uid);
         removal_sess_.insert(uid);
         return true;
     }
@@ -51,29 +100,43 @@ class OnlineStatusUploader {
         if (!in_progress_.compare_exchange_strong(expect, true)) {
             return;
         }
+        std::vector<uint64_t> sending_list;
+        // 租约模式下的刷新周期比续约周期长得多，其间活跃用户留在tracker_中
+        if (!lease_ || ++lease_ticks_ % LEASE_STATUS_REFRESH_TICKS == 0) {
+            tracker_.Collect(sending_list);
+        }
         std::unique_lock lock(lck_);
-        std::unordered_set<uint64_t> sending_list = std::move(sess_);
-        sess_.clear();
         std::unordered_set<uint64_t> erasing_list = std::move(removal_sess_);
         removal_sess_.clear();
         lock.unlock();  // ===== EXIT CRITICAL =====
 
+        if (lease_) {
+            RenewLease();
+        }
+
         auto pl = redis_->GetPipeline();
 
         // updating uid
         // std::unordered_map<std::string, std::string> hm = {{"server_id", "unset"}, {"status", "online"}};
         for (auto uid : sending_list) {
+            if (erasing_list.count(uid)) {
+                continue;  // 用户已经下线，不再刷新
+            }
             std::string key("status:");
             key += std::to_string(uid);
+            if (lease_) {
+                pl.expire(key, LEASE_STATUS_TTL);
+                continue;
+            }
             // HEXPIRE key seconds [NX | XX | GT | LT] FIELDS numfields field [field ...]
             pl.command("HEXPIRE", key, 30, "FIELDS", 2, "server_id", "status");
         }
 
-        // remove uid
+        // remove uid：用户可能已经在其他服务器上重新登录（例如排空时迁移），只删除仍然指向本服务器的状态
         for (auto uid : erasing_list) {
             std::string key("status:");
             key += std::to_string(uid);
-            pl.del(key);
+            pl.eval(REMOVE_STATUS_SCRIPT, {key}, {server_id_});
         }
 
         spdlog::debug("OnlineStatusUploader: Updated {} users, removed {} users", sending_list.size(),
@@ -82,13 +145,42 @@ class OnlineStatusUploader {
 
         in_progress_.store(false);
     }
+
+    void RenewLease() {
+        uint64_t epoch = lease_epoch_.load();
+        if (epoch == 0) {
+            return;  // 尚未调用Start()
+        }
+        try {
+            switch (redis_->RenewServerLease(server_id_, epoch, SERVER_LEASE_TTL)) {
+                case RedisMgr::LeaseRenewal::RENEWED:
+                    break;
+                case RedisMgr::LeaseRenewal::REACQUIRED:
+                    // 续约间隔超过了租约的有效期（例如进程被长时间挂起），其间本服务器上的用户被视为离线，
+                    // 网关可能已经允许他们在其他服务器上登录
+                    spdlog::warn("OnlineStatusUploader: Server lease (epoch {}) had expired, renewed", epoch);
+                    break;
+                case RedisMgr::LeaseRenewal::SUPERSEDED:
+                    // 同一server_id的新进程已经启动，本进程的用户保持离线，不能覆盖新进程的租约
+                    spdlog::error("OnlineStatusUploader: Server lease (epoch {}) superseded by a newer instance",
+                                  epoch);
+                    break;
+            }
+        } catch (const sw::redis::Error &e) {
+            spdlog::error("OnlineStatusUploader: Failed to renew server lease: {}", e.what());
+        }
+    }
     std::shared_ptr<RedisMgr> redis_;
-    std::unordered_set<uint64_t> sess_;          // 待更新的会话UID
+    PresenceTracker tracker_;                    // 待更新的会话UID
     std::unordered_set<uint64_t> removal_sess_;  // 待删除的会话UID
     TimerTaskManager *timer_mgr_;
     TimerTaskManager::TaskIter task_iter_;
+    std::string server_id_;
+    bool lease_;
+    std::atomic<uint64_t> lease_epoch_{0};  // 租约模式下Start()之后非0
+    uint32_t lease_ticks_{0};               // 租约模式下的上传次数，只在in_progress_保护下访问
     std::mutex lck_;
-    std::atomic_bool in_progress_;
+    std::atomic_bool in_progress_{false};
 };
 }  // namespace chatroom::backend
 
@@ -0,0 +1,156 @@
+#ifndef SERVER_OUTBOUND_RELAY_HEADER
+#define SERVER_OUTBOUND_RELAY_HEADER
+
+// outbound_relay.hpp: 跨服消息的发送阶段，按目标服务器缓冲并批量写入其消息队列
+// **********************************************
+//  发往同一个服务器的消息先放入该服务器的缓冲区，满足以下任一条件时整个缓冲区被一次性提交给AsyncRedis：
+//  - 缓冲区中的第一条消息已经等待了window（时间窗口，默认1ms）；
+//  - 缓冲区中的消息数达到max_batch。
+//  一次提交的所有XADD命令在同一个Pipeline中发送，只需要一次网络往返，每条消息编码为一个"e"字段
+//  （见common/mq_envelope.hpp）；开启pack选项时，
+//  一批消息被编码到同一个Stream条目的"pack"字段中，只需要一个XADD，接收方的MQHandler负责拆开。
+//  window越大，批次越大、吞吐量越高，但每条消息增加至多window的延迟；window为0时每条消息立即提交。
+//
+//  同一个目标服务器的消息按Send()的调用顺序写入其消息队列。
+//  设置了直连链路（SetPeerLinks）时，发往已建立链路的服务器的批次总是编码为一个SERVER_RELAY报文，
+//  直接写入链路而不经过Redis；链路未建立或者写入失败时，该批次改为写入对方的消息队列。
+//  回退发生时，同一个目标服务器的消息可能不再严格保持Send()的调用顺序。
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "server/peer_link.hpp"
+#include "server/redis/async_redis.hpp"
+#include "utils/util_class.hpp"
+
+namespace chatroom::backend {
+constexpr std::chrono::microseconds DEFAULT_RELAY_WINDOW{1000};  // 默认的缓冲时间窗口
+constexpr std::size_t DEFAULT_RELAY_MAX_BATCH = 64;               // 默认的单个缓冲区最大消息数
+constexpr int DEFAULT_RELAY_QUEUE_MAX_LEN = 1000;                  // 对方消息队列的近似最大长度（MAXLEN ~）
+
+// 发送阶段的配置
+struct RelayOptions {
+    std::chrono::microseconds window{DEFAULT_RELAY_WINDOW};  // 延迟/吞吐量的权衡：消息在缓冲区中的最长等待时间
+    std::size_t max_batch{DEFAULT_RELAY_MAX_BATCH};          // 缓冲区达到该消息数时立即提交
+    bool pack{false};                                        // 是否把一批消息编码到同一个Stream条目中
+    int queue_max_len{DEFAULT_RELAY_QUEUE_MAX_LEN};
+};
+
+// 发送阶段的统计信息
+struct RelayStats {
+    uint64_t messages;        // 已提交的消息数
+    uint64_t flushes;         // 提交的批次数，messages / flushes即平均批次大小
+    uint64_t size_flushes;    // 因达到max_batch而提交的批次数
+    uint64_t stream_entries;  // 写入的Stream条目数，开启pack时小于messages
+    uint64_t wait_us_sum;     // 消息在缓冲区中等待的时间之和
+    uint64_t failed;          // 写入失败的消息数
+    uint64_t peer_flushes;    // 经直连链路发送的批次数
+    uint64_t peer_fallbacks;  // 直连链路写入失败、改为写入消息队列的批次数
+};
+
+// "pack"字段中的一条消息
+//  编码（网络字节序）：[uint32_t：其后的长度][uint64_t：发送者][uint64_t：接收者或群ID][uint32_t：n][n个uint64_t：接收者][内容]
+//  n为0时是单聊消息，target为接收者；否则是群聊消息，target为群ID，其后是该服务器上的n个接收者
+struct RelayRecord {
+    uint64_t from;
+    uint64_t target;
+    std::string_view recipients;  // 群聊消息的接收者列表（PackUidList的格式），单聊时为空
+    std::string_view content;
+    bool IsGroup() const { return !recipients.empty(); }
+};
+
+// @brief 把一条消息追加编码到out中
+// @param recipients 群聊消息的接收者列表，单聊时为nullptr
+void AppendRelayRecord(std::string &out, uint64_t from, uint64_t target, const std::vector<uint64_t> *recipients,
+                       std::string_view content);
+
+// @brief 解码"pack"字段中的所有消息，RelayRecord中的string_view指向data
+// @return 数据格式错误时返回false，out中保留已经解码的消息
+bool UnpackRelayBatch(std::string_view data, std::vector<RelayRecord> &out);
+
+class OutboundRelay : public Noncopyable {
+   public:
+    // @param async_redis 用于提交XADD命令的异步Redis接口，需要在本对象停止之后再停止
+    // @param origin 本服务器的ID，写入消息的"srv"字段
+    OutboundRelay(std::shared_ptr<AsyncRedis> async_redis, std::string origin, RelayOptions opts = {});
+
+    ~OutboundRelay() { Stop(); }
+
+    // @brief 设置直连链路，需要在Start()之前调用；链路管理器需要在本对象停止之后再停止
+    void SetPeerLinks(std::shared_ptr<PeerLinkManager> peers) { peers_ = std::move(peers); }
+
+    bool Start();
+
+    // @brief 提交所有缓冲区中剩余的消息，然后停止刷新线程
+    bool Stop();
+
+    // @brief 发送一条单聊消息
+    // @param cb 写入完成后在AsyncRedis的工作线程上调用，参数为是否成功，可以为空
+    void Send(std::string_view server_id, uint64_t from, uint64_t to, std::string_view content,
+              std::function<void(bool)> cb = nullptr);
+
+    // @brief 发送一条群聊消息，对方服务器负责将其投递给to中的所有接收者
+    void SendGroup(std::string_view server_id, uint64_t gid, uint64_t from, const std::vector<uint64_t> &to,
+                   std::string_view content, std::function<void(bool)> cb = nullptr);
+
+    RelayStats GetStats() const;
+
+   private:
+    struct Entry {
+        uint64_t from;
+        uint64_t target;           // 接收者或群ID
+        std::vector<uint64_t> to;  // 群聊消息的接收者，单聊时为空
+        std::string content;
+        std::function<void(bool)> cb;
+        std::chrono::steady_clock::time_point enqueued;
+    };
+
+    struct Buffer {
+        std::vector<Entry> entries;
+        std::chrono::steady_clock::time_point deadline;  // 第一条消息进入时间 + window
+    };
+
+    void Enqueue(std::string_view server_id, Entry &&entry);
+    void FlusherFn();
+    // @brief 提交一个缓冲区中的消息：优先写入直连链路，否则调用FlushToRedis()
+    void Flush(const std::string &server_id, std::vector<Entry> &&entries);
+    // @brief 把一批消息作为一个命令提交给AsyncRedis
+    void FlushToRedis(const std::string &server_id, std::shared_ptr<std::vector<Entry>> batch);
+    // @brief 把一批消息编码为一个SERVER_RELAY报文并写入直连链路
+    // @return 链路未建立时返回false
+    bool FlushToPeer(const std::string &server_id, const std::shared_ptr<std::vector<Entry>> &batch);
+
+    std::shared_ptr<AsyncRedis> async_redis_;
+    std::string origin_;
+    RelayOptions opts_;
+    std::shared_ptr<PeerLinkManager> peers_;
+
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::unordered_map<std::string, Buffer> buffers_;  // server_id -> 缓冲区，由mtx_保护
+    bool running_{false};
+    std::thread flusher_;
+
+    std::atomic<uint64_t> messages_{0};
+    std::atomic<uint64_t> flushes_{0};
+    std::atomic<uint64_t> size_flushes_{0};
+    std::atomic<uint64_t> stream_entries_{0};
+    std::atomic<uint64_t> wait_us_sum_{0};
+    std::atomic<uint64_t> failed_{0};
+    std::atomic<uint64_t> peer_flushes_{0};
+    std::atomic<uint64_t> peer_fallbacks_{0};
+};
+}  // namespace chatroom::backend
+
+#endif
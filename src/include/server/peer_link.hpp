@@ -0,0 +1,119 @@
+#ifndef SERVER_PEER_LINK_HEADER
+#define SERVER_PEER_LINK_HEADER
+
+// peer_link.hpp: 后台服务器之间的直连链路（可选，CMake选项USE_PEER_LINKS）
+// **********************************************
+//  跨服消息原本需要经过Redis两次（发送方XADD，接收方XREADGROUP）。开启直连链路后，每个后台服务器
+//  在 客户端监听端口 + PEER_PORT_OFFSET 上接受其他后台服务器的连接，并主动与每个对端保持一条长连接，
+//  发往该对端的所有跨服消息都复用这条连接，以MsgNode的TLV格式发送：
+//  - 连接建立后发送的第一个报文为PEER_HELLO，内容为发送方的server_id；
+//  - 之后的SERVER_RELAY报文内容为一批编码后的跨服消息（与OutboundRelay的"pack"字段格式相同）；
+//  - 接收方投递完一个SERVER_RELAY报文（放入Session的发送队列或者离线存储）后，在同一条连接上回复PEER_ACK，
+//    内容为本次连接中已投递的报文总数（累计确认，多个确认可以合并为一个）。
+//  发送方只在收到覆盖某个报文的确认后才以成功回调该报文。
+//  链路断开（或尚未建立）时Send()返回false，或者以失败回调所有尚未确认的报文（包括已经写入的），由调用者改走
+//  Redis Stream；断开的链路会以指数退避的间隔自动重连。对端列表来自状态服务器（DumpServerList），定期刷新。
+//
+//  注意：链路上没有身份验证，对端端口只应该暴露在内网中。
+//  回退的语义是至少一次：对端已经投递、但其确认在断开前没有到达的报文会经Redis再投递一次（重复）；
+//  对端在确认之前崩溃时，报文经Redis重新发送，不会丢失。确认不等待离线存储落盘。
+
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "common/msgnode.hpp"
+#include "utils/util_class.hpp"
+
+namespace chatroom::backend {
+constexpr uint16_t PEER_PORT_OFFSET = 1000;                     // 直连链路的监听端口相对客户端监听端口的偏移
+constexpr std::chrono::milliseconds PEER_RECONNECT_MIN{200};    // 重连的初始间隔
+constexpr std::chrono::milliseconds PEER_RECONNECT_MAX{5000};   // 重连的最大间隔
+constexpr std::chrono::milliseconds PEER_REFRESH_INTERVAL{5000};  // 从状态服务器刷新对端列表的间隔
+constexpr std::size_t PEER_MAX_PENDING_FRAMES = 4096;  // 单条链路排队和等待确认的报文上限，超出时改走Redis
+
+// 直连链路的统计信息
+struct PeerLinkStats {
+    uint64_t frames_sent;      // 写入并被对端确认的SERVER_RELAY报文数
+    uint64_t frames_received;  // 收到的SERVER_RELAY报文数
+    uint64_t send_failures;    // 排队后因链路断开而失败的报文数
+    uint64_t connects;         // 出站连接建立的次数
+    uint32_t links_up;         // 当前已建立的出站链路数
+};
+
+// @brief 由对端的客户端地址（host:port）得到其直连链路的地址（host:port+PEER_PORT_OFFSET）
+// @return 地址格式错误时返回空字符串
+std::string MakePeerAddr(std::string_view server_addr);
+
+class PeerLinkManager : public Noncopyable {
+   public:
+    // @brief 收到一批跨服消息时的回调，在链路的IO线程上调用
+    // @param origin 发送方的server_id
+    // @param packed 编码后的消息，见UnpackRelayBatch()
+    using DeliverFn = std::function<void(const std::string &origin, std::string_view packed)>;
+
+    // @param server_id 本服务器的ID，对端列表中的本服务器会被忽略
+    // @param listen_port 接受对端连接的端口
+    PeerLinkManager(std::string server_id, uint16_t listen_port, DeliverFn deliver);
+
+    ~PeerLinkManager() { Stop(); }
+
+    // @brief 开始监听并启动IO线程，只能调用一次
+    bool Start();
+
+    // @brief 关闭所有链路（排队中的报文以失败回调），然后停止IO线程
+    void Stop();
+
+    // @brief 更新对端列表：为新出现的对端建立链路，关闭已经消失或者地址变化的对端的链路
+    // @param peers server_id -> 直连链路地址（host:port）
+    void UpdatePeers(const std::unordered_map<std::string, std::string> &peers);
+
+    // @brief 到server_id的链路是否已建立
+    bool IsConnected(const std::string &server_id);
+
+    // @brief 通过直连链路发送一个报文
+    // @param on_done 对端确认已投递该报文（true）或者在确认之前链路断开（false）时在IO线程上调用
+    // @return 链路未建立或者排队的报文过多时返回false，此时on_done不会被调用
+    bool Send(const std::string &server_id, std::shared_ptr<MsgNode> frame, std::function<void(bool)> on_done);
+
+    PeerLinkStats GetStats();
+
+   private:
+    class OutLink;
+    class InLink;
+
+    void AcceptorFn();
+
+    std::string server_id_;
+    uint16_t listen_port_;
+    DeliverFn deliver_;
+
+    boost::asio::io_context ctx_;
+    std::unique_ptr<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> work_guard_;
+    boost::asio::ip::tcp::acceptor acc_;
+    std::thread th_;
+
+    std::mutex mtx_;
+    bool started_{false};  // 由mtx_保护
+    std::unordered_map<std::string, std::shared_ptr<OutLink>> links_;  // server_id -> 出站链路，由mtx_保护
+    std::unordered_set<std::shared_ptr<InLink>> in_links_;              // 只在IO线程上访问
+
+    std::atomic<uint64_t> frames_sent_{0};
+    std::atomic<uint64_t> frames_received_{0};
+    std::atomic<uint64_t> send_failures_{0};
+    std::atomic<uint64_t> connects_{0};
+};
+}  // namespace chatroom::backend
+
+#endif
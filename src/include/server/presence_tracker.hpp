@@ -0,0 +1,84 @@
+#ifndef SERVER_PRESENCE_TRACKER_HEADER
+#define SERVER_PRESENCE_TRACKER_HEADER
+
+// presence_tracker.hpp: 记录一个上传周期内发送过消息的用户，供OnlineStatusUploader批量刷新其在线状态
+// **********************************************
+//  每个上传周期对应一个纪元（epoch），每个Session保存自己最近一次被记录时的纪元：
+//  - MarkActive()：Session的纪元与当前纪元相同时直接返回，只有两次relaxed读取，不写任何共享的缓存行；
+//    每个周期中用户的第一条消息才会把uid压入一个无锁栈（Treiber栈，只有push操作）；
+//  - Collect()：先推进纪元，再用一次exchange取走整个栈，生产者不会被阻塞。
+//  推进纪元与取走栈之间被压入的uid会留到下一个周期再上传，同一个uid可能因此在下一个周期出现两次，
+//  Collect()会对结果去重。
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "common/mpsc_queue.hpp"
+#include "utils/util_class.hpp"
+
+namespace chatroom::backend {
+class PresenceTracker : public Noncopyable {
+   public:
+    PresenceTracker() = default;
+
+    ~PresenceTracker() { FreeList(head_.exchange(nullptr, std::memory_order_acquire)); }
+
+    // @brief 记录用户在当前周期中是活跃的，可以在任意线程上并发调用
+    // @param last_epoch 该用户的Session保存的纪元，初始值为0
+    // @return uid是否被新加入了待上传列表
+    bool MarkActive(uint64_t uid, std::atomic<uint32_t> &last_epoch) {
+        uint32_t epoch = epoch_.load(std::memory_order_relaxed);
+        if (last_epoch.load(std::memory_order_relaxed) == epoch) {
+            return false;
+        }
+        // 同一个Session的消息可能在多个线程上同时到达，只有交换成功的一方压入uid
+        if (last_epoch.exchange(epoch, std::memory_order_relaxed) == epoch) {
+            return false;
+        }
+        Push(uid);
+        return true;
+    }
+
+    // @brief 开始一个新的周期，并取出上一个周期中所有活跃的uid（已去重）
+    void Collect(std::vector<uint64_t> &out) {
+        uint32_t next = epoch_.load(std::memory_order_relaxed) + 1;
+        epoch_.store(next == 0 ? 1 : next, std::memory_order_relaxed);  // 0保留给新建的Session
+        Node *head = head_.exchange(nullptr, std::memory_order_acquire);
+        std::size_t old_size = out.size();
+        for (Node *node = head; node != nullptr; node = node->next) {
+            out.push_back(node->uid);
+        }
+        FreeList(head);
+        std::sort(out.begin() + old_size, out.end());
+        out.erase(std::unique(out.begin() + old_size, out.end()), out.end());
+    }
+
+   private:
+    struct Node {
+        uint64_t uid;
+        Node *next;
+    };
+
+    void Push(uint64_t uid) {
+        Node *node = new Node{uid, head_.load(std::memory_order_relaxed)};
+        while (!head_.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed)) {
+        }
+    }
+
+    static void FreeList(Node *node) {
+        while (node != nullptr) {
+            Node *next = node->next;
+            delete node;
+            node = next;
+        }
+    }
+
+    // 纪元几乎只被读取，与被频繁CAS的栈顶分开放在不同的缓存行中；Collect()只在上传线程上调用
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> epoch_{1};
+    alignas(CACHE_LINE_SIZE) std::atomic<Node *> head_{nullptr};
+};
+}  // namespace chatroom::backend
+
+#endif
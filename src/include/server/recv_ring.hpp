@@ -0,0 +1,86 @@
+#ifndef SERVER_RECV_RING_HEADER
+#define SERVER_RECV_RING_HEADER
+
+// recv_ring.hpp: Session在环形缓冲区读取模式下使用的接收缓冲区
+// **********************************************
+//  Session每次async_read_some尽可能多地读入数据，然后由RecvRing一次性切分出其中所有完整的TLV报文：
+//  - 没有跨越环形缓冲区末尾的报文，直接以MsgNodeView的形式引用缓冲区中的内存（零拷贝）；
+//  - 跨越末尾（回绕）的报文，拷贝到一个新的MsgNode中；
+//  - 长度超过环形缓冲区最大容量的报文，拷贝已接收的部分到一个足够大的MsgNode中，由Session按原方式读完剩余内容。
+//
+//  由于帧视图会被投递给MsgHandler异步处理（甚至被放入其他Session的发送队列），只要还有视图引用着当前的缓冲区块，
+//  RecvRing就不会原地复用它，而是换用一个新的块并搬移尚未解析完的残余数据；旧块在最后一个视图释放时归还内存池。
+//
+//  缓冲区块从BufferPool中按需申请，容量在RING_RECV_MIN和RING_RECV_MAX之间自适应：
+//  - 一次读取填满了缓冲区，或者有报文比当前容量更长时，下一次读取换用两倍（或者足够容纳该报文）的块；
+//  - 连续RING_SHRINK_READS次读取都只用到不到1/4的容量时，在缓冲区为空或者需要换块时减半。
+//  内存上限：空闲或者只收发短消息的Session只占用一个RING_RECV_MIN的块，每个Session自身至多占用一个RING_RECV_MAX的块。
+//  注意视图引用的是整个块而不只是报文本身，仍在队列中的视图会让其所在的块（最多RING_RECV_MAX）一直保留到它们被释放，
+//  因此每个Session额外占用的内存还与MsgHandler中尚未处理完的批次数成正比。
+
+#include <array>
+#include <bit>
+#include <boost/asio/buffer.hpp>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "common/msgnode.hpp"
+
+namespace chatroom::backend {
+constexpr uint32_t RING_RECV_MIN = 1024;       // 接收环形缓冲区的初始（最小）容量，必须为2的幂
+constexpr uint32_t RING_RECV_MAX = 16 * 1024;  // 接收环形缓冲区的最大容量，必须为2的幂，更长的报文按原方式读取
+constexpr uint32_t RING_SHRINK_READS = 8;      // 连续多少次读取只用到不到1/4的容量后缩小缓冲区
+static_assert(std::has_single_bit(RING_RECV_MIN) && std::has_single_bit(RING_RECV_MAX) &&
+              RING_RECV_MIN <= RING_RECV_MAX);
+
+class RecvRing {
+   public:
+    enum class ParseStatus {
+        OK,           // 解析出了所有完整的报文（可能为0个），剩余的不完整数据留在缓冲区中
+        LARGE_FRAME,  // 遇到了长度超过缓冲区最大容量的报文，其已接收部分被移入large参数中
+        BAD_FRAME,    // 报文长度超出MAX_CTX_LEN，连接应当被关闭
+    };
+
+    // @param min_capacity 缓冲区的初始（最小）容量，必须为2的幂
+    // @param max_capacity 缓冲区的最大容量，必须为2的幂
+    explicit RecvRing(uint32_t min_capacity = RING_RECV_MIN, uint32_t max_capacity = RING_RECV_MAX);
+
+    // @brief 准备下一次读取所用的缓冲区
+    // @return 可写入区域，至多两段（发生回绕时第二段从缓冲区起始处开始），可直接用于async_read_some
+    std::array<boost::asio::mutable_buffer, 2> PrepareWrite();
+
+    // @brief 提交本次读取实际写入的字节数
+    void CommitWrite(std::size_t bytes);
+
+    // @brief 切分出缓冲区中所有完整的报文，并追加到out中
+    // @param out 解析出的报文节点，其cur_pos_和ctx_len_与按原方式完整接收后的节点一致
+    // @param large 返回LARGE_FRAME时，存放该大报文已接收部分的节点（cur_pos_为已接收的字节数）
+    ParseStatus ParseFrames(std::vector<std::shared_ptr<MsgNode>> &out, std::shared_ptr<MsgNode> &large);
+
+    // @brief 缓冲区中尚未解析的字节数
+    uint32_t Size() const { return static_cast<uint32_t>(tail_ - head_); }
+
+    // @brief 当前缓冲区块的容量（尚未分配时为下一次分配的容量）
+    uint32_t Capacity() const { return block_ ? cap_ : want_cap_; }
+
+   private:
+    // @brief 分配一个容量为want_cap_的新缓冲区块，并把尚未解析的数据搬移到新块的起始处
+    void Renew();
+
+    // @brief 从逻辑位置pos开始拷贝len字节到dst中，处理回绕的情况
+    void CopyOut(uint64_t pos, char *dst, uint32_t len) const;
+
+    std::shared_ptr<char> block_;
+    uint32_t min_cap_;
+    uint32_t max_cap_;
+    uint32_t cap_;
+    uint32_t mask_;
+    uint32_t want_cap_;        // 下一次换块时使用的容量
+    uint32_t small_reads_{0};  // 连续只用到不到1/4容量的读取次数
+    uint64_t head_{0};  // 下一个待解析字节的逻辑位置
+    uint64_t tail_{0};  // 下一个待写入字节的逻辑位置
+};
+}  // namespace chatroom::backend
+
+#endif
@@ -0,0 +1,168 @@
+#ifndef SERVER_ASYNC_REDIS_HEADER
+#define SERVER_ASYNC_REDIS_HEADER
+
+// async_redis.hpp: 后台服务器使用的异步、自动流水线化的Redis访问接口
+// **********************************************
+//  AsyncRedis内部有若干个流水线工作线程，每个工作线程独占一个Redis连接，以及一个无锁的命令队列。
+//  调用者提交的命令只是被放入队列中，接口立即返回；工作线程每次把队列中积累的所有命令（至多MAX_PIPELINE_CMDS个）
+//  打包成一个Pipeline一次性发送，收到所有回复后再依次调用各个命令的回调函数。
+//  因此同一时刻可以有大量的请求在途，同一"轮"内提交的命令只需要一次网络往返。
+//
+//  每个命令需要给出一个路由key（如发送者的UID），相同key的命令总是由同一个工作线程按提交顺序执行，
+//  其回调函数也按提交顺序在该工作线程上被调用。回调函数中不应执行耗时的操作，可以在其中继续提交命令。
+//  一个操作需要根据回复分多步执行时（例如分批扫描大集合），回调函数可以用Continue()追加后续命令，
+//  后续命令立即在下一个Pipeline中执行，整个操作仍然排在之后以相同key提交的命令之前。
+
+#include <sw/redis++/pipeline.h>
+#include <sw/redis++/queued_redis.h>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "common/mpsc_queue.hpp"
+#include "server/redis/server_redis.hpp"
+#include "utils/util_class.hpp"
+
+namespace chatroom::backend {
+constexpr uint32_t DEFAULT_PIPELINE_WORKERS = 2;     // 默认的流水线工作线程（连接）个数
+constexpr std::size_t PIPELINE_QUEUE_CAPACITY = 4096;  // 每个工作线程的命令队列容量
+constexpr std::size_t MAX_PIPELINE_CMDS = 256;         // 一个Pipeline中最多打包的命令个数
+constexpr std::size_t GROUP_SCAN_COUNT = 128;          // GetGroupLocations每次脚本调用扫描的群成员数（SSCAN的COUNT）
+
+// 查询用户位置的结果：ok为false表示查询失败（连接错误、错误回复等），不能据此认为用户不在线
+struct LocationResult {
+    bool ok{false};
+    std::optional<std::string> sid;  // ok为true时，nullopt表示用户不在线
+};
+
+// AsyncRedis的统计信息
+struct AsyncRedisStats {
+    uint64_t commands;   // 已执行的命令数
+    uint64_t pipelines;  // 已发送的Pipeline数，commands / pipelines即平均每次往返打包的命令数
+    uint64_t errors;     // 整个Pipeline执行失败（连接错误等）的次数
+};
+
+class AsyncRedis : public Noncopyable {
+   public:
+    // @brief 向Pipeline中追加命令的函数；一个Appender可以追加多个命令，但需要在ReplyHandler中按相同个数读取回复
+    using Appender = std::function<void(sw::redis::Pipeline &)>;
+    // @brief 回复的处理函数：replies为nullptr时表示整个Pipeline执行失败；idx为该命令第一个回复的下标
+    using ReplyHandler = std::function<void(sw::redis::QueuedReplies *replies, std::size_t idx)>;
+
+    // @param redis 已经（或者将在Start()之前）连接好的Redis管理器
+    // @param worker_count 流水线工作线程个数，每个线程使用一个独立的Redis连接
+    explicit AsyncRedis(std::shared_ptr<RedisMgr> redis, uint32_t worker_count = DEFAULT_PIPELINE_WORKERS);
+
+    ~AsyncRedis() { Stop(); }
+
+    // @brief 为每个工作线程建立连接并启动，需要在redis连接之后调用
+    bool Start();
+
+    // @brief 执行完队列中剩余的命令，然后停止所有工作线程并join
+    bool Stop();
+
+    // @brief 提交一个通用命令
+    // @param key 路由key，相同key的命令按提交顺序执行
+    // @param append 向Pipeline追加命令的函数
+    // @param on_reply 回复的处理函数，可以为空
+    // @param reply_count append追加的命令个数
+    bool Submit(uint64_t key, Appender append, ReplyHandler on_reply, std::size_t reply_count = 1);
+
+    // @brief 在回复处理函数中追加后续命令：它们立即在下一个Pipeline中执行，其回调先于同一批次中之后的命令的回调，
+    //        因此整个多步操作与之后以相同key提交的命令保持顺序
+    // @warning 只能在回复处理函数中调用；在其他地方（包括以nullptr回调的失败路径）调用时on_reply立即以失败的形式被调用
+    void Continue(Appender append, ReplyHandler on_reply, std::size_t reply_count = 1);
+
+    // @brief 在key对应的工作线程上执行fn，fn排在之前以相同key提交的所有命令的回调之后执行（不发送任何命令）
+    //        用于让不需要访问Redis的后续操作与之前等待Redis回复的操作保持顺序；工作线程未在运行时fn立即执行
+    void Post(uint64_t key, std::function<void()> fn);
+
+    // @brief 异步验证登录token，语义同RedisMgr::VerifyUser
+    std::future<std::optional<uint64_t>> VerifyUser(uint64_t key, std::string_view token);
+
+    // @brief 异步查询用户所在的服务器，语义同RedisMgr::GetUserLocation
+    void GetUserLocation(uint64_t key, uint64_t uid, std::function<void(LocationResult)> cb);
+
+    // @brief 批量查询用户所在的服务器，所有查询在同一个Pipeline中发送
+    // @param cb 回调函数，参数为与uids一一对应的查询结果
+    void GetUserLocations(uint64_t key, const std::vector<uint64_t> &uids,
+                          std::function<void(std::vector<LocationResult>)> cb);
+
+    // @brief 加载群成员，并查询所有成员所在的服务器（GET_GROUP_LOCATIONS_SCRIPT）
+    //        每次脚本调用只扫描约GROUP_SCAN_COUNT个成员，大群分多次调用（Continue()），不会长时间阻塞Redis
+    // @param cb 回调函数，参数为(uid, server_id)的列表，不在线的成员的server_id为空串；群不存在时列表为空，
+    //           查询失败时为nullopt
+    void GetGroupLocations(uint64_t key, uint64_t gid,
+                           std::function<void(std::optional<std::vector<std::pair<uint64_t, std::string>>>)> cb);
+
+    // @brief 异步向其他服务器的消息队列发送消息，语义同RedisMgr::SendToMsgQueue
+    // @param origin 本服务器的ID，对方发现接收者不在其上时据此发回位置失效通知
+    // @param cb 回调函数，参数为是否发送成功，可以为空
+    void SendToMsgQueue(uint64_t key, std::string_view server_id, std::string_view origin, uint64_t from, uint64_t to,
+                        std::string_view content, std::function<void(bool)> cb = nullptr, int queue_max_len = 1000);
+
+    // @brief 异步向其他服务器的消息队列发送一条群聊消息，对方服务器负责将其投递给to中的所有接收者
+    // @param to 该服务器上的接收者列表
+    void SendGroupToMsgQueue(uint64_t key, std::string_view server_id, std::string_view origin, uint64_t gid,
+                             uint64_t from, const std::vector<uint64_t> &to, std::string_view content,
+                             std::function<void(bool)> cb = nullptr, int queue_max_len = 1000);
+
+    // @brief 异步更新用户在线状态，语义同RedisMgr::UpdateUserStatus
+    // @param lease_epoch 服务器租约的纪元，为0时使用默认模式
+    void UpdateUserStatus(uint64_t key, std::string_view server_id, uint64_t uid, uint64_t lease_epoch,
+                          std::function<void(bool)> cb = nullptr);
+
+    AsyncRedisStats GetStats() const {
+        return {commands_.load(std::memory_order_relaxed), pipelines_.load(std::memory_order_relaxed),
+                errors_.load(std::memory_order_relaxed)};
+    }
+
+   private:
+    struct Command {
+        Appender append;
+        ReplyHandler on_reply;
+        std::size_t reply_count{1};
+    };
+
+    struct Worker {
+        Worker() : q(PIPELINE_QUEUE_CAPACITY) {}
+        MpscQueue<Command> q;
+        EventCount ec;
+        std::thread th;
+        std::atomic<bool> running{false};
+    };
+
+    struct GroupScan;
+
+    void WorkerFn(Worker &worker);
+
+    // @brief 把一批命令打包成一个Pipeline执行，并调用各个命令的回调函数；回调函数追加的后续命令在其之后立即执行
+    void ExecBatch(std::optional<sw::redis::Pipeline> &pl, std::vector<Command> &batch);
+
+    // @brief 执行回调函数用Continue()追加的命令，失败时以nullptr调用它们的回调函数
+    void ExecContinuations(std::optional<sw::redis::Pipeline> &pl, std::vector<Command> &cont);
+
+    // @brief GetGroupLocations的一步：从cursor开始扫描一批群成员，扫描未完成时用Continue()执行下一步
+    void ScanGroupLocations(const std::shared_ptr<GroupScan> &scan, std::string cursor, uint64_t key, bool first);
+
+    std::shared_ptr<RedisMgr> redis_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    bool started_{false};  // 只由Start()/Stop()的调用者访问
+    std::atomic<uint64_t> commands_{0};
+    std::atomic<uint64_t> pipelines_{0};
+    std::atomic<uint64_t> errors_{0};
+
+    static thread_local std::vector<Command> *cont_;  // 正在执行的回复处理函数可以追加后续命令的位置
+};
+}  // namespace chatroom::backend
+
+#endif
@@ -4,6 +4,7 @@
 #include <sw/redis++/pipeline.h>
 #include <sw/redis++/queued_redis.h>
 
+#include <chrono>
 #include <string_view>
 
 #include "common/redis/base_redis_mgr.hpp"
@@ -22,25 +23,87 @@ class RedisMgr : public chatroom::BaseRedisMgr {
 
     std::optional<uint64_t> VerifyUser(std::string_view token);
 
+    // @brief 查询用户所在的服务器，该服务器的租约已经失效时视为离线（见common/presence_lease.hpp）
     std::optional<std::string> GetUserLocation(uint64_t uid);
 
+    // @brief 批量查询用户所在的服务器，所有查询在同一个Pipeline中发送
+    // @param out 输出：与uids一一对应的查询结果
+    void GetUserLocations(const std::vector<uint64_t> &uids, std::vector<std::optional<std::string>> &out);
+
     std::string SendToMsgQueue(std::string_view server_id, uint64_t from, uint64_t to, std::string_view content,
                                int max_count = 1000);
 
-    bool UpdateUserStatus(std::string_view server_id, uint64_t uid);
+    // @param lease_epoch 服务器租约的纪元；为0时使用默认模式，在线状态30s后过期；否则LEASE_STATUS_TTL后过期
+    bool UpdateUserStatus(std::string_view server_id, uint64_t uid, uint64_t lease_epoch = 0);
+
+    // @brief 批量登记恢复用的token（与网关登录时发放的token格式相同），所有SET在同一个Pipeline中发送
+    // @param tokens (token, uid)列表
+    void RegisterResumeTokens(const std::vector<std::pair<std::string, uint64_t>> &tokens, std::chrono::seconds ttl);
+
+    // @brief 取得一个新的纪元并写入服务器的租约
+    // @return 新的纪元，从1开始
+    uint64_t AcquireServerLease(std::string_view server_id, std::chrono::milliseconds ttl);
+
+    // 续约的结果
+    enum class LeaseRenewal {
+        RENEWED,     // 续约前租约仍然有效
+        REACQUIRED,  // 租约曾经过期，已重新写入；在此期间该服务器上的用户被视为离线
+        SUPERSEDED,  // 同一server_id的新进程已经取得了更新的纪元，没有续约
+    };
+
+    // @brief 续约，只有租约仍属于epoch时才会续约（比较并设置，见RENEW_SERVER_LEASE_SCRIPT）
+    LeaseRenewal RenewServerLease(std::string_view server_id, uint64_t epoch, std::chrono::milliseconds ttl);
+
+    // @brief 释放租约，该服务器上的所有用户立即被视为离线
+    void ReleaseServerLease(std::string_view server_id, uint64_t epoch);
+
+    // @brief 读取群成员列表（Redis集合group:<gid>）
+    // @return 群不存在（集合为空）时返回false
+    bool GetGroupMembers(uint64_t gid, std::vector<uint64_t> &out);
+
+    // @brief 通知服务器：某个用户不在本服务器上，其缓存的用户位置已经过时；所有通知在同一个Pipeline中发送
+    // @param stale (server_id, uid)列表
+    void SendLocationInvalidates(const std::vector<std::pair<std::string_view, uint64_t>> &stale,
+                                 int queue_max_len = 1000);
 
     using Attrs = std::unordered_map<std::string, std::string>;  // Item中的属性列表（键值对）
     using Item = std::pair<std::string, std::optional<Attrs>>;   // (id, attrs)
     using ItemStream = std::vector<Item>;  // 一个RedisStream流，包含其中的一系列消息
 
     // @brief 从消息队列中接收消息，接收即确认
+    // @param block_ms 两个队列都为空时，在Redis服务端阻塞等待的最长时间；为0时不阻塞，立即返回
+    // @param recv_count 每个队列最多读取的条目数
+    // @warning 阻塞期间占用连接池中的一个连接，block_ms需要小于连接的socket_timeout，否则会抛出TimeoutError
     void RecvFromMsgQueueNoACK(std::string_view server_id, std::string_view consumer_id,
                                std::unordered_map<std::string, ItemStream> &out, uint block_ms = 2000,
                                uint recv_count = 10);
 
+    // @brief 从消息队列中接收消息，读到的条目进入消费者组的待确认列表（PEL），需要之后调用AckMsgQueue()确认
+    // @ 参数与RecvFromMsgQueueNoACK()相同
+    void RecvFromMsgQueue(std::string_view server_id, std::string_view consumer_id,
+                          std::unordered_map<std::string, ItemStream> &out, uint block_ms = 2000,
+                          uint recv_count = 10);
+
+    // @brief 确认已处理的条目，所有队列的XACK在同一个Pipeline中发送
+    // @param ids 队列的键 -> 该队列中要确认的条目ID
+    void AckMsgQueue(std::string_view server_id, const std::unordered_map<std::string, std::vector<std::string>> &ids);
+
+    // @brief 把消费者组中所有待确认的条目（XAUTOCLAIM）转移给本消费者并返回，用于重启后恢复
+    // @param mq_key 队列的键
+    // @param cursor 本次扫描的起始ID，首次调用时为"0-0"
+    // @param out 认领到的条目；已经被裁剪掉的条目会被Redis从待确认列表中删除，不会出现在out中
+    // @return 下一次扫描的起始ID，为"0-0"时表示扫描完毕
+    std::string ClaimPendingMsgs(std::string_view mq_key, std::string_view server_id, std::string_view consumer_id,
+                                 std::string_view cursor, uint count, ItemStream &out);
+
+    // @param read_from_begin 消费者组不存在时，从队列的开头（true）还是末尾（false）开始读取；
+    //                        消费者组已经存在时保留其读取位置
     void RegisterMsgQueue(std::string_view server_id, bool read_from_begin);
 
    private:
+    void ReadMsgQueue(std::string_view server_id, std::string_view consumer_id,
+                      std::unordered_map<std::string, ItemStream> &out, uint block_ms, uint recv_count, bool noack);
+
     std::unique_ptr<sw::redis::Pipeline> pl_;
 };
 }  // namespace chatroom::backend
@@ -9,13 +9,25 @@
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/system/error_code.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
 #include <utility>
 
+#include "server/group_chat.hpp"
 #include "server/io_context_pool.hpp"
+#include "server/load_sampler.hpp"
+#include "server/location_cache.hpp"
 #include "server/mq_handler.hpp"
 #include "server/msg_handler.hpp"
+#include "server/offline_store.hpp"
 #include "server/online_status_upload.hpp"
+#include "server/outbound_relay.hpp"
+#include "server/peer_link.hpp"
+#include "server/redis/async_redis.hpp"
 #include "server/redis/server_redis.hpp"
 #include "server/rpc/status_rpc_client.hpp"
 #include "server/session_manager.hpp"
@@ -24,6 +36,16 @@
 using errcode = boost::system::error_code;
 
 namespace chatroom::backend {
+constexpr std::chrono::milliseconds DRAIN_TICK{100};  // 排空过程中发送一批迁移通知、检查剩余会话的间隔
+constexpr uint32_t DRAIN_MAX_TARGETS_PER_QUERY = 4096;  // 排空时一次为多少个用户查询迁移目标（状态服务器的上限）
+
+// 排空（滚动重启前的优雅下线）的配置
+struct DrainOptions {
+    std::chrono::milliseconds window{30000};    // 迁移通知均匀分散在该时间窗口内发送，避免客户端同时重连
+    std::chrono::milliseconds deadline{60000};  // 从开始排空起，到期时关闭所有剩余的会话
+    std::chrono::seconds token_ttl{60};         // 恢复用的token的有效期
+};
+
 class ServerClass {
    public:
     // explicit ServerClass(boost::asio::io_context& listener_ctx) : context_(listener_ctx), acc_(listener_ctx) {}
@@ -36,19 +58,43 @@ class ServerClass {
           acc_(listener_ctx),
           timer_mgr_(std::make_unique<TimerTaskManager>()),
           redis_(std::make_shared<RedisMgr>()),
-          status_uploader_(std::make_shared<OnlineStatusUploader>(redis_, timer_mgr_.get())),
+          async_redis_(std::make_shared<AsyncRedis>(redis_)),
+          relay_(std::make_shared<OutboundRelay>(async_redis_, std::to_string(server_id))),
+          loc_cache_(std::make_shared<LocationCache>()),
+          group_index_(std::make_shared<GroupIndex>(
+              [redis = redis_](uint64_t gid, GroupMembers &out) { return redis->GetGroupMembers(gid, out); })),
+          offline_(std::make_shared<OfflineStore>("offline/" + std::to_string(server_id))),
+          status_uploader_(std::make_shared<OnlineStatusUploader>(redis_, timer_mgr_.get(), std::to_string(server_id))),
           sess_mgr_(std::make_shared<SessionManager>()),
-          handler_(std::make_shared<MsgHandler>(server_id_, sess_mgr_, redis_, status_uploader_)),
+          handler_(std::make_shared<MsgHandler>(server_id_, sess_mgr_, redis_, async_redis_, relay_, loc_cache_,
+                                                group_index_, offline_, status_uploader_)),
+          sampler_(std::make_shared<LoadSampler>(handler_)),
           rpc_cli_(std::make_shared<StatusRPCClient>(status_rpc_addr)),
-          reporter_(std::make_shared<StatusReporter>(server_addr_, server_id_, rpc_cli_, sess_mgr_, timer_mgr_.get())),
+          reporter_(std::make_shared<StatusReporter>(server_addr_, server_id_, rpc_cli_, sess_mgr_, sampler_,
+                                                     timer_mgr_.get())),
           mq_handler_() {
         // redis manager connect
         redis_->ConnectTo(redis_conn_opts, redis_pool_opts);
+        async_redis_->Start();
+        status_uploader_->Start();
+#ifdef USING_PEER_LINKS
+        InitPeerLinks();
+#endif
+        relay_->Start();
+
+        // 离线存储打开失败时，离线消息会被丢弃
+        if (!offline_->Open()) {
+            spdlog::error("Failed to open offline message store");
+        }
 
         // handler start
         handler_->Start();
 
-        mq_handler_ = std::make_shared<MQHandler>(server_id_, sess_mgr_, redis_);
+        mq_handler_ =
+            std::make_shared<MQHandler>(server_id_, sess_mgr_, redis_, loc_cache_, group_index_, offline_, relay_);
+        if (peers_) {
+            StartPeerLinks();
+        }
     }
 
     void Listen(const boost::asio::ip::tcp::endpoint &ep) {
@@ -63,21 +109,69 @@ class ServerClass {
 
     void AcceptorFn();
 
+    // @brief 设置本服务器的容量权重（百分比，100为基准），在Listen()之前调用时登记信息中也会带上
+    void SetCapacity(uint32_t capacity) { reporter_->SetCapacity(capacity); }
+
     // 强制下线逻辑
     bool Kick(const std::string &uuid);
 
+    // @brief 开始排空：停止接受新连接，向状态服务器报告排空状态，然后在opts.window内分批向已验证的客户端发送
+    //        SERVER_MIGRATE报文（目标服务器地址 + 恢复用的token），客户端据此直接连接目标服务器而不需要重新登录；
+    //        没有可用的目标服务器时，改为在opts.window内分批关闭会话。所有会话离开或者opts.deadline到期后，
+    //        关闭剩余的会话并在ctx上调用on_done
+    // @warning 需要在ctx的线程上调用
+    // @return 已经在排空时返回false
+    bool Drain(DrainOptions opts, std::function<void()> on_done);
+
     ~ServerClass() {  // NOLINT
+        // 排空线程会访问下面的所有对象，最先停止
+        {
+            std::unique_lock lock(drain_mtx_);
+            drain_stop_ = true;
+        }
+        drain_cv_.notify_all();
+        if (drain_th_.joinable()) {
+            drain_th_.join();
+        }
 #ifdef USING_IOCONTEXT_POOL
         Singleton<IOContextPool>::GetInstance().Stop();
 #elif defined(USING_IOTHREAD_POOL)
         Singleton<IOThreadPool>::GetInstance().Stop();
 #endif
+        // 直连链路最先停止：之后的跨服消息都写入消息队列，排队中的批次也回退到消息队列
+        if (peers_) {
+            (*peer_timer_)->Cancel();
+            timer_mgr_->RemoveTimer(peer_timer_);
+            peers_->Stop();
+        }
+        MQConsumerStats mq_stats = mq_handler_->GetStats();
+        spdlog::info(
+            "MQ consumer: {} reads ({} idle), {} entries, latency avg {} ms max {} ms, COUNT {}, {} acked, {} recovered",
+            mq_stats.reads, mq_stats.idle_reads, mq_stats.entries,
+            mq_stats.entries ? mq_stats.latency_ms_sum / mq_stats.entries : 0, mq_stats.latency_ms_max,
+            mq_stats.recv_count, mq_stats.acked, mq_stats.recovered);
         mq_handler_.reset();
 
+        LocationCacheStats loc_stats = loc_cache_->GetStats();
+        spdlog::info("Location cache: {} hits, {} misses, {} stale hits, {} invalidations, {} evictions",
+                     loc_stats.hits, loc_stats.misses, loc_stats.stale_hits, loc_stats.invalidations,
+                     loc_stats.evictions);
+
         reporter_->Stop();
         reporter_.reset();
+        sampler_.reset();
         handler_->Stop();
+        // 提交发送阶段缓冲的剩余消息，再执行完所有剩余命令；其回调会访问MsgHandler，因此需要在handler_析构之前停止
+        relay_->Stop();
+        async_redis_->Stop();
         handler_.reset();
+        relay_.reset();
+        async_redis_.reset();
+
+        OfflineStoreStats off_stats = offline_->GetStats();
+        spdlog::info("Offline store: {} messages appended in {} commits, {} drained, {} expired, {} segments",
+                     off_stats.appended, off_stats.commits, off_stats.drained, off_stats.expired, off_stats.segments);
+        offline_->Close();
 
         // 使用timer的类需要在timer_mgr_析构之前析构
         status_uploader_.reset();
@@ -87,6 +181,22 @@ class ServerClass {
     }
 
    private:
+    // @brief 创建直连链路管理器，并交给发送阶段使用；需要在relay_->Start()之前调用
+    void InitPeerLinks();
+
+    // @brief 开始监听对端连接，并定期从状态服务器刷新对端列表；需要在mq_handler_创建之后调用
+    void StartPeerLinks();
+
+    // @brief 从状态服务器获取服务器列表，更新直连链路的对端
+    void RefreshPeers();
+
+    // @brief 排空线程的执行函数
+    void DrainFn(DrainOptions opts, std::function<void()> on_done);
+
+    // @brief 等待到tp或者排空被中止
+    // @return 排空被中止（服务器析构）时返回true
+    bool DrainWaitUntil(std::chrono::steady_clock::time_point tp);
+
     uint32_t server_id_;
     std::string server_addr_;  // 使得外部主机能够连接到本服务器的地址（IP:Port）
     boost::asio::io_context &ctx_;
@@ -95,12 +205,26 @@ class ServerClass {
     // timer_mgr_类被StatusReporter类使用
     std::unique_ptr<TimerTaskManager> timer_mgr_;
     std::shared_ptr<RedisMgr> redis_;
+    std::shared_ptr<AsyncRedis> async_redis_;
+    std::shared_ptr<OutboundRelay> relay_;
+    std::shared_ptr<PeerLinkManager> peers_;  // 未开启直连链路时为空
+    TimerTaskManager::TaskIter peer_timer_;
+    std::shared_ptr<LocationCache> loc_cache_;
+    std::shared_ptr<GroupIndex> group_index_;
+    std::shared_ptr<OfflineStore> offline_;
     std::shared_ptr<OnlineStatusUploader> status_uploader_;
     std::shared_ptr<SessionManager> sess_mgr_;
     std::shared_ptr<MsgHandler> handler_;
+    std::shared_ptr<LoadSampler> sampler_;  // 上报负载时采集MsgHandler和进程的指标
     std::shared_ptr<StatusRPCClient> rpc_cli_;
     std::shared_ptr<StatusReporter> reporter_;
     std::shared_ptr<MQHandler> mq_handler_;
+    // 排空
+    std::atomic_bool draining_{false};
+    std::thread drain_th_;
+    std::mutex drain_mtx_;
+    std::condition_variable drain_cv_;
+    bool drain_stop_{false};  // 由drain_mtx_保护
 };
 
 }  // namespace chatroom::backend
@@ -4,9 +4,11 @@
 // 后台服务器管理的与客户端连接的会话（Session）类
 // Session对象通过shared_from_this维护自己的生命周期，同时持有SessionManager指针
 
+#include <atomic>
 #include <deque>
 #include <memory>
 #include <mutex>
+#include <vector>
 
 // #include <boost/asio.hpp>
 #include <boost/asio/io_context.hpp>
@@ -14,9 +16,12 @@
 #include <boost/asio/strand.hpp>
 
 #include "common/msgnode.hpp"
+#include "server/recv_ring.hpp"
 
 namespace chatroom::backend {
 constexpr size_t INITIAL_NODE_SIZE = 1024;
+constexpr size_t MAX_GATHER_FRAMES = 64;          // 单次聚合写入的最大报文数（即writev的iovec个数上限）
+constexpr size_t MAX_GATHER_BYTES = 256 * 1024;  // 单次聚合写入的最大字节数
 // 定义UID的类型，引用类型和const引用类型；uint64_t这种简单类型可以不取引用
 using UID = uint64_t;       // std::string
 using UIDRef = uint64_t &;  // std::string&
@@ -30,7 +35,7 @@ class Session : public std::enable_shared_from_this<Session> {
    public:
     // 添加对strand的支持
     Session(boost::asio::io_context &ctx, std::weak_ptr<MsgHandler> handler, std::weak_ptr<SessionManager> mgr)
-        : recv_ptr_(std::make_shared<MsgNode>(INITIAL_NODE_SIZE)),
+        : recv_ptr_(MakeMsgNode(INITIAL_NODE_SIZE)),
           sock_(ctx),
           strand_(ctx.get_executor())  // strand保护在多个线程同时执行回调的情况下，不会并发调用回调
           ,
@@ -45,7 +50,7 @@ class Session : public std::enable_shared_from_this<Session> {
     //         std::weak_ptr<SessionManager> mgr
     //     ) :
     //     user_id_(user_id)
-    //     , recv_ptr_(std::make_shared<MsgNode>(INITIAL_NODE_SIZE))
+    //     , recv_ptr_(MakeMsgNode(INITIAL_NODE_SIZE))
     //     , sock_(std::move(socket))
     //     , strand_(ctx.get_executor())
     //     , handler_(std::move(handler))
@@ -55,9 +60,20 @@ class Session : public std::enable_shared_from_this<Session> {
     // }
     uint64_t GetUserId() const { return user_id_; }
 
+    // 用户最近一次被记录为活跃时的纪元，由OnlineStatusUploader使用
+    std::atomic<uint32_t> &PresenceEpoch() { return presence_epoch_; }
+
     // 已建立链接的Sess开始执行
     // 注意Session的生命周期管理由自己以及Server的sessions集合对象管理
-    void Start() { ReceiveHead(); }
+    // 在CMake中打开USE_RING_READER选项（默认打开）后，使用环形缓冲区读取模式
+    void Start() {
+#ifdef USING_RING_READER
+        recv_ptr_.reset();  // 环形缓冲区模式下，recv_ptr_只用于接收超出环形缓冲区容量的大报文
+        ReceiveSome();
+#else
+        ReceiveHead();
+#endif
+    }
 
    public:
     // Session对外的发送接口1，函数会将消息放入队列中等待发送
@@ -69,12 +85,27 @@ class Session : public std::enable_shared_from_this<Session> {
     // Session对外的发送接口3，函数会将已有的消息放入队列中等待发送
     void Send(std::shared_ptr<MsgNode> msg);
 
+    // Session对外的发送接口4，一次加锁把一批消息按顺序放入队列中，用于离线消息等大批量的发送
+    void Send(std::vector<std::shared_ptr<MsgNode>> &&msgs);
+
     // @brief 关闭这个会话；其连接会被中断，同时down标志被设置为true，同时删除对sess_mgr_中对应的会话项
     void Close();
 
     // 用于客户端验证
     bool IsVerified() const { return verified_; }
 
+    // @brief 发送统计：发起的聚合写入（async_write）次数
+    uint64_t GetWriteCount() const { return write_count_.load(std::memory_order_relaxed); }
+
+    // @brief 发送统计：已提交写入的报文数
+    uint64_t GetWrittenFrames() const { return write_frames_.load(std::memory_order_relaxed); }
+
+    // @brief 发送统计：平均每次聚合写入包含的报文数
+    double GetAvgFramesPerWrite() const {
+        uint64_t writes = GetWriteCount();
+        return writes == 0 ? 0.0 : static_cast<double>(GetWrittenFrames()) / static_cast<double>(writes);
+    }
+
     // @brief 设定一个Session为已验证状态
     // @warning 该方法不负责修改SessionManager中对应Session的状态，需要调用者手动设置
     void SetVerified(UID user_id) {
@@ -94,7 +125,11 @@ class Session : public std::enable_shared_from_this<Session> {
     // 启动接收内容的回调
     void ReceiveContent();
 
+    // 环形缓冲区模式：尽可能多地读入数据，并一次性切分出其中所有完整的报文
+    void ReceiveSome();
+
     // 只要还有数据要发送，QueueSend就会一直被调用
+    // 每次调用会取出发送队列中的所有报文（不超过MAX_GATHER_FRAMES/MAX_GATHER_BYTES），通过一次聚合写入发送
     void QueueSend();
 
    private:
@@ -104,12 +139,19 @@ class Session : public std::enable_shared_from_this<Session> {
     // ***** 用户相关 *****
     UID user_id_{};  // 这里sess_id == user_id
     bool verified_{false};
+    std::atomic<uint32_t> presence_epoch_{0};
     // ***** 接收操作 *****
     std::shared_ptr<MsgNode> recv_ptr_;
+    RecvRing recv_ring_;                           // 环形缓冲区读取模式使用的缓冲区，首次读取时才分配内存
+    std::vector<std::shared_ptr<MsgNode>> batch_;  // 环形缓冲区模式下，一次读取中解析出的报文
     // ***** 发送操作 *****
-    std::deque<std::shared_ptr<MsgNode>> send_q_;  // 发送队列
-    std::shared_ptr<MsgNode> sending_;
+    std::deque<std::shared_ptr<MsgNode>> send_q_;    // 发送队列
+    bool writing_{false};                            // 是否有正在进行的写入，由send_latch_保护
+    std::vector<std::shared_ptr<MsgNode>> sending_;  // 正在写入的报文，写入完成后一起释放
+    std::vector<boost::asio::const_buffer> send_bufs_;
     std::mutex send_latch_;  // 队列锁
+    std::atomic<uint64_t> write_count_{0};
+    std::atomic<uint64_t> write_frames_{0};
     // 连接相关
     std::atomic_bool down_{false};  // 该标志被设为true后，session不会有下一步的动作
     boost::asio::ip::tcp::socket sock_;
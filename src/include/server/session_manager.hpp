@@ -4,10 +4,16 @@
 // session_manager.hpp: 管理当前服务器中Session列表的类
 //  其主要职责仅为按UID存储Session列表，同时保存临时Session列表
 //  因此该类对外的依赖仅有Session类
+//  已验证的Session保存在按UID分片的ShardedMap中，查找只获取对应分片的共享锁；会话个数由原子计数器维护
 
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 #include "server/session.hpp"
+#include "utils/sharded_map.hpp"
 
 namespace chatroom::backend {
 class SessionManager {
@@ -33,20 +39,40 @@ class SessionManager {
     // @brief 获取对应的Session对象
     std::shared_ptr<Session> GetSession(UID sess_id);
 
-    // @brief 获取当前管理器中所有有效的Session的个数
+    // @brief 批量获取Session对象
+    // @param ids 需要查找的UID列表
+    // @param found 输出：找到的Session对象
+    // @param missing 输出：不在本服务器上的UID，可以为nullptr
+    void GetSessions(const std::vector<UID> &ids, std::vector<std::shared_ptr<Session>> &found,
+                     std::vector<UID> *missing);
+
+    // @brief 批量获取Session对象，每个UID只获取其所在分片的锁，不会一次锁住所有分片；
+    //        因此结果不是同一时刻的快照，查找期间其他UID的Session可能已经加入或移除
+    // @param ids 需要查找的UID列表，可以有重复
+    // @param out 输出：与ids一一对应的Session对象，不在本服务器上的UID对应nullptr
+    void LookupSessions(const std::vector<UID> &ids, std::vector<std::shared_ptr<Session>> &out);
+
+    // @brief 获取所有已验证的Session对象的快照
+    void GetAllSessions(std::vector<std::shared_ptr<Session>> &out);
+
+    // @brief 获取所有临时（尚未验证）的Session对象的快照
+    void GetTempSessions(std::vector<std::shared_ptr<Session>> &out);
+
+    // @brief 获取当前管理器中所有有效的Session的个数，不获取锁
     uint32_t GetSessionCount();
 
-    // @brief 获取当前管理器中所有临时的Session的个数
+    // @brief 获取当前管理器中所有临时的Session的个数，不获取锁
     uint32_t GetTempSessionCount();
 
-    // @brief 获取当前管理器中总共的Session的个数
+    // @brief 获取当前管理器中总共的Session的个数，不获取锁
+    // @ AddSession先插入再从临时列表中移除，Session移入时可能短暂地被计算两次，但不会被漏掉（排空时据此判断是否完成）
     uint32_t GetTotalSessionCount();
 
    private:
-    std::unordered_map<UID, std::shared_ptr<Session>> sess_;  // session_id -> Session对象
+    ShardedMap<UID, std::shared_ptr<Session>> sess_;  // session_id -> Session对象
     std::unordered_map<Session *, std::shared_ptr<Session>> temp_sess_;  // 临时存放的Session对象序列（需要身份验证）
-    std::mutex lck_;                                                     // 并发访问控制
     std::mutex temp_lck_;
+    std::atomic<uint32_t> temp_count_{0};  // temp_sess_.size()，在temp_lck_中更新
 };
 }  // namespace chatroom::backend
 
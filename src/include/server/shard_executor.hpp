@@ -0,0 +1,193 @@
+#ifndef SERVER_SHARD_EXECUTOR_HEADER
+#define SERVER_SHARD_EXECUTOR_HEADER
+
+// shard_executor.hpp: 按key分片的多工作线程执行器
+// **********************************************
+//  执行器内部有N个分片，每个分片有自己的队列和工作线程。投递任务时需要给出一个路由用的key（如Session指针），
+//  相同key的任务总是被投递到同一个分片，因此同一个key的任务之间保持投递顺序、串行执行；
+//  不同key的任务则可以在不同分片上并行执行，一个分片上的慢任务（如同步的Redis请求）不会阻塞其他分片。
+//
+//  每个分片的队列是有界的无锁MPSC队列（见common/mpsc_queue.hpp），投递任务不需要获取任何锁；
+//  工作线程每次批量取出至多MAX_DRAIN_BATCH个任务再逐个处理，队列为空时通过EventCount休眠。
+//  队列满时投递者让出CPU并重试，不会丢弃任务。
+//
+//  投递时记录任务的入队时刻，工作线程处理完每个任务后把"排队+处理"的耗时记录到分片自己的直方图中，
+//  TakeLatency()合并所有分片的直方图并清零，用于上报处理延迟的百分位数和处理速率。
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "common/mpsc_queue.hpp"
+#include "utils/latency_histogram.hpp"
+
+namespace chatroom::backend {
+constexpr std::size_t SHARD_QUEUE_CAPACITY = 8192;  // 每个分片的队列容量
+constexpr std::size_t MAX_DRAIN_BATCH = 64;         // 工作线程每次从队列中取出的最大任务数
+
+template <typename Item>
+class ShardExecutor {
+   public:
+    using Processor = std::function<void(Item &&)>;
+
+    // @param shard_count 分片（工作线程）的个数，为0时按1处理
+    // @param processor 处理每个任务的函数，会在分片的工作线程上被调用
+    // @param queue_capacity 每个分片的队列容量
+    ShardExecutor(uint32_t shard_count, Processor processor, std::size_t queue_capacity = SHARD_QUEUE_CAPACITY)
+        : processor_(std::move(processor)) {
+        if (shard_count == 0) shard_count = 1;
+        shards_.reserve(shard_count);
+        for (uint32_t i = 0; i < shard_count; ++i) {
+            shards_.push_back(std::make_unique<Shard>(queue_capacity));
+        }
+    }
+
+    ~ShardExecutor() { Stop(); }
+
+    // @brief 计算key对应的分片下标
+    uint32_t ShardOf(uint64_t key) const {
+        // 指针的低位通常为0，先做一次混合再取模
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        return static_cast<uint32_t>(key % shards_.size());
+    }
+
+    uint32_t ShardCount() const { return static_cast<uint32_t>(shards_.size()); }
+
+    // @brief 向key对应的分片投递一个任务，队列已满时等待工作线程腾出空间
+    // @return 队列已满且执行器未在运行时返回false
+    bool Post(uint64_t key, Item &&item) {
+        Shard &shard = *shards_[ShardOf(key)];
+        if (!PushOne(shard, std::move(item), NowUs())) return false;
+        shard.ec.Notify();
+        return true;
+    }
+
+    // @brief 向key对应的分片投递一批任务，只唤醒一次工作线程
+    bool PostBatch(uint64_t key, std::vector<Item> &&items) {
+        if (items.empty()) return true;
+        Shard &shard = *shards_[ShardOf(key)];
+        bool ret = true;
+        uint64_t now = NowUs();
+        for (auto &item : items) {
+            if (!PushOne(shard, std::move(item), now)) {
+                ret = false;
+                break;
+            }
+        }
+        shard.ec.Notify();
+        return ret;
+    }
+
+    // @brief 启动所有分片的工作线程
+    bool Start() {
+        if (running_) return false;
+        running_ = true;
+        for (auto &shard : shards_) {
+            shard->running.store(true, std::memory_order_release);
+            Shard *ptr = shard.get();
+            shard->worker = std::thread([this, ptr] { this->Worker(*ptr); });
+        }
+        return true;
+    }
+
+    // @brief 停止所有分片的工作线程并join，未处理的任务会被丢弃
+    bool Stop() {
+        if (!running_) return false;
+        running_ = false;
+        for (auto &shard : shards_) {
+            shard->running.store(false, std::memory_order_release);
+            shard->ec.NotifyAll();
+        }
+        for (auto &shard : shards_) {
+            if (shard->worker.joinable()) shard->worker.join();
+        }
+        return true;
+    }
+
+    // @brief 获取所有分片队列的统计信息：depth为各分片深度之和，high_water为各分片高水位的最大值
+    MpscQueueStats GetQueueStats() const {
+        MpscQueueStats total{0, 0};
+        for (const auto &shard : shards_) {
+            MpscQueueStats st = shard->q.GetStats();
+            total.depth += st.depth;
+            total.high_water = std::max(total.high_water, st.high_water);
+        }
+        return total;
+    }
+
+    // @brief 把上次调用以来所有分片的任务耗时（排队+处理，微秒）累加到out中，out.Count()即处理的任务数
+    void TakeLatency(LatencyHistogram &out) {
+        for (auto &shard : shards_) {
+            shard->latency.TakeInto(out);
+        }
+    }
+
+   private:
+    struct Task {
+        Item item{};
+        uint64_t enqueue_us{0};  // 入队时刻
+    };
+
+    struct Shard {
+        explicit Shard(std::size_t capacity) : q(capacity) {}
+        MpscQueue<Task> q;
+        EventCount ec;
+        std::thread worker;
+        std::atomic<bool> running{false};
+        LatencyHistogram latency;  // 只由本分片的工作线程写入
+    };
+
+    static uint64_t NowUs() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    bool PushOne(Shard &shard, Item &&item, uint64_t now_us) {
+        Task task{std::move(item), now_us};
+        while (!shard.q.TryPush(std::move(task))) {
+            if (!shard.running.load(std::memory_order_acquire)) {
+                return false;
+            }
+            shard.ec.Notify();  // 确保工作线程是醒着的
+            std::this_thread::yield();
+        }
+        return true;
+    }
+
+    void Worker(Shard &shard) {
+        std::vector<Task> batch;
+        batch.reserve(MAX_DRAIN_BATCH);
+        while (shard.running.load(std::memory_order_acquire)) {
+            if (shard.q.PopBatch(batch, MAX_DRAIN_BATCH) == 0) {
+                EventCount::Key key = shard.ec.PrepareWait();
+                if (!shard.q.Empty() || !shard.running.load(std::memory_order_acquire)) {
+                    shard.ec.CancelWait();
+                    continue;
+                }
+                shard.ec.Wait(key);
+                continue;
+            }
+            for (auto &task : batch) {
+                processor_(std::move(task.item));  // 处理过程中不持有任何锁
+                uint64_t now = NowUs();
+                shard.latency.Record(now > task.enqueue_us ? now - task.enqueue_us : 0);
+            }
+            batch.clear();
+        }
+    }
+
+    Processor processor_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+    bool running_{false};  // 只由Start()/Stop()的调用者访问
+};
+}  // namespace chatroom::backend
+
+#endif
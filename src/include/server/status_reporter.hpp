@@ -7,43 +7,80 @@
 #include <grpcpp/support/status.h>
 
 #include <chrono>
+#include <string>
 #include <thread>
 #include <utility>
+#include <vector>
 
 #include "common/timer.hpp"
 #include "log/log_manager.hpp"
 #include "protocpp/status.grpc.pb.h"
 #include "protocpp/status.pb.h"
+#include "server/load_report_stream.hpp"
+#include "server/load_sampler.hpp"
 #include "server/rpc/status_rpc_client.hpp"
 #include "server/session_manager.hpp"
 
 namespace chatroom::backend {
+constexpr uint32_t DEFAULT_SERVER_CAPACITY = 100;  // 服务器默认的容量权重
+#ifdef USING_LOAD_REPORT_STREAM
+constexpr bool LOAD_REPORT_STREAM = true;
+#else
+constexpr bool LOAD_REPORT_STREAM = false;
+#endif
+constexpr std::chrono::milliseconds STREAM_REPORT_INTERVAL{500};  // 流式上报的间隔
+constexpr std::chrono::milliseconds STREAM_HEARTBEAT{5000};       // 流式上报在没有变化时发送心跳的间隔
+
 class StatusReportRPCImpl {
    private:
     std::shared_ptr<StatusRPCClient> rpc_client_;
 
    public:
     explicit StatusReportRPCImpl(std::shared_ptr<StatusRPCClient> rpc_cli) : rpc_client_(std::move(rpc_cli)) {}
-    grpc::Status ReportLoad(uint32_t id, uint32_t load);
-    grpc::Status ReportServerRegister(uint32_t id, const std::string &serv_addr, uint32_t load);
-    grpc::Status ReportServerLeave();
+    // @param sample 会话数以外的负载指标
+    // @param capacity 服务器的容量权重（百分比，100为基准）
+    grpc::Status ReportLoad(uint32_t id, uint32_t load, bool draining = false, const LoadSample &sample = {},
+                            uint32_t capacity = DEFAULT_SERVER_CAPACITY);
+    grpc::Status ReportServerRegister(uint32_t id, const std::string &serv_addr, uint32_t load, bool draining = false,
+                                      uint32_t capacity = DEFAULT_SERVER_CAPACITY);
+    // @brief 为count个登录查询负载最低的服务器，每个登录分别选择（并在状态服务器上预留）一次
+    // @param out 输出：(server_id, 地址)列表，最多count个
+    grpc::Status QueryMinimalLoadServers(uint32_t count, std::vector<std::pair<uint32_t, std::string>> &out);
+    // @brief 从状态服务器移除本服务器
+    grpc::Status ReportServerLeave(uint32_t id);
     StatusRPCClient &GetClient() { return *rpc_client_; }
 };
 
+// 两种上报方式：
+//  - 一元RPC：每interval_sec秒调用一次ReportServerLoad，状态服务器要等到TTL（40s）超时才能发现服务器停机；
+//  - 流式（CMake选项USE_LOAD_REPORT_STREAM）：每STREAM_REPORT_INTERVAL在长连接的上报流上发送一次增量，
+//    流结束时状态服务器立即移除本服务器。
 class StatusReporter {
    public:
+    // @param sampler 会话数以外的负载指标的采集器，为空时只上报会话数
+    // @param interval_sec 一元RPC方式的上报间隔
+    // @param stream 是否使用流式上报
     StatusReporter(std::string addr, uint32_t server_id, std::shared_ptr<StatusRPCClient> rpc_cli,
-                   std::shared_ptr<SessionManager> sess_mgr, TimerTaskManager *timer_mgr, uint32_t interval_sec = 15)
+                   std::shared_ptr<SessionManager> sess_mgr, std::shared_ptr<LoadSampler> sampler,
+                   TimerTaskManager *timer_mgr, uint32_t interval_sec = 15, bool stream = LOAD_REPORT_STREAM)
         : server_addr_(std::move(addr)),
           interval_sec_(interval_sec),
           server_id_(server_id),
           timer_mgr_(timer_mgr),
-          rpc_impl_(std::move(rpc_cli)),
-          sess_mgr_(std::move(sess_mgr)) {
+          rpc_impl_(rpc_cli),
+          sess_mgr_(std::move(sess_mgr)),
+          sampler_(std::move(sampler)) {
+        if (stream) {
+            stream_ =
+                std::make_unique<LoadReportStream>(std::move(rpc_cli), server_id_, server_addr_, STREAM_HEARTBEAT);
+        }
+        auto interval = stream_ ? STREAM_REPORT_INTERVAL : std::chrono::milliseconds(interval_sec_ * 1000);
         task_iter_ = timer_mgr_->CreateTimer(
-            std::chrono::milliseconds(interval_sec_ * 1000),
+            interval,
             [this] {
-                spdlog::info("StatusReporter: Updating status (timed task)");
+                if (!stream_) {
+                    spdlog::info("StatusReporter: Updating status (timed task)");
+                }
                 ReportImpl();
             },
             true);
@@ -61,7 +98,18 @@ class StatusReporter {
     // @brief 进行服务器在状态服务处的登记
     bool Register();
 
-    // @brief 停止运行，不要重复调用Stop()函数
+    // @brief 设置排空状态，之后的上报都会带上该状态；需要立即生效时再调用UpdateNow()
+    void SetDraining(bool draining) { draining_.store(draining); }
+
+    // @brief 设置服务器的容量权重（百分比，100为基准），硬件更强的服务器可以设置更大的值，按比例分到更多的登录
+    void SetCapacity(uint32_t capacity) { capacity_.store(capacity); }
+
+    // @brief 向状态服务器为count个用户查询可以接收他们的服务器，每个用户的目标分别选择，一批用户因此分散到多个服务器
+    // @param targets 输出：(server_id, 地址)列表，不包含本服务器，可能少于count个
+    // @return 查询失败，或者没有本服务器以外的服务器时返回false
+    bool QueryMigrationTargets(uint32_t count, std::vector<std::pair<uint32_t, std::string>> &targets);
+
+    // @brief 停止运行，并从状态服务器移除本服务器（关闭上报流，或者调用ServerLeave）
     void Stop();
 
    private:
@@ -74,7 +122,11 @@ class StatusReporter {
 
     StatusReportRPCImpl rpc_impl_;
     std::shared_ptr<SessionManager> sess_mgr_;
+    std::shared_ptr<LoadSampler> sampler_;
+    std::unique_ptr<LoadReportStream> stream_;  // 一元RPC方式时为空
     std::atomic_bool stopped_{false};
+    std::atomic_bool draining_{false};
+    std::atomic<uint32_t> capacity_{DEFAULT_SERVER_CAPACITY};
     void ReportImpl();
     void StartTimer();
     void ResetTimer();
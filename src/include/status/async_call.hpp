@@ -0,0 +1,270 @@
+#ifndef STATUS_ASYNC_CALL_HEADER
+#define STATUS_ASYNC_CALL_HEADER
+
+// async_call.hpp: 异步（CompletionQueue）模式下单个一元RPC调用（以及双向流）的状态机
+// **********************************************
+//  每个AsyncUnaryCall对象对应一次调用，其地址作为CompletionQueue的tag：
+//  1. 构造时向服务登记"等待一个新的调用"；
+//  2. 新调用到达（Proceed(true)）时，先创建下一个等待中的对象，再在当前线程上同步处理请求并Finish；
+//  3. Finish完成（或者服务器关闭时登记被取消，Proceed(false)）后对象删除自己。
+//  处理请求的逻辑与同步模式共用StatusServiceImpl。
+
+#include <grpcpp/alarm.h>
+#include <grpcpp/completion_queue.h>
+#include <grpcpp/server_context.h>
+#include <grpcpp/support/async_stream.h>
+#include <grpcpp/support/async_unary_call.h>
+#include <grpcpp/support/status.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+
+namespace chatroom::status {
+class AsyncCallBase {
+   public:
+    virtual ~AsyncCallBase() = default;
+
+    // @brief CompletionQueue上的事件完成后调用
+    // @param ok 事件是否成功，服务器关闭时为false
+    virtual void Proceed(bool ok) = 0;
+};
+
+// 一个RPC方法在异步模式下的登记函数和处理函数，需要比所有该方法的调用对象活得更久
+template <typename Req, typename Resp>
+struct AsyncMethod {
+    using Responder = grpc::ServerAsyncResponseWriter<Resp>;
+    // 调用AsyncService::RequestXXX()登记一个等待中的调用
+    std::function<void(grpc::ServerContext *, Req *, Responder *, grpc::ServerCompletionQueue *, void *)> request;
+    // 处理请求，与同步模式的服务方法相同
+    std::function<grpc::Status(grpc::ServerContext *, const Req *, Resp *)> handle;
+};
+
+template <typename Req, typename Resp>
+class AsyncUnaryCall final : public AsyncCallBase {
+   public:
+    // @brief 创建对象并登记一个等待中的调用，对象会在调用结束后删除自己
+    static void Spawn(const AsyncMethod<Req, Resp> *method, grpc::ServerCompletionQueue *cq) {
+        new AsyncUnaryCall(method, cq);
+    }
+
+    void Proceed(bool ok) override {
+        if (finished_ || !ok) {
+            delete this;
+            return;
+        }
+        Spawn(method_, cq_);  // 尽快登记下一个调用
+        Resp resp;
+        grpc::Status status = method_->handle(&ctx_, &req_, &resp);
+        finished_ = true;
+        responder_.Finish(resp, status, this);
+    }
+
+   private:
+    AsyncUnaryCall(const AsyncMethod<Req, Resp> *method, grpc::ServerCompletionQueue *cq)
+        : method_(method), cq_(cq), responder_(&ctx_) {
+        method_->request(&ctx_, &req_, &responder_, cq_, this);
+    }
+
+    const AsyncMethod<Req, Resp> *method_;
+    grpc::ServerCompletionQueue *cq_;
+    grpc::ServerContext ctx_;
+    Req req_;
+    grpc::ServerAsyncResponseWriter<Resp> responder_;
+    bool finished_{false};
+};
+
+// 一个双向流方法在异步模式下的登记函数和处理函数，State为每条流的状态
+template <typename Req, typename Resp, typename State>
+struct AsyncStreamMethod {
+    using Stream = grpc::ServerAsyncReaderWriter<Resp, Req>;
+    // 调用AsyncService::RequestXXX()登记一个等待中的流
+    std::function<void(grpc::ServerContext *, Stream *, grpc::ServerCompletionQueue *, void *)> request;
+    // 处理一条消息，需要回复时写入resp并把reply设为true；返回非OK的状态时以该状态结束流
+    std::function<grpc::Status(State &, const Req &, Resp *, bool &reply)> handle;
+    // 流结束（客户端关闭、被取消或者出错）时调用一次
+    std::function<void(State &)> close;
+};
+
+// 双向流的状态机：读取一条消息 -> 处理 -> （需要回复时）写入回复 -> 读取下一条消息……
+// 读写不会同时进行，因此一个tag（对象地址）就足够了
+template <typename Req, typename Resp, typename State>
+class AsyncBidiCall final : public AsyncCallBase {
+   public:
+    // @brief 创建对象并登记一个等待中的流，对象会在流结束后删除自己
+    static void Spawn(const AsyncStreamMethod<Req, Resp, State> *method, grpc::ServerCompletionQueue *cq) {
+        new AsyncBidiCall(method, cq);
+    }
+
+    void Proceed(bool ok) override {
+        switch (step_) {
+            case Step::REQUEST:
+                if (!ok) {
+                    delete this;  // 服务器关闭，登记被取消
+                    return;
+                }
+                Spawn(method_, cq_);
+                Read();
+                break;
+            case Step::READ:
+                if (!ok) {
+                    Finish(grpc::Status::OK);  // 客户端关闭了写端，或者连接已经断开
+                    return;
+                }
+                Handle();
+                break;
+            case Step::WRITE:
+                if (!ok) {
+                    Finish(grpc::Status::OK);
+                    return;
+                }
+                Read();
+                break;
+            case Step::FINISH:
+                delete this;
+                break;
+        }
+    }
+
+   private:
+    enum class Step { REQUEST, READ, WRITE, FINISH };
+
+    AsyncBidiCall(const AsyncStreamMethod<Req, Resp, State> *method, grpc::ServerCompletionQueue *cq)
+        : method_(method), cq_(cq), stream_(&ctx_) {
+        method_->request(&ctx_, &stream_, cq_, this);
+    }
+
+    void Read() {
+        step_ = Step::READ;
+        stream_.Read(&req_, this);
+    }
+
+    void Handle() {
+        Resp resp;
+        bool reply = false;
+        grpc::Status status = method_->handle(state_, req_, &resp, reply);
+        if (!status.ok()) {
+            Finish(status);
+        } else if (reply) {
+            step_ = Step::WRITE;
+            stream_.Write(resp, this);
+        } else {
+            Read();
+        }
+    }
+
+    void Finish(const grpc::Status &status) {
+        method_->close(state_);
+        step_ = Step::FINISH;
+        stream_.Finish(status, this);
+    }
+
+    const AsyncStreamMethod<Req, Resp, State> *method_;
+    grpc::ServerCompletionQueue *cq_;
+    grpc::ServerContext ctx_;
+    Req req_;
+    State state_;
+    grpc::ServerAsyncReaderWriter<Resp, Req> stream_;
+    Step step_{Step::REQUEST};
+};
+
+// 一个服务端流方法在异步模式下的登记函数和轮询函数，State为每个订阅的状态
+template <typename Req, typename Resp, typename State>
+struct AsyncPushMethod {
+    using Writer = grpc::ServerAsyncWriter<Resp>;
+    // 调用AsyncService::RequestXXX()登记一个等待中的调用
+    std::function<void(grpc::ServerContext *, Req *, Writer *, grpc::ServerCompletionQueue *, void *)> request;
+    // 检查是否有需要推送的消息，有时写入resp并返回true
+    std::function<bool(State &, const Req &, Resp *)> poll;
+    std::chrono::milliseconds interval;  // 没有消息需要推送时，下一次轮询的间隔
+    // 服务器开始关闭时置为true，之后的调用不再等待下一次轮询而是直接结束，
+    // 否则Shutdown()要等到下一次推送写入失败（最长WATCH_KEEPALIVE）才能取完这些调用
+    std::atomic<bool> stopping{false};
+};
+
+// 服务端流的状态机：轮询 -> （有消息时）写入 -> 用grpc::Alarm等待interval -> 轮询……
+// 写入失败（客户端取消或者连接断开）、等待被取消或者服务器开始关闭（method->stopping）时结束调用；
+// poll至少每隔一段时间返回一条消息，因此已经取消的调用最迟在下一次写入时被发现
+// （没有登记AsyncNotifyWhenDone，IsCancelled()不可用）
+template <typename Req, typename Resp, typename State>
+class AsyncPushCall final : public AsyncCallBase {
+   public:
+    // @brief 创建对象并登记一个等待中的调用，对象会在调用结束后删除自己
+    static void Spawn(const AsyncPushMethod<Req, Resp, State> *method, grpc::ServerCompletionQueue *cq) {
+        new AsyncPushCall(method, cq);
+    }
+
+    void Proceed(bool ok) override {
+        switch (step_) {
+            case Step::REQUEST:
+                if (!ok) {
+                    delete this;
+                    return;
+                }
+                Spawn(method_, cq_);
+                Poll();
+                break;
+            case Step::WRITE:
+                if (!ok) {
+                    Finish();
+                    return;
+                }
+                Wait();
+                break;
+            case Step::WAIT:
+                if (!ok) {
+                    Finish();
+                    return;
+                }
+                Poll();
+                break;
+            case Step::FINISH:
+                delete this;
+                break;
+        }
+    }
+
+   private:
+    enum class Step { REQUEST, WRITE, WAIT, FINISH };
+
+    AsyncPushCall(const AsyncPushMethod<Req, Resp, State> *method, grpc::ServerCompletionQueue *cq)
+        : method_(method), cq_(cq), writer_(&ctx_) {
+        method_->request(&ctx_, &req_, &writer_, cq_, this);
+    }
+
+    void Poll() {
+        Resp resp;
+        if (method_->poll(state_, req_, &resp)) {
+            step_ = Step::WRITE;
+            writer_.Write(resp, this);
+        } else {
+            Wait();
+        }
+    }
+
+    void Wait() {
+        if (method_->stopping.load(std::memory_order_acquire)) {
+            Finish();
+            return;
+        }
+        step_ = Step::WAIT;
+        alarm_.Set(cq_, std::chrono::system_clock::now() + method_->interval, this);
+    }
+
+    void Finish() {
+        step_ = Step::FINISH;
+        writer_.Finish(grpc::Status::OK, this);
+    }
+
+    const AsyncPushMethod<Req, Resp, State> *method_;
+    grpc::ServerCompletionQueue *cq_;
+    grpc::ServerContext ctx_;
+    Req req_;
+    State state_;
+    grpc::ServerAsyncWriter<Resp> writer_;
+    grpc::Alarm alarm_;
+    Step step_{Step::REQUEST};
+};
+}  // namespace chatroom::status
+
+#endif
@@ -3,6 +3,7 @@
 
 // load_balancer: 简易负载均衡器，其同时负责服务器信息的存储。
 
+#include <atomic>
 #include <cstdint>
 #include <memory>
 #include <mutex>
@@ -18,6 +19,45 @@
 namespace chatroom::status {
 constexpr uint32_t SERVER_TIMEOUT = 40 * 1000;  // 40s不更新的服务器视为停机
 
+// 选择服务器的策略
+enum class BalancePolicy {
+    MIN_LOAD,     // 总是返回（负载+预留数）最小的服务器
+    TWO_CHOICES,  // 随机抽取两个服务器，返回其中（负载+预留数）较小的一个（power of two choices）
+};
+
+#ifdef USING_TWO_CHOICES_BALANCER
+constexpr BalancePolicy DEFAULT_BALANCE_POLICY = BalancePolicy::TWO_CHOICES;
+#else
+constexpr BalancePolicy DEFAULT_BALANCE_POLICY = BalancePolicy::MIN_LOAD;
+#endif
+
+// 后台服务器随负载一起上报的其他指标，单位见status.proto中的StatusReportReq
+struct ServerMetrics {
+    uint32_t cpu_usage{0};    // 进程的CPU使用率，占整机的百分比 // NOLINT
+    uint32_t mem_usage{0};    // 进程的常驻内存，MiB // NOLINT
+    uint32_t msg_rate{0};     // 每秒处理的消息数 // NOLINT
+    uint32_t queue_depth{0};  // 消息处理队列中等待处理的消息数 // NOLINT
+    uint32_t p99_us{0};       // 消息处理耗时的p99，微秒 // NOLINT
+    uint32_t capacity{0};     // 容量权重，百分比，100为基准，0按100处理 // NOLINT
+};
+
+// 负载得分中各项指标的权重，单位都是"相当于多少个会话"
+// 默认值下，一个队列积压2000条消息、或者p99达到100ms的服务器，相当于多了约4万~5万个会话，即使会话数很少也不会再被选择
+struct LoadWeights {
+    double session{1.0};      // 每个会话（含预留数）
+    double cpu_usage{100.0};  // 每1%的CPU使用率
+    double mem_usage{1.0};    // 每1MiB常驻内存
+    double msg_rate{0.5};     // 每秒处理的每条消息
+    double queue_depth{20.0}; // 队列中的每条消息
+    double p99_ms{500.0};     // p99处理耗时的每1ms
+
+    // @brief 会话数以外的指标的加权和
+    double MetricCost(const ServerMetrics &m) const {
+        return cpu_usage * m.cpu_usage + mem_usage * m.mem_usage + msg_rate * m.msg_rate +
+               queue_depth * m.queue_depth + p99_ms * m.p99_us / 1000.0;
+    }
+};
+
 struct ServerInfo {
     ServerInfo(uint32_t field_id, std::string field_addr, uint32_t field_load)
         : id(field_id), addr(std::move(field_addr)), load(field_load), last_ts(GetTimestampMs()) {}
@@ -26,7 +66,18 @@ struct ServerInfo {
     std::string addr;  // 服务器的地址 // NOLINT
     uint32_t load;     // 当前服务器的负载 // NOLINT
     uint64_t last_ts;  // 上一次更新时的时间戳，用于计算ttl    // NOLINT
+    bool draining{false};  // 服务器正在排空，只在没有其他服务器时才被选择 // NOLINT
+    uint32_t reserved{0};  // 上一次上报负载以来分配给该服务器的登录数，下一次上报时清零 // NOLINT
+    bool provisional{false};  // 状态服务器重启时从快照恢复、还没有重新上报的服务器 // NOLINT
+    ServerMetrics metrics;  // 上一次上报的其他指标 // NOLINT
+    // 以下两项由LoadBalancer按其权重和服务器的容量在每次上报时计算，默认值下得分即为EffectiveLoad()
+    double session_cost{1.0};  // 每个会话的得分 // NOLINT
+    double metric_cost{0.0};   // 其他指标的得分 // NOLINT
     uint32_t GetID() const { return id; }
+    // 上报的负载加上之后已经分配出去、但还没有反映在上报中的登录
+    uint64_t EffectiveLoad() const { return static_cast<uint64_t>(load) + reserved; }
+    // 用于比较的加权得分，已经除以服务器的容量
+    double Score() const { return session_cost * static_cast<double>(EffectiveLoad()) + metric_cost; }
 };
 
 // comparable concept, c++20
@@ -92,48 +143,119 @@ class MinHeapImpl : public Noncopyable {
     greater_comp comp_;
 };
 
-inline bool SrvInfoComp(ServerInfo *lhs, ServerInfo *rhs) { return lhs->load > rhs->load; }
+// 正在排空的服务器总是排在其他服务器之后
+inline bool SrvInfoComp(ServerInfo *lhs, ServerInfo *rhs) {
+    if (lhs->draining != rhs->draining) return lhs->draining;
+    return lhs->Score() > rhs->Score();
+}
+
+// 写者发布的服务器列表的只读快照
+// 服务器按排名排序：未在排空的服务器在前，同一类中按得分（不含预留数）从小到大
+struct LoadSnapshot {
+    struct Entry {
+        ServerInfo info;  // 发布时的服务器信息，其中的reserved字段无意义
+        // 预留数，与写者和之后的快照共享同一个计数器，读者增加、该服务器上报负载时清零
+        std::shared_ptr<std::atomic<uint32_t>> reserved;
+
+        // 计入预留数r后的得分
+        double Score(uint32_t r) const {
+            return info.session_cost * static_cast<double>(static_cast<uint64_t>(info.load) + r) + info.metric_cost;
+        }
+    };
+
+    std::vector<Entry> servers;
+    uint64_t version{0};  // 发布的版本号，在进程内的所有LoadBalancer之间唯一
+};
 
 // 带有服务器列表的负载均衡器
 // 线程安全
+// 后台服务器每15s才上报一次负载，为了避免一次登录高峰全部落在同一个服务器上，
+// 每次分配服务器都会为其增加一个乐观的预留数（ServerInfo::reserved），并计入比较的负载，直到该服务器下一次上报负载。
+// 服务器按加权得分比较：(会话数 * 权重 + 其他指标的加权和) / 容量，见LoadWeights和ServerInfo::Score()。
+//
+// 读写分离（copy-on-write）：
+//  - 写者（上报、登记、注销、CheckTTL）持有互斥锁修改服务器表，然后重新排名并发布一个新的LoadSnapshot；
+//  - 读者（GetMinimalLoadServerInfo，每次登录一次）不获取任何锁，也不修改服务器表：每个线程缓存一份快照，
+//    只有发布的版本号变化时才通过std::atomic<std::shared_ptr>重新加载，预留数是快照中共享的原子计数器；
+//  - 读者遇到过期的服务器时只是跳过它，移除过期服务器由写者一侧的CheckTTL()负责（TimedUploader定期调用）。
 class LoadBalancer : public Noncopyable {
    public:
-    // @brief 默认构造函数
-    LoadBalancer() = default;
+    // @param policy 选择服务器的策略
+    // @param weights 负载得分中各项指标的权重
+    explicit LoadBalancer(BalancePolicy policy = DEFAULT_BALANCE_POLICY, LoadWeights weights = {});
 
     // @brief 服务器更新负载
+    // @param draining 服务器是否正在排空
+    // @param metrics 会话数以外的其他指标
     // @return true 更新成功，false 表示当前服务器列表中没有找到对应id的服务器
-    bool UpdateServerLoad(uint32_t id, uint32_t load);
+    bool UpdateServerLoad(uint32_t id, uint32_t load, bool draining = false, const ServerMetrics &metrics = {});
 
     // @brief 服务器启动时登记自己的信息
     // @return true正常登记或信息更新，正常情况下该函数不会返回false
-    bool RegisterServerInfo(uint32_t id, std::string addr, uint32_t load);
+    bool RegisterServerInfo(uint32_t id, std::string addr, uint32_t load, bool draining = false,
+                            const ServerMetrics &metrics = {});
 
     // @brief 服务器手动注销
     bool RemoveServer(uint32_t id);
 
-    // @brief 获取最小负载的服务器信息
+    // @brief 状态服务器重启时，从持久化的快照恢复服务器列表，只发布一次快照
+    //        恢复的服务器标记为临时的（provisional），和其他服务器一样参与选择，直到其重新上报或者登记时转为正常；
+    //        其last_ts保留快照中的值，一直没有重新上报的服务器在上一次上报的SERVER_TIMEOUT之后被CheckTTL()移除
+    // @param servers 快照中的服务器，使用id、addr、load、draining、metrics和last_ts字段
+    // @return 恢复的服务器数量；已经存在（已经重新上报）或者已经过期的服务器不会被恢复
+    uint32_t RestoreServers(const std::vector<ServerInfo> &servers);
+
+    // @brief 按策略选择一个服务器分配给新的登录，并为其增加一个预留数；
+    //        正在排空的服务器只在没有其他服务器时才会被返回；不获取任何锁
     // @return first: optional<ServerInfo> 返回对应ServerInfo信息，nullopt表示现在没有任何可用的服务器
-    //         second: bool 表示获取过程中是否发生了过期服务器的清除过程
+    //         second: bool 表示是否遇到了过期（但还没有被CheckTTL()移除）的服务器
     std::pair<std::optional<ServerInfo>, bool> GetMinimalLoadServerInfo();
 
-    // @brief 调试用接口，返回底层的服务器列表
+    // @brief 调试用接口，返回当前快照中的服务器列表
     void CopyServerInfoList(std::vector<ServerInfo> &out);
 
+    // @brief 当前发布的快照的版本号，只有一次原子读取，可以用来廉价地判断快照是否变化
+    uint64_t SnapshotVersion() const { return version_.load(std::memory_order_acquire); }
+
+    // @brief 获取当前发布的快照（WatchServers推送服务器列表的变化时使用）
+    std::shared_ptr<const LoadSnapshot> GetSnapshot() const { return snapshot_.load(std::memory_order_acquire); }
+
     // @brief 检查每个服务器的TTL有效期，并自动清理
     // @return 返回过期并被清理的服务器数量，0表示没有过期的服务器
     uint32_t CheckTTL();
 
-    ~LoadBalancer() {
-        // hm_中包含了动态分配的内存
-        hm_.clear();
-    }
+    BalancePolicy Policy() const { return policy_; }
+
+    const LoadWeights &Weights() const { return weights_; }
+
+    ~LoadBalancer() = default;
 
    private:
-    MinHeapImpl<ServerInfo *, decltype(SrvInfoComp) *> min_heap_{&SrvInfoComp};
-    std::unordered_map<uint32_t, std::unique_ptr<ServerInfo>>
-        hm_;  // id->ServerInfo*, 动态分配ServerInfo的内存，避免其在重分配/重哈希时地址失效
-    std::mutex mtx_;
+    using Entry = LoadSnapshot::Entry;
+
+    // @brief 更新服务器的负载、指标和排空状态，清零预留数，重新计算得分；调用时需持有mtx_
+    void ApplyReport(Entry &entry, uint32_t load, bool draining, const ServerMetrics &metrics);
+
+    // @brief 按hm_重新排名并发布新的快照；调用时需持有mtx_
+    void Publish();
+
+    // @brief 获取当前线程缓存的快照，版本号变化时重新加载
+    const LoadSnapshot &CurrentSnapshot() const;
+
+    // @brief 返回快照中有效的、得分（含预留数）最小的服务器，没有未在排空的服务器时才返回正在排空的服务器
+    // @param expired 遇到过期的服务器时被设置为true
+    static const Entry *PickMinimal(const LoadSnapshot &snap, uint64_t now, bool &expired);
+
+    // @brief 随机抽取两个服务器，返回其中有效、未在排空且得分较小的一个
+    // @return 服务器少于两个或者两个都不可用时返回nullptr，由调用者回退到PickMinimal
+    static const Entry *PickTwoChoices(const LoadSnapshot &snap, uint64_t now);
+
+    BalancePolicy policy_;
+    LoadWeights weights_;
+    std::unordered_map<uint32_t, Entry> hm_;  // id->服务器信息，只由写者在mtx_下访问
+    std::mutex mtx_;                          // 写者之间的互斥
+    std::atomic<std::shared_ptr<const LoadSnapshot>> snapshot_;
+    std::atomic<uint64_t> version_{0};  // snapshot_的版本号，读者先比较它来判断缓存的快照是否过期
 };
 
 // *********************************************
@@ -3,6 +3,9 @@
 
 // status_redis: 将redis对象和业务对象封装在一起，提供简化的接口
 
+#include <chrono>
+#include <optional>
+#include <string>
 #include <unordered_map>
 
 #include "common/redis/base_redis_mgr.hpp"
@@ -21,6 +24,14 @@ class RedisMgr : public chatroom::BaseRedisMgr {
 
     // @brief 状态服务器同时将自己的服务器列表上传至Redis服务器
     bool UpdateServerList(std::unordered_map<std::string, std::string> &serv_list);
+
+    // @brief 保存序列化之后的服务器列表快照（覆盖之前的快照），用于状态服务器重启时恢复
+    // @param ttl 快照的有效期，超过有效期的快照中不可能还有未过期的服务器
+    bool SaveServerSnapshot(const std::string &snapshot, std::chrono::milliseconds ttl);
+
+    // @brief 读取服务器列表快照
+    // @return 不存在（或者已经过期）时返回nullopt
+    std::optional<std::string> LoadServerSnapshot();
 };
 };  // namespace chatroom::status
 
@@ -3,21 +3,49 @@
 
 #include <grpcpp/server.h>
 
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
 #include "status/load_balancer.hpp"
 #include "status/redis/status_redis.hpp"
 #include "status/status_service_impl.hpp"
 #include "status/status_uploader.hpp"
 
 namespace chatroom::status {
-// 同步RPC的写法
+#ifdef USING_ASYNC_STATUS_SERVER
+constexpr bool ASYNC_STATUS_SERVER = true;
+#else
+constexpr bool ASYNC_STATUS_SERVER = false;
+#endif
+constexpr uint32_t ASYNC_PENDING_CALLS = 32;  // 异步模式下每个CompletionQueue为每个方法预先登记的等待中调用数
+constexpr int STREAM_KEEPALIVE_MS = 2000;      // 服务端keepalive ping的间隔和超时
+constexpr std::chrono::milliseconds SHUTDOWN_GRACE{1000};  // 关闭服务时等待进行中的调用结束的时间
+
+// 同步模式使用gRPC内部的线程池处理请求；
+// 异步模式下每个CPU核一个CompletionQueue和一个线程，请求在取出事件的线程上直接处理，不经过gRPC的同步线程池
 class StatusRPCManager {
    private:
+    struct AsyncMethods;  // 异步模式下各个方法的登记/处理函数
+
     RedisMgr *redis_mgr_;  // 不负责其生命周期管理
     LoadBalancer *load_balancer_;
     TimedUploader *uploader_;
+    bool async_;
+    uint32_t cq_count_;
 
     std::unique_ptr<grpc::Server> server_;
     std::unique_ptr<StatusServiceImpl> service_;  // FIXME
+    // 异步模式
+    std::unique_ptr<StatusService::AsyncService> async_service_;
+    std::unique_ptr<AsyncMethods> async_methods_;
+    std::vector<std::unique_ptr<grpc::ServerCompletionQueue>> cqs_;
+    std::vector<std::thread> cq_threads_;
+
+    // @brief 异步模式下每个CompletionQueue的线程函数
+    void AsyncWorker(grpc::ServerCompletionQueue *cq);
+
    public:
     // FIXME: 线程安全
     // @brief 启动RPC服务，调用后线程会阻塞于此函数，直到其他线程调用Stop函数
@@ -28,11 +56,13 @@ class StatusRPCManager {
     void Stop();
 
     // ctor
-    StatusRPCManager(RedisMgr *redis, LoadBalancer *load_balancer, TimedUploader *uploader)
-        : redis_mgr_(redis), load_balancer_(load_balancer), uploader_(uploader) {}
+    // @param async 是否使用异步（CompletionQueue）模式
+    // @param cq_count 异步模式下CompletionQueue（线程）的个数，为0时使用CPU核数
+    StatusRPCManager(RedisMgr *redis, LoadBalancer *load_balancer, TimedUploader *uploader,
+                     bool async = ASYNC_STATUS_SERVER, uint32_t cq_count = 0);
 
     // dtor
-    ~StatusRPCManager() = default;
+    ~StatusRPCManager();
 };
 
 class StatusServer {
@@ -1,6 +1,16 @@
 #ifndef STATUS_SERVICE_IMPL_HEADER
 #define STATUS_SERVICE_IMPL_HEADER
 
+#include <grpcpp/support/sync_stream.h>
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "log/log_manager.hpp"
 #include "protocpp/status.grpc.pb.h"
 #include "protocpp/status.pb.h"
 #include "status/load_balancer.hpp"
@@ -9,12 +19,49 @@
 
 namespace chatroom::status {
 
+// 一条负载上报流（ReportLoadStream）的状态，由处理这条流的线程（同步模式）或者调用对象（异步模式）持有
+struct LoadStreamState {
+    LoadReport full;    // 合并了所有增量之后的完整状态
+    uint64_t epoch{0};  // 登记时分配的流编号，为0表示还没有收到登记消息
+};
+
+constexpr uint32_t MAX_PICKS_PER_REQUEST = 4096;  // CheckMinimalLoadServer一次最多分配的登录数
+constexpr std::chrono::milliseconds WATCH_POLL_INTERVAL{100};  // WatchServers检查服务器列表变化的间隔，即合并推送的窗口
+constexpr std::chrono::milliseconds WATCH_KEEPALIVE{5000};     // 服务器列表没有变化时推送空消息的间隔
+
+// 一个WatchServers订阅的状态：已经推送给网关的服务器列表
+struct WatchState {
+    struct Sent {
+        std::string addr;
+        uint32_t load{0};
+        bool draining{false};
+        double score{0};
+        double session_cost{0};
+        bool provisional{false};
+        uint64_t last_ts{0};  // 每次负载上报都会更新，网关以收到该服务器的推送作为清零预留数的时机
+        bool operator==(const Sent &) const = default;
+    };
+    std::unordered_map<uint32_t, Sent> sent;
+    uint64_t version{0};  // 上一次检查的快照版本号
+    bool synced{false};   // 是否已经推送过完整列表
+    std::chrono::steady_clock::time_point last_push;
+};
+
+// 异步模式（见status_class.hpp）下不向gRPC注册，只由AsyncUnaryCall直接调用下面的方法处理请求
 class StatusServiceImpl final : public StatusService::Service {
+   public:
     grpc::Status ReportServerLoad(grpc::ServerContext *ctx, const StatusReportReq *request,
                                   GeneralResp *response) override {
         auto srv = request->server_id();
         auto load = request->load();
-        bool ret = balancer_->UpdateServerLoad(srv, load);
+        ServerMetrics metrics;
+        metrics.cpu_usage = request->cpu_usage();
+        metrics.mem_usage = request->mem_usage();
+        metrics.msg_rate = request->msg_rate();
+        metrics.queue_depth = request->queue_depth();
+        metrics.p99_us = request->p99_us();
+        metrics.capacity = request->capacity();
+        bool ret = balancer_->UpdateServerLoad(srv, load, request->draining(), metrics);
         if (ret) {
             response->set_ret(0);
             return grpc::Status::OK;
@@ -35,20 +82,40 @@ class StatusServiceImpl final : public StatusService::Service {
             response->set_ret(1);
             return {grpc::StatusCode::NOT_FOUND, "No server currently available."};
         }
-        if (updated) {
-            uploader_->UpdateNow();  // 显式更新一次服务器列表（异步）
-        }
         response->set_server_id(si->id);
         response->set_server_addr(si->addr);
+        uint32_t count = std::min(request->count(), MAX_PICKS_PER_REQUEST);
+        if (count > 1) {
+            // 每次选择都会增加被选中的服务器的预留数，一批登录因此分散到多个服务器上
+            auto *first = response->add_targets();
+            first->set_server_id(si->id);
+            first->set_server_addr(si->addr);
+            for (uint32_t i = 1; i < count; ++i) {
+                auto [next, next_updated] = balancer_->GetMinimalLoadServerInfo();
+                if (!next.has_value()) break;
+                updated = updated || next_updated;
+                auto *target = response->add_targets();
+                target->set_server_id(next->id);
+                target->set_server_addr(next->addr);
+            }
+        }
+        if (updated && uploader_) {
+            uploader_->UpdateNow();  // 显式更新一次服务器列表（异步）
+        }
         response->set_ret(0);
         return grpc::Status::OK;
     }
     grpc::Status RegisterServer(grpc::ServerContext *context, const ServerRegisterReq *request,
                                 GeneralResp *response) override {
-        bool ret = balancer_->RegisterServerInfo(request->server_id(), request->server_addr(), request->load());
+        ServerMetrics metrics;
+        metrics.capacity = request->capacity();
+        bool ret = balancer_->RegisterServerInfo(request->server_id(), request->server_addr(), request->load(),
+                                                request->draining(), metrics);
         if (ret) {
             response->set_ret(0);
-            uploader_->UpdateNow();  // 显式更新一次服务器列表（异步）
+            if (uploader_) {
+                uploader_->UpdateNow();  // 显式更新一次服务器列表（异步）
+            }
             return grpc::Status::OK;
         } else {
             response->set_ret(1);  // 注册失败
@@ -60,23 +127,204 @@ class StatusServiceImpl final : public StatusService::Service {
         return {grpc::StatusCode::UNIMPLEMENTED, "KickOnlineUser not implemented yet."};
     }
 
+    grpc::Status ServerLeave(grpc::ServerContext *context, const ServerLeaveReq *request,
+                             GeneralResp *response) override {
+        bool removed = false;
+        {
+            std::unique_lock lock(stream_mtx_);
+            stream_epochs_.erase(request->server_id());  // 之后该服务器的旧流结束时不会再移除任何东西
+            removed = balancer_->RemoveServer(request->server_id());
+        }
+        if (!removed) {
+            response->set_ret(1);
+            return {grpc::StatusCode::NOT_FOUND, "Couldn't found server with that ID."};
+        }
+        spdlog::info("Server {} left", request->server_id());
+        if (uploader_) {
+            uploader_->UpdateNow();
+        }
+        response->set_ret(0);
+        return grpc::Status::OK;
+    }
+
+    grpc::Status ReportLoadStream(grpc::ServerContext *context,
+                                  grpc::ServerReaderWriter<LoadReportAck, LoadReport> *stream) override {
+        // 同步模式下每条流占用gRPC线程池中的一个线程，直到流结束
+        LoadStreamState state;
+        LoadReport report;
+        grpc::Status status = grpc::Status::OK;
+        while (stream->Read(&report)) {
+            LoadReportAck ack;
+            bool reply = false;
+            status = OnLoadReport(state, report, &ack, reply);
+            if (!status.ok() || (reply && !stream->Write(ack))) {
+                break;
+            }
+        }
+        OnLoadStreamClosed(state);
+        return status;
+    }
+
+    // @brief 处理上报流上的一条消息：第一条消息登记服务器，之后的消息合并到完整状态上并更新负载均衡器
+    // @param reply 需要回复时设为true，回复的内容写入ack
+    // @return 非OK时应当以该状态结束这条流
+    grpc::Status OnLoadReport(LoadStreamState &state, const LoadReport &report, LoadReportAck *ack, bool &reply) {
+        reply = false;
+        if (state.epoch == 0) {
+            if (!report.has_server_id() || !report.has_server_addr()) {
+                return {grpc::StatusCode::INVALID_ARGUMENT, "The first load report must carry server_id and addr."};
+            }
+            state.full = report;
+        } else {
+            if (report.has_server_id() && report.server_id() != state.full.server_id()) {
+                return {grpc::StatusCode::INVALID_ARGUMENT, "Server ID changed within a load report stream."};
+            }
+            state.full.MergeFrom(report);
+        }
+        const LoadReport &full = state.full;
+        ServerMetrics metrics;
+        metrics.cpu_usage = full.cpu_usage();
+        metrics.mem_usage = full.mem_usage();
+        metrics.msg_rate = full.msg_rate();
+        metrics.queue_depth = full.queue_depth();
+        metrics.p99_us = full.p99_us();
+        metrics.capacity = full.capacity();
+
+        bool first = state.epoch == 0;
+        bool registered = false;
+        {
+            // 流编号和负载均衡器的修改在同一个锁下进行，旧流的结束不会移除新流刚登记的服务器
+            std::unique_lock lock(stream_mtx_);
+            if (first) {
+                state.epoch = ++next_stream_epoch_;
+                stream_epochs_[full.server_id()] = state.epoch;  // 同一服务器的旧流（如果还没有结束）被取代
+            } else {
+                auto it = stream_epochs_.find(full.server_id());
+                if (it == stream_epochs_.end() || it->second != state.epoch) {
+                    return {grpc::StatusCode::ABORTED, "Load report stream superseded or server left."};
+                }
+            }
+            // 服务器条目已经不存在（例如上报停滞超过TTL而被移除）时，用完整状态重新登记
+            if (first || report.has_server_addr() ||
+                !balancer_->UpdateServerLoad(full.server_id(), full.load(), full.draining(), metrics)) {
+                balancer_->RegisterServerInfo(full.server_id(), full.server_addr(), full.load(), full.draining(),
+                                              metrics);
+                registered = true;
+            }
+        }
+        if (first) {
+            spdlog::info("Server {} ({}) registered through load report stream {}", full.server_id(),
+                         full.server_addr(), state.epoch);
+            ack->set_ret(0);
+            reply = true;
+        }
+        if (registered && uploader_) {
+            uploader_->UpdateNow();  // 显式更新一次服务器列表（异步）
+        }
+        return grpc::Status::OK;
+    }
+
+    // @brief 上报流结束（正常关闭、被取消或者连接断开）时调用，立即从负载均衡器中移除对应的服务器，
+    //        除非该服务器已经被更新的流取代或者已经离开
+    void OnLoadStreamClosed(LoadStreamState &state) {
+        if (state.epoch == 0) {
+            return;
+        }
+        uint32_t id = state.full.server_id();
+        {
+            std::unique_lock lock(stream_mtx_);
+            auto it = stream_epochs_.find(id);
+            if (it == stream_epochs_.end() || it->second != state.epoch) {
+                return;
+            }
+            stream_epochs_.erase(it);
+            balancer_->RemoveServer(id);
+        }
+        spdlog::info("Load report stream {} of server {} closed, server removed", state.epoch, id);
+        state.epoch = 0;
+        if (uploader_) {
+            uploader_->UpdateNow();
+        }
+    }
+
     grpc::Status DumpServerList(grpc::ServerContext *context, const DumpServerListReq *request,
                                 ServerItemListResp *response) override {
         std::vector<ServerInfo> out;
         balancer_->CopyServerInfoList(out);
         for (auto &item : out) {
-            auto *server_item = response->add_servers();
-            server_item->set_id(item.id);
-            server_item->set_addr(item.addr);
-            server_item->set_load(item.load);
-            server_item->set_last_ts(item.last_ts);
+            FillServerItem(item, item.Score(), response->add_servers());
         }
         response->set_ret(0);
         return grpc::Status::OK;
     }
 
-   public:
+    grpc::Status WatchServers(grpc::ServerContext *context, const WatchServersReq *request,
+                              grpc::ServerWriter<ServerListUpdate> *writer) override {
+        // 同步模式下每个订阅占用gRPC线程池中的一个线程，直到网关取消订阅或者服务器关闭
+        WatchState state;
+        while (!context->IsCancelled()) {
+            ServerListUpdate update;
+            if (NextServerListUpdate(state, &update) && !writer->Write(update)) {
+                break;
+            }
+            std::this_thread::sleep_for(WATCH_POLL_INTERVAL);
+        }
+        return grpc::Status::OK;
+    }
+
+    // @brief 检查负载均衡器的快照，生成下一条需要推送给订阅者的消息
+    // @return 有需要推送的消息（变化、第一次的完整列表或者到期的空消息）时返回true
+    bool NextServerListUpdate(WatchState &state, ServerListUpdate *update) {
+        auto now = std::chrono::steady_clock::now();
+        bool keepalive = now - state.last_push >= WATCH_KEEPALIVE;
+        if (state.synced && balancer_->SnapshotVersion() == state.version) {
+            if (!keepalive) {
+                return false;
+            }
+            update->set_version(state.version);
+            state.last_push = now;
+            return true;
+        }
+        auto snap = balancer_->GetSnapshot();
+        state.version = snap->version;
+        update->set_version(snap->version);
+        update->set_full(!state.synced);
+        uint64_t now_ms = GetTimestampMs();
+        std::unordered_set<uint32_t> alive;
+        for (const auto &entry : snap->servers) {  // 快照按排名排序
+            const ServerInfo &info = entry.info;
+            if (now_ms - info.last_ts >= SERVER_TIMEOUT) {
+                continue;  // 过期的服务器视为已经移除
+            }
+            alive.insert(info.id);
+            WatchState::Sent cur{info.addr, info.load, info.draining, entry.Score(0), info.session_cost,
+                                 info.provisional, info.last_ts};
+            auto it = state.sent.find(info.id);
+            if (it != state.sent.end() && it->second == cur) {
+                continue;
+            }
+            // 网关在本地维护自己的预留数，推送的得分不含预留数
+            FillServerItem(info, cur.score, update->add_servers());
+            state.sent[info.id] = std::move(cur);
+        }
+        for (auto it = state.sent.begin(); it != state.sent.end();) {
+            if (alive.count(it->first) == 0) {
+                update->add_removed(it->first);
+                it = state.sent.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        if (state.synced && update->servers_size() == 0 && update->removed_size() == 0 && !keepalive) {
+            return false;  // 快照变化了，但是没有需要推送的服务器（例如只有已经过期的服务器变化）
+        }
+        state.synced = true;
+        state.last_push = now;
+        return true;
+    }
+
     // ctor
+    // @param uploader 可以为空（如压测时不需要上传服务器列表）
     StatusServiceImpl(RedisMgr *redis, LoadBalancer *load_balancer, TimedUploader *uploader)
         : redis_mgr_(redis), balancer_(load_balancer), uploader_(uploader) {}
 
@@ -84,9 +332,31 @@ class StatusServiceImpl final : public StatusService::Service {
     ~StatusServiceImpl() override = default;
 
    private:
+    static void FillServerItem(const ServerInfo &info, double score, ServerItem *item) {
+        item->set_id(info.id);
+        item->set_addr(info.addr);
+        item->set_load(info.load);
+        item->set_last_ts(info.last_ts);
+        item->set_draining(info.draining);
+        item->set_cpu_usage(info.metrics.cpu_usage);
+        item->set_mem_usage(info.metrics.mem_usage);
+        item->set_msg_rate(info.metrics.msg_rate);
+        item->set_queue_depth(info.metrics.queue_depth);
+        item->set_p99_us(info.metrics.p99_us);
+        item->set_capacity(info.metrics.capacity);
+        item->set_score(score);
+        item->set_session_cost(info.session_cost);
+        item->set_provisional(info.provisional);
+    }
+
     RedisMgr *redis_mgr_;
     LoadBalancer *balancer_;
     TimedUploader *uploader_;
+
+    // 每个服务器当前有效的上报流编号
+    std::mutex stream_mtx_;
+    std::unordered_map<uint32_t, uint64_t> stream_epochs_;
+    uint64_t next_stream_epoch_{0};
 };
 }  // namespace chatroom::status
 
@@ -5,6 +5,7 @@
 
 #include <condition_variable>
 #include <mutex>
+#include <vector>
 
 #include "status/load_balancer.hpp"
 #include "status/redis/status_redis.hpp"
@@ -47,8 +48,15 @@ class TimedUploader {
     // @brief 手动执行一次更新
     void UpdateNow();
 
+    // @brief 从Redis中读取上一次上传的服务器列表快照，恢复到负载均衡器中（服务器启动时、Start()之前调用）
+    // @return 恢复的服务器数量，快照不存在或者读取失败时为0
+    uint32_t RestoreSnapshot();
+
    private:
     void WorkerFn();
+
+    // @brief 把服务器列表序列化为快照并上传
+    bool SaveSnapshot(const std::vector<ServerInfo> &servers);
 };
 
 }  // namespace chatroom::status
@@ -0,0 +1,85 @@
+#ifndef UTILS_LATENCY_HISTOGRAM_HEADER
+#define UTILS_LATENCY_HISTOGRAM_HEADER
+
+// latency_histogram.hpp: 记录耗时分布、用于计算百分位数的直方图
+// **********************************************
+//  以微秒为单位，小于16us的值各占一个桶；之后每个2的幂区间再均分为8个子桶，相对误差不超过12.5%，
+//  最大可以表示约2^36us（约19小时），更大的值落入最后一个桶。
+//  Record()只是对桶做一次relaxed的fetch_add，适合每个写线程使用自己的直方图，由统计线程定期用TakeInto()合并并清零。
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+namespace chatroom {
+class LatencyHistogram {
+   public:
+    static constexpr uint32_t LINEAR_BUCKETS = 16;
+    static constexpr uint32_t SUB_BUCKET_BITS = 3;
+    static constexpr uint32_t MAX_EXPONENT = 36;
+    static constexpr uint32_t BUCKETS = LINEAR_BUCKETS + (MAX_EXPONENT - 4) * (1U << SUB_BUCKET_BITS);
+
+    LatencyHistogram() = default;
+
+    // @brief 记录一个耗时，可以在任意线程上并发调用
+    void Record(uint64_t us) { buckets_[BucketOf(us)].fetch_add(1, std::memory_order_relaxed); }
+
+    // @brief 把本直方图的计数累加到out中，并将本直方图清零
+    void TakeInto(LatencyHistogram &out) {
+        for (std::size_t i = 0; i < BUCKETS; ++i) {
+            uint64_t n = buckets_[i].exchange(0, std::memory_order_relaxed);
+            if (n != 0) out.buckets_[i].fetch_add(n, std::memory_order_relaxed);
+        }
+    }
+
+    // @brief 记录的总次数
+    uint64_t Count() const {
+        uint64_t total = 0;
+        for (const auto &bucket : buckets_) total += bucket.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    // @brief 计算百分位数，返回所在桶的上界
+    // @param ratio 百分位，如0.99
+    // @return 没有记录时返回0
+    uint64_t Percentile(double ratio) const {
+        uint64_t total = Count();
+        if (total == 0) return 0;
+        auto rank = static_cast<uint64_t>(static_cast<double>(total) * ratio);
+        if (rank >= total) rank = total - 1;
+        uint64_t seen = 0;
+        for (uint32_t i = 0; i < BUCKETS; ++i) {
+            seen += buckets_[i].load(std::memory_order_relaxed);
+            if (seen > rank) return UpperBound(i);
+        }
+        return UpperBound(BUCKETS - 1);
+    }
+
+    void Clear() {
+        for (auto &bucket : buckets_) bucket.store(0, std::memory_order_relaxed);
+    }
+
+   private:
+    static uint32_t BucketOf(uint64_t us) {
+        if (us < LINEAR_BUCKETS) return static_cast<uint32_t>(us);
+        uint32_t exp = std::bit_width(us) - 1;  // >= 4
+        if (exp >= MAX_EXPONENT) return BUCKETS - 1;
+        uint32_t sub = static_cast<uint32_t>(us >> (exp - SUB_BUCKET_BITS)) & ((1U << SUB_BUCKET_BITS) - 1);
+        return LINEAR_BUCKETS + (exp - 4) * (1U << SUB_BUCKET_BITS) + sub;
+    }
+
+    static uint64_t UpperBound(uint32_t bucket) {
+        if (bucket < LINEAR_BUCKETS) return bucket;
+        uint32_t exp = (bucket - LINEAR_BUCKETS) / (1U << SUB_BUCKET_BITS) + 4;
+        uint32_t sub = (bucket - LINEAR_BUCKETS) % (1U << SUB_BUCKET_BITS);
+        uint64_t width = uint64_t{1} << (exp - SUB_BUCKET_BITS);
+        return (uint64_t{1} << exp) + (sub + 1) * width - 1;
+    }
+
+    std::array<std::atomic<uint64_t>, BUCKETS> buckets_{};
+};
+}  // namespace chatroom
+
+#endif
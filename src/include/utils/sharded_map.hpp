@@ -0,0 +1,104 @@
+#ifndef UTILS_SHARDED_MAP_HEADER
+#define UTILS_SHARDED_MAP_HEADER
+
+// sharded_map.hpp: 按key分片的并发哈希表
+// **********************************************
+//  key的哈希值经过混合后选择2的幂个分片之一，每个分片有自己的读写锁和unordered_map，
+//  并独占缓存行，不同分片上的操作互不干扰；查找只获取分片的共享锁，可以与同一分片上的其他查找并行。
+//  元素个数由一个原子计数器维护，Size()不需要获取任何锁（结果是近似的：与并发的插入/删除之间没有同步）。
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+#include "utils/util_class.hpp"
+
+template <typename K, typename V, std::size_t SHARDS = 64, typename Hash = std::hash<K>>
+class ShardedMap : public Noncopyable {
+    static_assert(SHARDS > 0 && (SHARDS & (SHARDS - 1)) == 0, "SHARDS must be a power of two");
+
+   public:
+    ShardedMap() = default;
+
+    // @brief 插入key -> value，key已经存在时不做任何事
+    // @return 是否插入成功
+    bool TryEmplace(const K &key, V value) {
+        Shard &shard = ShardOf(key);
+        std::unique_lock lock(shard.mtx);
+        bool inserted = shard.map.try_emplace(key, std::move(value)).second;
+        if (inserted) size_.fetch_add(1, std::memory_order_relaxed);
+        return inserted;
+    }
+
+    // @return key是否存在并被删除
+    bool Erase(const K &key) {
+        Shard &shard = ShardOf(key);
+        std::unique_lock lock(shard.mtx);
+        bool erased = shard.map.erase(key) == 1;
+        if (erased) size_.fetch_sub(1, std::memory_order_relaxed);
+        return erased;
+    }
+
+    // @brief 查找key，找到时把值拷贝到out中
+    bool Find(const K &key, V &out) const {
+        const Shard &shard = ShardOf(key);
+        std::shared_lock lock(shard.mtx);
+        auto it = shard.map.find(key);
+        if (it == shard.map.end()) return false;
+        out = it->second;
+        return true;
+    }
+
+    // @brief 持有分片的共享锁访问key对应的值，fn不能再访问本对象
+    // @return key是否存在
+    template <typename F>
+    bool Visit(const K &key, F &&fn) const {
+        const Shard &shard = ShardOf(key);
+        std::shared_lock lock(shard.mtx);
+        auto it = shard.map.find(key);
+        if (it == shard.map.end()) return false;
+        fn(it->second);
+        return true;
+    }
+
+    // @brief 依次持有每个分片的共享锁，对其中的每个元素调用fn(key, value)，fn不能再访问本对象
+    template <typename F>
+    void ForEach(F &&fn) const {
+        for (const Shard &shard : shards_) {
+            std::shared_lock lock(shard.mtx);
+            for (const auto &[key, value] : shard.map) {
+                fn(key, value);
+            }
+        }
+    }
+
+    std::size_t Size() const { return size_.load(std::memory_order_relaxed); }
+
+    static constexpr std::size_t ShardCount() { return SHARDS; }
+
+   private:
+    struct alignas(64) Shard {
+        mutable std::shared_mutex mtx;
+        std::unordered_map<K, V, Hash> map;
+    };
+
+    std::size_t ShardIndex(const K &key) const {
+        // std::hash<uint64_t>通常是恒等函数，连续的UID需要先混合（Fibonacci哈希）再取高位
+        uint64_t h = static_cast<uint64_t>(Hash{}(key)) * 0x9E3779B97F4A7C15ULL;
+        return SHARDS == 1 ? 0 : static_cast<std::size_t>(h >> (64 - std::countr_zero(SHARDS)));
+    }
+
+    Shard &ShardOf(const K &key) { return shards_[ShardIndex(key)]; }
+    const Shard &ShardOf(const K &key) const { return shards_[ShardIndex(key)]; }
+
+    std::array<Shard, SHARDS> shards_;
+    alignas(64) std::atomic<std::size_t> size_{0};
+};
+
+#endif
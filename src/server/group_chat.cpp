@@ -0,0 +1,98 @@
+#include "server/group_chat.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+
+#include "common/mq_envelope.hpp"
+#include "utils/field_op.hpp"
+
+namespace chatroom::backend {
+GroupMembersPtr GroupIndex::GetMembers(uint64_t gid) {
+    if (auto members = Find(gid)) {
+        return members;
+    }
+    // 未命中或已过期，加载过程不持有锁；并发加载同一个群时以最后一次加载的结果为准
+    GroupMembers members;
+    if (!loader_ || !loader_(gid, members)) {
+        return nullptr;
+    }
+    return SetMembers(gid, std::move(members));
+}
+
+GroupMembersPtr GroupIndex::Find(uint64_t gid) {
+    auto now = std::chrono::steady_clock::now();
+    std::shared_lock lock(mtx_);
+    auto it = groups_.find(gid);
+    if (it != groups_.end() && it->second.expire > now) {
+        return it->second.members;
+    }
+    return nullptr;
+}
+
+GroupMembersPtr GroupIndex::SetMembers(uint64_t gid, GroupMembers members) {
+    std::sort(members.begin(), members.end());
+    members.erase(std::unique(members.begin(), members.end()), members.end());
+    members.shrink_to_fit();
+    auto ptr = std::make_shared<const GroupMembers>(std::move(members));
+    auto now = std::chrono::steady_clock::now();
+    std::unique_lock lock(mtx_);
+    if (now >= next_sweep_) {
+        // 清理过期的条目；每个有效期至多清理一次，清理的开销分摊到这段时间内的写入上
+        std::erase_if(groups_, [now](const auto &item) { return item.second.expire <= now; });
+        next_sweep_ = now + ttl_;
+    }
+    groups_[gid] = {ptr, now + ttl_};
+    return ptr;
+}
+
+void GroupIndex::Invalidate(uint64_t gid) {
+    std::unique_lock lock(mtx_);
+    groups_.erase(gid);
+}
+
+bool GroupIndex::IsMember(const GroupMembers &members, uint64_t uid) {
+    return std::binary_search(members.begin(), members.end(), uid);
+}
+
+std::shared_ptr<MsgNode> BuildGroupFrame(uint64_t gid, uint64_t from, std::string_view content) {
+    return MakeGroupToClientFrame(gid, from, content);
+}
+
+void GroupByServer(const std::vector<uint64_t> &uids, LocationCache &loc_cache, std::string_view own_server_id,
+                   std::unordered_map<std::string, std::vector<uint64_t>> &remote, std::vector<uint64_t> &unresolved) {
+    for (uint64_t uid : uids) {
+        auto sid = loc_cache.Get(uid);
+        if (!sid.has_value()) {
+            unresolved.push_back(uid);
+        } else if (sid.value() != own_server_id) {
+            remote[sid.value()].push_back(uid);
+        } else {
+            // 缓存的位置为本服务器，但是其不在本地：缓存已经过时，使其失效并重新查询
+            loc_cache.Invalidate(uid);
+            unresolved.push_back(uid);
+        }
+    }
+}
+
+std::string PackUidList(const std::vector<uint64_t> &uids) {
+    std::string data(uids.size() * sizeof(uint64_t), '\0');
+    char *ptr = data.data();
+    for (uint64_t uid : uids) {
+        WriteNetField64(ptr, uid);
+        ptr += sizeof(uint64_t);
+    }
+    return data;
+}
+
+bool UnpackUidList(std::string_view data, std::vector<uint64_t> &out) {
+    if (data.size() % sizeof(uint64_t) != 0) {
+        return false;
+    }
+    out.reserve(out.size() + data.size() / sizeof(uint64_t));
+    for (std::size_t off = 0; off < data.size(); off += sizeof(uint64_t)) {
+        out.push_back(ReadNetField64(data.data() + off));
+    }
+    return true;
+}
+}  // namespace chatroom::backend
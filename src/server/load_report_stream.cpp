@@ -0,0 +1,137 @@
+#include "server/load_report_stream.hpp"
+
+#include <spdlog/spdlog.h>
+
+// 把state中与last不同（或者last中还没有）的字段写入delta
+#define LOAD_REPORT_DELTA(field)                                \
+    if (!last.has_##field() || last.field() != state.field()) { \
+        delta.set_##field(state.field());                       \
+    }
+
+namespace {
+chatroom::status::LoadReport MakeDelta(const chatroom::status::LoadReport &last,
+                                       const chatroom::status::LoadReport &state) {
+    chatroom::status::LoadReport delta;
+    LOAD_REPORT_DELTA(load)
+    LOAD_REPORT_DELTA(cpu_usage)
+    LOAD_REPORT_DELTA(mem_usage)
+    LOAD_REPORT_DELTA(draining)
+    LOAD_REPORT_DELTA(msg_rate)
+    LOAD_REPORT_DELTA(queue_depth)
+    LOAD_REPORT_DELTA(p99_us)
+    LOAD_REPORT_DELTA(capacity)
+    return delta;
+}
+}  // namespace
+
+#undef LOAD_REPORT_DELTA
+
+chatroom::backend::LoadReportStream::LoadReportStream(std::shared_ptr<StatusRPCClient> rpc_cli, uint32_t server_id,
+                                                      std::string server_addr, std::chrono::milliseconds heartbeat)
+    : rpc_cli_(std::move(rpc_cli)),
+      server_id_(server_id),
+      server_addr_(std::move(server_addr)),
+      heartbeat_(heartbeat) {}
+
+bool chatroom::backend::LoadReportStream::Report(const status::LoadReport &state) {
+    std::unique_lock lock(mtx_);
+    if (closed_) {
+        return false;
+    }
+    if (stream_ && broken_.load()) {
+        Reset();
+    }
+    status::LoadReport msg;
+    if (!stream_) {
+        if (!Open()) {
+            return false;
+        }
+        // 新的流：发送完整状态
+        msg = state;
+        msg.set_server_id(server_id_);
+        msg.set_server_addr(server_addr_);
+    } else {
+        msg = MakeDelta(last_, state);
+        auto now = std::chrono::steady_clock::now();
+        if (msg.ByteSizeLong() == 0 && now - last_send_ < heartbeat_) {
+            return true;  // 没有变化，也不需要心跳
+        }
+    }
+
+    status::LoadReport full = last_;
+    full.MergeFrom(msg);
+    if (!stream_->Write(msg)) {
+        spdlog::warn("LoadReportStream: write failed, reconnecting on the next report");
+        Reset();
+        return false;
+    }
+    last_ = std::move(full);
+    last_send_ = std::chrono::steady_clock::now();
+    ++stats_.messages;
+    stats_.bytes += msg.ByteSizeLong();
+    stats_.full_bytes += last_.ByteSizeLong();
+    return true;
+}
+
+void chatroom::backend::LoadReportStream::Close() {
+    std::unique_lock lock(mtx_);
+    if (closed_) {
+        return;
+    }
+    closed_ = true;
+    if (stream_) {
+        stream_->WritesDone();  // 状态服务器读到流的结尾后移除本服务器并结束流
+        Reset();
+    }
+}
+
+chatroom::backend::LoadStreamStats chatroom::backend::LoadReportStream::GetStats() {
+    std::unique_lock lock(mtx_);
+    return stats_;
+}
+
+bool chatroom::backend::LoadReportStream::Open() {
+    auto *stub = rpc_cli_->GetThreadStatusStub();
+    if (stub == nullptr) {
+        return false;
+    }
+    ctx_ = std::make_unique<grpc::ClientContext>();
+    stream_ = stub->ReportLoadStream(ctx_.get());
+    if (!stream_) {
+        ctx_.reset();
+        return false;
+    }
+    broken_ = false;
+    last_.Clear();  // 新的流在状态服务器一侧没有任何状态
+    ++stats_.opens;
+    reader_ = std::thread([this] { ReaderFn(); });
+    return true;
+}
+
+void chatroom::backend::LoadReportStream::Reset() {
+    if (!broken_.load()) {
+        // 流还没有结束（例如写入失败或者主动关闭），取消调用使读线程退出
+        ctx_->TryCancel();
+    }
+    if (reader_.joinable()) {
+        reader_.join();
+    }
+    grpc::Status status = stream_->Finish();
+    if (!status.ok() && !closed_) {
+        spdlog::warn("LoadReportStream: stream ended: {}", status.error_message());
+    }
+    stream_.reset();
+    ctx_.reset();
+}
+
+void chatroom::backend::LoadReportStream::ReaderFn() {
+    status::LoadReportAck ack;
+    while (stream_->Read(&ack)) {
+        if (ack.ret() == 0) {
+            spdlog::info("LoadReportStream: server {} registered at status server", server_id_);
+        } else {
+            spdlog::warn("LoadReportStream: status server replied {}", ack.ret());
+        }
+    }
+    broken_ = true;
+}
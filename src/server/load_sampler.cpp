@@ -0,0 +1,76 @@
+#include "server/load_sampler.hpp"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "utils/latency_histogram.hpp"
+
+chatroom::backend::LoadSampler::LoadSampler(std::shared_ptr<MsgHandler> handler)
+    : handler_(std::move(handler)),
+      last_ts_(std::chrono::steady_clock::now()),
+      ticks_per_sec_(sysconf(_SC_CLK_TCK)),
+      page_size_(sysconf(_SC_PAGESIZE)),
+      cpu_count_(std::max(1U, std::thread::hardware_concurrency())) {
+    ReadCpuTicks(last_ticks_);
+}
+
+chatroom::backend::LoadSample chatroom::backend::LoadSampler::Sample() {
+    LoadSample sample;
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - last_ts_).count();
+    last_ts_ = now;
+
+    uint64_t ticks = 0;
+    if (ReadCpuTicks(ticks) && elapsed > 0 && ticks_per_sec_ > 0) {
+        double cpu_sec = static_cast<double>(ticks - last_ticks_) / static_cast<double>(ticks_per_sec_);
+        sample.cpu_usage = static_cast<uint32_t>(std::min(100.0, cpu_sec / elapsed / cpu_count_ * 100.0));
+        last_ticks_ = ticks;
+    }
+
+    uint64_t pages = 0;
+    if (ReadRssPages(pages) && page_size_ > 0) {
+        sample.mem_usage = static_cast<uint32_t>(pages * static_cast<uint64_t>(page_size_) >> 20);
+    }
+
+    LatencyHistogram latency;
+    handler_->TakeLatency(latency);
+    if (elapsed > 0) {
+        sample.msg_rate = static_cast<uint32_t>(static_cast<double>(latency.Count()) / elapsed);
+    }
+    sample.p99_us = static_cast<uint32_t>(
+        std::min<uint64_t>(latency.Percentile(0.99), std::numeric_limits<uint32_t>::max()));
+    sample.queue_depth = static_cast<uint32_t>(
+        std::min<uint64_t>(handler_->GetQueueStats().depth, std::numeric_limits<uint32_t>::max()));
+    return sample;
+}
+
+bool chatroom::backend::LoadSampler::ReadCpuTicks(uint64_t &ticks) {
+    std::ifstream ifs("/proc/self/stat");
+    std::string line;
+    if (!std::getline(ifs, line)) return false;
+    // 第2个字段（进程名）可能包含空格，从最后一个')'之后开始解析：state为第3个字段，utime、stime为第14、15个字段
+    auto pos = line.rfind(')');
+    if (pos == std::string::npos) return false;
+    std::istringstream iss(line.substr(pos + 1));
+    std::string field;
+    for (int i = 3; i <= 13; ++i) {
+        if (!(iss >> field)) return false;
+    }
+    uint64_t utime = 0;
+    uint64_t stime = 0;
+    if (!(iss >> utime >> stime)) return false;
+    ticks = utime + stime;
+    return true;
+}
+
+bool chatroom::backend::LoadSampler::ReadRssPages(uint64_t &pages) {
+    std::ifstream ifs("/proc/self/statm");
+    uint64_t size = 0;
+    return static_cast<bool>(ifs >> size >> pages);
+}
@@ -0,0 +1,80 @@
+#include "server/location_cache.hpp"
+
+namespace chatroom::backend {
+LocationCache::LocationCache(std::size_t capacity, std::chrono::milliseconds ttl)
+    : shards_(LOCATION_CACHE_SHARDS), shard_capacity_(capacity / LOCATION_CACHE_SHARDS), ttl_(ttl) {
+    if (shard_capacity_ == 0) shard_capacity_ = 1;
+}
+
+std::optional<std::string> LocationCache::Get(uint64_t uid) {
+    Shard &shard = ShardOf(uid);
+    std::unique_lock lock(shard.mtx);
+    auto it = shard.index.find(uid);
+    if (it == shard.index.end()) {
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return std::nullopt;
+    }
+    auto entry = it->second;
+    if (entry->expire <= Clock::now()) {
+        // 已过期，顺便删除
+        shard.lru.erase(entry);
+        shard.index.erase(it);
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return std::nullopt;
+    }
+    shard.lru.splice(shard.lru.begin(), shard.lru, entry);  // 移动到链表头部
+    hits_.fetch_add(1, std::memory_order_relaxed);
+    return entry->server_id;
+}
+
+void LocationCache::Put(uint64_t uid, const std::string &server_id) {
+    Shard &shard = ShardOf(uid);
+    Clock::time_point expire = Clock::now() + ttl_;
+    std::unique_lock lock(shard.mtx);
+    auto it = shard.index.find(uid);
+    if (it != shard.index.end()) {
+        it->second->server_id = server_id;
+        it->second->expire = expire;
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        return;
+    }
+    if (shard.index.size() >= shard_capacity_) {
+        // 淘汰最久未使用的条目
+        shard.index.erase(shard.lru.back().uid);
+        shard.lru.pop_back();
+        evictions_.fetch_add(1, std::memory_order_relaxed);
+    }
+    shard.lru.push_front({uid, server_id, expire});
+    shard.index.emplace(uid, shard.lru.begin());
+}
+
+bool LocationCache::Invalidate(uint64_t uid) {
+    Shard &shard = ShardOf(uid);
+    std::unique_lock lock(shard.mtx);
+    auto it = shard.index.find(uid);
+    if (it == shard.index.end()) {
+        return false;
+    }
+    shard.lru.erase(it->second);
+    shard.index.erase(it);
+    invalidations_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool LocationCache::InvalidateStale(uint64_t uid) {
+    bool existed = Invalidate(uid);
+    if (existed) {
+        stale_hits_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return existed;
+}
+
+std::size_t LocationCache::Size() {
+    std::size_t total = 0;
+    for (auto &shard : shards_) {
+        std::unique_lock lock(shard.mtx);
+        total += shard.index.size();
+    }
+    return total;
+}
+}  // namespace chatroom::backend
@@ -1,76 +1,483 @@
 #include "server/mq_handler.hpp"
 
+#include <sw/redis++/errors.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "common/mq_envelope.hpp"
 #include "log/log_manager.hpp"
 
 namespace chatroom::backend {
+constexpr std::string_view MQ_CONSUMER_ID = "0";  // 消费者组中本服务器使用的消费者名称后缀
+const std::string ENVELOPE_FIELD(MQ_ENVELOPE_FIELD);
+
 void MQHandler::WorkerFn() {
+    if (ack_) {
+        RecoverPending();
+    }
     unordered_map<std::string, RedisMgr::ItemStream> stms;
-    std::string mq_key = "stream:server:";
-    mq_key += server_id_;
-    std::string mq2_key = "stream:serverctl:";
-    mq2_key += server_id_;
+    uint32_t recv_count = MQ_MIN_RECV_COUNT;
     while (running_) {
-        // stms[mq_key].clear();
+        if (retry_ && std::chrono::steady_clock::now() >= retry_at_) {
+            // 之前未能投递的条目仍在待确认列表中，重新认领并处理
+            retry_ = false;
+            RecoverPending();
+        }
         stms.clear();
         try {
-            redis_->RecvFromMsgQueueNoACK(server_id_, "0", stms, 2000);
+            // 两个队列都为空时在服务端阻塞，最多MQ_BLOCK_MS后返回以检查running_
+            if (ack_) {
+                redis_->RecvFromMsgQueue(server_id_, MQ_CONSUMER_ID, stms, MQ_BLOCK_MS, recv_count);
+            } else {
+                redis_->RecvFromMsgQueueNoACK(server_id_, MQ_CONSUMER_ID, stms, MQ_BLOCK_MS, recv_count);
+            }
         } catch (const sw::redis::TimeoutError &te) {
             continue;  // timeout
+        } catch (const sw::redis::Error &e) {
+            spdlog::error("MQHandler: Failed to read from message queue: {}", e.what());
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));  // Redis不可用时避免空转
+            continue;
         }
-        if (stms.empty()) continue;
+        reads_.fetch_add(1, std::memory_order_relaxed);
+        if (stms.empty()) {
+            idle_reads_.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        std::size_t max_received = 0;
+        std::size_t offline = 0;
         for (auto &stm : stms) {
-            if (stm.first == mq_key) {
-                for (auto &item : stm.second) {
-                    MessageHandler(item);
-                }
-            } else if (stm.first == mq2_key) {
-                for (auto &item : stm.second) {
-                    CtrlMsgHandler(item);
-                }
-            } else {
-                spdlog::warn("Unknown message queue: {}", stm.first);
+            max_received = std::max(max_received, stm.second.size());
+            offline += StreamHandler(stm.first, stm.second);
+            uint64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                  std::chrono::system_clock::now().time_since_epoch())
+                                  .count();
+            for (auto &item : stm.second) {
+                RecordLatency(item.first, now_ms);
             }
+            entries_.fetch_add(stm.second.size(), std::memory_order_relaxed);
         }
+        if (ack_) {
+            AckEntries(stms, offline > 0);
+        }
+        // COUNT对每个队列分别生效，以积压最多的队列为准
+        recv_count = NextRecvCount(recv_count, max_received);
+        recv_count_.store(recv_count, std::memory_order_relaxed);
     }
 }
 
-// type = {"kick", ...}
-void MQHandler::CtrlMsgHandler(RedisMgr::Item &item) {
-    if (!item.second.has_value()) return;
-    auto &msg = item.second.value();
-    std::string_view type = msg.at("type");
-    if (type == "kick") {
-        uint64_t uid = std::stoull(msg.at("uid"));
-        spdlog::info("Kicking user {} from server {}", uid, server_id_);
-        auto sess = sess_->GetSession(uid);
-        if (sess) {
-            sess->Close();  // 关闭会话
-        } else {
-            spdlog::warn("Kick command can't find user with uid {}", uid);
+std::size_t MQHandler::StreamHandler(const std::string &mq_key, RedisMgr::ItemStream &items) {
+    if (mq_key == mq_key_) {
+        return MessageBatchHandler(items);
+    }
+    if (mq_key == ctl_key_) {
+        for (auto &item : items) {
+            CtrlMsgHandler(item);
         }
     } else {
-        spdlog::warn("Unknown control message type: {}", type);
+        spdlog::warn("Unknown message queue: {}", mq_key);
+    }
+    return 0;
+}
+
+void MQHandler::AckEntries(const std::unordered_map<std::string, RedisMgr::ItemStream> &stms, bool flush_offline) {
+    if (flush_offline && !offline_->Flush()) {
+        // 写入离线存储的消息丢失了，这一批条目都不确认，稍后重新处理（其中已经投递的消息会重复）
+        spdlog::error("MQHandler: Offline store commit failed, entries left unacknowledged");
+        retry_ = true;
+        retry_at_ = std::chrono::steady_clock::now() + MQ_RETRY_INTERVAL;
+        return;
+    }
+    std::unordered_map<std::string, std::vector<std::string>> ids;
+    std::size_t count = 0;
+    for (const auto &[mq_key, items] : stms) {
+        auto &mq_ids = ids[mq_key];
+        mq_ids.reserve(items.size());
+        for (const auto &item : items) {
+            mq_ids.push_back(item.first);
+        }
+        count += items.size();
+    }
+    if (count == 0) return;
+    try {
+        redis_->AckMsgQueue(server_id_, ids);
+        acked_.fetch_add(count, std::memory_order_relaxed);
+    } catch (const sw::redis::Error &e) {
+        // 这些条目留在待确认列表中，下次启动时会被重新处理
+        spdlog::error("MQHandler: Failed to acknowledge {} entries: {}", count, e.what());
+    }
+}
+
+void MQHandler::RecoverPending() {
+    unordered_map<std::string, RedisMgr::ItemStream> claimed;
+    std::size_t recovered = 0;
+    for (const std::string &mq_key : {mq_key_, ctl_key_}) {
+        std::string cursor = "0-0";
+        do {
+            claimed.clear();
+            auto &items = claimed[mq_key];
+            try {
+                cursor = redis_->ClaimPendingMsgs(mq_key, server_id_, MQ_CONSUMER_ID, cursor, MQ_CLAIM_COUNT, items);
+            } catch (const sw::redis::Error &e) {
+                // 剩余的条目留在待确认列表中，下次启动时再处理
+                spdlog::error("MQHandler: Failed to claim pending entries of {}: {}", mq_key, e.what());
+                break;
+            }
+            recovered += items.size();
+            std::size_t offline = StreamHandler(mq_key, items);
+            AckEntries(claimed, offline > 0);
+        } while (cursor != "0-0" && running_);
+    }
+    recovered_.fetch_add(recovered, std::memory_order_relaxed);
+    if (recovered > 0) {
+        spdlog::info("MQHandler: Recovered {} unacknowledged entries", recovered);
+    }
+}
+
+void MQHandler::RecordLatency(std::string_view id, uint64_t now_ms) {
+    auto ms = StreamIdMillis(id);
+    if (!ms.has_value()) return;
+    // 条目ID使用Redis服务器的时钟，两者不同步时可能为负数
+    uint64_t latency = now_ms > ms.value() ? now_ms - ms.value() : 0;
+    latency_ms_sum_.fetch_add(latency, std::memory_order_relaxed);
+    if (latency > latency_ms_max_.load(std::memory_order_relaxed)) {
+        latency_ms_max_.store(latency, std::memory_order_relaxed);  // 只有工作线程写入
     }
 }
 
-void MQHandler::MessageHandler(RedisMgr::Item &item) {
+MQConsumerStats MQHandler::GetStats() const {
+    return {reads_.load(std::memory_order_relaxed),          idle_reads_.load(std::memory_order_relaxed),
+            entries_.load(std::memory_order_relaxed),        latency_ms_sum_.load(std::memory_order_relaxed),
+            latency_ms_max_.load(std::memory_order_relaxed), recv_count_.load(std::memory_order_relaxed),
+            acked_.load(std::memory_order_relaxed),          recovered_.load(std::memory_order_relaxed)};
+}
+
+// 控制消息：二进制编码（"e"字段），或者旧格式的type = {"kick", "locinv", "grpinv"}
+void MQHandler::CtrlMsgHandler(RedisMgr::Item &item) {
     if (!item.second.has_value()) return;
     auto &msg = item.second.value();
-    uint64_t from = std::stoull(msg.at("from"));
-    uint64_t to = std::stoull(msg.at("to"));
-    std::string_view content = msg.at("content");
-    // HEAD_LEN | FROM_UID | CONTENT
-    auto sending = std::make_shared<MsgNode>(HEAD_LEN + sizeof(uint64_t) + content.size());
-    WriteNetField64(sending->GetContent(), from);
-    std::memcpy(sending->GetContent() + sizeof(uint64_t), content.data(), content.size());
-    sending->SetTagField(CHAT_MSG_TOCLI);
-    sending->SetContentLenField(sizeof(uint64_t) + content.size());
-    auto sess = sess_->GetSession(to);
-    if (sess) {
-        spdlog::debug("MQHandler: Sending msg from {} to {}", from, to);
-        sess->Send(std::move(sending));
+    EnvelopeType type;
+    uint64_t id;
+    if (auto e = msg.find(ENVELOPE_FIELD); e != msg.end()) {
+        auto env = DecodeEnvelope(e->second);
+        if (!env.has_value()) {
+            spdlog::error("MQHandler: Undecodable control message {}", item.first);
+            return;
+        }
+        type = env->type;
+        id = env->to;
     } else {
-        spdlog::error("MQHandler: User {} not on local server, message dropped", to);
+        try {
+            std::string_view legacy_type = msg.at("type");
+            if (legacy_type == "kick") {
+                type = EnvelopeType::KICK;
+            } else if (legacy_type == "locinv") {
+                type = EnvelopeType::LOC_INVALIDATE;
+            } else if (legacy_type == "grpinv") {
+                type = EnvelopeType::GROUP_INVALIDATE;
+            } else {
+                spdlog::warn("Unknown control message type: {}", legacy_type);
+                return;
+            }
+            id = std::stoull(msg.at(type == EnvelopeType::GROUP_INVALIDATE ? "gid" : "uid"));
+        } catch (const std::logic_error &e) {
+            spdlog::error("MQHandler: Malformed control message {}: {}", item.first, e.what());
+            return;
+        }
+    }
+
+    switch (type) {
+        case EnvelopeType::KICK: {
+            spdlog::info("Kicking user {} from server {}", id, server_id_);
+            auto sess = sess_->GetSession(id);
+            if (sess) {
+                sess->Close();  // 关闭会话
+            } else {
+                spdlog::warn("Kick command can't find user with uid {}", id);
+            }
+            break;
+        }
+        case EnvelopeType::LOC_INVALIDATE:
+            // 其他服务器告知：我们发给它的某个用户已经不在它那里了
+            spdlog::debug("Location of user {} invalidated by peer server", id);
+            loc_cache_->InvalidateStale(id);
+            break;
+        case EnvelopeType::GROUP_INVALIDATE:
+            // 群成员发生了变化
+            spdlog::debug("Members of group {} invalidated", id);
+            group_index_->Invalidate(id);
+            break;
+        default:
+            spdlog::warn("Unexpected control message type: {}", static_cast<int>(type));
+            break;
+    }
+}
+
+std::size_t MQHandler::MessageBatchHandler(RedisMgr::ItemStream &items) {
+    std::vector<Delivery> deliveries;
+    std::vector<uint64_t> uids;
+    std::vector<RelayRecord> records;
+    deliveries.reserve(items.size());
+    uids.reserve(items.size());
+
+    // 解析所有条目，收集接收者
+    for (std::size_t k = 0; k < items.size(); ++k) {
+        auto &item = items[k];
+        if (!item.second.has_value()) continue;
+        auto &msg = item.second.value();
+        if (auto e = msg.find(ENVELOPE_FIELD); e != msg.end()) {
+            auto env = DecodeEnvelope(e->second);
+            if (!env.has_value() || (env->type != EnvelopeType::CHAT && env->type != EnvelopeType::GROUP_CHAT)) {
+                spdlog::error("MQHandler: Undecodable message {}", item.first);
+                continue;
+            }
+            Delivery d{k, env->origin, env->from, std::nullopt, env->content, uids.size(), 0};
+            if (env->type == EnvelopeType::GROUP_CHAT) {
+                d.gid = env->to;
+                UnpackUidList(env->recipients, uids);
+            } else {
+                uids.push_back(env->to);
+            }
+            d.count = uids.size() - d.first;
+            deliveries.push_back(d);
+            continue;
+        }
+        std::string_view srv;
+        if (auto it = msg.find("srv"); it != msg.end()) {
+            srv = it->second;
+        }
+        auto pack = msg.find("pack");
+        if (pack != msg.end()) {
+            // 发送方打包在同一个条目中的一批消息（见OutboundRelay）
+            records.clear();
+            if (!UnpackRelayBatch(pack->second, records)) {
+                spdlog::error("MQHandler: Malformed packed message {}", item.first);
+            }
+            AppendRelayRecords(k, srv, records, deliveries, uids);
+            continue;
+        }
+        // 旧格式：from, to/gid + to_list, content分别存放在各自的字段中
+        std::size_t first = uids.size();
+        try {
+            Delivery d{k, srv, std::stoull(msg.at("from")), std::nullopt, msg.at("content"), first, 0};
+            auto gid = msg.find("gid");
+            if (gid != msg.end()) {
+                d.gid = std::stoull(gid->second);
+                if (!UnpackUidList(msg.at("to_list"), uids)) {
+                    spdlog::error("MQHandler: Invalid recipient list in group {} message", d.gid.value());
+                    continue;
+                }
+            } else {
+                uids.push_back(std::stoull(msg.at("to")));
+            }
+            d.count = uids.size() - first;
+            deliveries.push_back(d);
+        } catch (const std::logic_error &e) {
+            // 缺少字段或者字段无法解析
+            spdlog::error("MQHandler: Malformed message {}: {}", item.first, e.what());
+            uids.resize(first);
+        }
+    }
+    if (!ack_) {
+        return Deliver(deliveries, uids, nullptr);
+    }
+    std::vector<std::size_t> failed;
+    std::size_t offline = Deliver(deliveries, uids, &failed);
+    if (!failed.empty()) {
+        // 未能投递的条目不确认，留在待确认列表中稍后重新处理；条目中已经投递的接收者会再收到一次（至少一次）
+        std::vector<bool> keep(items.size(), true);
+        for (std::size_t k : failed) {
+            keep[deliveries[k].entry] = false;
+        }
+        std::size_t n = 0;
+        for (std::size_t k = 0; k < items.size(); ++k) {
+            if (keep[k]) {
+                if (n != k) items[n] = std::move(items[k]);
+                ++n;
+            }
+        }
+        spdlog::warn("MQHandler: {} entries could not be delivered, retrying in {}s", items.size() - n,
+                     MQ_RETRY_INTERVAL.count());
+        items.resize(n);
+        retry_ = true;
+        retry_at_ = std::chrono::steady_clock::now() + MQ_RETRY_INTERVAL;
+    }
+    return offline;
+}
+
+void MQHandler::DeliverPacked(const std::string &origin, std::string_view packed) {
+    std::vector<RelayRecord> records;
+    if (!UnpackRelayBatch(packed, records)) {
+        spdlog::error("MQHandler: Malformed relay frame from server {}", origin);
+    }
+    std::vector<Delivery> deliveries;
+    std::vector<uint64_t> uids;
+    deliveries.reserve(records.size());
+    uids.reserve(records.size());
+    AppendRelayRecords(0, origin, records, deliveries, uids);
+    // 在IO线程上调用，不等待转发完成，未能投递的消息重新写入本服务器的队列
+    Deliver(deliveries, uids, nullptr);
+}
+
+void MQHandler::AppendRelayRecords(std::size_t entry, std::string_view srv, const std::vector<RelayRecord> &records,
+                                   std::vector<Delivery> &deliveries, std::vector<uint64_t> &uids) {
+    for (const auto &rec : records) {
+        Delivery d{entry, srv, rec.from, std::nullopt, rec.content, uids.size(), 0};
+        if (rec.IsGroup()) {
+            d.gid = rec.target;
+            UnpackUidList(rec.recipients, uids);
+        } else {
+            uids.push_back(rec.target);
+        }
+        d.count = uids.size() - d.first;
+        deliveries.push_back(d);
+    }
+}
+
+std::size_t MQHandler::Deliver(const std::vector<Delivery> &deliveries, const std::vector<uint64_t> &uids,
+                               std::vector<std::size_t> *failed) {
+    // 一次性查找这一批所有接收者的Session
+    std::vector<std::shared_ptr<Session>> sessions;
+    sess_->LookupSessions(uids, sessions);
+
+    // 按顺序投递，每条消息只构造一个报文，由它的所有本地接收者共享
+    std::vector<std::shared_ptr<MsgNode>> frames(deliveries.size());
+    std::vector<Miss> misses;
+    std::vector<std::pair<std::string_view, uint64_t>> stale;
+    for (std::size_t k = 0; k < deliveries.size(); ++k) {
+        const Delivery &d = deliveries[k];
+        // 内容直接拷贝到发送给客户端的报文中，头部已就位
+        frames[k] = d.gid.has_value() ? MakeGroupToClientFrame(d.gid.value(), d.from, d.content)
+                                      : MakeChatToClientFrame(d.from, d.content);
+        for (std::size_t i = d.first; i < d.first + d.count; ++i) {
+            if (sessions[i]) {
+                sessions[i]->Send(frames[k]);
+            } else {
+                misses.push_back({k, uids[i]});
+                // 发送方使用了过时的用户位置，通知其使缓存失效
+                stale.emplace_back(d.srv, uids[i]);
+            }
+        }
+    }
+    if (misses.empty()) {
+        return 0;
+    }
+    NotifyStaleLocations(stale);
+    return Reroute(deliveries, frames, misses, failed);
+}
+
+std::size_t MQHandler::Reroute(const std::vector<Delivery> &deliveries,
+                               const std::vector<std::shared_ptr<MsgNode>> &frames, const std::vector<Miss> &misses,
+                               std::vector<std::size_t> *failed) {
+    std::vector<uint64_t> uids;
+    uids.reserve(misses.size());
+    for (const auto &miss : misses) {
+        uids.push_back(miss.uid);
+    }
+    std::vector<std::optional<std::string>> sids;
+    bool requeue = false;  // 查询失败且不等待时，全部重新写入本服务器的队列，由之后的处理重新查询
+    try {
+        redis_->GetUserLocations(uids, sids);
+    } catch (const sw::redis::Error &e) {
+        // 查询失败不代表接收者不在线，不能存入本服务器的离线存储
+        spdlog::error("MQHandler: Failed to look up {} moved recipients: {}", uids.size(), e.what());
+        if (failed != nullptr) {
+            for (const auto &miss : misses) {
+                failed->push_back(miss.delivery);
+            }
+            return 0;
+        }
+        requeue = true;
+    }
+
+    // 转发给同一个服务器的同一条群聊消息的接收者合并为一条
+    struct Forward {
+        std::size_t delivery;
+        std::string sid;
+        std::vector<uint64_t> to;
+    };
+    std::vector<Forward> forwards;
+    std::size_t offline = 0;
+    for (std::size_t i = 0; i < misses.size(); ++i) {
+        const Miss &miss = misses[i];
+        if (!requeue && (!sids[i].has_value() || sids[i].value() == server_id_)) {
+            spdlog::debug("MQHandler: User {} is offline, message stored offline", miss.uid);
+            offline_->Append(miss.uid, *frames[miss.delivery]);
+            ++offline;
+            continue;
+        }
+        const std::string &sid = requeue ? server_id_ : sids[i].value();
+        if (!forwards.empty() && forwards.back().delivery == miss.delivery && forwards.back().sid == sid &&
+            deliveries[miss.delivery].gid.has_value()) {
+            forwards.back().to.push_back(miss.uid);
+        } else {
+            forwards.push_back({miss.delivery, sid, {miss.uid}});
+        }
+    }
+    if (forwards.empty()) {
+        return offline;
+    }
+
+    // 等待时记录每个转发是否成功；不等待时转发失败的消息只能丢弃（OutboundRelay已经回退到了消息队列）
+    struct Pending {
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::size_t remaining{0};
+        std::vector<bool> ok;
+    };
+    auto pending = std::make_shared<Pending>();
+    pending->remaining = forwards.size();
+    pending->ok.assign(forwards.size(), false);
+    bool waiting = failed != nullptr;
+    for (std::size_t j = 0; j < forwards.size(); ++j) {
+        const Forward &fwd = forwards[j];
+        const Delivery &d = deliveries[fwd.delivery];
+        spdlog::debug("MQHandler: Forwarding message for {} moved users to server {}", fwd.to.size(), fwd.sid);
+        auto on_done = [pending, j, waiting, count = fwd.to.size(), sid = fwd.sid](bool ok) {
+            if (!ok && !waiting) {
+                spdlog::error("MQHandler: Failed to forward message for {} users to server {}, dropped", count, sid);
+            }
+            std::unique_lock lock(pending->mtx);
+            pending->ok[j] = ok;
+            if (--pending->remaining == 0) {
+                pending->cv.notify_all();
+            }
+        };
+        if (d.gid.has_value()) {
+            relay_->SendGroup(fwd.sid, d.gid.value(), d.from, fwd.to, d.content, std::move(on_done));
+        } else {
+            relay_->Send(fwd.sid, d.from, fwd.to.front(), d.content, std::move(on_done));
+        }
+    }
+    if (waiting) {
+        // 链路或者Redis卡住时不能让工作线程一直等待，超时的转发视为失败，其条目稍后重新处理（可能重复投递）
+        std::unique_lock lock(pending->mtx);
+        if (!pending->cv.wait_for(lock, MQ_FORWARD_TIMEOUT, [&pending] { return pending->remaining == 0; })) {
+            spdlog::warn("MQHandler: {} of {} forwards timed out", pending->remaining, forwards.size());
+        }
+        for (std::size_t j = 0; j < forwards.size(); ++j) {
+            if (!pending->ok[j]) {
+                failed->push_back(forwards[j].delivery);
+            }
+        }
+    }
+    return offline;
+}
+
+void MQHandler::NotifyStaleLocations(const std::vector<std::pair<std::string_view, uint64_t>> &stale) {
+    std::vector<std::pair<std::string_view, uint64_t>> notices;
+    notices.reserve(stale.size());
+    for (const auto &[srv, uid] : stale) {
+        if (!srv.empty() && srv != server_id_) {
+            notices.emplace_back(srv, uid);
+        }
+    }
+    try {
+        redis_->SendLocationInvalidates(notices);
+    } catch (const sw::redis::Error &e) {
+        spdlog::error("MQHandler: Failed to send {} location invalidations: {}", notices.size(), e.what());
     }
 }
 
@@ -1,6 +1,7 @@
 #include "server/msg_handler.hpp"
 
 #include <jsoncpp/json/json.h>
+#include <sw/redis++/errors.h>
 
 #include <string_view>
 
@@ -8,55 +9,31 @@
 #include "utils/field_op.hpp"
 
 bool chatroom::backend::MsgHandler::PostMessage(CbSessType sess, RcvdMsgType msg) {
-    std::unique_lock lock(lck_);
-    q_.emplace(std::move(sess), std::move(msg));
-    if (q_.size() == 1) {
-        lock.unlock();
-        cv_.notify_one();
-    }
-    return true;
+    uint64_t key = RouteKey(sess);
+    return exec_.Post(key, {std::move(sess), std::move(msg)});
 }
 
-bool chatroom::backend::MsgHandler::Start() {
-    std::unique_lock lock(lck_);
-    if (running_) {
-        return false;
+bool chatroom::backend::MsgHandler::PostMessages(const CbSessType &sess, std::vector<RcvdMsgType> &&msgs) {
+    std::vector<MsgItem> items;
+    items.reserve(msgs.size());
+    for (auto &msg : msgs) {
+        items.emplace_back(sess, std::move(msg));
     }
-    running_ = true;
-    worker_ = std::thread([this] { this->Worker(); });
-    return true;
+    return exec_.PostBatch(RouteKey(sess), std::move(items));
 }
 
-bool chatroom::backend::MsgHandler::Stop() {
-    std::unique_lock lock(lck_);
-    if (!running_) {
-        return false;
-    }
-    running_ = false;
-    lock.unlock();  // *********** EXIT CRITICAL **********
-    cv_.notify_all();
-
-    worker_.join();
-    spdlog::info("MsgHandler worker thread exited");
-    // worker_ = std::thread(); // MsgHandler没有重复使用的需求
-    lock.lock();
-    return true;
+bool chatroom::backend::MsgHandler::Start() {
+    spdlog::info("MsgHandler starting with {} shards", exec_.ShardCount());
+    return exec_.Start();
 }
 
-void chatroom::backend::MsgHandler::Worker() {
-    std::unique_lock lock(lck_);
-    while (running_) {
-        while (running_ && q_.empty()) {
-            cv_.wait(lock);
-        }
-        if (!running_) {
-            break;  // 这里会放弃掉剩余的未处理消息
-        }
-        auto item = std::move(q_.front());
-        q_.pop();
-        // 具体的处理过程
-        Processor(std::move(item.first), std::move(item.second));
+bool chatroom::backend::MsgHandler::Stop() {
+    bool ret = exec_.Stop();
+    if (ret) {
+        MpscQueueStats st = exec_.GetQueueStats();
+        spdlog::info("MsgHandler worker threads exited, queue depth: {}, high water: {}", st.depth, st.high_water);
     }
+    return ret;
 }
 
 // TODO(user): unfinished
@@ -69,6 +46,7 @@ void chatroom::backend::MsgHandler::Processor(CbSessType &&sess, RcvdMsgType &&m
     if (!msg) {
         if (sess->IsVerified()) {
             spdlog::info("Session {} closed", sess->GetUserId());
+            loc_cache_->Invalidate(sess->GetUserId());
             // 将用户设置为非在线状态并立即更新
             status_uploader_->RemoveSession(sess->GetUserId());
             status_uploader_->UpdateNow();
@@ -77,7 +55,10 @@ void chatroom::backend::MsgHandler::Processor(CbSessType &&sess, RcvdMsgType &&m
     }
 
     uint32_t msg_type = msg->GetTagField();
-    status_uploader_->AddSession(sess->GetUserId());  // 收到了用户发送的消息，我们更新其在线状态
+    if (sess->IsVerified()) {
+        // 收到了用户发送的消息，我们更新其在线状态（验证前的uid无意义，VERIFY本身会写入在线状态）
+        status_uploader_->AddSession(sess->GetUserId(), sess->PresenceEpoch());
+    }
     switch (msg_type) {
         case DEBUG: {
             // spdlog::debug(std::string(msg->GetContent(), msg->GetContentLen()));
@@ -94,7 +75,7 @@ void chatroom::backend::MsgHandler::Processor(CbSessType &&sess, RcvdMsgType &&m
             Json::Reader reader;
             std::string token;
             uint64_t uid;
-            if (!reader.parse(msg->GetContent(), root)) {
+            if (!reader.parse(msg->GetContent(), msg->GetContent() + msg->GetContentLen(), root)) {
                 // 无效的验证请求，其无法被解析为JSON
                 spdlog::error("Invalid verify message");
                 sess->Close();  // 关闭会话
@@ -110,8 +91,8 @@ void chatroom::backend::MsgHandler::Processor(CbSessType &&sess, RcvdMsgType &&m
                 sess_mgr_->RemoveTempSession(sess.get());
                 return;
             }
-            // 验证过程
-            std::optional<uint64_t> ans_uid = redis_->VerifyUser(token);
+            // 验证过程：验证结果决定了后续消息能否被处理，因此这里等待其完成；等待期间该请求与其他分片的请求被打包在一起发送
+            std::optional<uint64_t> ans_uid = async_redis_->VerifyUser(uid, token).get();
             if (!ans_uid.has_value() || ans_uid != uid) {
                 // 错误或过期的token
                 spdlog::error("User attempt to verify with wrong/expired token");
@@ -122,8 +103,19 @@ void chatroom::backend::MsgHandler::Processor(CbSessType &&sess, RcvdMsgType &&m
             // 否则验证成功
             sess->SetVerified(uid);
             sess_mgr_->AddSession(uid, sess);
-            redis_->UpdateUserStatus(server_id_, uid);
+            loc_cache_->Invalidate(uid);  // 用户现在位于本服务器，之前缓存的位置已经过时
+            async_redis_->UpdateUserStatus(uid, server_id_, uid, status_uploader_->LeaseEpoch(), [uid](bool ok) {
+                if (!ok) spdlog::warn("Failed to update online status of user {}", uid);
+            });
             sess->Send("Welcome to the chatroom!", VERIFY_DONE);
+            // 把离线期间收到的消息作为一批报文发送给用户，报文直接指向离线存储的映射区域
+            // 取走由离线存储的写线程在提交之后完成，分片不等待fdatasync
+            offline_->DrainAsync(uid, [sess, uid](std::vector<std::shared_ptr<MsgNode>> offline_msgs) {
+                if (!offline_msgs.empty()) {
+                    spdlog::debug("Delivering {} offline messages to user {}", offline_msgs.size(), uid);
+                    sess->Send(std::move(offline_msgs));
+                }
+            });
         } break;
         case CHAT_MSG: {
             spdlog::debug("Chat message received");
@@ -131,24 +123,52 @@ void chatroom::backend::MsgHandler::Processor(CbSessType &&sess, RcvdMsgType &&m
                 // 未验证的用户无法发送消息
                 return;
             }
+            if (msg->GetContentLen() < sizeof(uint64_t)) {
+                // 报文直接指向接收环形缓冲区，过短的报文读写目标UID会越过报文的边界
+                spdlog::warn("Invalid chat message from user {}", sess->GetUserId());
+                return;
+            }
             uint64_t target_uid = ReadNetField64(msg->GetContent());
             auto target_sess = sess_mgr_->GetSession(target_uid);
             if (!target_sess) {
                 // 用户未在本服务器上登陆，要么其在其他服务器上、要么其不在线、甚至可能是不存在的用户ID，最复杂的场景
                 spdlog::debug("MsgHandler received a non-local user chat");
-                // 首先根据UID查询用户在线状态（查Redis）
-                auto sid = redis_->GetUserLocation(target_uid);
-                if (sid.has_value()) {
-                    spdlog::debug("Sending message to server {}", sid.value());
-                    // 通过消息队列（Redis Stream）发送给对方服务器
-                    auto ret = redis_->SendToMsgQueue(sid.value(), sess->GetUserId(), target_uid,
-                                                      std::string_view(msg->GetContent() + sizeof(uint64_t),
-                                                                       msg->GetContent() + msg->GetContentLen()));
-                    spdlog::debug("Message sent with return value: {}", ret);
-                } else {
-                    // 用户不在线，需要进一步查询（可能需要查MySQL数据库来确定用户是否存在）
-                    spdlog::debug("TODO: Finish the logic for offline user!");
+                uint64_t from_uid = sess->GetUserId();
+                if (auto sid = loc_cache_->Get(target_uid)) {
+                    if (!HasPendingRelay(from_uid)) {
+                        RelayChatMsg(sid.value(), from_uid, target_uid, msg);
+                    } else {
+                        // 该发送者之前的消息还在等待位置查询，这条消息排在它们之后由AsyncRedis的工作线程发出
+                        AddPendingRelay(from_uid);
+                        async_redis_->Post(from_uid, [this, sid = std::move(sid.value()), from_uid, target_uid,
+                                                      msg = std::move(msg)] {
+                            RelayChatMsg(sid, from_uid, target_uid, msg);
+                            DonePendingRelay(from_uid);
+                        });
+                    }
+                    break;
                 }
+                // 缓存未命中，根据UID查询用户在线状态（查Redis）
+                // 查询和发送都是异步的，以发送者UID为路由key保证同一发送者的消息顺序
+                auto on_location = [this, from_uid, target_uid, msg = std::move(msg)](LocationResult loc) {
+                    const std::optional<std::string> &sid = loc.sid;
+                    if (!loc.ok) {
+                        // 查询失败不代表用户不在线，不能存入本服务器的离线收件箱
+                        spdlog::error("Failed to look up location of user {}, message from user {} dropped",
+                                      target_uid, from_uid);
+                    } else if (!sid.has_value() || sid.value() == server_id_) {
+                        // 用户不在线，或者其状态仍指向本服务器但已经不在本地（刚刚断开），存入其离线收件箱，
+                        // 待其下次在本服务器上验证时发送；指向本服务器的位置不写入缓存
+                        StoreOfflineChatMsg(from_uid, target_uid, msg);
+                    } else {
+                        RelayChatMsg(sid.value(), from_uid, target_uid, msg);
+                        loc_cache_->Put(target_uid, sid.value());
+                    }
+                    // 发出之后才计数减一：之后在分片上直接发出的消息一定排在这条消息之后
+                    DonePendingRelay(from_uid);
+                };
+                AddPendingRelay(from_uid);
+                async_redis_->GetUserLocation(from_uid, target_uid, std::move(on_location));
             } else {
                 spdlog::debug("MsgHandler received a local user chat");
                 // 将消息传给对应用户即可，不需要拷贝
@@ -161,14 +181,19 @@ void chatroom::backend::MsgHandler::Processor(CbSessType &&sess, RcvdMsgType &&m
             }
         } break;
         case GROUP_CHAT_MSG: {
-            // TODO(user): 完成群聊功能
             spdlog::debug("GroupChat message received");
             if (!sess->IsVerified()) {
                 // 未验证的用户无法发送消息
                 return;
             }
-            // uint64_t target_group;
-            return;
+            if (msg->GetContentLen() < sizeof(uint64_t)) {
+                spdlog::warn("Invalid group chat message from user {}", sess->GetUserId());
+                return;
+            }
+            uint64_t target_group = ReadNetField64(msg->GetContent());
+            FanOutGroupMsg(sess, target_group,
+                           std::string_view(msg->GetContent() + sizeof(uint64_t),
+                                            msg->GetContentLen() - sizeof(uint64_t)));
         } break;
         case PING: {
             // do nothing
@@ -178,4 +203,189 @@ void chatroom::backend::MsgHandler::Processor(CbSessType &&sess, RcvdMsgType &&m
             return;  // 不知道如何处理
         }
     }
-}
\ No newline at end of file
+}
+
+void chatroom::backend::MsgHandler::AddPendingRelay(uint64_t from_uid) {
+    std::unique_lock lock(pending_mtx_);
+    ++pending_relays_[from_uid];
+    pending_total_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void chatroom::backend::MsgHandler::DonePendingRelay(uint64_t from_uid) {
+    std::unique_lock lock(pending_mtx_);
+    auto it = pending_relays_.find(from_uid);
+    if (it != pending_relays_.end() && --it->second == 0) {
+        pending_relays_.erase(it);
+    }
+    pending_total_.fetch_sub(1, std::memory_order_release);
+}
+
+bool chatroom::backend::MsgHandler::HasPendingRelay(uint64_t from_uid) {
+    if (pending_total_.load(std::memory_order_acquire) == 0) {
+        return false;
+    }
+    std::unique_lock lock(pending_mtx_);
+    return pending_relays_.contains(from_uid);
+}
+
+void chatroom::backend::MsgHandler::RelayChatMsg(const std::string &sid, uint64_t from_uid, uint64_t target_uid,
+                                                 const RcvdMsgType &msg) {
+    spdlog::debug("Sending message to server {}", sid);
+    // 通过消息队列（Redis Stream）发送给对方服务器，发往同一服务器的消息在发送阶段被合并为一批
+    LocationCache *loc_cache = loc_cache_.get();
+    relay_->Send(
+        sid, from_uid, target_uid,
+        std::string_view(msg->GetContent() + sizeof(uint64_t), msg->GetContent() + msg->GetContentLen()),
+        [loc_cache, target_uid](bool ok) {
+            if (!ok) {
+                spdlog::warn("Failed to relay message to user {}", target_uid);
+                loc_cache->Invalidate(target_uid);
+            }
+        });
+}
+
+void chatroom::backend::MsgHandler::StoreOfflineChatMsg(uint64_t from_uid, uint64_t target_uid,
+                                                        const RcvdMsgType &msg) {
+    // [to_uid][content] -> [from_uid][content]，与发给在线用户的报文相同
+    msg->SetTagField(CHAT_MSG_TOCLI);
+    WriteNetField64(msg->GetContent(), from_uid);
+    if (!offline_->Append(target_uid, *msg)) {
+        spdlog::error("Failed to store offline message for user {}", target_uid);
+    }
+}
+
+void chatroom::backend::MsgHandler::FanOutGroupMsg(const CbSessType &sess, uint64_t gid, std::string_view content) {
+    uint64_t from_uid = sess->GetUserId();
+    // 所有接收者共享同一个报文，报文中的内容也被之后的步骤使用，不再引用客户端的消息
+    auto frame = BuildGroupFrame(gid, from_uid, content);
+    GroupMembersPtr members = group_index_->Find(gid);
+    if (!members) {
+        // 群成员未缓存：在一个命令中加载群成员和所有成员的位置，之后的步骤在回调中完成
+        AddPendingRelay(from_uid);
+        async_redis_->GetGroupLocations(
+            from_uid, gid,
+            [this, gid, from_uid, frame](std::optional<std::vector<std::pair<uint64_t, std::string>>> loaded) {
+                FanOutLoadedGroupMsg(gid, from_uid, frame, std::move(loaded));
+                DonePendingRelay(from_uid);
+            });
+        return;
+    }
+    if (!GroupIndex::IsMember(*members, from_uid)) {
+        spdlog::warn("User {} is not a member of group {}", from_uid, gid);
+        return;
+    }
+
+    // 本地成员：批量查找；远程成员：按所在服务器分组
+    std::vector<std::shared_ptr<Session>> local;
+    std::vector<uint64_t> others;
+    sess_mgr_->GetSessions(*members, local, &others);
+    std::erase(others, from_uid);
+    std::unordered_map<std::string, std::vector<uint64_t>> remote;
+    std::vector<uint64_t> unresolved;
+    GroupByServer(others, *loc_cache_, server_id_, remote, unresolved);
+    if (unresolved.empty() && !HasPendingRelay(from_uid)) {
+        SendGroupMsg(gid, from_uid, frame, local, remote, {});
+        return;
+    }
+
+    // 位置缓存未命中的成员在同一个Pipeline中批量查询；查询与该发送者之前等待Redis回复的消息使用同一个key，
+    // 发送在回调中完成，因此同一发送者的群聊消息按顺序到达（unresolved为空时回调只是排在之前的消息之后）
+    AddPendingRelay(from_uid);
+    auto on_locations = [this, gid, from_uid, frame, local = std::move(local), remote = std::move(remote),
+                         unresolved](std::vector<LocationResult> locs) mutable {
+        std::vector<uint64_t> offline;
+        std::size_t failed = 0;
+        for (std::size_t i = 0; i < unresolved.size(); ++i) {
+            const std::optional<std::string> &sid = locs[i].sid;
+            if (!locs[i].ok) {
+                ++failed;  // 查询失败不代表成员不在线，不存入离线收件箱
+                continue;
+            }
+            if (!sid.has_value() || sid.value() == server_id_) {
+                // 不在线的成员，或者状态仍指向本服务器但已经不在本地的成员（不写入缓存）
+                offline.push_back(unresolved[i]);
+                continue;
+            }
+            loc_cache_->Put(unresolved[i], sid.value());
+            remote[sid.value()].push_back(unresolved[i]);
+        }
+        if (failed > 0) {
+            spdlog::error("Failed to look up locations of {} members of group {}, message from user {} not sent",
+                          failed, gid, from_uid);
+        }
+        SendGroupMsg(gid, from_uid, frame, local, remote, offline);
+        DonePendingRelay(from_uid);
+    };
+    async_redis_->GetUserLocations(from_uid, unresolved, std::move(on_locations));
+}
+
+void chatroom::backend::MsgHandler::FanOutLoadedGroupMsg(
+    uint64_t gid, uint64_t from_uid, const std::shared_ptr<MsgNode> &frame,
+    std::optional<std::vector<std::pair<uint64_t, std::string>>> members) {
+    if (!members.has_value()) {
+        spdlog::error("Failed to load members of group {}", gid);
+        return;
+    }
+    std::vector<uint64_t> uids;
+    uids.reserve(members->size());
+    for (const auto &item : *members) {
+        uids.push_back(item.first);
+    }
+    if (uids.empty() || !GroupIndex::IsMember(*group_index_->SetMembers(gid, uids), from_uid)) {
+        spdlog::warn("User {} is not a member of group {}", from_uid, gid);
+        return;
+    }
+
+    std::vector<std::shared_ptr<Session>> found;
+    sess_mgr_->LookupSessions(uids, found);
+    std::vector<std::shared_ptr<Session>> local;
+    std::unordered_map<std::string, std::vector<uint64_t>> remote;
+    std::vector<uint64_t> offline;
+    for (std::size_t i = 0; i < uids.size(); ++i) {
+        const std::string &sid = (*members)[i].second;
+        if (uids[i] == from_uid) {
+            continue;
+        }
+        if (found[i]) {
+            local.push_back(std::move(found[i]));
+        } else if (sid.empty() || sid == server_id_) {
+            offline.push_back(uids[i]);
+        } else {
+            loc_cache_->Put(uids[i], sid);
+            remote[sid].push_back(uids[i]);
+        }
+    }
+    SendGroupMsg(gid, from_uid, frame, local, remote, offline);
+}
+
+void chatroom::backend::MsgHandler::SendGroupMsg(uint64_t gid, uint64_t from_uid,
+                                                 const std::shared_ptr<MsgNode> &frame,
+                                                 const std::vector<std::shared_ptr<Session>> &local,
+                                                 const std::unordered_map<std::string, std::vector<uint64_t>> &remote,
+                                                 const std::vector<uint64_t> &offline) {
+    for (const auto &target : local) {
+        if (target->GetUserId() != from_uid) {
+            target->Send(frame);
+        }
+    }
+    for (uint64_t uid : offline) {
+        // 共享的群聊报文原样存入其离线收件箱
+        offline_->Append(uid, *frame);
+    }
+    // 远程成员的消息内容直接取自报文：[group_id][发送者id][消息内容]
+    std::string_view content(frame->GetContent() + 2 * sizeof(uint64_t),
+                             frame->GetContentLen() - 2 * sizeof(uint64_t));
+    LocationCache *loc_cache = loc_cache_.get();
+    for (const auto &[sid, uids] : remote) {
+        spdlog::debug("Sending group {} message to {} users on server {}", gid, uids.size(), sid);
+        // 投递失败时使这些接收者的位置缓存失效
+        auto on_done = [loc_cache, recipients = uids](bool ok) {
+            if (ok) return;
+            spdlog::warn("Failed to relay group message to {} users", recipients.size());
+            for (uint64_t uid : recipients) {
+                loc_cache->Invalidate(uid);
+            }
+        };
+        relay_->SendGroup(sid, gid, from_uid, uids, content, std::move(on_done));
+    }
+}
@@ -0,0 +1,466 @@
+#include "server/offline_store.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iterator>
+
+#include "log/log_manager.hpp"
+
+namespace chatroom::backend {
+OfflineStore::Segment::~Segment() {
+    if (base) munmap(base, size);
+    if (fd >= 0) close(fd);
+}
+
+OfflineStore::OfflineStore(std::string dir, uint32_t segment_bytes, bool sync, std::chrono::seconds ttl)
+    : dir_(std::move(dir)), segment_bytes_(segment_bytes), sync_(sync), ttl_(ttl) {}
+
+uint32_t OfflineStore::NowSeconds() {
+    return static_cast<uint32_t>(
+        std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+uint32_t OfflineStore::Checksum(const RecordHeader &hdr, const char *data) {
+    // FNV-1a
+    uint32_t hash = 2166136261U;
+    auto feed = [&hash](const char *ptr, std::size_t len) {
+        for (std::size_t i = 0; i < len; ++i) {
+            hash ^= static_cast<uint8_t>(ptr[i]);
+            hash *= 16777619U;
+        }
+    };
+    RecordHeader tmp = hdr;
+    tmp.checksum = 0;
+    feed(reinterpret_cast<const char *>(&tmp), sizeof(tmp));  // NOLINT
+    feed(data, hdr.len);
+    return hash;
+}
+
+std::string OfflineStore::SegmentPath(uint32_t id) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "seg-%08u.log", id);
+    return (std::filesystem::path(dir_) / name).string();
+}
+
+std::shared_ptr<OfflineStore::Segment> OfflineStore::CreateSegment(uint32_t id) {
+    std::string path = SegmentPath(id);
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        spdlog::error("OfflineStore: Failed to create segment {}: {}", path, std::strerror(errno));
+        return nullptr;
+    }
+    if (ftruncate(fd, segment_bytes_) != 0) {
+        spdlog::error("OfflineStore: Failed to preallocate segment {}: {}", path, std::strerror(errno));
+        close(fd);
+        return nullptr;
+    }
+    void *base = mmap(nullptr, segment_bytes_, PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {  // NOLINT
+        spdlog::error("OfflineStore: Failed to map segment {}: {}", path, std::strerror(errno));
+        close(fd);
+        return nullptr;
+    }
+    return std::make_shared<Segment>(id, fd, static_cast<char *>(base), segment_bytes_, std::move(path));
+}
+
+std::shared_ptr<OfflineStore::Segment> OfflineStore::RecoverSegment(uint32_t id) {
+    std::string path = SegmentPath(id);
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        spdlog::error("OfflineStore: Failed to open segment {}: {}", path, std::strerror(errno));
+        return nullptr;
+    }
+    struct stat st {};
+    if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(RecordHeader))) {
+        close(fd);
+        return std::make_shared<Segment>(id, -1, nullptr, 0, std::move(path));  // 空段，等待回收
+    }
+    auto size = static_cast<uint32_t>(st.st_size);
+    void *base = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {  // NOLINT
+        spdlog::error("OfflineStore: Failed to map segment {}: {}", path, std::strerror(errno));
+        return nullptr;
+    }
+    auto seg = std::make_shared<Segment>(id, -1, static_cast<char *>(base), size, std::move(path));
+    segments_.emplace(id, seg);
+
+    // 按顺序扫描记录，遇到未写入的区域或者校验失败的记录时停止
+    uint32_t pos = 0;
+    uint32_t count = 0;
+    uint32_t expired = 0;
+    uint32_t now = NowSeconds();
+    while (pos + sizeof(RecordHeader) <= size) {
+        RecordHeader hdr;
+        std::memcpy(&hdr, seg->base + pos, sizeof(hdr));
+        if (hdr.type == REC_NONE) break;
+        if ((hdr.type != REC_MSG && hdr.type != REC_DRAIN) || hdr.len > size - pos - sizeof(RecordHeader) ||
+            Checksum(hdr, seg->base + pos + sizeof(RecordHeader)) != hdr.checksum) {
+            spdlog::warn("OfflineStore: Segment {} truncated at offset {} (torn or corrupted record)", id, pos);
+            break;
+        }
+        if (hdr.type == REC_MSG) {
+            next_seq_ = std::max(next_seq_, hdr.seq + 1);
+            // 没有写入时间的旧记录从现在开始计算保存时间
+            uint32_t ts = hdr.ts != 0 ? hdr.ts : now;
+            if (Expired(ts, now)) {
+                ++expired;
+            } else {
+                auto offset = static_cast<uint32_t>(pos + sizeof(RecordHeader));
+                index_[hdr.uid].push_back({hdr.seq, id, offset, hdr.len, ts});
+                ++seg->live;
+            }
+        } else {
+            DropIndex(hdr.uid, hdr.seq);
+        }
+        pos += RecordSize(hdr.len);
+        ++count;
+    }
+    seg->write_pos = pos;
+    expired_.fetch_add(expired, std::memory_order_relaxed);
+    spdlog::info("OfflineStore: Recovered {} records from segment {} ({} messages expired)", count, id, expired);
+    return seg;
+}
+
+bool OfflineStore::Open() {
+    if (opened_) return true;
+    std::error_code ec;
+    std::filesystem::create_directories(dir_, ec);
+    if (ec) {
+        spdlog::error("OfflineStore: Failed to create directory {}: {}", dir_, ec.message());
+        return false;
+    }
+    std::vector<uint32_t> ids;
+    for (const auto &entry : std::filesystem::directory_iterator(dir_, ec)) {
+        unsigned id;
+        std::string name = entry.path().filename().string();
+        if (std::sscanf(name.c_str(), "seg-%08u.log", &id) == 1) {
+            ids.push_back(id);
+        }
+    }
+    std::sort(ids.begin(), ids.end());
+
+    std::unique_lock lock(idx_mtx_);
+    for (uint32_t id : ids) {
+        if (!RecoverSegment(id)) {
+            return false;
+        }
+    }
+    // 恢复出的段只读，之后的写入从一个新的段开始
+    active_ = CreateSegment(ids.empty() ? 1 : ids.back() + 1);
+    if (!active_) {
+        return false;
+    }
+    segments_.emplace(active_->id, active_);
+    ReclaimSegments();
+    lock.unlock();
+
+    {
+        std::unique_lock plock(pending_mtx_);
+        running_ = true;
+    }
+    writer_ = std::thread([this] { WriterFn(); });
+    opened_ = true;
+    return true;
+}
+
+void OfflineStore::Close() {
+    if (!opened_) return;
+    {
+        std::unique_lock lock(pending_mtx_);
+        running_ = false;
+    }
+    pending_cv_.notify_all();
+    if (writer_.joinable()) writer_.join();
+    commit_cv_.notify_all();
+
+    std::unique_lock lock(idx_mtx_);
+    index_.clear();
+    segments_.clear();  // 仍被报文视图引用的段会在视图释放后解除映射
+    active_.reset();
+    opened_ = false;
+}
+
+bool OfflineStore::Enqueue(RecordType type, uint64_t uid, uint64_t seq, std::string_view data) {
+    std::unique_lock lock(pending_mtx_);
+    if (!running_) return false;
+    if (type == REC_MSG) {
+        seq = next_seq_++;
+    }
+    bool was_empty = pending_.empty();
+    pending_.push_back({type, uid, seq, static_cast<uint32_t>(pending_buf_.size()), static_cast<uint32_t>(data.size())});
+    pending_buf_.append(data);
+    ++enqueued_;
+    if (was_empty) {
+        lock.unlock();
+        pending_cv_.notify_one();
+    }
+    return true;
+}
+
+bool OfflineStore::Append(uint64_t uid, std::string_view frame) {
+    if (RecordSize(frame.size()) > segment_bytes_) {
+        spdlog::error("OfflineStore: Frame of {} bytes too large for a segment", frame.size());
+        return false;
+    }
+    return Enqueue(REC_MSG, uid, 0, frame);
+}
+
+void OfflineStore::WriterFn() {
+    std::vector<PendingRecord> records;
+    std::string buf;
+    std::vector<DrainRequest> ready;
+    auto next_expire = std::chrono::steady_clock::now() + OFFLINE_EXPIRE_INTERVAL;
+    std::unique_lock lock(pending_mtx_);
+    for (;;) {
+        pending_cv_.wait_until(lock, next_expire,
+                               [this] { return !pending_.empty() || !drains_.empty() || !running_; });
+        if (std::chrono::steady_clock::now() >= next_expire) {
+            lock.unlock();
+            Expire();
+            lock.lock();
+            next_expire = std::chrono::steady_clock::now() + OFFLINE_EXPIRE_INTERVAL;
+        }
+        if (!pending_.empty()) {
+            // 取走积累的所有记录，写入过程中新的记录继续积累在pending_中，由下一次提交写入
+            records.swap(pending_);
+            buf.swap(pending_buf_);
+            lock.unlock();
+            bool ok = Commit(records, buf);
+            lock.lock();
+            processed_ += records.size();
+            if (!ok) {
+                failed_upto_ = processed_;  // Flush()据此报告失败，调用者不能确认这些消息的来源
+            }
+            records.clear();
+            buf.clear();
+            commit_cv_.notify_all();
+        }
+        // 此前追加的记录都已处理的取走请求；写线程总是先提交再处理请求，因此所有请求都会在这里被处理
+        auto it = std::partition(drains_.begin(), drains_.end(),
+                                 [this](const DrainRequest &req) { return req.target > processed_; });
+        std::move(it, drains_.end(), std::back_inserter(ready));
+        drains_.erase(it, drains_.end());
+        if (!ready.empty()) {
+            lock.unlock();
+            for (auto &req : ready) {
+                req.cb(TakeCommitted(req.uid));
+            }
+            ready.clear();
+            lock.lock();
+            continue;  // 取走产生的DRAIN记录
+        }
+        if (pending_.empty() && drains_.empty() && !running_) {
+            break;  // 已停止且没有待写的记录
+        }
+    }
+}
+
+bool OfflineStore::Commit(std::vector<PendingRecord> &records, const std::string &buf) {
+    std::vector<std::pair<const PendingRecord *, Location>> placed;
+    placed.reserve(records.size());
+    std::string chunk;
+    bool failed = false;
+    uint32_t now = NowSeconds();
+
+    // 把chunk写入当前段的write_pos处
+    auto write_chunk = [&]() {
+        if (chunk.empty() || failed) return;
+        ssize_t ret = pwrite(active_->fd, chunk.data(), chunk.size(), active_->write_pos);
+        if (ret != static_cast<ssize_t>(chunk.size())) {
+            spdlog::error("OfflineStore: Failed to write segment {}: {}", active_->id, std::strerror(errno));
+            failed = true;
+            return;
+        }
+        if (sync_ && fdatasync(active_->fd) != 0) {
+            spdlog::error("OfflineStore: Failed to sync segment {}: {}", active_->id, std::strerror(errno));
+        }
+        active_->write_pos += chunk.size();
+        chunk.clear();
+    };
+
+    for (const auto &rec : records) {
+        uint32_t rec_size = RecordSize(rec.len);
+        uint32_t ts = rec.type == REC_MSG ? now : 0;
+        if (active_->write_pos + chunk.size() + rec_size > segment_bytes_) {
+            // 当前段已满，写入已有的部分后换用新的段
+            write_chunk();
+            auto seg = CreateSegment(active_->id + 1);
+            if (!seg) {
+                failed = true;
+                break;
+            }
+            std::unique_lock lock(idx_mtx_);
+            segments_.emplace(seg->id, seg);
+            active_ = std::move(seg);
+        }
+        RecordHeader hdr{};
+        hdr.len = rec.len;
+        hdr.type = rec.type;
+        hdr.uid = rec.uid;
+        hdr.seq = rec.seq;
+        hdr.ts = ts;
+        hdr.checksum = Checksum(hdr, buf.data() + rec.buf_offset);
+        uint32_t offset = active_->write_pos + chunk.size() + sizeof(RecordHeader);
+        chunk.append(reinterpret_cast<const char *>(&hdr), sizeof(hdr));  // NOLINT
+        chunk.append(buf, rec.buf_offset, rec.len);
+        chunk.resize(chunk.size() + (rec_size - sizeof(RecordHeader) - rec.len), '\0');
+        placed.push_back({&rec, {rec.seq, active_->id, offset, rec.len, ts}});
+    }
+    write_chunk();
+    if (failed) {
+        spdlog::error("OfflineStore: {} records lost in a failed commit", records.size());
+        return false;
+    }
+
+    // 提交完成，消息对Drain()可见
+    uint64_t msgs = 0;
+    std::unique_lock lock(idx_mtx_);
+    for (auto &[rec, loc] : placed) {
+        if (rec->type != REC_MSG) continue;
+        index_[rec->uid].push_back(loc);
+        ++segments_[loc.seg_id]->live;
+        ++msgs;
+    }
+    appended_.fetch_add(msgs, std::memory_order_relaxed);
+    if (msgs > 0) {
+        commits_.fetch_add(1, std::memory_order_relaxed);  // 只有DRAIN记录的提交不计入
+    }
+    return true;
+}
+
+void OfflineStore::WaitProcessed(std::unique_lock<std::mutex> &lock, uint64_t target) {
+    commit_cv_.wait(lock, [this, target] { return processed_ >= target || !running_; });
+}
+
+bool OfflineStore::Flush() {
+    std::unique_lock lock(pending_mtx_);
+    uint64_t target = enqueued_;
+    WaitProcessed(lock, target);
+    // 编号在(flushed_, target]之间的记录中有失败的：其中可能包含调用者此前追加的记录
+    bool ok = processed_ >= target && failed_upto_ <= flushed_;
+    flushed_ = std::max(flushed_, target);
+    return ok;
+}
+
+std::vector<std::shared_ptr<MsgNode>> OfflineStore::Drain(uint64_t uid) {
+    {
+        std::unique_lock lock(pending_mtx_);
+        WaitProcessed(lock, enqueued_);
+    }
+    return TakeCommitted(uid);
+}
+
+void OfflineStore::DrainAsync(uint64_t uid, DrainCallback cb) {
+    {
+        std::unique_lock lock(pending_mtx_);
+        if (running_) {
+            drains_.push_back({uid, enqueued_, std::move(cb)});
+            lock.unlock();
+            pending_cv_.notify_one();
+            return;
+        }
+    }
+    cb(TakeCommitted(uid));
+}
+
+std::vector<std::shared_ptr<MsgNode>> OfflineStore::TakeCommitted(uint64_t uid) {
+    std::vector<std::shared_ptr<MsgNode>> out;
+    uint64_t last_seq;
+    {
+        std::unique_lock lock(idx_mtx_);
+        auto it = index_.find(uid);
+        if (it == index_.end() || it->second.empty()) {
+            return out;
+        }
+        std::vector<Location> locs = std::move(it->second);
+        index_.erase(it);
+        out.reserve(locs.size());
+        for (const auto &loc : locs) {
+            auto &seg = segments_[loc.seg_id];
+            --seg->live;
+            // 视图通过别名shared_ptr持有整个段，段被回收后映射也会保留到视图释放为止
+            std::shared_ptr<char> owner(seg, seg->base);
+            auto node = MakeMsgNode<MsgNodeView>(std::move(owner), seg->base + loc.offset, loc.len);
+            node->UpdateContentLenField();
+            out.push_back(std::move(node));
+        }
+        last_seq = locs.back().seq;
+        drained_.fetch_add(locs.size(), std::memory_order_relaxed);
+        ReclaimSegments();
+    }
+    // DRAIN记录提交之前崩溃的话，这些消息会在重启后被再次投递（至少一次）
+    Enqueue(REC_DRAIN, uid, last_seq, {});
+    return out;
+}
+
+void OfflineStore::DropIndex(uint64_t uid, uint64_t seq) {
+    auto it = index_.find(uid);
+    if (it == index_.end()) return;
+    auto &locs = it->second;
+    std::size_t n = 0;
+    while (n < locs.size() && locs[n].seq <= seq) {
+        --segments_[locs[n].seg_id]->live;
+        ++n;
+    }
+    locs.erase(locs.begin(), locs.begin() + static_cast<std::ptrdiff_t>(n));
+    if (locs.empty()) {
+        index_.erase(it);
+    }
+}
+
+void OfflineStore::ReclaimSegments() {
+    while (!segments_.empty()) {
+        auto it = segments_.begin();
+        if (it->second == active_ || it->second->live > 0) {
+            break;
+        }
+        unlink(it->second->path.c_str());
+        spdlog::debug("OfflineStore: Segment {} reclaimed", it->first);
+        segments_.erase(it);
+    }
+}
+
+void OfflineStore::Expire() {
+    if (ttl_.count() == 0) return;
+    uint32_t now = NowSeconds();
+    uint64_t expired = 0;
+    std::unique_lock lock(idx_mtx_);
+    for (auto it = index_.begin(); it != index_.end();) {
+        // 同一个用户的消息按序号排列，写入时间也是递增的，只需要检查开头的部分
+        auto &locs = it->second;
+        std::size_t n = 0;
+        while (n < locs.size() && Expired(locs[n].ts, now)) {
+            --segments_[locs[n].seg_id]->live;
+            ++n;
+        }
+        expired += n;
+        locs.erase(locs.begin(), locs.begin() + static_cast<std::ptrdiff_t>(n));
+        it = locs.empty() ? index_.erase(it) : std::next(it);
+    }
+    if (expired > 0) {
+        expired_.fetch_add(expired, std::memory_order_relaxed);
+        spdlog::info("OfflineStore: {} messages expired", expired);
+        ReclaimSegments();
+    }
+}
+
+std::size_t OfflineStore::PendingCount(uint64_t uid) {
+    std::unique_lock lock(idx_mtx_);
+    auto it = index_.find(uid);
+    return it == index_.end() ? 0 : it->second.size();
+}
+
+OfflineStoreStats OfflineStore::GetStats() {
+    std::unique_lock lock(idx_mtx_);
+    return {appended_.load(std::memory_order_relaxed), drained_.load(std::memory_order_relaxed),
+            expired_.load(std::memory_order_relaxed), commits_.load(std::memory_order_relaxed), segments_.size()};
+}
+}  // namespace chatroom::backend
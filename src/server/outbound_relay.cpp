@@ -0,0 +1,267 @@
+#include "server/outbound_relay.hpp"
+
+#include <sw/redis++/errors.h>
+
+#include <array>
+
+#include "common/mq_envelope.hpp"
+#include "log/log_manager.hpp"
+#include "utils/field_op.hpp"
+
+namespace chatroom::backend {
+constexpr std::size_t RELAY_RECORD_FIXED_LEN = 2 * sizeof(uint64_t) + sizeof(uint32_t);  // from, target, n
+
+void AppendRelayRecord(std::string &out, uint64_t from, uint64_t target, const std::vector<uint64_t> *recipients,
+                       std::string_view content) {
+    std::size_t n = recipients ? recipients->size() : 0;
+    std::size_t len = RELAY_RECORD_FIXED_LEN + n * sizeof(uint64_t) + content.size();
+    std::size_t pos = out.size();
+    out.resize(pos + sizeof(uint32_t) + len);
+    char *ptr = out.data() + pos;
+    WriteNetField32(ptr, len);
+    WriteNetField64(ptr + 4, from);
+    WriteNetField64(ptr + 12, target);
+    WriteNetField32(ptr + 20, n);
+    ptr += sizeof(uint32_t) + RELAY_RECORD_FIXED_LEN;
+    for (std::size_t i = 0; i < n; ++i) {
+        WriteNetField64(ptr, (*recipients)[i]);
+        ptr += sizeof(uint64_t);
+    }
+    std::memcpy(ptr, content.data(), content.size());
+}
+
+bool UnpackRelayBatch(std::string_view data, std::vector<RelayRecord> &out) {
+    while (!data.empty()) {
+        if (data.size() < sizeof(uint32_t) + RELAY_RECORD_FIXED_LEN) {
+            return false;
+        }
+        uint32_t len = ReadNetField32(data.data());
+        if (len < RELAY_RECORD_FIXED_LEN || len > data.size() - sizeof(uint32_t)) {
+            return false;
+        }
+        const char *ptr = data.data() + sizeof(uint32_t);
+        uint32_t n = ReadNetField32(ptr + 16);
+        if (n > (len - RELAY_RECORD_FIXED_LEN) / sizeof(uint64_t)) {
+            return false;
+        }
+        std::size_t list_len = n * sizeof(uint64_t);
+        out.push_back({ReadNetField64(ptr), ReadNetField64(ptr + 8),
+                       std::string_view(ptr + RELAY_RECORD_FIXED_LEN, list_len),
+                       std::string_view(ptr + RELAY_RECORD_FIXED_LEN + list_len,
+                                        len - RELAY_RECORD_FIXED_LEN - list_len)});
+        data.remove_prefix(sizeof(uint32_t) + len);
+    }
+    return true;
+}
+
+OutboundRelay::OutboundRelay(std::shared_ptr<AsyncRedis> async_redis, std::string origin, RelayOptions opts)
+    : async_redis_(std::move(async_redis)), origin_(std::move(origin)), opts_(opts) {
+    if (opts_.max_batch == 0) opts_.max_batch = 1;
+}
+
+bool OutboundRelay::Start() {
+    std::unique_lock lock(mtx_);
+    if (running_) return false;
+    running_ = true;
+    flusher_ = std::thread([this] { FlusherFn(); });
+    spdlog::info("OutboundRelay started, window: {} us, max batch: {}, pack: {}", opts_.window.count(),
+                 opts_.max_batch, opts_.pack);
+    return true;
+}
+
+bool OutboundRelay::Stop() {
+    {
+        std::unique_lock lock(mtx_);
+        if (!running_) return false;
+        running_ = false;
+    }
+    cv_.notify_all();
+    if (flusher_.joinable()) flusher_.join();
+    RelayStats st = GetStats();
+    spdlog::info("OutboundRelay stopped, {} messages in {} batches ({} full, {} via peer links, {} fell back), "
+                 "{} stream entries, {} failed",
+                 st.messages, st.flushes, st.size_flushes, st.peer_flushes, st.peer_fallbacks, st.stream_entries,
+                 st.failed);
+    return true;
+}
+
+void OutboundRelay::Send(std::string_view server_id, uint64_t from, uint64_t to, std::string_view content,
+                         std::function<void(bool)> cb) {
+    Enqueue(server_id, {from, to, {}, std::string(content), std::move(cb), {}});
+}
+
+void OutboundRelay::SendGroup(std::string_view server_id, uint64_t gid, uint64_t from,
+                              const std::vector<uint64_t> &to, std::string_view content,
+                              std::function<void(bool)> cb) {
+    Enqueue(server_id, {from, gid, to, std::string(content), std::move(cb), {}});
+}
+
+void OutboundRelay::Enqueue(std::string_view server_id, Entry &&entry) {
+    auto now = std::chrono::steady_clock::now();
+    entry.enqueued = now;
+    std::unique_lock lock(mtx_);
+    if (!running_) {
+        lock.unlock();
+        failed_.fetch_add(1, std::memory_order_relaxed);
+        if (entry.cb) entry.cb(false);
+        return;
+    }
+    Buffer &buf = buffers_[std::string(server_id)];
+    if (buf.entries.empty()) {
+        buf.deadline = now + opts_.window;
+    }
+    buf.entries.push_back(std::move(entry));
+    // 新的缓冲区需要刷新线程重新计算唤醒时间，满的缓冲区需要立即提交
+    bool wake = buf.entries.size() == 1 || buf.entries.size() >= opts_.max_batch;
+    lock.unlock();
+    if (wake) cv_.notify_one();
+}
+
+void OutboundRelay::FlusherFn() {
+    std::vector<std::pair<std::string, std::vector<Entry>>> ready;
+    std::unique_lock lock(mtx_);
+    for (;;) {
+        auto now = std::chrono::steady_clock::now();
+        auto next_deadline = std::chrono::steady_clock::time_point::max();
+        for (auto &[sid, buf] : buffers_) {
+            if (buf.entries.empty()) continue;
+            if (!running_ || buf.deadline <= now || buf.entries.size() >= opts_.max_batch) {
+                if (buf.entries.size() >= opts_.max_batch) {
+                    size_flushes_.fetch_add(1, std::memory_order_relaxed);
+                }
+                ready.emplace_back(sid, std::move(buf.entries));
+                buf.entries.clear();
+            } else {
+                next_deadline = std::min(next_deadline, buf.deadline);
+            }
+        }
+        if (!ready.empty()) {
+            // 提交过程不持有锁，期间新的消息进入各自的缓冲区
+            lock.unlock();
+            for (auto &[sid, entries] : ready) {
+                Flush(sid, std::move(entries));
+            }
+            ready.clear();
+            lock.lock();
+            continue;
+        }
+        if (!running_) {
+            break;  // 所有缓冲区都已提交
+        }
+        if (next_deadline == std::chrono::steady_clock::time_point::max()) {
+            cv_.wait(lock);
+        } else {
+            cv_.wait_until(lock, next_deadline);
+        }
+    }
+}
+
+void OutboundRelay::Flush(const std::string &server_id, std::vector<Entry> &&entries) {
+    auto now = std::chrono::steady_clock::now();
+    uint64_t wait_us = 0;
+    for (const auto &entry : entries) {
+        wait_us += std::chrono::duration_cast<std::chrono::microseconds>(now - entry.enqueued).count();
+    }
+    messages_.fetch_add(entries.size(), std::memory_order_relaxed);
+    flushes_.fetch_add(1, std::memory_order_relaxed);
+    wait_us_sum_.fetch_add(wait_us, std::memory_order_relaxed);
+
+    auto batch = std::make_shared<std::vector<Entry>>(std::move(entries));
+    if (peers_ && FlushToPeer(server_id, batch)) {
+        return;
+    }
+    FlushToRedis(server_id, std::move(batch));
+}
+
+bool OutboundRelay::FlushToPeer(const std::string &server_id, const std::shared_ptr<std::vector<Entry>> &batch) {
+    if (!peers_->IsConnected(server_id)) {
+        return false;
+    }
+    std::string packed;
+    for (const auto &entry : *batch) {
+        AppendRelayRecord(packed, entry.from, entry.target, entry.to.empty() ? nullptr : &entry.to, entry.content);
+    }
+    if (packed.size() > MAX_CTX_LEN) {
+        return false;  // 超出报文长度上限的批次只能写入消息队列
+    }
+    auto frame = MakeMsgNode(packed.data(), packed.size(), SERVER_RELAY);
+    // 对端确认之前链路断开时在链路的IO线程上回退到消息队列，此时AsyncRedis仍在运行（其停止晚于链路管理器）
+    auto on_done = [this, server_id, batch](bool ok) {
+        if (!ok) {
+            peer_fallbacks_.fetch_add(1, std::memory_order_relaxed);
+            FlushToRedis(server_id, batch);
+            return;
+        }
+        for (auto &entry : *batch) {
+            if (entry.cb) entry.cb(true);
+        }
+    };
+    if (!peers_->Send(server_id, std::move(frame), std::move(on_done))) {
+        return false;
+    }
+    peer_flushes_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void OutboundRelay::FlushToRedis(const std::string &server_id, std::shared_ptr<std::vector<Entry>> batch) {
+    std::string mq_key = "stream:server:";
+    mq_key += server_id;
+    std::size_t reply_count = opts_.pack ? 1 : batch->size();
+    stream_entries_.fetch_add(reply_count, std::memory_order_relaxed);
+    // 同一个目标服务器的批次总是由同一个AsyncRedis工作线程按顺序执行
+    uint64_t key = std::hash<std::string>{}(server_id);
+
+    AsyncRedis::Appender append;
+    if (opts_.pack) {
+        std::string packed;
+        for (const auto &entry : *batch) {
+            AppendRelayRecord(packed, entry.from, entry.target, entry.to.empty() ? nullptr : &entry.to,
+                              entry.content);
+        }
+        append = [mq_key = std::move(mq_key), origin = origin_, packed = std::move(packed),
+                  max_len = opts_.queue_max_len](sw::redis::Pipeline &pl) {
+            std::array<std::pair<std::string_view, std::string_view>, 2> msg = {
+                {{"pack", packed}, {"srv", origin}}};
+            pl.xadd(mq_key, "*", msg.begin(), msg.end(), max_len, true);
+        };
+    } else {
+        append = [mq_key = std::move(mq_key), origin = origin_, batch,
+                  max_len = opts_.queue_max_len](sw::redis::Pipeline &pl) {
+            for (const auto &entry : *batch) {
+                std::string envelope =
+                    entry.to.empty()
+                        ? EncodeEnvelope(EnvelopeType::CHAT, entry.from, entry.target, entry.content, origin)
+                        : EncodeEnvelope(EnvelopeType::GROUP_CHAT, entry.from, entry.target, entry.content, origin,
+                                         &entry.to);
+                std::array<std::pair<std::string_view, std::string_view>, 1> msg = {{{MQ_ENVELOPE_FIELD, envelope}}};
+                pl.xadd(mq_key, "*", msg.begin(), msg.end(), max_len, true);
+            }
+        };
+    }
+
+    bool pack = opts_.pack;
+    auto on_reply = [this, batch, pack](sw::redis::QueuedReplies *replies, std::size_t idx) {
+        for (std::size_t i = 0; i < batch->size(); ++i) {
+            bool ok = false;
+            if (replies) {
+                try {
+                    ok = !replies->get<std::string>(idx + (pack ? 0 : i)).empty();
+                } catch (const sw::redis::Error &e) {
+                    spdlog::error("OutboundRelay: XADD failed: {}", e.what());
+                }
+            }
+            if (!ok) failed_.fetch_add(1, std::memory_order_relaxed);
+            auto &cb = (*batch)[i].cb;
+            if (cb) cb(ok);
+        }
+    };
+    async_redis_->Submit(key, std::move(append), std::move(on_reply), reply_count);
+}
+
+RelayStats OutboundRelay::GetStats() const {
+    return {messages_.load(std::memory_order_relaxed),     flushes_.load(std::memory_order_relaxed),
+            size_flushes_.load(std::memory_order_relaxed), stream_entries_.load(std::memory_order_relaxed),
+            wait_us_sum_.load(std::memory_order_relaxed),  failed_.load(std::memory_order_relaxed),
+            peer_flushes_.load(std::memory_order_relaxed), peer_fallbacks_.load(std::memory_order_relaxed)};
+}
+}  // namespace chatroom::backend
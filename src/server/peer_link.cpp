@@ -0,0 +1,533 @@
+#include "server/peer_link.hpp"
+
+#include <boost/asio/connect.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/write.hpp>
+#include <charconv>
+#include <deque>
+#include <vector>
+
+#include "log/log_manager.hpp"
+#include "utils/field_op.hpp"
+
+using boost::asio::ip::tcp;
+
+namespace chatroom::backend {
+constexpr uint32_t PEER_RECV_NODE_SIZE = 4096;  // 入站链路接收缓冲区的初始大小，遇到更大的报文时扩容
+constexpr std::size_t PEER_MAX_GATHER_FRAMES = 64;  // 一次聚合写入的最大报文数
+
+std::string MakePeerAddr(std::string_view server_addr) {
+    auto pos = server_addr.rfind(':');
+    if (pos == std::string_view::npos || pos == 0) {
+        return {};
+    }
+    uint32_t port = 0;
+    std::string_view port_str = server_addr.substr(pos + 1);
+    auto [ptr, ec] = std::from_chars(port_str.data(), port_str.data() + port_str.size(), port);
+    if (ec != std::errc() || ptr != port_str.data() + port_str.size() || port + PEER_PORT_OFFSET > 65535) {
+        return {};
+    }
+    std::string addr(server_addr.substr(0, pos + 1));
+    addr += std::to_string(port + PEER_PORT_OFFSET);
+    return addr;
+}
+
+// 到一个对端的出站链路，除Send()和IsUp()外的成员函数都只在IO线程上调用
+class PeerLinkManager::OutLink : public std::enable_shared_from_this<OutLink> {
+   public:
+    OutLink(PeerLinkManager &mgr, std::string server_id, std::string addr)
+        : mgr_(mgr),
+          server_id_(std::move(server_id)),
+          addr_(std::move(addr)),
+          sock_(mgr.ctx_),
+          resolver_(mgr.ctx_),
+          timer_(mgr.ctx_),
+          backoff_(PEER_RECONNECT_MIN) {}
+
+    const std::string &Addr() const { return addr_; }
+
+    bool IsUp() const { return up_.load(std::memory_order_acquire); }
+
+    bool Send(std::shared_ptr<MsgNode> frame, std::function<void(bool)> on_done) {
+        uint64_t gen;
+        {
+            std::unique_lock lock(send_latch_);
+            if (!up_.load(std::memory_order_relaxed) ||
+                send_q_.size() + sending_.size() + unacked_.size() >= PEER_MAX_PENDING_FRAMES) {
+                return false;
+            }
+            send_q_.push_back({std::move(frame), std::move(on_done)});
+            if (writing_) {
+                return true;  // 会在当前写入完成后与其他报文一起发送
+            }
+            writing_ = true;
+            gen = gen_;
+        }
+        boost::asio::post(mgr_.ctx_, [self = shared_from_this(), gen] { self->QueueSend(gen); });
+        return true;
+    }
+
+    void Connect() {
+        if (state_ == State::CLOSED) return;
+        state_ = State::CONNECTING;
+        auto pos = addr_.rfind(':');
+        resolver_.async_resolve(
+            addr_.substr(0, pos), addr_.substr(pos + 1),
+            [self = shared_from_this()](const boost::system::error_code &err, tcp::resolver::results_type results) {
+                if (err) {
+                    self->Fail(err);
+                    return;
+                }
+                boost::asio::async_connect(self->sock_, results,
+                                           [self](const boost::system::error_code &err, const tcp::endpoint &) {
+                                               if (err) {
+                                                   self->Fail(err);
+                                                   return;
+                                               }
+                                               self->SendHello();
+                                           });
+            });
+    }
+
+    // @brief 永久关闭链路，排队中的报文以失败回调
+    void Close() {
+        state_ = State::CLOSED;
+        resolver_.cancel();
+        timer_.cancel();
+        boost::system::error_code ec;
+        sock_.close(ec);
+        FailPending();
+    }
+
+   private:
+    enum class State { CONNECTING, UP, WAITING, CLOSED };
+
+    struct Pending {
+        std::shared_ptr<MsgNode> frame;
+        std::function<void(bool)> on_done;
+    };
+
+    void SendHello() {
+        boost::system::error_code ec;
+        sock_.set_option(tcp::no_delay(true), ec);
+        hello_ = MakeMsgNode(mgr_.server_id_.data(), mgr_.server_id_.size(), PEER_HELLO);
+        boost::asio::async_write(sock_, boost::asio::buffer(hello_->data_, hello_->ctx_len_ + HEAD_LEN),
+                                 [self = shared_from_this()](const boost::system::error_code &err, std::size_t) {
+                                     self->hello_.reset();
+                                     if (err) {
+                                         self->Fail(err);
+                                         return;
+                                     }
+                                     if (self->state_ != State::CONNECTING) return;
+                                     self->state_ = State::UP;
+                                     self->backoff_ = PEER_RECONNECT_MIN;
+                                     self->up_.store(true, std::memory_order_release);
+                                     self->mgr_.connects_.fetch_add(1, std::memory_order_relaxed);
+                                     spdlog::info("Peer link to server {} ({}) established", self->server_id_,
+                                                  self->addr_);
+                                     self->ReceiveAck();
+                                 });
+    }
+
+    // @brief 读取对端的PEER_ACK，同时用于及时发现连接断开
+    void ReceiveAck() {
+        boost::asio::async_read(
+            sock_, boost::asio::buffer(ack_buf_), [self = shared_from_this()](const boost::system::error_code &err,
+                                                                              std::size_t) {
+                if (err) {
+                    self->Fail(err);
+                    return;
+                }
+                if (ReadNetField32(self->ack_buf_) != PEER_ACK ||
+                    ReadNetField32(self->ack_buf_ + TAG_LEN) != sizeof(uint64_t)) {
+                    spdlog::error("Unexpected frame on peer link to server {}", self->server_id_);
+                    self->Fail(boost::asio::error::invalid_argument);
+                    return;
+                }
+                self->OnAck(ReadNetField64(self->ack_buf_ + HEAD_LEN));
+                self->ReceiveAck();
+            });
+    }
+
+    // @brief 对端确认已投递本次连接中的前count个报文
+    void OnAck(uint64_t count) {
+        std::vector<Pending> done;
+        {
+            std::unique_lock lock(send_latch_);
+            while (acked_ < count && !unacked_.empty()) {
+                done.push_back(std::move(unacked_.front()));
+                unacked_.pop_front();
+                ++acked_;
+            }
+        }
+        mgr_.frames_sent_.fetch_add(done.size(), std::memory_order_relaxed);
+        for (auto &pending : done) {
+            if (pending.on_done) pending.on_done(true);
+        }
+    }
+
+    void QueueSend(uint64_t gen) {
+        {
+            std::unique_lock lock(send_latch_);
+            if (gen != gen_) return;  // 链路已经断开过，该次发送已经作废
+            if (send_q_.empty()) {
+                writing_ = false;
+                return;
+            }
+            while (!send_q_.empty() && sending_.size() < PEER_MAX_GATHER_FRAMES) {
+                sending_.push_back(std::move(send_q_.front()));
+                send_q_.pop_front();
+            }
+        }
+        send_bufs_.clear();
+        for (auto &pending : sending_) {
+            send_bufs_.emplace_back(pending.frame->data_, pending.frame->ctx_len_ + HEAD_LEN);
+        }
+        boost::asio::async_write(
+            sock_, send_bufs_, [self = shared_from_this(), gen](const boost::system::error_code &err, std::size_t) {
+                if (err) {
+                    self->Fail(err);
+                    return;
+                }
+                {
+                    std::unique_lock lock(self->send_latch_);
+                    if (gen != self->gen_) return;  // 这些报文已经以失败回调
+                    // 写入完成不代表对端已经投递，等待其确认
+                    for (auto &pending : self->sending_) {
+                        self->unacked_.push_back(std::move(pending));
+                    }
+                    self->sending_.clear();
+                }
+                self->QueueSend(gen);
+            });
+    }
+
+    // @brief 连接失败或者断开：失败回调所有尚未确认的报文，并在退避间隔后重连
+    void Fail(const boost::system::error_code &err) {
+        if (state_ != State::CONNECTING && state_ != State::UP) {
+            return;  // 已经处理过这次断开，或者链路已被关闭
+        }
+        if (state_ == State::UP) {
+            spdlog::warn("Peer link to server {} ({}) lost: {}", server_id_, addr_, err.message());
+        } else {
+            spdlog::debug("Failed to connect peer link to server {} ({}): {}", server_id_, addr_, err.message());
+        }
+        state_ = State::WAITING;
+        boost::system::error_code ec;
+        sock_.close(ec);
+        FailPending();
+
+        timer_.expires_after(backoff_);
+        backoff_ = std::min(backoff_ * 2, PEER_RECONNECT_MAX);
+        timer_.async_wait([self = shared_from_this()](const boost::system::error_code &err) {
+            if (err || self->state_ != State::WAITING) return;
+            self->Connect();
+        });
+    }
+
+    void FailPending() {
+        std::deque<Pending> unacked;
+        std::deque<Pending> queued;
+        std::vector<Pending> sending;
+        {
+            std::unique_lock lock(send_latch_);
+            up_.store(false, std::memory_order_release);
+            ++gen_;
+            writing_ = false;
+            acked_ = 0;  // 新的连接重新计数
+            unacked.swap(unacked_);
+            queued.swap(send_q_);
+            sending.swap(sending_);
+        }
+        std::size_t count = unacked.size() + queued.size() + sending.size();
+        if (count == 0) return;
+        mgr_.send_failures_.fetch_add(count, std::memory_order_relaxed);
+        // 按写入顺序回调，回退到Redis的报文尽量保持原来的顺序
+        for (auto &pending : unacked) {
+            if (pending.on_done) pending.on_done(false);
+        }
+        for (auto &pending : sending) {
+            if (pending.on_done) pending.on_done(false);
+        }
+        for (auto &pending : queued) {
+            if (pending.on_done) pending.on_done(false);
+        }
+    }
+
+    PeerLinkManager &mgr_;
+    std::string server_id_;
+    std::string addr_;
+    tcp::socket sock_;
+    tcp::resolver resolver_;
+    boost::asio::steady_timer timer_;
+    std::chrono::milliseconds backoff_;
+    State state_{State::WAITING};
+    std::shared_ptr<MsgNode> hello_;
+    char ack_buf_[HEAD_LEN + sizeof(uint64_t)];  // 一个PEER_ACK报文
+
+    std::atomic<bool> up_{false};
+    std::mutex send_latch_;  // 保护以下成员
+    uint64_t gen_{0};        // 每次断开时加一，使断开之前发起的写入作废
+    bool writing_{false};
+    std::deque<Pending> send_q_;
+    std::vector<Pending> sending_;
+    std::deque<Pending> unacked_;  // 已经写入、等待对端确认的报文
+    uint64_t acked_{0};            // 本次连接中对端已经确认的报文数
+    std::vector<boost::asio::const_buffer> send_bufs_;  // 只在IO线程上访问
+};
+
+// 对端发起的入站链路，只在IO线程上访问
+class PeerLinkManager::InLink : public std::enable_shared_from_this<InLink> {
+   public:
+    InLink(PeerLinkManager &mgr, tcp::socket &&sock)
+        : mgr_(mgr), sock_(std::move(sock)), recv_(MakeMsgNode(PEER_RECV_NODE_SIZE)) {}
+
+    void Start() { ReceiveHead(); }
+
+    void Close() {
+        boost::system::error_code ec;
+        sock_.close(ec);
+    }
+
+   private:
+    void ReceiveHead() {
+        boost::asio::async_read(sock_, boost::asio::buffer(recv_->data_, HEAD_LEN),
+                                [self = shared_from_this()](const boost::system::error_code &err, std::size_t) {
+                                    if (err) {
+                                        self->Shutdown(err);
+                                        return;
+                                    }
+                                    uint32_t content_len = self->recv_->UpdateContentLenField();
+                                    if (content_len > MAX_CTX_LEN) {
+                                        spdlog::error("Peer link frame length exceeds the limit: {}", content_len);
+                                        self->Shutdown({});
+                                        return;
+                                    }
+                                    if (content_len + HEAD_LEN > self->recv_->max_len_) {
+                                        self->recv_->Reallocate(content_len + HEAD_LEN);
+                                    }
+                                    self->ReceiveContent();
+                                });
+    }
+
+    void ReceiveContent() {
+        boost::asio::async_read(sock_, boost::asio::buffer(recv_->GetContent(), recv_->ctx_len_),
+                                [self = shared_from_this()](const boost::system::error_code &err, std::size_t) {
+                                    if (err) {
+                                        self->Shutdown(err);
+                                        return;
+                                    }
+                                    if (!self->HandleFrame()) {
+                                        self->Shutdown({});
+                                        return;
+                                    }
+                                    self->ReceiveHead();
+                                });
+    }
+
+    bool HandleFrame() {
+        uint32_t tag = recv_->GetTagField();
+        std::string_view content(recv_->GetContent(), recv_->ctx_len_);
+        if (origin_.empty()) {
+            // 第一个报文必须是握手
+            if (tag != PEER_HELLO || content.empty()) {
+                spdlog::error("Peer link closed: expected PEER_HELLO, got {}", TagTypeStr(static_cast<TagType>(tag)));
+                return false;
+            }
+            origin_ = content;
+            spdlog::info("Peer link from server {} accepted", origin_);
+            return true;
+        }
+        switch (tag) {
+            case SERVER_RELAY:
+                mgr_.frames_received_.fetch_add(1, std::memory_order_relaxed);
+                mgr_.deliver_(origin_, content);
+                ++delivered_;
+                SendAck();
+                break;
+            case PING:
+                break;
+            default:
+                spdlog::warn("Unexpected frame on peer link from server {}: {}", origin_,
+                             TagTypeStr(static_cast<TagType>(tag)));
+                break;
+        }
+        return true;
+    }
+
+    // @brief 确认已投递的报文；正在写入上一个确认时，完成后再发送一个覆盖所有已投递报文的确认
+    void SendAck() {
+        if (ack_writing_ || acked_sent_ == delivered_) {
+            return;
+        }
+        ack_writing_ = true;
+        acked_sent_ = delivered_;
+        char count[sizeof(uint64_t)];
+        WriteNetField64(count, acked_sent_);
+        auto ack = MakeMsgNode(count, sizeof(count), PEER_ACK);
+        boost::asio::async_write(sock_, boost::asio::buffer(ack->data_, ack->ctx_len_ + HEAD_LEN),
+                                 [self = shared_from_this(), ack](const boost::system::error_code &err, std::size_t) {
+                                     self->ack_writing_ = false;
+                                     if (err) {
+                                         return;  // 读取操作会发现连接断开
+                                     }
+                                     self->SendAck();
+                                 });
+    }
+
+    void Shutdown(const boost::system::error_code &err) {
+        if (err && err != boost::asio::error::eof && err != boost::asio::error::operation_aborted) {
+            spdlog::warn("Peer link from server {} closed: {}", origin_, err.message());
+        }
+        Close();
+        mgr_.in_links_.erase(shared_from_this());
+    }
+
+    PeerLinkManager &mgr_;
+    tcp::socket sock_;
+    std::shared_ptr<MsgNode> recv_;
+    std::string origin_;  // 对端的server_id，收到握手之前为空
+    uint64_t delivered_{0};   // 本次连接中已投递的SERVER_RELAY报文数
+    uint64_t acked_sent_{0};  // 已经（或者正在）发送的确认中的报文数
+    bool ack_writing_{false};
+};
+
+PeerLinkManager::PeerLinkManager(std::string server_id, uint16_t listen_port, DeliverFn deliver)
+    : server_id_(std::move(server_id)), listen_port_(listen_port), deliver_(std::move(deliver)), acc_(ctx_) {}
+
+bool PeerLinkManager::Start() {
+    if (th_.joinable()) return false;
+    try {
+        tcp::endpoint ep(tcp::v4(), listen_port_);
+        acc_.open(ep.protocol());
+        acc_.set_option(tcp::acceptor::reuse_address(true));
+        acc_.bind(ep);
+        acc_.listen();
+    } catch (const boost::system::system_error &e) {
+        spdlog::error("Failed to listen for peer links on port {}: {}", listen_port_, e.what());
+        boost::system::error_code ec;
+        acc_.close(ec);
+        return false;
+    }
+    work_guard_ = std::make_unique<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>>(
+        ctx_.get_executor());
+    AcceptorFn();
+    th_ = std::thread([this] { ctx_.run(); });
+    {
+        std::unique_lock lock(mtx_);
+        started_ = true;
+    }
+    spdlog::info("Listening for peer links on port {}", listen_port_);
+    return true;
+}
+
+void PeerLinkManager::Stop() {
+    std::unordered_map<std::string, std::shared_ptr<OutLink>> links;
+    {
+        std::unique_lock lock(mtx_);
+        if (!started_) return;
+        started_ = false;
+        links.swap(links_);  // 之后的Send()和UpdatePeers()都不再生效
+    }
+    boost::asio::post(ctx_, [this, links = std::move(links)] {
+        boost::system::error_code ec;
+        acc_.close(ec);
+        for (auto &[sid, link] : links) {
+            link->Close();
+        }
+        for (auto &link : in_links_) {
+            link->Close();
+        }
+    });
+    // 剩余的异步操作以operation_aborted完成后，run()返回
+    work_guard_.reset();
+    if (th_.joinable()) th_.join();
+    in_links_.clear();
+    PeerLinkStats st = GetStats();
+    spdlog::info("Peer links stopped, {} frames sent, {} received, {} failed, {} connects", st.frames_sent,
+                 st.frames_received, st.send_failures, st.connects);
+}
+
+void PeerLinkManager::AcceptorFn() {
+    auto sock = std::make_shared<tcp::socket>(ctx_);
+    acc_.async_accept(*sock, [this, sock](const boost::system::error_code &err) {
+        if (err) {
+            if (err != boost::asio::error::operation_aborted) {
+                spdlog::error("Error when accepting peer link: {}", err.message());
+            }
+            return;
+        }
+        boost::system::error_code ec;
+        sock->set_option(tcp::no_delay(true), ec);
+        auto link = std::make_shared<InLink>(*this, std::move(*sock));
+        in_links_.insert(link);
+        link->Start();
+        AcceptorFn();
+    });
+}
+
+void PeerLinkManager::UpdatePeers(const std::unordered_map<std::string, std::string> &peers) {
+    std::vector<std::shared_ptr<OutLink>> closed;
+    std::vector<std::shared_ptr<OutLink>> created;
+    {
+        std::unique_lock lock(mtx_);
+        if (!started_) return;
+        for (auto it = links_.begin(); it != links_.end();) {
+            auto peer = peers.find(it->first);
+            if (peer == peers.end() || peer->second != it->second->Addr()) {
+                closed.push_back(std::move(it->second));
+                it = links_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        for (const auto &[sid, addr] : peers) {
+            if (sid == server_id_ || addr.empty() || links_.count(sid)) continue;
+            auto link = std::make_shared<OutLink>(*this, sid, addr);
+            links_.emplace(sid, link);
+            created.push_back(std::move(link));
+        }
+    }
+    if (closed.empty() && created.empty()) return;
+    boost::asio::post(ctx_, [closed = std::move(closed), created = std::move(created)] {
+        for (auto &link : closed) {
+            link->Close();
+        }
+        for (auto &link : created) {
+            link->Connect();
+        }
+    });
+}
+
+bool PeerLinkManager::IsConnected(const std::string &server_id) {
+    std::unique_lock lock(mtx_);
+    auto it = links_.find(server_id);
+    return it != links_.end() && it->second->IsUp();
+}
+
+bool PeerLinkManager::Send(const std::string &server_id, std::shared_ptr<MsgNode> frame,
+                           std::function<void(bool)> on_done) {
+    std::shared_ptr<OutLink> link;
+    {
+        std::unique_lock lock(mtx_);
+        auto it = links_.find(server_id);
+        if (it == links_.end()) return false;
+        link = it->second;
+    }
+    return link->Send(std::move(frame), std::move(on_done));
+}
+
+PeerLinkStats PeerLinkManager::GetStats() {
+    uint32_t links_up = 0;
+    {
+        std::unique_lock lock(mtx_);
+        for (auto &[sid, link] : links_) {
+            if (link->IsUp()) ++links_up;
+        }
+    }
+    return {frames_sent_.load(std::memory_order_relaxed), frames_received_.load(std::memory_order_relaxed),
+            send_failures_.load(std::memory_order_relaxed), connects_.load(std::memory_order_relaxed), links_up};
+}
+}  // namespace chatroom::backend
@@ -0,0 +1,130 @@
+#include "server/recv_ring.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cstring>
+
+namespace chatroom::backend {
+RecvRing::RecvRing(uint32_t min_capacity, uint32_t max_capacity)
+    : min_cap_(min_capacity),
+      max_cap_(max_capacity),
+      cap_(min_capacity),
+      mask_(min_capacity - 1),
+      want_cap_(min_capacity) {
+    // 容量必须是2的幂
+    assert(std::has_single_bit(min_capacity) && std::has_single_bit(max_capacity) && min_capacity <= max_capacity);
+}
+
+void RecvRing::Renew() {
+    uint32_t cap = want_cap_;
+    assert(Size() <= cap);
+    std::shared_ptr<char> blk(
+        BufferPool::Allocate(cap), [cap](char *ptr) { BufferPool::Deallocate(ptr, cap); }, PoolAllocator<char>());
+    uint32_t remain = Size();
+    if (block_ && remain > 0) {
+        CopyOut(head_, blk.get(), remain);
+    }
+    block_ = std::move(blk);
+    cap_ = cap;
+    mask_ = cap - 1;
+    head_ = 0;
+    tail_ = remain;
+    small_reads_ = 0;
+}
+
+std::array<boost::asio::mutable_buffer, 2> RecvRing::PrepareWrite() {
+    if (small_reads_ >= RING_SHRINK_READS && cap_ > min_cap_ && (Size() == 0 || block_.use_count() > 1)) {
+        // 最近的读取都很短，缓冲区为空（不需要搬移数据）或者本来就要换块时，换用容量减半的块
+        want_cap_ = cap_ / 2;
+    }
+    if (!block_ || block_.use_count() > 1 || want_cap_ != cap_) {
+        // 当前块仍被帧视图引用（或尚未分配），或者需要改变容量，换用新块
+        Renew();
+    } else {
+        // 没有任何视图引用当前块，可以原地复用；acquire保证其他线程对视图内存的写入先于我们的覆盖写入
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (head_ == tail_) {
+            // 缓冲区已空，回到起始位置，尽量避免报文跨越末尾
+            head_ = tail_ = 0;
+        }
+    }
+    uint32_t free_len = cap_ - Size();
+    uint32_t beg = static_cast<uint32_t>(tail_ & mask_);
+    uint32_t first = std::min(free_len, cap_ - beg);
+    char *base = block_.get();
+    return {boost::asio::buffer(base + beg, first), boost::asio::buffer(base, free_len - first)};
+}
+
+void RecvRing::CommitWrite(std::size_t bytes) {
+    assert(bytes <= cap_ - Size());
+    bool filled = bytes == cap_ - Size();
+    tail_ += bytes;
+    if (filled) {
+        // 读满了整个缓冲区，套接字中可能还有更多数据，下一次读取换用更大的块
+        want_cap_ = std::max(want_cap_, std::min(cap_ * 2, max_cap_));
+        small_reads_ = 0;
+    } else if (bytes < cap_ / 4 && Size() < cap_ / 4) {
+        ++small_reads_;
+    } else {
+        small_reads_ = 0;
+    }
+}
+
+void RecvRing::CopyOut(uint64_t pos, char *dst, uint32_t len) const {
+    uint32_t beg = static_cast<uint32_t>(pos & mask_);
+    uint32_t first = std::min(len, cap_ - beg);
+    std::memcpy(dst, block_.get() + beg, first);
+    if (first < len) {
+        std::memcpy(dst + first, block_.get(), len - first);
+    }
+}
+
+RecvRing::ParseStatus RecvRing::ParseFrames(std::vector<std::shared_ptr<MsgNode>> &out,
+                                            std::shared_ptr<MsgNode> &large) {
+    while (Size() >= HEAD_LEN) {
+        char head[HEAD_LEN];
+        CopyOut(head_, head, HEAD_LEN);
+        uint32_t content_len = ReadNetField32(head + TAG_LEN);
+        if (content_len > MAX_CTX_LEN) {
+            return ParseStatus::BAD_FRAME;
+        }
+        uint32_t frame_len = HEAD_LEN + content_len;
+        if (frame_len > max_cap_) {
+            // 缓冲区最大容量也装不下的大报文：拷贝已接收的部分，剩余部分交给调用者按原方式读取
+            uint32_t got = Size();
+            large = MakeMsgNode(frame_len);
+            CopyOut(head_, large->data_, got);
+            large->cur_pos_ = got;
+            large->UpdateContentLenField();
+            head_ = tail_;
+            return ParseStatus::LARGE_FRAME;
+        }
+        if (frame_len > cap_) {
+            // 当前块装不下这个报文，下一次读取换用足够大的块
+            want_cap_ = std::max(want_cap_, std::bit_ceil(frame_len));
+            small_reads_ = 0;
+            break;
+        }
+        if (Size() < frame_len) {
+            break;  // 报文还没有接收完整
+        }
+        uint32_t beg = static_cast<uint32_t>(head_ & mask_);
+        std::shared_ptr<MsgNode> node;
+        if (beg + frame_len <= cap_) {
+            // 零拷贝：直接引用缓冲区中的内存
+            node = MakeMsgNode<MsgNodeView>(block_, block_.get() + beg, frame_len);
+        } else {
+            // 报文跨越了缓冲区末尾，只能拷贝
+            node = MakeMsgNode(frame_len);
+            CopyOut(head_, node->data_, frame_len);
+        }
+        node->UpdateContentLenField();
+        node->cur_pos_ = frame_len;
+        out.push_back(std::move(node));
+        head_ += frame_len;
+    }
+    return ParseStatus::OK;
+}
+}  // namespace chatroom::backend
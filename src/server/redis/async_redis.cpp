@@ -0,0 +1,412 @@
+#include "server/redis/async_redis.hpp"
+
+#include <sw/redis++/errors.h>
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+
+#include "common/mq_envelope.hpp"
+#include "common/presence_lease.hpp"
+#include "log/log_manager.hpp"
+
+namespace chatroom::backend {
+thread_local std::vector<AsyncRedis::Command> *AsyncRedis::cont_ = nullptr;
+
+// 一次GetGroupLocations的状态，在各步之间传递
+struct AsyncRedis::GroupScan {
+    std::string group_key;
+    std::vector<std::pair<uint64_t, std::string>> out;
+    std::function<void(std::optional<std::vector<std::pair<uint64_t, std::string>>>)> cb;
+};
+
+AsyncRedis::AsyncRedis(std::shared_ptr<RedisMgr> redis, uint32_t worker_count) : redis_(std::move(redis)) {
+    if (worker_count == 0) worker_count = 1;
+    workers_.reserve(worker_count);
+    for (uint32_t i = 0; i < worker_count; ++i) {
+        workers_.push_back(std::make_unique<Worker>());
+    }
+}
+
+bool AsyncRedis::Start() {
+    if (started_) return false;
+    started_ = true;
+    for (auto &worker : workers_) {
+        worker->running.store(true, std::memory_order_release);
+        Worker *ptr = worker.get();
+        worker->th = std::thread([this, ptr] { WorkerFn(*ptr); });
+    }
+    spdlog::info("AsyncRedis started with {} pipeline workers", workers_.size());
+    return true;
+}
+
+bool AsyncRedis::Stop() {
+    if (!started_) return false;
+    started_ = false;
+    for (auto &worker : workers_) {
+        worker->running.store(false, std::memory_order_release);
+        worker->ec.NotifyAll();
+    }
+    for (auto &worker : workers_) {
+        if (worker->th.joinable()) worker->th.join();
+    }
+    AsyncRedisStats st = GetStats();
+    spdlog::info("AsyncRedis stopped, {} commands in {} pipelines, {} failed pipelines", st.commands, st.pipelines,
+                 st.errors);
+    return true;
+}
+
+bool AsyncRedis::Submit(uint64_t key, Appender append, ReplyHandler on_reply, std::size_t reply_count) {
+    Worker &worker = *workers_[key % workers_.size()];
+    Command cmd{std::move(append), std::move(on_reply), reply_count};
+    bool pushed = false;
+    while (worker.running.load(std::memory_order_acquire)) {
+        if (worker.q.TryPush(std::move(cmd))) {
+            pushed = true;
+            break;
+        }
+        // 队列已满，等待工作线程腾出空间
+        worker.ec.Notify();
+        std::this_thread::yield();
+    }
+    if (!pushed) {
+        // 工作线程未在运行，直接以失败的形式回调
+        if (cmd.on_reply) cmd.on_reply(nullptr, 0);
+        return false;
+    }
+    worker.ec.Notify();
+    return true;
+}
+
+void AsyncRedis::WorkerFn(Worker &worker) {
+    std::optional<sw::redis::Pipeline> pl;
+    std::vector<Command> batch;
+    batch.reserve(MAX_PIPELINE_CMDS);
+    for (;;) {
+        if (worker.q.PopBatch(batch, MAX_PIPELINE_CMDS) == 0) {
+            if (!worker.running.load(std::memory_order_acquire)) {
+                break;  // 队列中的命令已全部执行完
+            }
+            EventCount::Key key = worker.ec.PrepareWait();
+            if (!worker.q.Empty() || !worker.running.load(std::memory_order_acquire)) {
+                worker.ec.CancelWait();
+                continue;
+            }
+            worker.ec.Wait(key);
+            continue;
+        }
+        try {
+            if (!pl) {
+                // 每个工作线程使用一个独立的连接，不占用连接池中的连接
+                pl.emplace(redis_->GetRedis().pipeline(true));
+            }
+            ExecBatch(pl, batch);
+        } catch (const sw::redis::Error &e) {
+            spdlog::error("AsyncRedis pipeline of {} commands failed: {}", batch.size(), e.what());
+            errors_.fetch_add(1, std::memory_order_relaxed);
+            pl.reset();  // 连接可能已损坏，下次重新建立
+            for (auto &cmd : batch) {
+                if (cmd.on_reply) cmd.on_reply(nullptr, 0);
+            }
+        }
+        batch.clear();
+    }
+}
+
+void AsyncRedis::ExecBatch(std::optional<sw::redis::Pipeline> &pl, std::vector<Command> &batch) {
+    for (auto &cmd : batch) {
+        cmd.append(*pl);
+    }
+    // pl.exec()之后回复保存在replies中，后续命令可以继续使用pl
+    auto replies = pl->exec();
+    pipelines_.fetch_add(1, std::memory_order_relaxed);
+    std::size_t idx = 0;
+    std::vector<Command> cont;
+    for (auto &cmd : batch) {
+        if (cmd.on_reply) {
+            cont_ = &cont;
+            try {
+                cmd.on_reply(&replies, idx);
+            } catch (const std::exception &e) {
+                // 单个命令的错误回复（ReplyError）或回调中的异常不影响同一批次的其他命令
+                spdlog::error("AsyncRedis reply handler error: {}", e.what());
+            }
+            cont_ = nullptr;
+            if (!cont.empty()) {
+                ExecContinuations(pl, cont);
+            }
+        }
+        idx += cmd.reply_count;
+    }
+    commands_.fetch_add(idx, std::memory_order_relaxed);
+}
+
+void AsyncRedis::ExecContinuations(std::optional<sw::redis::Pipeline> &pl, std::vector<Command> &cont) {
+    std::vector<Command> batch;
+    batch.swap(cont);
+    try {
+        if (!pl) {
+            pl.emplace(redis_->GetRedis().pipeline(true));
+        }
+        ExecBatch(pl, batch);
+    } catch (const sw::redis::Error &e) {
+        // 只有pl.exec()会抛出异常，此时这一批后续命令的回调都还没有执行
+        spdlog::error("AsyncRedis pipeline of {} continued commands failed: {}", batch.size(), e.what());
+        errors_.fetch_add(1, std::memory_order_relaxed);
+        pl.reset();
+        for (auto &cmd : batch) {
+            if (cmd.on_reply) cmd.on_reply(nullptr, 0);
+        }
+    }
+}
+
+void AsyncRedis::Continue(Appender append, ReplyHandler on_reply, std::size_t reply_count) {
+    if (!cont_) {
+        if (on_reply) on_reply(nullptr, 0);
+        return;
+    }
+    cont_->push_back({std::move(append), std::move(on_reply), reply_count});
+}
+
+void AsyncRedis::Post(uint64_t key, std::function<void()> fn) {
+    // 不追加任何命令（reply_count为0）的命令只占据队列中的位置，整个Pipeline失败时同样执行fn
+    Submit(
+        key, [](sw::redis::Pipeline &) {}, [fn = std::move(fn)](sw::redis::QueuedReplies *, std::size_t) { fn(); },
+        0);
+}
+
+std::future<std::optional<uint64_t>> AsyncRedis::VerifyUser(uint64_t key, std::string_view token) {
+    auto prom = std::make_shared<std::promise<std::optional<uint64_t>>>();
+    auto fut = prom->get_future();
+    std::string token_key("token:");
+    token_key += token;
+    Submit(
+        key, [token_key = std::move(token_key)](sw::redis::Pipeline &pl) { pl.get(token_key); },
+        [prom](sw::redis::QueuedReplies *replies, std::size_t idx) {
+            std::optional<uint64_t> uid;
+            if (replies) {
+                try {
+                    auto ret = replies->get<sw::redis::OptionalString>(idx);
+                    uint64_t val;
+                    if (ret.has_value()) {
+                        const std::string &str = ret.value();
+                        auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), val);
+                        if (ec == std::errc()) uid = val;
+                    }
+                } catch (const sw::redis::Error &e) {
+                    spdlog::error("AsyncRedis VerifyUser error: {}", e.what());
+                }
+            }
+            prom->set_value(uid);
+        });
+    return fut;
+}
+
+void AsyncRedis::GetUserLocation(uint64_t key, uint64_t uid, std::function<void(LocationResult)> cb) {
+    std::string status_key = "status:";
+    status_key += std::to_string(uid);
+    Submit(
+        key,
+        [status_key = std::move(status_key)](sw::redis::Pipeline &pl) {
+            pl.eval(GET_USER_LOCATION_SCRIPT, {status_key}, {});
+        },
+        [cb = std::move(cb)](sw::redis::QueuedReplies *replies, std::size_t idx) {
+            LocationResult ret;
+            if (replies) {
+                try {
+                    ret.sid = replies->get<sw::redis::OptionalString>(idx);
+                    ret.ok = true;
+                } catch (const sw::redis::Error &e) {
+                    // 错误回复或者类型不符，同样以失败的形式回调
+                    spdlog::error("AsyncRedis GetUserLocation error: {}", e.what());
+                }
+            }
+            cb(std::move(ret));
+        });
+}
+
+void AsyncRedis::SendToMsgQueue(uint64_t key, std::string_view server_id, std::string_view origin, uint64_t from,
+                                uint64_t to, std::string_view content, std::function<void(bool)> cb,
+                                int queue_max_len) {
+    std::string mq_key = "stream:server:";
+    mq_key += server_id;
+    Submit(
+        key,
+        [mq_key = std::move(mq_key), envelope = EncodeEnvelope(EnvelopeType::CHAT, from, to, content, origin),
+         queue_max_len](sw::redis::Pipeline &pl) {
+            std::array<std::pair<std::string_view, std::string_view>, 1> msg = {{{MQ_ENVELOPE_FIELD, envelope}}};
+            pl.xadd(mq_key, "*", msg.begin(), msg.end(), queue_max_len, true);
+        },
+        [cb = std::move(cb)](sw::redis::QueuedReplies *replies, std::size_t idx) {
+            bool ok = false;
+            if (replies) {
+                try {
+                    ok = !replies->get<std::string>(idx).empty();
+                } catch (const sw::redis::Error &e) {
+                    // 错误回复（例如队列键类型不符）同样以失败的形式回调，而不是让回调丢失
+                    spdlog::error("AsyncRedis SendToMsgQueue error: {}", e.what());
+                }
+            }
+            if (cb) cb(ok);
+        });
+}
+
+void AsyncRedis::GetUserLocations(uint64_t key, const std::vector<uint64_t> &uids,
+                                  std::function<void(std::vector<LocationResult>)> cb) {
+    // uids为空时不追加任何命令，回调同样排在之前以相同key提交的命令之后执行
+    std::size_t count = uids.size();
+    std::vector<std::string> keys;
+    keys.reserve(count);
+    for (uint64_t uid : uids) {
+        keys.push_back("status:" + std::to_string(uid));
+    }
+    Submit(
+        key,
+        [keys = std::move(keys)](sw::redis::Pipeline &pl) {
+            for (const auto &status_key : keys) {
+                pl.eval(GET_USER_LOCATION_SCRIPT, {status_key}, {});
+            }
+        },
+        [cb = std::move(cb), count](sw::redis::QueuedReplies *replies, std::size_t idx) {
+            std::vector<LocationResult> ret(count);
+            if (replies) {
+                for (std::size_t i = 0; i < count; ++i) {
+                    try {
+                        ret[i].sid = replies->get<sw::redis::OptionalString>(idx + i);
+                        ret[i].ok = true;
+                    } catch (const sw::redis::Error &e) {
+                        spdlog::error("AsyncRedis GetUserLocations error: {}", e.what());
+                    }
+                }
+            }
+            cb(std::move(ret));
+        },
+        count);
+}
+
+void AsyncRedis::GetGroupLocations(
+    uint64_t key, uint64_t gid, std::function<void(std::optional<std::vector<std::pair<uint64_t, std::string>>>)> cb) {
+    auto scan = std::make_shared<GroupScan>();
+    scan->group_key = "group:" + std::to_string(gid);
+    scan->cb = std::move(cb);
+    ScanGroupLocations(scan, "0", key, true);
+}
+
+void AsyncRedis::ScanGroupLocations(const std::shared_ptr<GroupScan> &scan, std::string cursor, uint64_t key,
+                                    bool first) {
+    auto append = [scan, cursor = std::move(cursor)](sw::redis::Pipeline &pl) {
+        pl.eval(GET_GROUP_LOCATIONS_SCRIPT, {scan->group_key}, {cursor, std::to_string(GROUP_SCAN_COUNT)});
+    };
+    auto on_reply = [this, scan, key](sw::redis::QueuedReplies *replies, std::size_t idx) {
+        std::string next;
+        bool ok = false;
+        if (replies) {
+            try {
+                auto flat = replies->get<std::vector<std::string>>(idx);
+                if (!flat.empty()) {
+                    next = std::move(flat[0]);
+                    for (std::size_t i = 1; i + 1 < flat.size(); i += 2) {
+                        scan->out.emplace_back(std::stoull(flat[i]), std::move(flat[i + 1]));
+                    }
+                    ok = true;
+                }
+            } catch (const std::exception &e) {
+                spdlog::error("AsyncRedis GetGroupLocations error: {}", e.what());
+            }
+        }
+        if (!ok) {
+            scan->cb(std::nullopt);
+        } else if (next != "0") {
+            ScanGroupLocations(scan, std::move(next), key, false);
+        } else {
+            // SSCAN可能多次返回同一个成员，去重后再回调
+            auto &out = scan->out;
+            std::sort(out.begin(), out.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+            auto same = [](const auto &a, const auto &b) { return a.first == b.first; };
+            out.erase(std::unique(out.begin(), out.end(), same), out.end());
+            scan->cb(std::move(out));
+        }
+    };
+    if (first) {
+        Submit(key, std::move(append), std::move(on_reply));
+    } else {
+        Continue(std::move(append), std::move(on_reply));
+    }
+}
+
+void AsyncRedis::SendGroupToMsgQueue(uint64_t key, std::string_view server_id, std::string_view origin, uint64_t gid,
+                                     uint64_t from, const std::vector<uint64_t> &to, std::string_view content,
+                                     std::function<void(bool)> cb, int queue_max_len) {
+    std::string mq_key = "stream:server:";
+    mq_key += server_id;
+    Submit(
+        key,
+        [mq_key = std::move(mq_key),
+         envelope = EncodeEnvelope(EnvelopeType::GROUP_CHAT, from, gid, content, origin, &to),
+         queue_max_len](sw::redis::Pipeline &pl) {
+            std::array<std::pair<std::string_view, std::string_view>, 1> msg = {{{MQ_ENVELOPE_FIELD, envelope}}};
+            pl.xadd(mq_key, "*", msg.begin(), msg.end(), queue_max_len, true);
+        },
+        [cb = std::move(cb)](sw::redis::QueuedReplies *replies, std::size_t idx) {
+            bool ok = false;
+            if (replies) {
+                try {
+                    ok = !replies->get<std::string>(idx).empty();
+                } catch (const sw::redis::Error &e) {
+                    // 错误回复（例如队列键类型不符）同样以失败的形式回调，而不是让回调丢失
+                    spdlog::error("AsyncRedis SendGroupToMsgQueue error: {}", e.what());
+                }
+            }
+            if (cb) cb(ok);
+        });
+}
+
+void AsyncRedis::UpdateUserStatus(uint64_t key, std::string_view server_id, uint64_t uid, uint64_t lease_epoch,
+                                  std::function<void(bool)> cb) {
+    std::string key_name = "status:";
+    key_name += std::to_string(uid);
+    if (lease_epoch != 0) {
+        // 与RedisMgr::UpdateUserStatus的租约模式相同：写入纪元并把键的过期时间设为LEASE_STATUS_TTL
+        Submit(
+            key,
+            [key_name = std::move(key_name), server_id = std::string(server_id),
+             epoch = std::to_string(lease_epoch)](sw::redis::Pipeline &pl) {
+                pl.command("HSET", key_name, "server_id", server_id, "status", "online", LEASE_EPOCH_FIELD, epoch);
+                pl.expire(key_name, LEASE_STATUS_TTL);
+            },
+            [cb = std::move(cb)](sw::redis::QueuedReplies *replies, std::size_t idx) {
+                // HSET返回新增的字段数，重复登录时可能为0，因此只检查两条命令都没有返回错误
+                bool ok = false;
+                if (replies) {
+                    try {
+                        replies->get<long long>(idx);
+                        ok = replies->get<bool>(idx + 1);
+                    } catch (const sw::redis::Error &e) {
+                        spdlog::error("AsyncRedis UpdateUserStatus error: {}", e.what());
+                    }
+                }
+                if (cb) cb(ok);
+            },
+            2);
+        return;
+    }
+    Submit(
+        key,
+        [key_name = std::move(key_name), server_id = std::string(server_id)](sw::redis::Pipeline &pl) {
+            // 与RedisMgr::UpdateUserStatus中的hsetex相同：设置字段并将过期时间设为30s
+            pl.command("HSETEX", key_name, "EX", "30", "FIELDS", "2", "server_id", server_id, "status", "online");
+        },
+        [cb = std::move(cb)](sw::redis::QueuedReplies *replies, std::size_t idx) {
+            bool ok = false;
+            if (replies) {
+                try {
+                    ok = replies->get<long long>(idx) == 1;
+                } catch (const sw::redis::Error &e) {
+                    // 错误回复（例如服务器不支持HSETEX）同样以失败的形式回调，而不是让回调丢失
+                    spdlog::error("AsyncRedis UpdateUserStatus error: {}", e.what());
+                }
+            }
+            if (cb) cb(ok);
+        });
+}
+}  // namespace chatroom::backend
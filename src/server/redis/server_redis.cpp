@@ -3,9 +3,12 @@
 #include <absl/strings/numbers.h>
 #include <sw/redis++/errors.h>
 
+#include <array>
 #include <chrono>
 #include <iterator>
 
+#include "common/mq_envelope.hpp"
+#include "common/presence_lease.hpp"
 #include "log/log_manager.hpp"
 
 namespace chatroom::backend {
@@ -23,25 +26,78 @@ std::optional<uint64_t> RedisMgr::VerifyUser(std::string_view token) {
 std::optional<std::string> RedisMgr::GetUserLocation(uint64_t uid) {
     std::string key = "status:";
     key += std::to_string(uid);
-    auto ret = GetRedis().hget(key, "server_id");
-    return ret;
+    return GetRedis().eval<sw::redis::OptionalString>(GET_USER_LOCATION_SCRIPT, {key}, {});
+}
+
+void RedisMgr::GetUserLocations(const std::vector<uint64_t> &uids, std::vector<std::optional<std::string>> &out) {
+    out.clear();
+    if (uids.empty()) {
+        return;
+    }
+    auto pl = GetPipeline();
+    for (uint64_t uid : uids) {
+        pl.eval(GET_USER_LOCATION_SCRIPT, {"status:" + std::to_string(uid)}, {});
+    }
+    auto replies = pl.exec();
+    out.reserve(uids.size());
+    for (std::size_t i = 0; i < uids.size(); ++i) {
+        out.push_back(replies.get<sw::redis::OptionalString>(i));
+    }
 }
 
 std::string RedisMgr::SendToMsgQueue(std::string_view server_id, uint64_t from, uint64_t to, std::string_view content,
                                      int queue_max_len) {
     std::string mq_key = "stream:server:";
     mq_key += server_id;
-    std::string from_str = std::to_string(from);
-    std::string to_str = std::to_string(to);
-    std::vector<std::pair<std::string_view, std::string_view>> msg = {
-        {"from", from_str}, {"to", to_str}, {"content", content}};
+    std::string envelope = EncodeEnvelope(EnvelopeType::CHAT, from, to, content);
+    std::array<std::pair<std::string_view, std::string_view>, 1> msg = {{{MQ_ENVELOPE_FIELD, envelope}}};
     // approx = true
     return GetRedis().xadd(mq_key, "*", msg.begin(), msg.end(), queue_max_len, true);
 }
 
-bool RedisMgr::UpdateUserStatus(std::string_view server_id, uint64_t uid) {
+bool RedisMgr::GetGroupMembers(uint64_t gid, std::vector<uint64_t> &out) {
+    std::string key = "group:";
+    key += std::to_string(gid);
+    std::vector<std::string> members;
+    GetRedis().smembers(key, std::back_inserter(members));
+    if (members.empty()) {
+        return false;
+    }
+    out.reserve(members.size());
+    for (const auto &member : members) {
+        out.push_back(std::stoull(member));
+    }
+    return true;
+}
+
+void RedisMgr::SendLocationInvalidates(const std::vector<std::pair<std::string_view, uint64_t>> &stale,
+                                       int queue_max_len) {
+    if (stale.empty()) {
+        return;
+    }
+    auto pl = GetPipeline();
+    for (const auto &[server_id, uid] : stale) {
+        std::string mq_key = "stream:serverctl:";
+        mq_key += server_id;
+        std::string envelope = EncodeEnvelope(EnvelopeType::LOC_INVALIDATE, 0, uid);
+        std::array<std::pair<std::string_view, std::string_view>, 1> msg = {{{MQ_ENVELOPE_FIELD, envelope}}};
+        pl.xadd(mq_key, "*", msg.begin(), msg.end(), queue_max_len, true);
+    }
+    pl.exec();
+}
+
+bool RedisMgr::UpdateUserStatus(std::string_view server_id, uint64_t uid, uint64_t lease_epoch) {
     std::string key_name = "status:";
     key_name += std::to_string(uid);
+    if (lease_epoch != 0) {
+        // 租约模式：在线状态随服务器的租约失效，键本身使用较长的过期时间（覆盖网关设置的过期时间）
+        auto pl = GetPipeline();
+        pl.command("HSET", key_name, "server_id", server_id, "status", "online", LEASE_EPOCH_FIELD,
+                   std::to_string(lease_epoch));
+        pl.expire(key_name, LEASE_STATUS_TTL);
+        pl.exec();
+        return true;
+    }
     thread_local std::unordered_map<string, string> user_data = {{"server_id", "unset"}, {"status", "online"}};
     user_data["server_id"] = server_id;
     auto ans = GetRedis().hsetex(key_name, user_data.begin(), user_data.end(), std::chrono::seconds(30),
@@ -49,8 +105,52 @@ bool RedisMgr::UpdateUserStatus(std::string_view server_id, uint64_t uid) {
     return ans == 1;
 }
 
+void RedisMgr::RegisterResumeTokens(const std::vector<std::pair<std::string, uint64_t>> &tokens,
+                                    std::chrono::seconds ttl) {
+    if (tokens.empty()) return;
+    auto pl = GetPipeline();
+    for (const auto &[token, uid] : tokens) {
+        std::string key("token:");
+        key += token;
+        pl.set(key, std::to_string(uid), ttl);
+    }
+    pl.exec();
+}
+
+uint64_t RedisMgr::AcquireServerLease(std::string_view server_id, std::chrono::milliseconds ttl) {
+    auto epoch = static_cast<uint64_t>(GetRedis().incr(LeaseEpochKey(server_id)));
+    GetRedis().set(ServerLeaseKey(server_id), std::to_string(epoch), ttl);
+    return epoch;
+}
+
+RedisMgr::LeaseRenewal RedisMgr::RenewServerLease(std::string_view server_id, uint64_t epoch,
+                                                  std::chrono::milliseconds ttl) {
+    auto ret = GetRedis().eval<long long>(RENEW_SERVER_LEASE_SCRIPT,
+                                          {ServerLeaseKey(server_id), LeaseEpochKey(server_id)},
+                                          {std::to_string(epoch), std::to_string(ttl.count())});
+    if (ret > 0) {
+        return LeaseRenewal::RENEWED;
+    }
+    return ret == 0 ? LeaseRenewal::REACQUIRED : LeaseRenewal::SUPERSEDED;
+}
+
+void RedisMgr::ReleaseServerLease(std::string_view server_id, uint64_t epoch) {
+    GetRedis().eval<long long>(RELEASE_SERVER_LEASE_SCRIPT, {ServerLeaseKey(server_id)}, {std::to_string(epoch)});
+}
+
 void RedisMgr::RecvFromMsgQueueNoACK(std::string_view server_id, std::string_view consumer_id,
                                      std::unordered_map<std::string, ItemStream> &out, uint block_ms, uint recv_count) {
+    ReadMsgQueue(server_id, consumer_id, out, block_ms, recv_count, true);
+}
+
+void RedisMgr::RecvFromMsgQueue(std::string_view server_id, std::string_view consumer_id,
+                                std::unordered_map<std::string, ItemStream> &out, uint block_ms, uint recv_count) {
+    ReadMsgQueue(server_id, consumer_id, out, block_ms, recv_count, false);
+}
+
+void RedisMgr::ReadMsgQueue(std::string_view server_id, std::string_view consumer_id,
+                            std::unordered_map<std::string, ItemStream> &out, uint block_ms, uint recv_count,
+                            bool noack) {
     std::string mq_key = "stream:server:";
     mq_key += server_id;
     std::string mq2_key = "stream:serverctl:";
@@ -60,12 +160,45 @@ void RedisMgr::RecvFromMsgQueueNoACK(std::string_view server_id, std::string_vie
     consumer += consumer_id;
     std::string group_name = "message_group";
     group_name += server_id;
-    // GetRedis().xread(mq_key, "$", std::chrono::milliseconds(block_ms), recv_count, std::back_inserter(out));
-    // noack = true
-    // GetRedis().xreadgroup(group_name, consumer, mq_key, ">", std::chrono::milliseconds(block_ms), recv_count, true,
-    // std::inserter(out, out.end()));
-    GetRedis().xreadgroup(group_name, consumer, mqs_name.begin(), mqs_name.end(), recv_count, true,
-                          std::inserter(out, out.end()));
+    if (block_ms == 0) {
+        GetRedis().xreadgroup(group_name, consumer, mqs_name.begin(), mqs_name.end(), recv_count, noack,
+                              std::inserter(out, out.end()));
+    } else {
+        // 带BLOCK参数：队列为空时由服务端挂起请求，有新条目或超时时才返回
+        GetRedis().xreadgroup(group_name, consumer, mqs_name.begin(), mqs_name.end(),
+                              std::chrono::milliseconds(block_ms), recv_count, noack, std::inserter(out, out.end()));
+    }
+}
+
+void RedisMgr::AckMsgQueue(std::string_view server_id,
+                           const std::unordered_map<std::string, std::vector<std::string>> &ids) {
+    std::string group_name = "message_group";
+    group_name += server_id;
+    auto pl = GetPipeline();
+    std::size_t cmds = 0;
+    for (const auto &[mq_key, mq_ids] : ids) {
+        if (mq_ids.empty()) continue;
+        pl.xack(mq_key, group_name, mq_ids.begin(), mq_ids.end());
+        ++cmds;
+    }
+    if (cmds > 0) {
+        pl.exec();
+    }
+}
+
+std::string RedisMgr::ClaimPendingMsgs(std::string_view mq_key, std::string_view server_id,
+                                       std::string_view consumer_id, std::string_view cursor, uint count,
+                                       ItemStream &out) {
+    std::string consumer = "server";
+    consumer += consumer_id;
+    std::string group_name = "message_group";
+    group_name += server_id;
+    // 回复：[下一次扫描的起始ID, 认领到的条目, 已被删除的条目ID]；min-idle-time为0，认领所有待确认的条目
+    auto reply = GetRedis().command<std::tuple<std::string, ItemStream, std::vector<std::string>>>(
+        "XAUTOCLAIM", mq_key, group_name, consumer, "0", cursor, "COUNT", std::to_string(count));
+    auto &items = std::get<1>(reply);
+    out.insert(out.end(), std::make_move_iterator(items.begin()), std::make_move_iterator(items.end()));
+    return std::move(std::get<0>(reply));
 }
 
 void RedisMgr::RegisterMsgQueue(std::string_view server_id, bool read_from_begin) {
@@ -1,10 +1,16 @@
 #include "server/server_class.hpp"
 
+#include <openssl/rand.h>
+
+#include <array>
 #include <cstdio>
+#include <cstring>
 #include <memory>
+#include <set>
 
 #include "log/log_manager.hpp"
 #include "server/session.hpp"
+#include "utils/field_op.hpp"
 
 namespace chatroom::backend {
 void ServerClass::AcceptorFn() {
@@ -20,6 +26,9 @@ void ServerClass::AcceptorFn() {
             sess->Start();
             AcceptorFn();
         } else {
+            if (err == boost::asio::error::operation_aborted && draining_) {
+                return;  // 排空时关闭了监听
+            }
             spdlog::error("Error when accepting new session: {}", err.what());
             return;
         }
@@ -27,4 +36,176 @@ void ServerClass::AcceptorFn() {
     acc_.async_accept(sess->sock_, accept_token);
 }
 
+void ServerClass::InitPeerLinks() {
+    // 对端按照本服务器登记的地址计算直连链路的端口，见MakePeerAddr()
+    std::string peer_addr = MakePeerAddr(server_addr_);
+    if (peer_addr.empty()) {
+        spdlog::error("Invalid server address {}, peer links disabled", server_addr_);
+        return;
+    }
+    auto port = static_cast<uint16_t>(std::stoul(peer_addr.substr(peer_addr.rfind(':') + 1)));
+    peers_ = std::make_shared<PeerLinkManager>(
+        std::to_string(server_id_), port,
+        [this](const std::string &origin, std::string_view packed) { mq_handler_->DeliverPacked(origin, packed); });
+    relay_->SetPeerLinks(peers_);
+}
+
+void ServerClass::StartPeerLinks() {
+    if (!peers_->Start()) {
+        // 无法监听时其他服务器连不上本服务器，但本服务器仍可以通过直连链路发送
+        spdlog::warn("Peer links are send-only on server {}", server_id_);
+    }
+    peer_timer_ = timer_mgr_->CreateTimer(PEER_REFRESH_INTERVAL, [this] { RefreshPeers(); }, true);
+    (*peer_timer_)->Activate();
+}
+
+void ServerClass::RefreshPeers() {
+    auto stub = rpc_cli_->GetThreadStatusStub();
+    if (!stub) return;
+    grpc::ClientContext ctx;
+    chatroom::status::DumpServerListReq req;
+    chatroom::status::ServerItemListResp resp;
+    auto rpc_status = stub->DumpServerList(&ctx, req, &resp);
+    if (!rpc_status.ok() || resp.ret() != 0) {
+        spdlog::warn("Failed to fetch server list for peer links: {}", rpc_status.error_message());
+        return;
+    }
+    std::unordered_map<std::string, std::string> peers;
+    for (const auto &item : resp.servers()) {
+        if (item.id() == server_id_) continue;
+        std::string addr = MakePeerAddr(item.addr());
+        if (!addr.empty()) {
+            peers.emplace(std::to_string(item.id()), std::move(addr));
+        }
+    }
+    peers_->UpdatePeers(peers);
+}
+
+// @brief 生成恢复用的token：24个随机字节的十六进制表示
+static std::string ResumeTokenGenerator() {
+    std::array<unsigned char, 24> bytes{};
+    if (RAND_bytes(bytes.data(), bytes.size()) != 1) {
+        return {};
+    }
+    static constexpr char HEX[] = "0123456789abcdef";
+    std::string token;
+    token.reserve(bytes.size() * 2);
+    for (unsigned char b : bytes) {
+        token.push_back(HEX[b >> 4]);
+        token.push_back(HEX[b & 0xf]);
+    }
+    return token;
+}
+
+bool ServerClass::Drain(DrainOptions opts, std::function<void()> on_done) {
+    if (draining_.exchange(true)) {
+        return false;
+    }
+    spdlog::info("Server {} draining: window {} ms, deadline {} ms", server_id_, opts.window.count(),
+                 opts.deadline.count());
+    errcode ec;
+    acc_.close(ec);  // 不再接受新连接
+    // RPC和Redis调用都是同步的，放在单独的线程上执行，避免阻塞会话所在的io_context
+    drain_th_ = std::thread([this, opts, on_done = std::move(on_done)]() mutable { DrainFn(opts, std::move(on_done)); });
+    return true;
+}
+
+bool ServerClass::DrainWaitUntil(std::chrono::steady_clock::time_point tp) {
+    std::unique_lock lock(drain_mtx_);
+    return drain_cv_.wait_until(lock, tp, [this] { return drain_stop_; });
+}
+
+void ServerClass::DrainFn(DrainOptions opts, std::function<void()> on_done) {
+    auto start = std::chrono::steady_clock::now();
+    // 让负载均衡器不再把新用户分配到本服务器，之后每一批用户的目标分别查询
+    reporter_->SetDraining(true);
+    reporter_->UpdateNow();
+
+    // 尚未验证的连接没有用户可以迁移，直接关闭
+    std::vector<std::shared_ptr<Session>> sessions;
+    sess_mgr_->GetTempSessions(sessions);
+    for (auto &sess : sessions) {
+        sess->Close();
+    }
+    sessions.clear();
+
+    sess_mgr_->GetAllSessions(sessions);
+    const std::size_t total = sessions.size();
+    std::size_t next = 0;
+    std::size_t migrated = 0;
+    std::set<uint32_t> used_targets;
+    std::vector<std::pair<uint32_t, std::string>> targets;
+    std::vector<std::pair<std::string, uint64_t>> tokens;
+    while (next < total) {
+        // 按经过的时间计算到目前为止应当处理的会话数，使通知均匀分布在window内
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        std::size_t due = total;
+        if (elapsed < opts.window) {
+            double progress = elapsed / opts.window;
+            due = std::min(total, static_cast<std::size_t>(static_cast<double>(total) * progress) + 1);
+        }
+        std::size_t first = next;
+        // 每个用户在状态服务器上分别选择目标并预留，一批用户按当前的负载分散到多个服务器上；
+        // 一批超过一次请求的上限时，剩余的用户轮流使用已经分配到的目标
+        auto count = static_cast<uint32_t>(std::min<std::size_t>(due - first, DRAIN_MAX_TARGETS_PER_QUERY));
+        bool migrate = count > 0 && reporter_->QueryMigrationTargets(count, targets);
+        if (migrate) {
+            tokens.clear();
+            for (std::size_t i = first; i < due; ++i) {
+                tokens.emplace_back(ResumeTokenGenerator(), sessions[i]->GetUserId());
+            }
+            try {
+                redis_->RegisterResumeTokens(tokens, opts.token_ttl);
+            } catch (const sw::redis::Error &e) {
+                spdlog::error("Failed to register resume tokens, closing sessions instead: {}", e.what());
+                migrate = false;
+            }
+        } else if (count > 0) {
+            spdlog::warn("No migration target available, closing {} sessions", due - first);
+        }
+        for (std::size_t i = first; i < due; ++i) {
+            if (migrate && !tokens[i - first].first.empty()) {
+                const auto &[target_id, target_addr] = targets[(i - first) % targets.size()];
+                const std::string &token = tokens[i - first].first;
+                std::string content(sizeof(uint16_t) + target_addr.size() + token.size(), '\0');
+                WriteNetField16(content.data(), target_addr.size());
+                std::memcpy(content.data() + sizeof(uint16_t), target_addr.data(), target_addr.size());
+                std::memcpy(content.data() + sizeof(uint16_t) + target_addr.size(), token.data(), token.size());
+                sessions[i]->Send(content, SERVER_MIGRATE);
+                used_targets.insert(target_id);
+                ++migrated;
+            } else {
+                sessions[i]->Close();
+            }
+        }
+        for (std::size_t i = first; i < due; ++i) {
+            sessions[i].reset();
+        }
+        next = due;
+        if (next < total && DrainWaitUntil(std::chrono::steady_clock::now() + DRAIN_TICK)) {
+            return;
+        }
+    }
+    spdlog::info("Sent {} migration notices to {} sessions, spread over {} servers", migrated, total,
+                 used_targets.size());
+
+    // 客户端连接到目标服务器后会关闭与本服务器的连接；等待所有会话（包括正在关闭的临时会话）离开，或者到期
+    auto deadline = start + opts.deadline;
+    while (sess_mgr_->GetTotalSessionCount() > 0 && std::chrono::steady_clock::now() < deadline) {
+        if (DrainWaitUntil(std::min(deadline, std::chrono::steady_clock::now() + DRAIN_TICK))) {
+            return;
+        }
+    }
+    sessions.clear();
+    sess_mgr_->GetAllSessions(sessions);
+    sess_mgr_->GetTempSessions(sessions);
+    if (!sessions.empty()) {
+        spdlog::warn("Drain deadline passed, closing {} remaining sessions", sessions.size());
+    }
+    for (auto &sess : sessions) {
+        sess->Close();
+    }
+    spdlog::info("Server {} drained", server_id_);
+    boost::asio::post(ctx_, std::move(on_done));
+}
 }  // namespace chatroom::backend
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include <boost/asio.hpp>
+#include <functional>
 #include <iostream>
 
 #include "server/server_class.hpp"
@@ -14,6 +15,7 @@ int main(int argc, char **argv) {
     string status_rpc_addr = "192.168.56.101:3000";
     uint32_t listen_port = 1235;
     string server_addr = std::string("192.168.56.101:") + std::to_string(listen_port);
+    uint32_t capacity = chatroom::backend::DEFAULT_SERVER_CAPACITY;
     if (argc == 1) {
         // default
     } else if (argc == 2) {
@@ -27,8 +29,14 @@ int main(int argc, char **argv) {
         server_addr = argv[2];
         listen_port = std::stoul(argv[3]);
         server_addr += ":" + std::to_string(listen_port);
+    } else if (argc == 5) {
+        server_id = std::stoul(argv[1]);
+        server_addr = argv[2];
+        listen_port = std::stoul(argv[3]);
+        server_addr += ":" + std::to_string(listen_port);
+        capacity = std::stoul(argv[4]);
     } else {
-        cout << "usage:" << argv[0] << " [server_id] [server_addr] [listen_port]\n";
+        cout << "usage:" << argv[0] << " [server_id] [server_addr] [listen_port] [capacity]\n";
         return -1;
     }
 
@@ -36,6 +44,7 @@ int main(int argc, char **argv) {
     cout << "ServerID: " << server_id << "\n";
     cout << "ServerAddr: " << server_addr << "\n";
     cout << "ListenPort: " << listen_port << "\n";
+    cout << "Capacity: " << capacity << "\n";
     cout << "Starting server\n";
     try {
         boost::asio::io_context ctx;
@@ -58,12 +67,24 @@ int main(int argc, char **argv) {
         pool_opt.connection_lifetime = std::chrono::minutes(10);  // 连接的最大生命时长，超过时长连接会过期并重新建立
 
         chatroom::backend::ServerClass srv(server_id, server_addr, ctx, status_rpc_addr, conn_opt, pool_opt);
+        srv.SetCapacity(capacity);
 
-        sigset.async_wait([&ctx, &srv](const errcode &err, int sig) {
-            // 收到了信号
+        // SIGTERM：先排空（把用户迁移到其他服务器）再退出，用于滚动重启；
+        // SIGINT或者排空过程中再次收到信号：立即退出
+        bool draining = false;
+        std::function<void(const errcode &, int)> on_signal = [&](const errcode &err, int sig) {
+            if (err) return;
+            if (sig == SIGTERM && !draining) {
+                printf("Draining\n");
+                draining = true;
+                srv.Drain(chatroom::backend::DrainOptions{}, [&ctx] { ctx.stop(); });
+                sigset.async_wait(on_signal);
+                return;
+            }
             printf("Stopping\n");
             ctx.stop();
-        });
+        };
+        sigset.async_wait(on_signal);
 
         srv.Listen(local);  // 监听
 
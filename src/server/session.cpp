@@ -14,16 +14,22 @@ using namespace boost::asio;
 namespace chatroom::backend {
 using msg_ptr = std::shared_ptr<MsgNode>;
 void Session::Send(const char *content, uint32_t send_len, uint32_t tag) {
-    msg_ptr ptr = std::make_shared<MsgNode>(content, send_len, tag);  // 实际缓冲区长度为HEAD_LEN + send_len
-    // 如果队列原本是空的，表示当前没有正在执行的发送
-    // 那么我们就执行QueueSend函数以启动异步发送程序
+    msg_ptr ptr = MakeMsgNode(content, send_len, tag);  // 实际缓冲区长度为HEAD_LEN + send_len
+    Send(std::move(ptr));
+}
+
+// Send3
+void Session::Send(std::shared_ptr<MsgNode> ptr) {
+    // 如果当前没有正在执行的写入，那么我们就执行QueueSend函数以启动异步发送程序
+    // 否则报文会在当前写入完成后，与队列中的其他报文一起被聚合发送
     // 对队列的操作通过send_latch保护
     bool start_send;
     {
         // 临界区
         // Send和Send之间不会冲突，能够确保任意时间只有至多一个Session的QueueSend会被执行
         std::unique_lock lck(send_latch_);
-        start_send = send_q_.empty();
+        start_send = !writing_;
+        writing_ = true;
         send_q_.push_back(std::move(ptr));
     }
     if (start_send) {
@@ -31,31 +37,42 @@ void Session::Send(const char *content, uint32_t send_len, uint32_t tag) {
     }
 }
 
-// Send3
-void Session::Send(std::shared_ptr<MsgNode> ptr) {
-    // 如果队列原本是空的，表示当前没有正在执行的发送
-    // 那么我们就执行QueueSend函数以启动异步发送程序
-    // 对队列的操作通过send_latch保护
+// Send4
+void Session::Send(std::vector<std::shared_ptr<MsgNode>> &&msgs) {
+    if (msgs.empty()) {
+        return;
+    }
     bool start_send;
     {
-        // 临界区
-        // Send和Send之间不会冲突，能够确保任意时间只有至多一个Session的QueueSend会被执行
         std::unique_lock lck(send_latch_);
-        start_send = send_q_.empty();
-        send_q_.push_back(std::move(ptr));
+        start_send = !writing_;
+        writing_ = true;
+        for (auto &ptr : msgs) {
+            send_q_.push_back(std::move(ptr));
+        }
     }
+    msgs.clear();
     if (start_send) {
         QueueSend();
     }
 }
 
 void Session::QueueSend() {
-    // 临界区
+    // 临界区：取出队列中的所有报文（受聚合上限限制）
     {
         std::unique_lock lck(send_latch_);
-        if (send_q_.empty()) return;
-        sending_ = std::move(send_q_.front());
-        send_q_.pop_front();
+        if (send_q_.empty()) {
+            writing_ = false;  // 没有要发送的数据了，下一次Send()会重新启动发送
+            return;
+        }
+        size_t bytes = 0;
+        while (!send_q_.empty() && sending_.size() < MAX_GATHER_FRAMES) {
+            size_t len = send_q_.front()->ctx_len_ + HEAD_LEN;
+            if (!sending_.empty() && bytes + len > MAX_GATHER_BYTES) break;
+            bytes += len;
+            sending_.push_back(std::move(send_q_.front()));
+            send_q_.pop_front();
+        }
     }
 
     // 发送操作完成后的回调函数
@@ -67,18 +84,26 @@ void Session::QueueSend() {
             self->Close();
             return;
         }
+        // 本批报文发送完毕，释放它们
+        self->sending_.clear();
         // 鉴于消费者只有一个，不用担心在临界区之间的间隙中该队列变空
         if (!self->down_) {
             self->QueueSend();
         }
     };
 
-    // 开始异步操作，ptr以及session自身保证有效
+    // 构造聚合写入的缓冲区序列，async_write会以writev的方式一次提交
+    send_bufs_.clear();
+    for (auto &node : sending_) {
+        assert(node->cur_pos_ == 0);  // sending msg's cur_pos should be zero
+        send_bufs_.emplace_back(node->data_, node->ctx_len_ + HEAD_LEN);
+    }
+    write_count_.fetch_add(1, std::memory_order_relaxed);
+    write_frames_.fetch_add(sending_.size(), std::memory_order_relaxed);
+
+    // 开始异步操作，sending_中的报文以及session自身保证有效
     // strand保护同一strand的回调不会被并发执行
-    assert(sending_->cur_pos_ == 0);  // sending msg's cur_pos should be zero
-    boost::asio::async_write(
-        sock_, buffer(sending_->data_ + sending_->cur_pos_, sending_->ctx_len_ + HEAD_LEN - sending_->cur_pos_),
-        bind_executor(strand_, cb));
+    boost::asio::async_write(sock_, send_bufs_, bind_executor(strand_, cb));
 }
 
 void Session::ReceiveHandler(uint32_t content_len, uint32_t tag) {
@@ -88,7 +113,56 @@ void Session::ReceiveHandler(uint32_t content_len, uint32_t tag) {
         return;  // 异步过程中，handler对象已经被销毁了
     }
     handler->PostMessage(shared_from_this(), std::move(this->recv_ptr_));
-    this->recv_ptr_ = std::make_shared<MsgNode>(INITIAL_NODE_SIZE);  // 发送完数据之后创建新节点
+#ifndef USING_RING_READER
+    this->recv_ptr_ = MakeMsgNode(INITIAL_NODE_SIZE);  // 发送完数据之后创建新节点
+#endif
+}
+
+void Session::ReceiveSome() {
+    auto cb = [self = shared_from_this()](const boost::system::error_code &err, std::size_t bytes_rcvd) {
+        if (err) {
+            if (err == boost::asio::error::eof) {
+                spdlog::debug("Remote host closed connection");
+                self->Close();
+                return;
+            }
+            // tell that error!
+            spdlog::error("Error occured in ReceiveSome(): {}", err.what().c_str());
+            self->Close();
+            return;
+        }
+        if (self->down_) {  // 检查会话状态
+            return;
+        }
+        self->recv_ring_.CommitWrite(bytes_rcvd);
+        std::shared_ptr<MsgNode> large;
+        auto status = self->recv_ring_.ParseFrames(self->batch_, large);
+        if (status == RecvRing::ParseStatus::BAD_FRAME) {
+            // 超出最大报文长度了！
+            spdlog::error("Message content length exceeds the limit {}", MAX_CTX_LEN);
+            self->Close();
+            return;
+        }
+        if (!self->batch_.empty()) {
+            // 本次读取得到的所有报文作为一批投递给MsgHandler
+            auto handler = self->handler_.lock();
+            if (!handler) {
+                self->Close();
+                return;  // 异步过程中，handler对象已经被销毁了
+            }
+            handler->PostMessages(self, std::move(self->batch_));
+            self->batch_.clear();
+        }
+        if (status == RecvRing::ParseStatus::LARGE_FRAME) {
+            // 大报文：按原方式读取剩余内容，读取完毕后回到ReceiveSome()
+            self->recv_ptr_ = std::move(large);
+            self->ReceiveContent();
+        } else {
+            self->ReceiveSome();
+        }
+    };
+
+    sock_.async_read_some(recv_ring_.PrepareWrite(), boost::asio::bind_executor(strand_, cb));
 }
 
 void Session::ReceiveHead() {
@@ -158,9 +232,14 @@ void Session::ReceiveContent() {
             // 处理了一整个消息
             uint32_t tag = self->recv_ptr_->GetTagField();
             self->ReceiveHandler(self->recv_ptr_->ctx_len_, tag);
+#ifdef USING_RING_READER
+            // 大报文接收完毕，回到环形缓冲区的读取
+            self->ReceiveSome();
+#else
             // 处理完毕后清除缓冲区，准备下一次接收
             self->recv_ptr_->Zero();
             self->ReceiveHead();
+#endif
         } else {
             self->ReceiveContent();
         }
@@ -179,6 +258,8 @@ void Session::Close() {
     bool expected = false;
     // 原子操作
     if (down_.compare_exchange_strong(expected, true)) {
+        spdlog::debug("Session {} closing, {} frames sent in {} writes (avg {:.2f} frames/write)", user_id_,
+                      GetWrittenFrames(), GetWriteCount(), GetAvgFramesPerWrite());
         // 异步操作会被中断
         sock_.close();
         auto handler = handler_.lock();
@@ -5,69 +5,93 @@
 
 namespace chatroom::backend {
 bool chatroom::backend::SessionManager::StopSession(UID sess_id) {
-    std::unique_lock lock(lck_);
-    auto it = sess_.find(sess_id);
-    if (it != sess_.end()) {
-        it->second->Close();
+    std::shared_ptr<Session> sess;
+    if (sess_.Find(sess_id, sess)) {
+        sess->Close();
         return true;
     }
     return false;
 }
 
 bool SessionManager::RemoveSession(UID sess_id) {
-    std::unique_lock lock(lck_);
-    return sess_.erase(sess_id) == 1;
+    return sess_.Erase(sess_id);
 }
 
 bool SessionManager::AddTempSession(std::shared_ptr<Session> sess) {
     std::unique_lock lock(temp_lck_);
     auto key = sess.get();
     // 等待到验证之后，我们才能够把其放到根据UID编号的数据结构中
-    return temp_sess_.try_emplace(key, std::move(sess)).second;
+    bool inserted = temp_sess_.try_emplace(key, std::move(sess)).second;
+    if (inserted) temp_count_.fetch_add(1, std::memory_order_relaxed);
+    return inserted;
 }
 
 bool SessionManager::AddSession(UID sess_id, std::shared_ptr<Session> sess) {
-    std::unique_lock lock(lck_);
-    std::unique_lock temp_lock(temp_lck_);
+    Session *key = sess.get();
+    // 先尝试插入 UID -> SessPtr，再从临时列表中移除，移动的过程中总数不会短暂地少计
+    bool inserted = sess_.TryEmplace(sess_id, std::move(sess));
 
     // 将会话从临时列表中移除
-    if (temp_sess_.erase(sess.get()) == 0) {
+    std::unique_lock temp_lock(temp_lck_);
+    if (temp_sess_.erase(key) == 0) {
         // not present in temporary list, whatever
         spdlog::warn("Verified Session not found in temporary list");
+    } else {
+        temp_count_.fetch_sub(1, std::memory_order_relaxed);
     }
-    temp_lock.unlock();  // 解锁，减小锁粒度
-
-    // 尝试插入 UID -> SessPtr
-    return sess_.try_emplace(sess_id, std::move(sess)).second;
+    return inserted;
 }
 
 bool SessionManager::RemoveTempSession(Session *sess_ptr) {
     std::unique_lock temp_lock(temp_lck_);
-    return temp_sess_.erase(sess_ptr) == 1;
+    bool erased = temp_sess_.erase(sess_ptr) == 1;
+    if (erased) temp_count_.fetch_sub(1, std::memory_order_relaxed);
+    return erased;
 }
 
-uint32_t SessionManager::GetSessionCount() {
-    std::unique_lock lock(lck_);
-    return sess_.size();
+void SessionManager::GetAllSessions(std::vector<std::shared_ptr<Session>> &out) {
+    out.reserve(out.size() + sess_.Size());
+    sess_.ForEach([&out](UID, const std::shared_ptr<Session> &sess) { out.push_back(sess); });
 }
 
-uint32_t SessionManager::GetTempSessionCount() {
+void SessionManager::GetTempSessions(std::vector<std::shared_ptr<Session>> &out) {
     std::unique_lock lock(temp_lck_);
-    return temp_sess_.size();
+    out.reserve(out.size() + temp_sess_.size());
+    for (const auto &item : temp_sess_) {
+        out.push_back(item.second);
+    }
 }
 
-uint32_t SessionManager::GetTotalSessionCount() {
-    std::unique_lock lock(lck_);
-    std::unique_lock temp_lock(temp_lck_);
-    return sess_.size() + temp_sess_.size();
-}
+uint32_t SessionManager::GetSessionCount() { return sess_.Size(); }
+
+uint32_t SessionManager::GetTempSessionCount() { return temp_count_.load(std::memory_order_relaxed); }
+
+uint32_t SessionManager::GetTotalSessionCount() { return GetSessionCount() + GetTempSessionCount(); }
 
 std::shared_ptr<Session> SessionManager::GetSession(UID sess_id) {
-    std::unique_lock lock(lck_);
-    auto it = sess_.find(sess_id);
-    if (it != sess_.end()) {
-        return it->second;
+    std::shared_ptr<Session> sess;
+    sess_.Find(sess_id, sess);
+    return sess;
+}
+
+void SessionManager::GetSessions(const std::vector<UID> &ids, std::vector<std::shared_ptr<Session>> &found,
+                                 std::vector<UID> *missing) {
+    std::shared_ptr<Session> sess;
+    for (UID id : ids) {
+        if (sess_.Find(id, sess)) {
+            found.push_back(std::move(sess));
+        } else if (missing) {
+            missing->push_back(id);
+        }
+    }
+}
+
+void SessionManager::LookupSessions(const std::vector<UID> &ids, std::vector<std::shared_ptr<Session>> &out) {
+    out.clear();
+    out.reserve(ids.size());
+    for (UID id : ids) {
+        out.emplace_back();
+        sess_.Find(id, out.back());
     }
-    return nullptr;
 }
 }  // namespace chatroom::backend
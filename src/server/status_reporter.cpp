@@ -9,18 +9,27 @@
 #include <spdlog/spdlog.h>
 
 namespace chatroom::backend {
-grpc::Status StatusReportRPCImpl::ReportLoad(uint32_t id, uint32_t load) {
+grpc::Status StatusReportRPCImpl::ReportLoad(uint32_t id, uint32_t load, bool draining, const LoadSample &sample,
+                                             uint32_t capacity) {
     auto stub = rpc_client_->GetThreadStatusStub();
     grpc::ClientContext ctx;
     chatroom::status::StatusReportReq req;
     chatroom::status::GeneralResp resp;
     req.set_server_id(id);
     req.set_load(load);
+    req.set_draining(draining);
+    req.set_cpu_usage(sample.cpu_usage);
+    req.set_mem_usage(sample.mem_usage);
+    req.set_msg_rate(sample.msg_rate);
+    req.set_queue_depth(sample.queue_depth);
+    req.set_p99_us(sample.p99_us);
+    req.set_capacity(capacity);
     auto rpc_status = stub->ReportServerLoad(&ctx, req, &resp);
     return rpc_status;
 }
 
-grpc::Status StatusReportRPCImpl::ReportServerRegister(uint32_t id, const std::string &serv_addr, uint32_t load) {
+grpc::Status StatusReportRPCImpl::ReportServerRegister(uint32_t id, const std::string &serv_addr, uint32_t load,
+                                                       bool draining, uint32_t capacity) {
     auto stub = rpc_client_->GetThreadStatusStub();
     grpc::ClientContext ctx;
     chatroom::status::ServerRegisterReq req;
@@ -28,13 +37,38 @@ grpc::Status StatusReportRPCImpl::ReportServerRegister(uint32_t id, const std::s
     req.set_server_id(id);
     req.set_server_addr(serv_addr);
     req.set_load(load);
+    req.set_draining(draining);
+    req.set_capacity(capacity);
     auto rpc_status = stub->RegisterServer(&ctx, req, &resp);
     return rpc_status;
 }
-grpc::Status StatusReportRPCImpl::ReportServerLeave() {
-    // auto stub = rpc_client_->GetThreadStatusStub();
-    // TODO(user): Implement ServerLeave interface in status service
-    return {grpc::StatusCode::UNIMPLEMENTED, "Not implemented"};
+
+grpc::Status StatusReportRPCImpl::QueryMinimalLoadServers(uint32_t count,
+                                                          std::vector<std::pair<uint32_t, std::string>> &out) {
+    auto stub = rpc_client_->GetThreadStatusStub();
+    grpc::ClientContext ctx;
+    chatroom::status::MinimalLoadServerReq req;
+    chatroom::status::ServerAddrResp resp;
+    req.set_count(count);
+    auto rpc_status = stub->CheckMinimalLoadServer(&ctx, req, &resp);
+    if (rpc_status.ok()) {
+        out.clear();
+        if (resp.targets_size() == 0) {
+            out.emplace_back(resp.server_id(), resp.server_addr());  // count为1，或者状态服务器不支持批量分配
+        }
+        for (const auto &target : resp.targets()) {
+            out.emplace_back(target.server_id(), target.server_addr());
+        }
+    }
+    return rpc_status;
+}
+grpc::Status StatusReportRPCImpl::ReportServerLeave(uint32_t id) {
+    auto stub = rpc_client_->GetThreadStatusStub();
+    grpc::ClientContext ctx;
+    chatroom::status::ServerLeaveReq req;
+    chatroom::status::GeneralResp resp;
+    req.set_server_id(id);
+    return stub->ServerLeave(&ctx, req, &resp);
 }
 
 // ***** StatusReporter *****
@@ -44,28 +78,87 @@ void StatusReporter::UpdateNow() {
     (*task_iter_)->Activate();
 }
 bool StatusReporter::Register() {
-    auto ret = rpc_impl_.ReportServerRegister(server_id_, server_addr_, sess_mgr_->GetSessionCount());
+    if (stream_) {
+        // 流的第一条消息就是登记信息
+        chatroom::status::LoadReport state;
+        state.set_load(sess_mgr_->GetSessionCount());
+        state.set_draining(draining_);
+        state.set_capacity(capacity_);
+        if (!stream_->Report(state)) {
+            spdlog::error("StatusReporter failed to open load report stream");
+            return false;
+        }
+        return true;
+    }
+    auto ret = rpc_impl_.ReportServerRegister(server_id_, server_addr_, sess_mgr_->GetSessionCount(), draining_,
+                                              capacity_);
     if (!ret.ok()) {
         spdlog::error("StatusReporter register rpc call failed: {}", ret.error_message());
     }
     return ret.ok();
 }
+bool StatusReporter::QueryMigrationTargets(uint32_t count, std::vector<std::pair<uint32_t, std::string>> &targets) {
+    auto ret = rpc_impl_.QueryMinimalLoadServers(count, targets);
+    if (!ret.ok()) {
+        spdlog::warn("StatusReporter query minimal load server failed: {}", ret.error_message());
+        return false;
+    }
+    // 排空状态已经上报时，只有在没有其他服务器的情况下才会返回本服务器
+    std::erase_if(targets, [this](const auto &target) { return target.first == server_id_; });
+    return !targets.empty();
+}
+
 void StatusReporter::Stop() {
     // stopped_ = true;
     if (stopped_.exchange(true)) return;
     (*task_iter_)->Cancel();
     timer_mgr_->RemoveTimer(task_iter_);
+    if (stream_) {
+        stream_->Close();  // 状态服务器在流结束时移除本服务器
+        LoadStreamStats stats = stream_->GetStats();
+        spdlog::info("Load report stream: {} opens, {} messages, {} bytes ({} bytes if sent in full)", stats.opens,
+                     stats.messages, stats.bytes, stats.full_bytes);
+        return;
+    }
+    auto ret = rpc_impl_.ReportServerLeave(server_id_);
+    if (!ret.ok()) {
+        spdlog::warn("StatusReporter leave rpc call failed: {}", ret.error_message());
+    }
 }
 
 void StatusReporter::ReportImpl() {
     uint32_t sess_count = sess_mgr_->GetSessionCount();
     uint32_t tmps_count = sess_mgr_->GetTempSessionCount();
-    spdlog::info("Reporting load: {} sessions, {} temporary sessions", sess_count, tmps_count);
-    auto ret = rpc_impl_.ReportLoad(server_id_, sess_count + tmps_count);
+    LoadSample sample;
+    if (sampler_) {
+        sample = sampler_->Sample();
+    }
+    // 流式上报的频率很高，只在debug级别输出
+    spdlog::log(stream_ ? spdlog::level::debug : spdlog::level::info,
+                "Reporting load: {} sessions, {} temporary sessions, cpu {}%, rss {} MiB, {} msg/s, queue depth {}, "
+                "p99 {} us",
+                sess_count, tmps_count, sample.cpu_usage, sample.mem_usage, sample.msg_rate, sample.queue_depth,
+                sample.p99_us);
+    if (stream_) {
+        chatroom::status::LoadReport state;
+        state.set_load(sess_count + tmps_count);
+        state.set_draining(draining_);
+        state.set_cpu_usage(sample.cpu_usage);
+        state.set_mem_usage(sample.mem_usage);
+        state.set_msg_rate(sample.msg_rate);
+        state.set_queue_depth(sample.queue_depth);
+        state.set_p99_us(sample.p99_us);
+        state.set_capacity(capacity_);
+        // 失败时下一次上报会重新建立流并重新登记
+        stream_->Report(state);
+        return;
+    }
+    auto ret = rpc_impl_.ReportLoad(server_id_, sess_count + tmps_count, draining_, sample, capacity_);
     if (!ret.ok()) {
         if (ret.error_code() == grpc::StatusCode::NOT_FOUND) {
             // server with that id not found
-            auto ret2 = rpc_impl_.ReportServerRegister(server_id_, server_addr_, sess_count + tmps_count);
+            auto ret2 = rpc_impl_.ReportServerRegister(server_id_, server_addr_, sess_count + tmps_count, draining_,
+                                                       capacity_);
             if (!ret2.ok()) {
                 spdlog::error("StatusReporter re-register rpc call failed: {}", ret2.error_message());
             }
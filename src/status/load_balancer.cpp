@@ -3,94 +3,218 @@
 #include <algorithm>
 #include <iterator>
 #include <mutex>
+#include <random>
 
 using namespace chatroom::status;
 
-bool chatroom::status::LoadBalancer::UpdateServerLoad(uint32_t id, uint32_t load) {
+namespace {
+// 快照的版本号在进程内全局递增，线程缓存不会把新的LoadBalancer（可能分配在同一地址上）的快照误认为旧的
+std::atomic<uint64_t> next_snapshot_version{1};
+}  // namespace
+
+chatroom::status::LoadBalancer::LoadBalancer(BalancePolicy policy, LoadWeights weights)
+    : policy_(policy), weights_(weights) {
+    std::unique_lock<std::mutex> lock(mtx_);
+    Publish();
+}
+
+void chatroom::status::LoadBalancer::ApplyReport(Entry &entry, uint32_t load, bool draining,
+                                                 const ServerMetrics &metrics) {
+    ServerInfo &si = entry.info;
+    si.load = load;
+    si.draining = draining;
+    si.metrics = metrics;
+    double capacity = (metrics.capacity == 0 ? 100.0 : metrics.capacity) / 100.0;
+    si.session_cost = weights_.session / capacity;
+    si.metric_cost = weights_.MetricCost(metrics) / capacity;
+    si.last_ts = GetTimestampMs();
+    si.provisional = false;
+    // 上报的负载已经包含了之前分配出去的登录
+    entry.reserved->store(0, std::memory_order_relaxed);
+}
+
+void chatroom::status::LoadBalancer::Publish() {
+    auto snap = std::make_shared<LoadSnapshot>();
+    snap->servers.reserve(hm_.size());
+    std::transform(hm_.begin(), hm_.end(), std::back_inserter(snap->servers),
+                   [](const auto &item) { return item.second; });
+    std::sort(snap->servers.begin(), snap->servers.end(), [](const Entry &lhs, const Entry &rhs) {
+        if (lhs.info.draining != rhs.info.draining) return rhs.info.draining;
+        double ls = lhs.Score(0);
+        double rs = rhs.Score(0);
+        return ls != rs ? ls < rs : lhs.info.id < rhs.info.id;
+    });
+    snap->version = next_snapshot_version.fetch_add(1, std::memory_order_relaxed);
+    uint64_t version = snap->version;
+    // 先发布快照再发布版本号：读者看到新的版本号时一定能加载到对应（或者更新）的快照
+    snapshot_.store(std::move(snap), std::memory_order_release);
+    version_.store(version, std::memory_order_release);
+}
+
+const LoadSnapshot &chatroom::status::LoadBalancer::CurrentSnapshot() const {
+    struct Cache {
+        const LoadBalancer *owner{nullptr};
+        uint64_t version{0};
+        std::shared_ptr<const LoadSnapshot> snap;
+    };
+    thread_local Cache cache;
+    // 快速路径只有一次原子读取；版本号变化时（每次上报一次）才加载新的快照
+    if (cache.owner != this || cache.version != version_.load(std::memory_order_acquire)) {
+        cache.snap = snapshot_.load(std::memory_order_acquire);
+        cache.owner = this;
+        cache.version = cache.snap->version;
+    }
+    return *cache.snap;
+}
+
+bool chatroom::status::LoadBalancer::UpdateServerLoad(uint32_t id, uint32_t load, bool draining,
+                                                      const ServerMetrics &metrics) {
     std::unique_lock<std::mutex> lock(mtx_);
     auto it = hm_.find(id);
     if (it == hm_.end()) {
         return false;
     } else {
-        ServerInfo *si = it->second.get();
-        uint32_t prev_load = si->load;
-        si->load = load;
-        si->last_ts = GetTimestampMs();
-        min_heap_.InsertOrUpdate(id, si, static_cast<int>(load) - static_cast<int>(prev_load));
+        ApplyReport(it->second, load, draining, metrics);
+        Publish();
         return true;
     }
 }
 
-bool chatroom::status::LoadBalancer::RegisterServerInfo(uint32_t id, std::string addr, uint32_t load) {
+bool chatroom::status::LoadBalancer::RegisterServerInfo(uint32_t id, std::string addr, uint32_t load, bool draining,
+                                                        const ServerMetrics &metrics) {
     std::unique_lock<std::mutex> lock(mtx_);
     auto it = hm_.find(id);
     if (it == hm_.end()) {
-        auto si = std::make_unique<ServerInfo>(id, std::move(addr), load);
-        min_heap_.InsertOrUpdate(id, si.get());
-        hm_.insert({id, std::move(si)});
-        return true;
+        Entry entry{ServerInfo(id, std::move(addr), load), std::make_shared<std::atomic<uint32_t>>(0)};
+        ApplyReport(entry, load, draining, metrics);
+        hm_.emplace(id, std::move(entry));
     } else {
         // 已存在服务器信息的情况重新收到登记信息，选择更新
-        ServerInfo *si = it->second.get();
-        uint32_t prev_load = si->load;
-        si->load = load;
-        si->last_ts = GetTimestampMs();
-        si->addr = std::move(addr);  // 更新地址
-        min_heap_.InsertOrUpdate(id, si, static_cast<int>(load) - static_cast<int>(prev_load));
-        return true;
+        it->second.info.addr = std::move(addr);  // 更新地址
+        ApplyReport(it->second, load, draining, metrics);
     }
+    Publish();
+    return true;
 }
 
 bool chatroom::status::LoadBalancer::RemoveServer(uint32_t id) {
     std::unique_lock<std::mutex> lock(mtx_);
-    auto it = hm_.find(id);
-    if (it == hm_.end()) {
+    if (hm_.erase(id) == 0) {
         return false;  // 不存在
-    } else {
-        min_heap_.AnyRemove(id);  // 从堆中移除
-        hm_.erase(it);            // 从哈希表中移除
-        return true;
     }
+    Publish();
+    return true;
 }
 
-std::pair<std::optional<ServerInfo>, bool> chatroom::status::LoadBalancer::GetMinimalLoadServerInfo() {
+uint32_t chatroom::status::LoadBalancer::RestoreServers(const std::vector<ServerInfo> &servers) {
     std::unique_lock<std::mutex> lock(mtx_);
-    bool updated = false;
-    while (!min_heap_.Empty()) {
-        ServerInfo *si;
-        si = min_heap_.Get();
-        if (GetTimestampMs() - si->last_ts < SERVER_TIMEOUT) {
-            return {*si, updated};  // 有效的服务器
-        } else {
-            updated = true;
-            min_heap_.Remove();      // 过期的服务器，移除
-            hm_.erase(si->GetID());  // 从哈希表中删除
+    uint32_t restored = 0;
+    uint64_t now = GetTimestampMs();
+    for (const ServerInfo &si : servers) {
+        uint64_t last_ts = std::min(si.last_ts, now);  // 快照可能来自时钟略快的另一台主机
+        if (now - last_ts >= SERVER_TIMEOUT || hm_.count(si.id) != 0) {
+            continue;
         }
+        Entry entry{ServerInfo(si.id, si.addr, si.load), std::make_shared<std::atomic<uint32_t>>(0)};
+        ApplyReport(entry, si.load, si.draining, si.metrics);
+        entry.info.last_ts = last_ts;
+        entry.info.provisional = true;
+        hm_.emplace(si.id, std::move(entry));
+        ++restored;
+    }
+    if (restored > 0) {
+        Publish();
     }
-    return {std::nullopt, updated};  // 没有有效的服务器
+    return restored;
+}
+
+const LoadSnapshot::Entry *chatroom::status::LoadBalancer::PickMinimal(const LoadSnapshot &snap, uint64_t now,
+                                                                       bool &expired) {
+    const Entry *best = nullptr;
+    double best_score = 0;
+    for (const Entry &entry : snap.servers) {
+        if (best != nullptr) {
+            // 快照按排名排序，预留数只会增大得分：之后的服务器不可能更好
+            if (entry.info.draining && !best->info.draining) break;
+            if (entry.info.draining == best->info.draining && entry.Score(0) >= best_score) break;
+        }
+        if (now - entry.info.last_ts >= SERVER_TIMEOUT) {
+            expired = true;  // 过期的服务器，等待CheckTTL()移除
+            continue;
+        }
+        double score = entry.Score(entry.reserved->load(std::memory_order_relaxed));
+        if (best == nullptr || (entry.info.draining == best->info.draining && score < best_score)) {
+            best = &entry;
+            best_score = score;
+        }
+    }
+    return best;
+}
+
+const LoadSnapshot::Entry *chatroom::status::LoadBalancer::PickTwoChoices(const LoadSnapshot &snap, uint64_t now) {
+    std::size_t n = snap.servers.size();
+    if (n < 2) {
+        return nullptr;
+    }
+    thread_local std::mt19937 rng(std::random_device{}());
+    // 不放回地抽取两个下标
+    std::size_t a = rng() % n;
+    std::size_t b = rng() % (n - 1);
+    if (b >= a) ++b;
+    auto usable = [now](const Entry &entry) {
+        return !entry.info.draining && now - entry.info.last_ts < SERVER_TIMEOUT;
+    };
+    const Entry *lhs = usable(snap.servers[a]) ? &snap.servers[a] : nullptr;
+    const Entry *rhs = usable(snap.servers[b]) ? &snap.servers[b] : nullptr;
+    if (lhs == nullptr || rhs == nullptr) {
+        return lhs != nullptr ? lhs : rhs;
+    }
+    return lhs->Score(lhs->reserved->load(std::memory_order_relaxed)) <=
+                   rhs->Score(rhs->reserved->load(std::memory_order_relaxed))
+               ? lhs
+               : rhs;
+}
+
+std::pair<std::optional<ServerInfo>, bool> chatroom::status::LoadBalancer::GetMinimalLoadServerInfo() {
+    const LoadSnapshot &snap = CurrentSnapshot();
+    uint64_t now = GetTimestampMs();
+    bool expired = false;
+    const Entry *entry = policy_ == BalancePolicy::TWO_CHOICES ? PickTwoChoices(snap, now) : nullptr;
+    if (entry == nullptr) {
+        entry = PickMinimal(snap, now, expired);
+    }
+    if (entry == nullptr) {
+        return {std::nullopt, expired};  // 没有有效的服务器
+    }
+    ServerInfo si = entry->info;
+    si.reserved = entry->reserved->fetch_add(1, std::memory_order_relaxed) + 1;
+    return {std::move(si), expired};
 }
 
 void chatroom::status::LoadBalancer::CopyServerInfoList(std::vector<ServerInfo> &out) {
-    std::unique_lock<std::mutex> lock(mtx_);
+    const LoadSnapshot &snap = CurrentSnapshot();
     out.clear();
-    out.reserve(hm_.size());
-    // for (const auto& item : hm_) {
-    //     out.push_back(*(item.second));
-    // }
-    std::transform(hm_.begin(), hm_.end(), std::back_inserter(out), [](const auto &item) { return *item.second; });
+    out.reserve(snap.servers.size());
+    for (const Entry &entry : snap.servers) {
+        out.push_back(entry.info);
+        out.back().reserved = entry.reserved->load(std::memory_order_relaxed);
+    }
 }
 
 uint32_t chatroom::status::LoadBalancer::CheckTTL() {
     std::unique_lock<std::mutex> lock(mtx_);
     uint32_t removed = 0;
+    uint64_t now = GetTimestampMs();
     for (auto iter = hm_.begin(); iter != hm_.end();) {
-        if (GetTimestampMs() - iter->second->last_ts >= SERVER_TIMEOUT) {  // 过期服务器
-            min_heap_.AnyRemove(iter->second->id);                         // == item.first
-            iter = hm_.erase(iter);                                        // 从哈希表中删除
+        if (now - iter->second.info.last_ts >= SERVER_TIMEOUT) {  // 过期服务器
+            iter = hm_.erase(iter);                                // 从哈希表中删除
             ++removed;
         } else {
             ++iter;
         }
     }
+    if (removed > 0) {
+        Publish();
+    }
     return removed;
-}
\ No newline at end of file
+}
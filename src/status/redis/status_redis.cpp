@@ -1,5 +1,7 @@
 #include "status/redis/status_redis.hpp"
 
+constexpr const char *SERVER_SNAPSHOT = "server_snapshot";
+
 void chatroom::status::RedisMgr::RegisterScript() {
     if (!IsConnected()) {
         throw std::runtime_error("Redis connection not initialized");
@@ -18,3 +20,16 @@ bool chatroom::status::RedisMgr::UpdateServerList(std::unordered_map<std::string
         GetRedis().hsetex("server_list", serv_list.begin(), serv_list.end(), std::chrono::milliseconds(40000));
     return ans;
 }
+
+bool chatroom::status::RedisMgr::SaveServerSnapshot(const std::string &snapshot, std::chrono::milliseconds ttl) {
+    // 整个快照保存为一个键，已经离开的服务器不会残留在快照中
+    return GetRedis().set(SERVER_SNAPSHOT, snapshot, ttl);
+}
+
+std::optional<std::string> chatroom::status::RedisMgr::LoadServerSnapshot() {
+    auto val = GetRedis().get(SERVER_SNAPSHOT);
+    if (!val) {
+        return std::nullopt;
+    }
+    return std::string(*val);
+}
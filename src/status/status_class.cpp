@@ -9,12 +9,46 @@
 #include <sw/redis++/connection_pool.h>
 #include <sys/types.h>
 
+#include <algorithm>
 #include <string>
 
 #include "log/log_manager.hpp"
+#include "status/async_call.hpp"
 
 // using namespace chatroom::status;
 
+struct chatroom::status::StatusRPCManager::AsyncMethods {
+    AsyncMethod<StatusReportReq, GeneralResp> report_server_load;
+    AsyncMethod<UserCheckReq, GeneralResp> check_user_online;
+    AsyncMethod<MinimalLoadServerReq, ServerAddrResp> check_minimal_load_server;
+    AsyncMethod<ServerRegisterReq, GeneralResp> register_server;
+    AsyncMethod<KickRequest, GeneralResp> kick_online_user;
+    AsyncMethod<DumpServerListReq, ServerItemListResp> dump_server_list;
+    AsyncMethod<ServerLeaveReq, GeneralResp> server_leave;
+    AsyncStreamMethod<LoadReport, LoadReportAck, LoadStreamState> report_load_stream;
+    AsyncPushMethod<WatchServersReq, ServerListUpdate, WatchState> watch_servers;
+};
+
+// 把AsyncService::RequestXXX和StatusServiceImpl::XXX绑定为一个AsyncMethod
+#define BIND_ASYNC_METHOD(field, Method)                                                                      \
+    async_methods_->field.request = [svc = async_service_.get()](auto *ctx, auto *req, auto *resp, auto *cq, \
+                                                                 void *tag) {                                \
+        svc->Request##Method(ctx, req, resp, cq, cq, tag);                                                    \
+    };                                                                                                        \
+    async_methods_->field.handle = [impl = service_.get()](auto *ctx, const auto *req, auto *resp) {         \
+        return impl->Method(ctx, req, resp);                                                                  \
+    }
+
+chatroom::status::StatusRPCManager::StatusRPCManager(RedisMgr *redis, LoadBalancer *load_balancer,
+                                                     TimedUploader *uploader, bool async, uint32_t cq_count)
+    : redis_mgr_(redis),
+      load_balancer_(load_balancer),
+      uploader_(uploader),
+      async_(async),
+      cq_count_(cq_count != 0 ? cq_count : std::max(1U, std::thread::hardware_concurrency())) {}
+
+chatroom::status::StatusRPCManager::~StatusRPCManager() { Stop(); }
+
 void chatroom::status::StatusRPCManager::Run(const std::string &rpc_address) {
     if (!server_) {
         // StatusServiceImpl service(redis_mgr_, load_balancer_);
@@ -23,20 +57,105 @@ void chatroom::status::StatusRPCManager::Run(const std::string &rpc_address) {
 
         grpc::ServerBuilder builder;
         builder.AddListeningPort(rpc_address, grpc::InsecureServerCredentials());
-        builder.RegisterService(service_.get());
+        // 上报流期间定期发送keepalive ping，后台服务器所在的主机宕机（没有FIN/RST）时也能很快结束它的上报流
+        builder.AddChannelArgument(GRPC_ARG_KEEPALIVE_TIME_MS, STREAM_KEEPALIVE_MS);
+        builder.AddChannelArgument(GRPC_ARG_KEEPALIVE_TIMEOUT_MS, STREAM_KEEPALIVE_MS);
+        if (async_) {
+            // 异步模式：service_只用于处理请求，不向builder注册
+            async_service_ = std::make_unique<StatusService::AsyncService>();
+            async_methods_ = std::make_unique<AsyncMethods>();
+            BIND_ASYNC_METHOD(report_server_load, ReportServerLoad);
+            BIND_ASYNC_METHOD(check_user_online, CheckUserOnline);
+            BIND_ASYNC_METHOD(check_minimal_load_server, CheckMinimalLoadServer);
+            BIND_ASYNC_METHOD(register_server, RegisterServer);
+            BIND_ASYNC_METHOD(kick_online_user, KickOnlineUser);
+            BIND_ASYNC_METHOD(dump_server_list, DumpServerList);
+            BIND_ASYNC_METHOD(server_leave, ServerLeave);
+            async_methods_->report_load_stream.request = [svc = async_service_.get()](auto *ctx, auto *stream,
+                                                                                      auto *cq, void *tag) {
+                svc->RequestReportLoadStream(ctx, stream, cq, cq, tag);
+            };
+            async_methods_->report_load_stream.handle = [impl = service_.get()](auto &state, const auto &report,
+                                                                                auto *ack, bool &reply) {
+                return impl->OnLoadReport(state, report, ack, reply);
+            };
+            async_methods_->report_load_stream.close = [impl = service_.get()](auto &state) {
+                impl->OnLoadStreamClosed(state);
+            };
+            async_methods_->watch_servers.request = [svc = async_service_.get()](auto *ctx, auto *req, auto *writer,
+                                                                                 auto *cq, void *tag) {
+                svc->RequestWatchServers(ctx, req, writer, cq, cq, tag);
+            };
+            async_methods_->watch_servers.poll = [impl = service_.get()](auto &state, const auto &, auto *update) {
+                return impl->NextServerListUpdate(state, update);
+            };
+            async_methods_->watch_servers.interval = WATCH_POLL_INTERVAL;
+            builder.RegisterService(async_service_.get());
+            for (uint32_t i = 0; i < cq_count_; ++i) {
+                cqs_.push_back(builder.AddCompletionQueue());
+            }
+        } else {
+            builder.RegisterService(service_.get());
+        }
 
         server_ = builder.BuildAndStart();
+        if (!server_) {
+            spdlog::error("StatusRPCManager: failed to start gRPC server at {}", rpc_address);
+            return;
+        }
+        if (async_) {
+            spdlog::info("StatusRPCManager: async mode with {} completion queues", cqs_.size());
+            for (auto &cq : cqs_) {
+                cq_threads_.emplace_back([this, cq = cq.get()] { AsyncWorker(cq); });
+            }
+        }
         // The server must be either shutting down or some other thread must call Shutdown for this function to ever
         // return.
         server_->Wait();
     }
 }
 
+void chatroom::status::StatusRPCManager::AsyncWorker(grpc::ServerCompletionQueue *cq) {
+    for (uint32_t i = 0; i < ASYNC_PENDING_CALLS; ++i) {
+        AsyncUnaryCall<StatusReportReq, GeneralResp>::Spawn(&async_methods_->report_server_load, cq);
+        AsyncUnaryCall<UserCheckReq, GeneralResp>::Spawn(&async_methods_->check_user_online, cq);
+        AsyncUnaryCall<MinimalLoadServerReq, ServerAddrResp>::Spawn(&async_methods_->check_minimal_load_server, cq);
+        AsyncUnaryCall<ServerRegisterReq, GeneralResp>::Spawn(&async_methods_->register_server, cq);
+        AsyncUnaryCall<KickRequest, GeneralResp>::Spawn(&async_methods_->kick_online_user, cq);
+        AsyncUnaryCall<DumpServerListReq, ServerItemListResp>::Spawn(&async_methods_->dump_server_list, cq);
+        AsyncUnaryCall<ServerLeaveReq, GeneralResp>::Spawn(&async_methods_->server_leave, cq);
+        AsyncBidiCall<LoadReport, LoadReportAck, LoadStreamState>::Spawn(&async_methods_->report_load_stream, cq);
+        AsyncPushCall<WatchServersReq, ServerListUpdate, WatchState>::Spawn(&async_methods_->watch_servers, cq);
+    }
+    void *tag;
+    bool ok;
+    // Shutdown()之后，队列中剩余的事件（包括被取消的等待中调用）取完时Next()返回false
+    while (cq->Next(&tag, &ok)) {
+        static_cast<AsyncCallBase *>(tag)->Proceed(ok);
+    }
+}
+
 void chatroom::status::StatusRPCManager::Stop() {
     if (server_) {
         // server_需要service_，那么我们明显应该先析构server_然后再service_
-        server_->Shutdown();
+        // 上报流和服务器列表的订阅不会自己结束，等待SHUTDOWN_GRACE之后取消所有还在进行的调用；
+        // 异步模式下的订阅在下一次轮询时发现stopping并结束，不再重新设置grpc::Alarm
+        if (async_methods_) {
+            async_methods_->watch_servers.stopping.store(true, std::memory_order_release);
+        }
+        server_->Shutdown(std::chrono::system_clock::now() + SHUTDOWN_GRACE);
+        // 异步模式：服务器关闭之后才能关闭CompletionQueue，等待所有线程取完剩余的事件
+        for (auto &cq : cqs_) {
+            cq->Shutdown();
+        }
+        for (auto &th : cq_threads_) {
+            th.join();
+        }
+        cq_threads_.clear();
+        cqs_.clear();
         server_.reset();
+        async_service_.reset();
+        async_methods_.reset();
         service_.reset();
     }
 }
@@ -46,8 +165,9 @@ bool chatroom::status::StatusServer::RunStatusServer(const string &rpc_address,
                                                      const sw::redis::ConnectionPoolOptions &pool_opt) {
     if (!running_) {
         // Load balancer initialize
-        spdlog::info("LoadBalancer init");
         load_balancer_ = std::make_unique<LoadBalancer>();
+        spdlog::info("LoadBalancer init, policy: {}",
+                     load_balancer_->Policy() == BalancePolicy::TWO_CHOICES ? "two choices" : "minimal load");
 
         // redis connection initialize
         redis_mgr_ = std::make_unique<RedisMgr>();
@@ -55,6 +175,13 @@ bool chatroom::status::StatusServer::RunStatusServer(const string &rpc_address,
 
         // uploader initialize
         uploader_ = std::make_unique<TimedUploader>(redis_mgr_.get(), load_balancer_.get());
+        // 在开始接受RPC之前，从上一次上传的快照恢复服务器列表，重启之后的登录不需要等待后台服务器重新上报
+        auto restore_start = std::chrono::steady_clock::now();
+        uint32_t restored = uploader_->RestoreSnapshot();
+        spdlog::info("Restored {} servers in {} us", restored,
+                     std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() -
+                                                                           restore_start)
+                         .count());
         uploader_->Start();
 
         // RPC manager initialize
@@ -1,6 +1,9 @@
 #include "status/status_uploader.hpp"
 
+#include <chrono>
+
 #include "log/log_manager.hpp"
+#include "protocpp/status.pb.h"
 
 void chatroom::status::TimedUploader::Start() {
     running_ = true;
@@ -43,9 +46,9 @@ void chatroom::status::TimedUploader::WorkerFn() {
         balancer_->CopyServerInfoList(out);
         std::unordered_map<std::string, std::string> serv_list;
         for (auto &item : out) {
-            serv_list.emplace(std::to_string(item.id), std::move(item.addr));
+            serv_list.emplace(std::to_string(item.id), item.addr);
         }
-        bool ret = redis_->UpdateServerList(serv_list);
+        bool ret = redis_->UpdateServerList(serv_list) && SaveSnapshot(out);
         if (!ret) {
             ++err_count_;
             if (err_count_ > err_count_max_) {
@@ -62,4 +65,59 @@ void chatroom::status::TimedUploader::WorkerFn() {
         lock.lock();
     }
     spdlog::info("StatusUploader: worker stopping");
-}
\ No newline at end of file
+}
+bool chatroom::status::TimedUploader::SaveSnapshot(const std::vector<ServerInfo> &servers) {
+    ServerSnapshot snapshot;
+    snapshot.set_saved_ts(GetTimestampMs());
+    for (const auto &info : servers) {
+        auto *item = snapshot.add_servers();
+        item->set_id(info.id);
+        item->set_addr(info.addr);
+        item->set_load(info.load);
+        item->set_last_ts(info.last_ts);
+        item->set_draining(info.draining);
+        item->set_cpu_usage(info.metrics.cpu_usage);
+        item->set_mem_usage(info.metrics.mem_usage);
+        item->set_msg_rate(info.metrics.msg_rate);
+        item->set_queue_depth(info.metrics.queue_depth);
+        item->set_p99_us(info.metrics.p99_us);
+        item->set_capacity(info.metrics.capacity);
+    }
+    return redis_->SaveServerSnapshot(snapshot.SerializeAsString(), std::chrono::milliseconds(SERVER_TIMEOUT));
+}
+
+uint32_t chatroom::status::TimedUploader::RestoreSnapshot() {
+    std::optional<std::string> data;
+    try {
+        data = redis_->LoadServerSnapshot();
+    } catch (const sw::redis::Error &e) {
+        spdlog::warn("StatusUploader: failed to load server snapshot: {}", e.what());
+        return 0;
+    }
+    ServerSnapshot snapshot;
+    if (!data) {
+        spdlog::info("StatusUploader: no server snapshot to restore");
+        return 0;
+    }
+    if (!snapshot.ParseFromString(*data)) {
+        spdlog::warn("StatusUploader: malformed server snapshot ignored");
+        return 0;
+    }
+    std::vector<ServerInfo> servers;
+    servers.reserve(snapshot.servers_size());
+    for (const auto &item : snapshot.servers()) {
+        ServerInfo &info = servers.emplace_back(item.id(), item.addr(), item.load());
+        info.last_ts = item.last_ts();
+        info.draining = item.draining();
+        info.metrics.cpu_usage = item.cpu_usage();
+        info.metrics.mem_usage = item.mem_usage();
+        info.metrics.msg_rate = item.msg_rate();
+        info.metrics.queue_depth = item.queue_depth();
+        info.metrics.p99_us = item.p99_us();
+        info.metrics.capacity = item.capacity();
+    }
+    uint32_t restored = balancer_->RestoreServers(servers);
+    spdlog::info("StatusUploader: restored {} of {} servers from the snapshot saved {} ms ago", restored,
+                 snapshot.servers_size(), GetTimestampMs() - std::min(snapshot.saved_ts(), GetTimestampMs()));
+    return restored;
+}
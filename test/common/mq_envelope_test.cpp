@@ -0,0 +1,78 @@
+// GTest for the inter-server stream entry envelope
+
+#include "common/mq_envelope.hpp"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+using namespace chatroom;
+using namespace std;
+
+TEST(MQEnvelopeTest, ChatRoundTrip) {
+    string data = EncodeEnvelope(EnvelopeType::CHAT, 42, 1ULL << 40, "hello", "srv7");
+    auto env = DecodeEnvelope(data);
+    ASSERT_TRUE(env.has_value());
+    EXPECT_EQ(env->version, MQ_ENVELOPE_VERSION);
+    EXPECT_EQ(env->type, EnvelopeType::CHAT);
+    EXPECT_EQ(env->flags, ENVELOPE_FLAG_ORIGIN);
+    EXPECT_EQ(env->from, 42U);
+    EXPECT_EQ(env->to, 1ULL << 40);
+    EXPECT_EQ(env->origin, "srv7");
+    EXPECT_TRUE(env->recipients.empty());
+    EXPECT_EQ(env->content, "hello");
+
+    auto frame = MakeClientFrame(env.value());
+    ASSERT_NE(frame, nullptr);
+    EXPECT_EQ(frame->GetTagField(), CHAT_MSG_TOCLI);
+    ASSERT_EQ(frame->GetContentLen(), sizeof(uint64_t) + 5);
+    EXPECT_EQ(ReadNetField64(frame->GetContent()), 42U);
+    EXPECT_EQ(string(frame->GetContent() + sizeof(uint64_t), 5), "hello");
+}
+
+TEST(MQEnvelopeTest, GroupRoundTrip) {
+    vector<uint64_t> to = {3, 5, 8};
+    string data = EncodeEnvelope(EnvelopeType::GROUP_CHAT, 1, 99, "hi all", {}, &to);
+    auto env = DecodeEnvelope(data);
+    ASSERT_TRUE(env.has_value());
+    EXPECT_EQ(env->flags, 0);
+    EXPECT_TRUE(env->origin.empty());
+    ASSERT_EQ(env->recipients.size(), to.size() * sizeof(uint64_t));
+    for (size_t i = 0; i < to.size(); ++i) {
+        EXPECT_EQ(ReadNetField64(env->recipients.data() + i * sizeof(uint64_t)), to[i]);
+    }
+    EXPECT_EQ(env->content, "hi all");
+
+    auto frame = MakeClientFrame(env.value());
+    ASSERT_NE(frame, nullptr);
+    EXPECT_EQ(frame->GetTagField(), GROUP_CHAT_MSG_TOCLI);
+    EXPECT_EQ(ReadNetField64(frame->GetContent()), 99U);
+    EXPECT_EQ(ReadNetField64(frame->GetContent() + sizeof(uint64_t)), 1U);
+}
+
+TEST(MQEnvelopeTest, ControlHasNoFrame) {
+    auto env = DecodeEnvelope(EncodeEnvelope(EnvelopeType::KICK, 0, 12345));
+    ASSERT_TRUE(env.has_value());
+    EXPECT_EQ(env->type, EnvelopeType::KICK);
+    EXPECT_EQ(env->to, 12345U);
+    EXPECT_TRUE(env->content.empty());
+    EXPECT_EQ(MakeClientFrame(env.value()), nullptr);
+}
+
+TEST(MQEnvelopeTest, RejectsMalformed) {
+    string data = EncodeEnvelope(EnvelopeType::CHAT, 1, 2, "content", "origin");
+    // 截断
+    for (size_t len = 0; len < data.size(); ++len) {
+        EXPECT_FALSE(DecodeEnvelope(string_view(data.data(), len)).has_value()) << len;
+    }
+    // 不支持的版本
+    string future = data;
+    future[0] = static_cast<char>(MQ_ENVELOPE_VERSION + 1);
+    EXPECT_FALSE(DecodeEnvelope(future).has_value());
+    // 同一版本中payload之后的多余字节被忽略
+    string extended = data + "trailing";
+    auto env = DecodeEnvelope(extended);
+    ASSERT_TRUE(env.has_value());
+    EXPECT_EQ(env->content, "content");
+}
@@ -0,0 +1,116 @@
+// MsgNode内存池的微基准测试
+// 模拟后台服务器中一条消息的生命周期：io线程接收（1KiB初始节点，偶尔扩容）-> 投递给处理线程 ->
+// 处理线程转发/释放；同时模拟MQHandler为每条跨服消息创建一个新节点。
+// 通过替换全局operator new来统计每条消息产生的堆分配次数。
+// 分别编译两个版本进行对比：
+//   bench_msgnode_pool    使用内存池
+//   bench_msgnode_nopool  定义MSGNODE_DISABLE_POOL，即改动前的new[]/delete[]实现
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <thread>
+
+#include "common/msgnode.hpp"
+
+static std::atomic<uint64_t> g_new_calls{0};
+
+void *operator new(std::size_t size) {
+    g_new_calls.fetch_add(1, std::memory_order_relaxed);
+    if (void *ptr = std::malloc(size)) return ptr;
+    throw std::bad_alloc();
+}
+void *operator new[](std::size_t size) {
+    g_new_calls.fetch_add(1, std::memory_order_relaxed);
+    if (void *ptr = std::malloc(size)) return ptr;
+    throw std::bad_alloc();
+}
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete[](void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t /*unused*/) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, std::size_t /*unused*/) noexcept { std::free(ptr); }
+
+using namespace chatroom;
+
+constexpr int MESSAGES = 1000000;
+constexpr uint32_t INITIAL_NODE_SIZE = 1024;
+
+int main() {
+    std::deque<std::shared_ptr<MsgNode>> q;
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool done = false;
+    const char text[] = "hello, this is a chat message of moderate length";
+
+    // 预热：让线程缓存和deque内部的块就位
+    for (int i = 0; i < 1000; ++i) {
+        auto node = MakeMsgNode(INITIAL_NODE_SIZE);
+        node->Reallocate(2048);
+    }
+
+    uint64_t before = g_new_calls.load();
+    auto beg = std::chrono::steady_clock::now();
+
+    // 处理线程：取出消息，模拟MQHandler重新封装一个节点，然后全部释放
+    std::thread consumer([&] {
+        std::unique_lock lock(mtx);
+        while (true) {
+            cv.wait(lock, [&] { return done || !q.empty(); });
+            if (q.empty() && done) break;
+            auto msg = std::move(q.front());
+            q.pop_front();
+            lock.unlock();
+            auto relay = MakeMsgNode(HEAD_LEN + sizeof(uint64_t) + msg->GetContentLen());
+            std::memcpy(relay->GetContent(), msg->GetContent(), msg->GetContentLen());
+            relay->SetContentLenField(msg->GetContentLen());
+            msg.reset();
+            relay.reset();
+            lock.lock();
+        }
+    });
+
+    // io线程：接收消息（每64条消息出现一条需要扩容的大消息）
+    for (int i = 0; i < MESSAGES; ++i) {
+        auto recv = MakeMsgNode(INITIAL_NODE_SIZE);
+        uint32_t len = (i % 64 == 0) ? 3000 : sizeof(text);
+        if (len + HEAD_LEN > recv->max_len_) {
+            recv->Reallocate(len + HEAD_LEN);
+        }
+        std::memcpy(recv->GetContent(), text, sizeof(text));
+        recv->SetContentLenField(len);
+        {
+            std::unique_lock lock(mtx);
+            q.push_back(std::move(recv));
+        }
+        cv.notify_one();
+    }
+    {
+        std::unique_lock lock(mtx);
+        done = true;
+    }
+    cv.notify_one();
+    consumer.join();
+
+    auto end = std::chrono::steady_clock::now();
+    uint64_t calls = g_new_calls.load() - before;
+    double ns = std::chrono::duration<double, std::nano>(end - beg).count();
+
+#ifndef MSGNODE_DISABLE_POOL
+    std::printf("[pool]   ");
+#else
+    std::printf("[nopool] ");
+#endif
+    std::printf("messages: %d, operator new calls: %lu (%.3f per message), %.1f ns/message\n", MESSAGES, calls,
+                static_cast<double>(calls) / MESSAGES, ns / MESSAGES);
+#ifndef MSGNODE_DISABLE_POOL
+    auto stats = BufferPool::Instance().GetStats();
+    std::printf("pool stats: hits %lu, misses %lu, slabs %lu, oversize %lu\n", stats.hits, stats.misses,
+                stats.slab_allocs, stats.oversize);
+#endif
+    return 0;
+}
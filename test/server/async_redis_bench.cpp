@@ -0,0 +1,109 @@
+// 跨服务器聊天消息路径的Redis吞吐量基准测试（需要一个本地Redis服务）
+// 每条跨服聊天消息需要两个Redis命令：HGET status:<uid> server_id 查询目标用户所在服务器，
+// 然后 XADD stream:server:<sid> 把消息投递到对方服务器的消息队列。
+//  - sync: 使用RedisMgr的同步接口逐条处理，吞吐量上限约为 1 / (2 * RTT)；
+//  - async: 使用AsyncRedis，同时保持depth条消息在途，观察吞吐量随在途深度的增长。
+// 用法: bench_async_redis [redis_url]，默认为tcp://127.0.0.1:6379；测试会写入status:bench:*和stream:server:bench键
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+
+#include "server/redis/async_redis.hpp"
+#include "server/redis/server_redis.hpp"
+
+using namespace chatroom::backend;
+
+constexpr int TOTAL_MSGS = 20000;
+constexpr int TARGET_USERS = 100;
+constexpr uint64_t TARGET_UID_BASE = 9000000000ULL;  // 避免与真实用户冲突
+constexpr std::string_view CONTENT = "hello from bench, this is a typical short chat message";
+
+static void Setup(RedisMgr &redis) {
+    for (int i = 0; i < TARGET_USERS; ++i) {
+        std::string key = "status:" + std::to_string(TARGET_UID_BASE + i);
+        redis.GetRedis().hset(key, "server_id", "bench");
+    }
+    redis.GetRedis().del("stream:server:bench");
+}
+
+static void Cleanup(RedisMgr &redis) {
+    for (int i = 0; i < TARGET_USERS; ++i) {
+        redis.GetRedis().del("status:" + std::to_string(TARGET_UID_BASE + i));
+    }
+    redis.GetRedis().del("stream:server:bench");
+}
+
+static void RunSync(RedisMgr &redis) {
+    auto beg = std::chrono::steady_clock::now();
+    for (int i = 0; i < TOTAL_MSGS; ++i) {
+        uint64_t to = TARGET_UID_BASE + i % TARGET_USERS;
+        auto sid = redis.GetUserLocation(to);
+        if (sid.has_value()) {
+            redis.SendToMsgQueue(sid.value(), i, to, CONTENT);
+        }
+    }
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - beg).count();
+    std::printf("sync:            %.0f msg/s\n", TOTAL_MSGS / sec);
+}
+
+static void RunAsync(const std::shared_ptr<RedisMgr> &redis, int depth) {
+    AsyncRedis async_redis(redis);
+    async_redis.Start();
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    int in_flight = 0;
+    std::atomic<int> failed{0};
+    auto done = [&](bool ok) {
+        if (!ok) failed.fetch_add(1, std::memory_order_relaxed);
+        std::unique_lock lock(mtx);
+        --in_flight;
+        cv.notify_one();
+    };
+
+    auto beg = std::chrono::steady_clock::now();
+    for (int i = 0; i < TOTAL_MSGS; ++i) {
+        {
+            std::unique_lock lock(mtx);
+            cv.wait(lock, [&] { return in_flight < depth; });
+            ++in_flight;
+        }
+        uint64_t from = i % 1024;  // 模拟1024个发送者，分散到各个流水线工作线程上
+        uint64_t to = TARGET_UID_BASE + i % TARGET_USERS;
+        async_redis.GetUserLocation(from, to, [&, from, to](LocationResult loc) {
+            if (!loc.sid.has_value()) {
+                done(false);
+                return;
+            }
+            async_redis.SendToMsgQueue(from, loc.sid.value(), "bench", from, to, CONTENT, done);
+        });
+    }
+    {
+        std::unique_lock lock(mtx);
+        cv.wait(lock, [&] { return in_flight == 0; });
+    }
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - beg).count();
+    AsyncRedisStats st = async_redis.GetStats();
+    async_redis.Stop();
+    std::printf("async depth %4d: %.0f msg/s, %.1f commands per pipeline, failed: %d\n", depth, TOTAL_MSGS / sec,
+                st.pipelines ? static_cast<double>(st.commands) / st.pipelines : 0.0, failed.load());
+}
+
+int main(int argc, char **argv) {
+    std::string url = argc > 1 ? argv[1] : "tcp://127.0.0.1:6379";
+    auto redis = std::make_shared<RedisMgr>();
+    redis->ConnectTo(url);
+    Setup(*redis);
+
+    RunSync(*redis);
+    for (int depth : {1, 8, 64, 256, 1024}) {
+        RunAsync(redis, depth);
+    }
+
+    Cleanup(*redis);
+    return 0;
+}
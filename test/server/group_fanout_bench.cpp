@@ -0,0 +1,93 @@
+// 群聊消息扇出的基准测试：10 / 1k / 10k 个成员
+// 每条群聊消息的处理过程：从GroupIndex中取得成员列表并检查发送者身份，然后
+//  - 本地成员（一半）：把报文放入各自的发送队列（这里用std::deque模拟Session的发送队列），
+//    分别测试共享同一个报文（shared）和为每个接收者拷贝一份报文（copy）两种方式；
+//  - 远程成员（另一半，分布在8个服务器上）：通过LocationCache按服务器分组，并为每个服务器编码一次接收者列表。
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "server/group_chat.hpp"
+#include "server/location_cache.hpp"
+
+using namespace chatroom;
+using namespace chatroom::backend;
+
+constexpr int REMOTE_SERVERS = 8;
+constexpr uint64_t GROUP_ID = 42;
+const std::string CONTENT(200, 'x');  // 典型的短消息
+
+struct Result {
+    double shared_us;  // 每条消息的扇出耗时（共享报文）
+    double copy_us;    // 每条消息的扇出耗时（逐个拷贝）
+    uint64_t remote_bytes;
+};
+
+static Result RunBench(uint32_t member_count) {
+    GroupIndex index(nullptr);
+    LocationCache loc_cache(member_count * 2);
+    GroupMembers members;
+    std::vector<uint64_t> local_uids, remote_uids;
+    for (uint32_t i = 0; i < member_count; ++i) {
+        uint64_t uid = 100000 + i;
+        members.push_back(uid);
+        if (i % 2 == 0) {
+            local_uids.push_back(uid);
+        } else {
+            remote_uids.push_back(uid);
+            loc_cache.Put(uid, std::to_string(i % REMOTE_SERVERS + 2));
+        }
+    }
+    index.SetMembers(GROUP_ID, members);
+    std::vector<std::deque<std::shared_ptr<MsgNode>>> send_queues(local_uids.size());
+
+    // 消息数与成员数成反比，使每轮测试的总投递次数大致相同
+    const int rounds = std::max(20, static_cast<int>(2000000 / member_count));
+    uint64_t remote_bytes = 0;
+
+    auto fan_out = [&](bool shared) {
+        auto beg = std::chrono::steady_clock::now();
+        for (int r = 0; r < rounds; ++r) {
+            GroupMembersPtr ptr = index.GetMembers(GROUP_ID);
+            if (!ptr || !GroupIndex::IsMember(*ptr, members.front())) std::abort();
+            if (shared) {
+                auto frame = BuildGroupFrame(GROUP_ID, members.front(), CONTENT);
+                for (auto &q : send_queues) q.push_back(frame);
+            } else {
+                for (auto &q : send_queues) q.push_back(BuildGroupFrame(GROUP_ID, members.front(), CONTENT));
+            }
+            std::unordered_map<std::string, std::vector<uint64_t>> remote;
+            std::vector<uint64_t> unresolved;
+            GroupByServer(remote_uids, loc_cache, "1", remote, unresolved);
+            for (auto &[sid, uids] : remote) {
+                remote_bytes += PackUidList(uids).size();
+            }
+            for (auto &q : send_queues) q.pop_front();  // 模拟发送完成
+        }
+        double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - beg).count();
+        return sec * 1e6 / rounds;
+    };
+
+    Result res{};
+    res.shared_us = fan_out(true);
+    res.copy_us = fan_out(false);
+    res.remote_bytes = remote_bytes / (2 * rounds);
+    return res;
+}
+
+int main() {
+    for (uint32_t members : {10U, 1000U, 10000U}) {
+        Result res = RunBench(members);
+        std::printf("members: %5u, shared frame: %9.2f us/msg, per-recipient copy: %9.2f us/msg, "
+                    "remote recipient list: %lu bytes in %d entries\n",
+                    members, res.shared_us, res.copy_us, res.remote_bytes, REMOTE_SERVERS);
+    }
+    return 0;
+}
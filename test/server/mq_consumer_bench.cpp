@@ -0,0 +1,167 @@
+// 消息队列消费者的基准测试（需要一个本地Redis服务）
+//  - idle: 队列为空时，不带BLOCK（block_ms = 0，旧的行为）与带BLOCK的读取循环每秒发出的XREADGROUP个数，
+//    以及Redis服务端为此花费的CPU时间（INFO commandstats中的usec）；
+//  - burst: 生产者成批写入消息，消费者分别使用固定COUNT = 10和自适应COUNT读取，
+//    比较读取次数和每个条目的投递延迟（由条目ID中的时间戳计算）；
+//  - restart: 队列中有HISTORY条已处理的条目，其中最后UNACKED条在"崩溃"前未确认，比较重启时
+//    从头重放整个队列（旧的行为）与XAUTOCLAIM认领待确认条目（确认模式）需要处理的条目数和时间。
+// 用法: bench_mq_consumer [redis_url]，默认为tcp://127.0.0.1:6379；测试会写入stream:server(ctl):benchmq键
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "server/mq_handler.hpp"
+#include "server/redis/server_redis.hpp"
+
+using namespace chatroom::backend;
+
+constexpr std::string_view SERVER_ID = "benchmq";
+constexpr int IDLE_SECONDS = 3;
+constexpr int BURSTS = 40;
+constexpr int BURST_SIZE = 500;
+constexpr int HISTORY = 20000;
+constexpr int UNACKED = 500;
+constexpr std::string_view CONTENT = "hello from bench, this is a typical short chat message";
+
+static void Reset(RedisMgr &redis) {
+    redis.GetRedis().del("stream:server:benchmq");
+    redis.GetRedis().del("stream:serverctl:benchmq");
+    redis.RegisterMsgQueue(SERVER_ID, false);
+}
+
+// 返回Redis服务端执行XREADGROUP累计花费的微秒数
+static uint64_t XReadGroupUsec(RedisMgr &redis) {
+    std::string info = redis.GetRedis().info("commandstats");
+    auto pos = info.find("cmdstat_xreadgroup:");
+    if (pos == std::string::npos) return 0;
+    pos = info.find("usec=", pos);
+    return pos == std::string::npos ? 0 : std::stoull(info.substr(pos + 5));
+}
+
+static void RunIdle(RedisMgr &redis, uint32_t block_ms) {
+    Reset(redis);
+    std::unordered_map<std::string, RedisMgr::ItemStream> out;
+    uint64_t usec_beg = XReadGroupUsec(redis);
+    uint64_t reads = 0;
+    auto end = std::chrono::steady_clock::now() + std::chrono::seconds(IDLE_SECONDS);
+    while (std::chrono::steady_clock::now() < end) {
+        out.clear();
+        redis.RecvFromMsgQueueNoACK(SERVER_ID, "0", out, block_ms, MQ_MIN_RECV_COUNT);
+        ++reads;
+    }
+    uint64_t usec = XReadGroupUsec(redis) - usec_beg;
+    std::printf("idle,  block %4u ms: %8.1f reads/s, redis cpu %8.1f us/s\n", block_ms,
+                static_cast<double>(reads) / IDLE_SECONDS, static_cast<double>(usec) / IDLE_SECONDS);
+}
+
+static void RunBurst(RedisMgr &redis, bool adaptive) {
+    Reset(redis);
+    std::atomic<bool> done{false};
+    std::thread producer([&redis, &done] {
+        for (int b = 0; b < BURSTS; ++b) {
+            for (int i = 0; i < BURST_SIZE; ++i) {
+                redis.SendToMsgQueue(SERVER_ID, i, b, CONTENT, BURSTS * BURST_SIZE);
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+        done = true;
+    });
+
+    std::unordered_map<std::string, RedisMgr::ItemStream> out;
+    uint32_t recv_count = adaptive ? MQ_MIN_RECV_COUNT : 10;
+    uint64_t reads = 0, entries = 0, latency_sum = 0, latency_max = 0;
+    while (entries < static_cast<uint64_t>(BURSTS) * BURST_SIZE) {
+        out.clear();
+        redis.RecvFromMsgQueueNoACK(SERVER_ID, "0", out, MQ_BLOCK_MS, recv_count);
+        ++reads;
+        uint64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                              std::chrono::system_clock::now().time_since_epoch())
+                              .count();
+        std::size_t received = 0;
+        for (auto &[key, items] : out) {
+            received = std::max(received, items.size());
+            for (auto &item : items) {
+                uint64_t ms = StreamIdMillis(item.first).value_or(now_ms);
+                uint64_t latency = now_ms > ms ? now_ms - ms : 0;
+                latency_sum += latency;
+                latency_max = std::max(latency_max, latency);
+                ++entries;
+            }
+        }
+        if (adaptive) {
+            recv_count = NextRecvCount(recv_count, received);
+        }
+        if (out.empty() && done) break;
+    }
+    producer.join();
+    std::printf("burst, %-8s COUNT: %6lu reads, latency avg %6.2f ms, max %4lu ms\n", adaptive ? "adaptive" : "fixed",
+                reads, entries ? static_cast<double>(latency_sum) / entries : 0.0, latency_max);
+}
+
+static void RunRestart(RedisMgr &redis) {
+    Reset(redis);
+    std::string mq_key = "stream:server:";
+    mq_key += SERVER_ID;
+    for (int i = 0; i < HISTORY; ++i) {
+        redis.SendToMsgQueue(SERVER_ID, i, i, CONTENT, HISTORY);
+    }
+    // 处理所有条目，但只确认前HISTORY - UNACKED条
+    std::unordered_map<std::string, RedisMgr::ItemStream> out;
+    std::unordered_map<std::string, std::vector<std::string>> ids;
+    int read = 0;
+    while (read < HISTORY) {
+        out.clear();
+        redis.RecvFromMsgQueue(SERVER_ID, "0", out, MQ_BLOCK_MS, MQ_MAX_RECV_COUNT);
+        for (auto &[key, items] : out) {
+            for (auto &item : items) {
+                if (read++ < HISTORY - UNACKED) ids[key].push_back(item.first);
+            }
+        }
+    }
+    redis.AckMsgQueue(SERVER_ID, ids);
+
+    // 确认模式的重启：认领待确认的条目
+    auto beg = std::chrono::steady_clock::now();
+    RedisMgr::ItemStream claimed;
+    std::string cursor = "0-0";
+    do {
+        cursor = redis.ClaimPendingMsgs(mq_key, SERVER_ID, "0", cursor, MQ_CLAIM_COUNT, claimed);
+    } while (cursor != "0-0");
+    double claim_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - beg).count();
+
+    // 旧的行为：消费者组从"0"开始，重放整个队列
+    std::string group_name = "message_group";
+    group_name += SERVER_ID;
+    redis.GetRedis().command<long long>("XGROUP", "DESTROY", mq_key, group_name);
+    redis.RegisterMsgQueue(SERVER_ID, true);
+    beg = std::chrono::steady_clock::now();
+    std::size_t replayed = 0;
+    for (;;) {
+        out.clear();
+        redis.RecvFromMsgQueueNoACK(SERVER_ID, "0", out, 0, MQ_MAX_RECV_COUNT);
+        if (out.empty()) break;
+        for (auto &[key, items] : out) replayed += items.size();
+    }
+    double replay_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - beg).count();
+    std::printf("restart, replay whole stream: %6zu entries in %8.2f ms\n", replayed, replay_ms);
+    std::printf("restart, claim pending:       %6zu entries in %8.2f ms\n", claimed.size(), claim_ms);
+}
+
+int main(int argc, char *argv[]) {
+    RedisMgr redis;
+    redis.ConnectTo(argc > 1 ? argv[1] : "tcp://127.0.0.1:6379");
+
+    RunIdle(redis, 0);
+    RunIdle(redis, MQ_BLOCK_MS);
+    RunBurst(redis, false);
+    RunBurst(redis, true);
+    RunRestart(redis);
+
+    redis.GetRedis().del("stream:server:benchmq");
+    redis.GetRedis().del("stream:serverctl:benchmq");
+    return 0;
+}
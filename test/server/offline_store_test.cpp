@@ -0,0 +1,182 @@
+// GTest for OfflineStore
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "server/offline_store.hpp"
+
+using namespace chatroom;
+using namespace chatroom::backend;
+using namespace std;
+
+namespace {
+string MakeFrame(uint32_t tag, const string &content) {
+    MsgNode node(content.data(), content.size(), tag);
+    return string(node.GetContent() - HEAD_LEN, HEAD_LEN + content.size());
+}
+
+string FrameContent(const shared_ptr<MsgNode> &node) { return string(node->GetContent(), node->GetContentLen()); }
+
+class OfflineStoreTest : public ::testing::Test {
+   protected:
+    void SetUp() override {
+        dir_ = (filesystem::temp_directory_path() / ("offline_store_test_" + to_string(::getpid()))).string();
+        filesystem::remove_all(dir_);
+    }
+    void TearDown() override { filesystem::remove_all(dir_); }
+
+    size_t SegmentFiles() const {
+        return std::distance(filesystem::directory_iterator(dir_), filesystem::directory_iterator{});
+    }
+
+    string dir_;
+};
+}  // namespace
+
+TEST_F(OfflineStoreTest, AppendThenDrain) {
+    OfflineStore store(dir_, DEFAULT_SEGMENT_BYTES, false);
+    ASSERT_TRUE(store.Open());
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_TRUE(store.Append(1, MakeFrame(CHAT_MSG_TOCLI, "msg" + to_string(i))));
+    }
+    ASSERT_TRUE(store.Append(2, MakeFrame(CHAT_MSG_TOCLI, "other")));
+    store.Flush();
+    EXPECT_EQ(store.PendingCount(1), 100);
+
+    auto frames = store.Drain(1);
+    ASSERT_EQ(frames.size(), 100);
+    for (int i = 0; i < 100; ++i) {
+        EXPECT_EQ(frames[i]->GetTagField(), CHAT_MSG_TOCLI);
+        EXPECT_EQ(FrameContent(frames[i]), "msg" + to_string(i));
+    }
+    EXPECT_EQ(store.PendingCount(1), 0);
+    EXPECT_TRUE(store.Drain(1).empty());
+    EXPECT_EQ(store.PendingCount(2), 1);
+
+    auto stats = store.GetStats();
+    EXPECT_EQ(stats.appended, 101);
+    EXPECT_EQ(stats.drained, 100);
+    EXPECT_LE(stats.commits, stats.appended);
+}
+
+TEST_F(OfflineStoreTest, DrainAsyncSeesUncommittedAppends) {
+    OfflineStore store(dir_, DEFAULT_SEGMENT_BYTES, false);
+    ASSERT_TRUE(store.Open());
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_TRUE(store.Append(1, MakeFrame(CHAT_MSG_TOCLI, "msg" + to_string(i))));
+    }
+    // 不调用Flush()：取走请求需要包括此前追加、但可能尚未提交的记录
+    promise<vector<shared_ptr<MsgNode>>> done;
+    store.DrainAsync(1, [&done](vector<shared_ptr<MsgNode>> frames) { done.set_value(std::move(frames)); });
+    auto frames = done.get_future().get();
+    ASSERT_EQ(frames.size(), 10);
+    for (int i = 0; i < 10; ++i) {
+        EXPECT_EQ(FrameContent(frames[i]), "msg" + to_string(i));
+    }
+    EXPECT_EQ(store.PendingCount(1), 0);
+
+    // 停止之后在调用者的线程上立即取走
+    store.Close();
+    bool called = false;
+    store.DrainAsync(1, [&called](vector<shared_ptr<MsgNode>> frames) { called = frames.empty(); });
+    EXPECT_TRUE(called);
+}
+
+TEST_F(OfflineStoreTest, PersistAcrossReopen) {
+    {
+        OfflineStore store(dir_, DEFAULT_SEGMENT_BYTES, false);
+        ASSERT_TRUE(store.Open());
+        store.Append(1, MakeFrame(CHAT_MSG_TOCLI, "a"));
+        store.Append(1, MakeFrame(CHAT_MSG_TOCLI, "b"));
+        store.Append(2, MakeFrame(CHAT_MSG_TOCLI, "c"));
+        store.Append(3, MakeFrame(CHAT_MSG_TOCLI, "d"));
+        EXPECT_EQ(store.Drain(2).size(), 1);
+    }
+    OfflineStore store(dir_, DEFAULT_SEGMENT_BYTES, false);
+    ASSERT_TRUE(store.Open());
+    // 已取走的消息不会被再次投递
+    EXPECT_TRUE(store.Drain(2).empty());
+    auto frames = store.Drain(1);
+    ASSERT_EQ(frames.size(), 2);
+    EXPECT_EQ(FrameContent(frames[0]), "a");
+    EXPECT_EQ(FrameContent(frames[1]), "b");
+
+    // 重启后分配的序号不能与已有的记录重复
+    store.Append(3, MakeFrame(CHAT_MSG_TOCLI, "e"));
+    frames = store.Drain(3);
+    ASSERT_EQ(frames.size(), 2);
+    EXPECT_EQ(FrameContent(frames[0]), "d");
+    EXPECT_EQ(FrameContent(frames[1]), "e");
+}
+
+TEST_F(OfflineStoreTest, ExpiredMessagesReclaimed) {
+    {
+        OfflineStore store(dir_, DEFAULT_SEGMENT_BYTES, false, chrono::seconds(1));
+        ASSERT_TRUE(store.Open());
+        store.Append(1, MakeFrame(CHAT_MSG_TOCLI, "a"));
+        store.Append(2, MakeFrame(CHAT_MSG_TOCLI, "b"));
+        store.Flush();
+    }
+    this_thread::sleep_for(chrono::milliseconds(1100));
+    // 从不回来取消息的用户不会使段一直无法回收
+    OfflineStore store(dir_, DEFAULT_SEGMENT_BYTES, false, chrono::seconds(1));
+    ASSERT_TRUE(store.Open());
+    EXPECT_EQ(store.PendingCount(1), 0);
+    EXPECT_EQ(store.PendingCount(2), 0);
+    EXPECT_EQ(store.GetStats().expired, 2);
+    EXPECT_EQ(SegmentFiles(), 1);
+}
+
+TEST_F(OfflineStoreTest, SegmentRolloverAndReclaim) {
+    constexpr uint32_t SEGMENT_BYTES = 4096;
+    const string payload(1000, 'x');
+    vector<shared_ptr<MsgNode>> frames;
+    {
+        OfflineStore store(dir_, SEGMENT_BYTES, false);
+        ASSERT_TRUE(store.Open());
+        for (int i = 0; i < 20; ++i) {
+            ASSERT_TRUE(store.Append(1, MakeFrame(CHAT_MSG_TOCLI, payload + to_string(i))));
+            store.Flush();  // 每条记录单独提交，使其分布到多个段中
+        }
+        EXPECT_GT(store.GetStats().segments, 4);
+        EXPECT_FALSE(store.Append(1, MakeFrame(CHAT_MSG_TOCLI, string(SEGMENT_BYTES, 'y'))));
+
+        frames = store.Drain(1);
+        // 所有消息都被取走后，只剩下当前写入的段
+        EXPECT_EQ(store.GetStats().segments, 1);
+        EXPECT_EQ(SegmentFiles(), 1);
+    }
+    // 段文件被删除后，已取出的报文仍然可以访问
+    ASSERT_EQ(frames.size(), 20);
+    for (int i = 0; i < 20; ++i) {
+        EXPECT_EQ(FrameContent(frames[i]), payload + to_string(i));
+    }
+}
+
+TEST_F(OfflineStoreTest, TornTailIgnored) {
+    {
+        OfflineStore store(dir_, DEFAULT_SEGMENT_BYTES, false);
+        ASSERT_TRUE(store.Open());
+        store.Append(1, MakeFrame(CHAT_MSG_TOCLI, "intact"));
+        store.Append(1, MakeFrame(CHAT_MSG_TOCLI, "torn"));
+    }
+    // 破坏最后一条记录的内容
+    auto path = filesystem::directory_iterator(dir_)->path();
+    FILE *fp = fopen(path.c_str(), "r+b");
+    ASSERT_NE(fp, nullptr);
+    string frame = MakeFrame(CHAT_MSG_TOCLI, "intact");
+    fseek(fp, static_cast<long>(((32 + frame.size() + 7) & ~7U) + 32 + HEAD_LEN), SEEK_SET);
+    fputc('X', fp);
+    fclose(fp);
+
+    OfflineStore store(dir_, DEFAULT_SEGMENT_BYTES, false);
+    ASSERT_TRUE(store.Open());
+    auto frames = store.Drain(1);
+    ASSERT_EQ(frames.size(), 1);
+    EXPECT_EQ(FrameContent(frames[0]), "intact");
+}
@@ -0,0 +1,153 @@
+// 跨服消息发送阶段的基准测试（需要一个本地Redis服务）
+// 4个线程模拟MsgHandler的分片，向8个目标服务器发送TOTAL_MSGS条跨服聊天消息：
+//  - direct: 每条消息直接提交给AsyncRedis，一条消息一个XADD；
+//  - relay:  经过OutboundRelay按目标服务器缓冲，分别测试不同的时间窗口以及是否开启pack；
+//  - peer:   OutboundRelay经直连链路发送给同一进程中的另一个PeerLinkManager（监听本地PEER_BENCH_PORT端口），
+//            延迟为写入链路的时间，另外统计接收方收到全部消息的时间。
+// 输出吞吐量、从提交到写入完成（回调）的平均延迟，以及写入的Stream条目数。
+// 用法: bench_outbound_relay [redis_url]，默认为tcp://127.0.0.1:6379；测试会写入stream:server:relaybench*键
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "server/outbound_relay.hpp"
+#include "server/peer_link.hpp"
+#include "server/redis/async_redis.hpp"
+#include "server/redis/server_redis.hpp"
+
+using namespace chatroom::backend;
+
+constexpr int TOTAL_MSGS = 200000;
+constexpr int PRODUCERS = 4;
+constexpr int TARGET_SERVERS = 8;
+constexpr std::string_view CONTENT = "hello from bench, this is a typical short chat message";
+constexpr uint16_t PEER_BENCH_PORT = 19500;
+
+using SendFn = std::function<void(const std::string &sid, uint64_t from, uint64_t to, std::function<void(bool)> cb)>;
+
+struct Result {
+    double msg_per_sec;
+    double latency_us;
+};
+
+static void Cleanup(RedisMgr &redis) {
+    for (int i = 0; i < TARGET_SERVERS; ++i) {
+        redis.GetRedis().del("stream:server:relaybench" + std::to_string(i));
+    }
+}
+
+static Result Run(const SendFn &send) {
+    std::atomic<int> done{0};
+    std::atomic<uint64_t> latency_sum{0};
+    std::vector<std::string> sids;
+    for (int i = 0; i < TARGET_SERVERS; ++i) {
+        sids.push_back("relaybench" + std::to_string(i));
+    }
+    auto beg = std::chrono::steady_clock::now();
+    std::vector<std::thread> producers;
+    for (int p = 0; p < PRODUCERS; ++p) {
+        producers.emplace_back([&, p] {
+            for (int i = p; i < TOTAL_MSGS; i += PRODUCERS) {
+                auto sent = std::chrono::steady_clock::now();
+                send(sids[i % TARGET_SERVERS], p, i, [&done, &latency_sum, sent](bool) {
+                    auto now = std::chrono::steady_clock::now();
+                    latency_sum += std::chrono::duration_cast<std::chrono::microseconds>(now - sent).count();
+                    done.fetch_add(1, std::memory_order_release);
+                });
+            }
+        });
+    }
+    for (auto &th : producers) th.join();
+    while (done.load(std::memory_order_acquire) < TOTAL_MSGS) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - beg).count();
+    return {TOTAL_MSGS / sec, static_cast<double>(latency_sum.load()) / TOTAL_MSGS};
+}
+
+int main(int argc, char *argv[]) {
+    auto redis = std::make_shared<RedisMgr>();
+    redis->ConnectTo(argc > 1 ? argv[1] : "tcp://127.0.0.1:6379");
+    auto async_redis = std::make_shared<AsyncRedis>(redis);
+    async_redis->Start();
+
+    Cleanup(*redis);
+    Result res = Run([&](const std::string &sid, uint64_t from, uint64_t to, std::function<void(bool)> cb) {
+        async_redis->SendToMsgQueue(from, sid, "bench", from, to, CONTENT, std::move(cb), TOTAL_MSGS);
+    });
+    std::printf("direct:                       %9.0f msg/s, latency %8.1f us, %d stream entries\n", res.msg_per_sec,
+                res.latency_us, TOTAL_MSGS);
+
+    for (bool pack : {false, true}) {
+        for (int window_us : {0, 250, 1000}) {
+            Cleanup(*redis);
+            RelayOptions opts;
+            opts.window = std::chrono::microseconds(window_us);
+            opts.pack = pack;
+            opts.queue_max_len = TOTAL_MSGS;
+            OutboundRelay relay(async_redis, "bench", opts);
+            relay.Start();
+            res = Run([&](const std::string &sid, uint64_t from, uint64_t to, std::function<void(bool)> cb) {
+                relay.Send(sid, from, to, CONTENT, std::move(cb));
+            });
+            relay.Stop();
+            RelayStats st = relay.GetStats();
+            std::printf("relay window %4d us, pack %d: %9.0f msg/s, latency %8.1f us, %lu stream entries, "
+                        "avg batch %.1f\n",
+                        window_us, pack, res.msg_per_sec, res.latency_us, st.stream_entries,
+                        static_cast<double>(st.messages) / st.flushes);
+        }
+    }
+
+    {
+        // 接收方只统计收到的消息数
+        std::atomic<uint64_t> received{0};
+        PeerLinkManager receiver("bench_recv", PEER_BENCH_PORT, [&](const std::string &, std::string_view packed) {
+            std::vector<RelayRecord> records;
+            UnpackRelayBatch(packed, records);
+            received.fetch_add(records.size(), std::memory_order_relaxed);
+        });
+        auto peers = std::make_shared<PeerLinkManager>("bench", PEER_BENCH_PORT + 1, nullptr);
+        if (!receiver.Start() || !peers->Start()) {
+            std::printf("peer: failed to listen on port %u\n", PEER_BENCH_PORT);
+        } else {
+            std::unordered_map<std::string, std::string> addrs;
+            for (int i = 0; i < TARGET_SERVERS; ++i) {
+                addrs.emplace("relaybench" + std::to_string(i), "127.0.0.1:" + std::to_string(PEER_BENCH_PORT));
+            }
+            peers->UpdatePeers(addrs);
+            while (peers->GetStats().links_up < TARGET_SERVERS) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            Cleanup(*redis);
+            OutboundRelay relay(async_redis, "bench");
+            relay.SetPeerLinks(peers);
+            relay.Start();
+            auto beg = std::chrono::steady_clock::now();
+            res = Run([&](const std::string &sid, uint64_t from, uint64_t to, std::function<void(bool)> cb) {
+                relay.Send(sid, from, to, CONTENT, std::move(cb));
+            });
+            while (received.load(std::memory_order_relaxed) < TOTAL_MSGS) {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+            double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - beg).count();
+            relay.Stop();
+            RelayStats st = relay.GetStats();
+            std::printf("peer link window 1000 us:     %9.0f msg/s, latency %8.1f us, %lu stream entries, "
+                        "all received in %.3f s\n",
+                        res.msg_per_sec, res.latency_us, st.stream_entries, sec);
+        }
+        peers->Stop();
+        receiver.Stop();
+    }
+
+    async_redis->Stop();
+    Cleanup(*redis);
+    return 0;
+}
@@ -0,0 +1,108 @@
+// 在线状态刷新记录（OnlineStatusUploader的热路径）的竞争基准测试
+// 8个线程模拟io/分片线程，每条消息都为其发送者记录一次"活跃"，另有一个线程每COLLECT_INTERVAL取走一次待上传列表：
+//  - mutex:  原来的实现，每条消息获取互斥锁并插入unordered_set；
+//  - epoch:  PresenceTracker，Session中保存纪元，每个周期中用户的第一条消息才压入无锁栈。
+// 输出消息吞吐量，以及每次收集得到的平均uid数（两种实现应当接近）。
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "server/presence_tracker.hpp"
+
+using namespace chatroom::backend;
+
+constexpr int USERS = 100000;
+constexpr int MSGS_PER_THREAD = 2000000;
+constexpr std::chrono::milliseconds COLLECT_INTERVAL{10};
+
+struct BenchSession {
+    uint64_t uid;
+    std::atomic<uint32_t> epoch{0};
+};
+
+class MutexTracker {
+   public:
+    void MarkActive(uint64_t uid, std::atomic<uint32_t> &) {
+        std::unique_lock lock(mtx_);
+        sess_.insert(uid);
+    }
+
+    void Collect(std::vector<uint64_t> &out) {
+        std::unique_lock lock(mtx_);
+        std::unordered_set<uint64_t> list = std::move(sess_);
+        sess_.clear();
+        lock.unlock();
+        out.assign(list.begin(), list.end());
+    }
+
+   private:
+    std::mutex mtx_;
+    std::unordered_set<uint64_t> sess_;
+};
+
+template <typename Tracker>
+static void Run(const char *name, int threads) {
+    Tracker tracker;
+    std::vector<std::unique_ptr<BenchSession>> sessions;
+    for (int i = 0; i < USERS; ++i) {
+        sessions.push_back(std::make_unique<BenchSession>());
+        sessions.back()->uid = i + 1;
+    }
+
+    // 预先生成每个线程的消息发送者，少数活跃用户发送大部分消息
+    std::vector<std::vector<BenchSession *>> senders(threads);
+    for (int t = 0; t < threads; ++t) {
+        std::mt19937 rng(t);
+        std::geometric_distribution<int> dist(0.001);
+        for (int i = 0; i < MSGS_PER_THREAD; ++i) {
+            senders[t].push_back(sessions[dist(rng) % USERS].get());
+        }
+    }
+
+    std::atomic<bool> running{true};
+    uint64_t collects = 0;
+    uint64_t collected = 0;
+    std::thread collector([&] {
+        std::vector<uint64_t> out;
+        while (running.load(std::memory_order_relaxed)) {
+            std::this_thread::sleep_for(COLLECT_INTERVAL);
+            out.clear();
+            tracker.Collect(out);
+            ++collects;
+            collected += out.size();
+        }
+    });
+
+    auto beg = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            for (BenchSession *sess : senders[t]) {
+                tracker.MarkActive(sess->uid, sess->epoch);
+            }
+        });
+    }
+    for (auto &th : workers) th.join();
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - beg).count();
+    running.store(false, std::memory_order_relaxed);
+    collector.join();
+
+    std::printf("%-6s %d threads: %8.2f Mmsg/s, %lu collects, avg %.0f uids per collect\n", name, threads,
+                static_cast<double>(threads) * MSGS_PER_THREAD / sec / 1e6, collects,
+                collects ? static_cast<double>(collected) / collects : 0.0);
+}
+
+int main() {
+    for (int threads : {1, 8}) {
+        Run<MutexTracker>("mutex", threads);
+        Run<PresenceTracker>("epoch", threads);
+    }
+    return 0;
+}
@@ -0,0 +1,82 @@
+// MsgHandler分片执行器（ShardExecutor）的吞吐量基准测试
+// 模拟4个io线程为1024个Session投递消息，每条消息的处理耗时约2us的CPU计算；
+// 其中1%的消息模拟一次同步的Redis往返（阻塞200us），用来观察慢请求对整体吞吐量的影响。
+// 分别测试1/2/4/8个分片，同时检查同一个Session的消息是否按投递顺序被处理。
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "server/shard_executor.hpp"
+
+using namespace chatroom::backend;
+
+constexpr int IO_THREADS = 4;
+constexpr int SESSIONS = 1024;
+constexpr int MSGS_PER_THREAD = 50000;
+
+struct BenchMsg {
+    uint32_t sess;
+    uint32_t seq;
+};
+
+static void BusyWork(std::chrono::nanoseconds dur) {
+    auto end = std::chrono::steady_clock::now() + dur;
+    while (std::chrono::steady_clock::now() < end) {
+    }
+}
+
+static void RunBench(uint32_t shard_count) {
+    std::vector<uint32_t> last_seq(SESSIONS, 0);  // 每个Session只会在一个分片上处理，不需要同步
+    std::atomic<uint64_t> processed{0};
+    std::atomic<uint64_t> out_of_order{0};
+    const uint64_t total = static_cast<uint64_t>(IO_THREADS) * MSGS_PER_THREAD;
+
+    ShardExecutor<BenchMsg> exec(shard_count, [&](BenchMsg &&msg) {
+        if (msg.seq <= last_seq[msg.sess] && msg.seq != 0) {
+            out_of_order.fetch_add(1, std::memory_order_relaxed);
+        }
+        last_seq[msg.sess] = msg.seq;
+        if (msg.seq % 100 == 99) {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));  // 模拟同步Redis往返
+        } else {
+            BusyWork(std::chrono::microseconds(2));
+        }
+        processed.fetch_add(1, std::memory_order_relaxed);
+    });
+    exec.Start();
+
+    auto beg = std::chrono::steady_clock::now();
+    std::vector<std::thread> io;
+    for (int t = 0; t < IO_THREADS; ++t) {
+        io.emplace_back([&exec, t] {
+            // 每个io线程负责SESSIONS / IO_THREADS个Session，逐个Session轮流投递
+            std::vector<uint32_t> seq(SESSIONS / IO_THREADS, 0);
+            for (int i = 0; i < MSGS_PER_THREAD; ++i) {
+                uint32_t local = i % (SESSIONS / IO_THREADS);
+                uint32_t sess = t * (SESSIONS / IO_THREADS) + local;
+                exec.Post(sess * 64ULL + 0x7f0000000000ULL, {sess, ++seq[local]});
+            }
+        });
+    }
+    for (auto &th : io) th.join();
+    while (processed.load(std::memory_order_relaxed) < total) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    auto end = std::chrono::steady_clock::now();
+    chatroom::MpscQueueStats st = exec.GetQueueStats();
+    exec.Stop();
+
+    double sec = std::chrono::duration<double>(end - beg).count();
+    std::printf("shards: %u, messages: %lu, %.3f s, %.0f msg/s, out of order: %lu, queue high water: %lu\n",
+                shard_count, total, sec, static_cast<double>(total) / sec, out_of_order.load(), st.high_water);
+}
+
+int main() {
+    for (uint32_t shards : {1U, 2U, 4U, 8U}) {
+        RunBench(shards);
+    }
+    return 0;
+}
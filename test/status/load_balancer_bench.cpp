@@ -0,0 +1,111 @@
+// LoadBalancer在登录高峰下的负载分布模拟
+// 8个后台服务器的初始会话数在[2000, 4000]之间随机，之后的30s内每秒有10k次登录；
+// 每个服务器每15s上报一次自己的实际会话数（各个服务器的上报时刻错开），登录被分配后立即计入实际会话数。
+// 时间是模拟的（按登录的序号推进），不依赖真实的时钟，分别测试：
+//  - stale:       原来的行为，总是返回上报负载最小的服务器，两次上报之间负载不变；
+//  - min_load:    LoadBalancer的MIN_LOAD策略，上报负载加上预留数；
+//  - two_choices: LoadBalancer的TWO_CHOICES策略。
+// 输出每秒采样的最大会话数/平均会话数的最大值、单个服务器在一秒内收到的最多登录数、
+// 每次登录的平均耗时（含模拟本身），以及结束时各服务器的会话数。
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "status/load_balancer.hpp"
+
+using namespace chatroom::status;
+
+constexpr uint32_t SERVERS = 8;
+constexpr uint32_t LOGINS_PER_SEC = 10000;
+constexpr uint32_t SECONDS = 30;
+constexpr uint64_t REPORT_INTERVAL_MS = 15000;
+
+// 原来的行为：只看上报的负载
+class StaleBalancer {
+   public:
+    void Report(uint32_t id, uint32_t load) { reported_[id] = load; }
+    uint32_t Pick() {
+        return static_cast<uint32_t>(std::min_element(reported_.begin(), reported_.end()) - reported_.begin());
+    }
+
+   private:
+    std::vector<uint32_t> reported_ = std::vector<uint32_t>(SERVERS, 0);
+};
+
+// 把LoadBalancer包装成与StaleBalancer相同的接口
+class BalancerAdapter {
+   public:
+    explicit BalancerAdapter(BalancePolicy policy) : lb_(policy) {
+        for (uint32_t id = 0; id < SERVERS; ++id) {
+            lb_.RegisterServerInfo(id, "localhost:" + std::to_string(9000 + id), 0);
+        }
+    }
+    void Report(uint32_t id, uint32_t load) { lb_.UpdateServerLoad(id, load); }
+    uint32_t Pick() { return lb_.GetMinimalLoadServerInfo().first->id; }
+
+   private:
+    LoadBalancer lb_;
+};
+
+template <typename Balancer>
+static void Run(const char *name, Balancer &balancer) {
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<uint32_t> init_dist(2000, 4000);
+    std::vector<uint32_t> actual(SERVERS);
+    for (uint32_t id = 0; id < SERVERS; ++id) {
+        actual[id] = init_dist(rng);
+        balancer.Report(id, actual[id]);
+    }
+
+    double worst_ratio = 0;
+    uint32_t worst_hotspot = 0;
+    std::vector<uint32_t> this_sec(SERVERS, 0);
+    uint64_t total = static_cast<uint64_t>(LOGINS_PER_SEC) * SECONDS;
+    auto beg = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < total; ++i) {
+        uint64_t now_ms = i * 1000 / LOGINS_PER_SEC;
+        uint64_t next_ms = (i + 1) * 1000 / LOGINS_PER_SEC;
+        uint32_t id = balancer.Pick();
+        ++actual[id];
+        ++this_sec[id];
+
+        // 在[now_ms, next_ms)之间到期的上报，服务器i的上报时刻错开 i * REPORT_INTERVAL_MS / SERVERS
+        for (uint32_t srv = 0; srv < SERVERS; ++srv) {
+            uint64_t offset = srv * REPORT_INTERVAL_MS / SERVERS;
+            for (uint64_t t = now_ms; t < next_ms; ++t) {
+                if (t >= offset && (t - offset) % REPORT_INTERVAL_MS == 0) {
+                    balancer.Report(srv, actual[srv]);
+                }
+            }
+        }
+
+        if ((i + 1) % LOGINS_PER_SEC == 0) {
+            double mean = 0;
+            for (uint32_t load : actual) mean += load;
+            mean /= SERVERS;
+            worst_ratio = std::max(worst_ratio, *std::max_element(actual.begin(), actual.end()) / mean);
+            worst_hotspot = std::max(worst_hotspot, *std::max_element(this_sec.begin(), this_sec.end()));
+            std::fill(this_sec.begin(), this_sec.end(), 0);
+        }
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - beg).count();
+
+    std::printf("%-12s max/mean %.3f, hottest server %5u logins/s, %.0f ns per login, final:", name, worst_ratio,
+                worst_hotspot, ns / total);
+    for (uint32_t load : actual) std::printf(" %u", load);
+    std::printf("\n");
+}
+
+int main() {
+    StaleBalancer stale;
+    Run("stale", stale);
+    BalancerAdapter min_load(BalancePolicy::MIN_LOAD);
+    Run("min_load", min_load);
+    BalancerAdapter two_choices(BalancePolicy::TWO_CHOICES);
+    Run("two_choices", two_choices);
+    return 0;
+}
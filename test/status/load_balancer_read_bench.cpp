@@ -0,0 +1,134 @@
+// LoadBalancer读路径（每次登录一次GetMinimalLoadServerInfo）的并发基准测试
+// 64个后台服务器，32个读线程不停地选择服务器，另有一个写线程每10ms为一个服务器上报一次负载：
+//  - mutex:    原来的实现，每次读取都获取互斥锁，在小根堆上取堆顶并增加预留数；
+//  - snapshot: LoadBalancer（MIN_LOAD），读者使用线程缓存的只读快照，不获取任何锁，在快照上按排名扫描；
+//  - snap_2c:  LoadBalancer（TWO_CHOICES），同上，但每次只比较两个随机的服务器。
+// 输出读取的吞吐量和单次读取耗时的p50/p99/p99.9，以及写线程完成的上报次数。
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "status/load_balancer.hpp"
+#include "utils/latency_histogram.hpp"
+
+using namespace chatroom::status;
+using chatroom::LatencyHistogram;
+using Clock = std::chrono::steady_clock;
+
+constexpr uint32_t SERVERS = 64;
+constexpr int READERS = 32;
+constexpr int READS_PER_THREAD = 200000;
+constexpr std::chrono::milliseconds REPORT_INTERVAL{10};
+
+// 原来的实现：互斥锁 + 小根堆
+class MutexBalancer {
+   public:
+    MutexBalancer() {
+        for (uint32_t id = 0; id < SERVERS; ++id) {
+            auto si = std::make_unique<ServerInfo>(id, "10.0.0.1:" + std::to_string(1000 + id), 1000);
+            heap_.InsertOrUpdate(id, si.get());
+            hm_.emplace(id, std::move(si));
+        }
+    }
+
+    void UpdateServerLoad(uint32_t id, uint32_t load) {
+        std::unique_lock lock(mtx_);
+        ServerInfo *si = hm_.at(id).get();
+        si->load = load;
+        si->reserved = 0;
+        si->last_ts = chatroom::GetTimestampMs();
+        heap_.InsertOrUpdate(id, si, 0);
+    }
+
+    std::optional<ServerInfo> GetMinimalLoadServerInfo() {
+        std::unique_lock lock(mtx_);
+        while (!heap_.Empty()) {
+            ServerInfo *si = heap_.Get();
+            if (chatroom::GetTimestampMs() - si->last_ts < SERVER_TIMEOUT) {
+                ++si->reserved;
+                heap_.InsertOrUpdate(si->id, si, 1);
+                return *si;
+            }
+            heap_.Remove();
+            hm_.erase(si->GetID());
+        }
+        return std::nullopt;
+    }
+
+   private:
+    MinHeapImpl<ServerInfo *, decltype(SrvInfoComp) *> heap_{&SrvInfoComp};
+    std::unordered_map<uint32_t, std::unique_ptr<ServerInfo>> hm_;
+    std::mutex mtx_;
+};
+
+template <BalancePolicy POLICY>
+class SnapshotBalancer {
+   public:
+    SnapshotBalancer() {
+        for (uint32_t id = 0; id < SERVERS; ++id) {
+            lb_.RegisterServerInfo(id, "10.0.0.1:" + std::to_string(1000 + id), 1000);
+        }
+    }
+    void UpdateServerLoad(uint32_t id, uint32_t load) { lb_.UpdateServerLoad(id, load); }
+    std::optional<ServerInfo> GetMinimalLoadServerInfo() { return lb_.GetMinimalLoadServerInfo().first; }
+
+   private:
+    LoadBalancer lb_{POLICY};
+};
+
+template <typename Balancer>
+static void Run(const char *name) {
+    Balancer balancer;
+    std::atomic<bool> running{true};
+    uint64_t reports = 0;
+    std::thread writer([&] {
+        uint32_t id = 0;
+        while (running.load(std::memory_order_relaxed)) {
+            std::this_thread::sleep_for(REPORT_INTERVAL);
+            balancer.UpdateServerLoad(id, 1000 + static_cast<uint32_t>(reports % 500));
+            id = (id + 1) % SERVERS;
+            ++reports;
+        }
+    });
+
+    std::vector<LatencyHistogram> latencies(READERS);
+    auto beg = Clock::now();
+    std::vector<std::thread> readers;
+    for (int t = 0; t < READERS; ++t) {
+        readers.emplace_back([&, t] {
+            uint64_t misses = 0;
+            for (int i = 0; i < READS_PER_THREAD; ++i) {
+                auto start = Clock::now();
+                misses += !balancer.GetMinimalLoadServerInfo().has_value();
+                latencies[t].Record(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+            }
+            if (misses != 0) std::printf("unexpected: %lu reads found no server\n", misses);
+        });
+    }
+    for (auto &th : readers) th.join();
+    double sec = std::chrono::duration<double>(Clock::now() - beg).count();
+    running.store(false, std::memory_order_relaxed);
+    writer.join();
+
+    LatencyHistogram total;
+    for (auto &latency : latencies) latency.TakeInto(total);
+    // 直方图的单位在这里是纳秒
+    std::printf("%-9s %d readers: %7.2f Mreads/s, p50 %5lu ns, p99 %7lu ns, p99.9 %8lu ns, %lu reports\n", name,
+                READERS, static_cast<double>(READERS) * READS_PER_THREAD / sec / 1e6, total.Percentile(0.5),
+                total.Percentile(0.99), total.Percentile(0.999), reports);
+}
+
+int main() {
+    Run<MutexBalancer>("mutex");
+    Run<SnapshotBalancer<BalancePolicy::MIN_LOAD>>("snapshot");
+    Run<SnapshotBalancer<BalancePolicy::TWO_CHOICES>>("snap_2c");
+    return 0;
+}
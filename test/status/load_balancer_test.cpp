@@ -1,12 +1,13 @@
 // GTest for Load Balancer
 
-#include <vector>
 #include <iostream>
+#include <map>
+#include <vector>
 
 #include "status/load_balancer.hpp"
 #include <gtest/gtest.h>
 
-using namespace chatroom;
+using namespace chatroom::status;
 using namespace std;
 
 TEST(MinHeapImplTest, BasicOperation) {
@@ -14,7 +15,7 @@ TEST(MinHeapImplTest, BasicOperation) {
     v.emplace_back(0, "localhost:1234", 80);
     v.emplace_back(1, "localhost:1235", 40);
     v.emplace_back(2, "localhost:1236", 60000);
-    MinHeapImpl<ServerInfo*, decltype(srv_info_comp)*> heap{&srv_info_comp};
+    MinHeapImpl<ServerInfo*, decltype(SrvInfoComp)*> heap{&SrvInfoComp};
     
     // first element
     ASSERT_TRUE(heap.Empty());
@@ -52,7 +53,7 @@ TEST(MinHeapImplTest, BasicOperation) {
 }
 
 TEST(MinHeapImplTest, AnyRemove) {
-    MinHeapImpl<ServerInfo*, decltype(srv_info_comp)*> heap{&srv_info_comp};
+    MinHeapImpl<ServerInfo*, decltype(SrvInfoComp)*> heap{&SrvInfoComp};
     std::vector<ServerInfo> v;
     v.emplace_back(0, "localhost:9000", 11);
     v.emplace_back(1, "localhost:9001", 14);
@@ -114,7 +115,7 @@ TEST(MinHeapImplTest, AnyRemove) {
 }
 
 TEST(MinHeapImplTest, InsertMany) {
-    MinHeapImpl<ServerInfo*, decltype(srv_info_comp)*> heap{&srv_info_comp};
+    MinHeapImpl<ServerInfo*, decltype(SrvInfoComp)*> heap{&SrvInfoComp};
     // 注：这并不是一种好的方法！因为vector扩容之后其ServerInfo*会全部失效，
     // 但是这个测试仅仅是为了测试LoadBalancer和其MinHeapImpl对象，所以暂时忽略这个问题
     // 实际项目中不可以使用std::vector<ServerInfo>和其指针！
@@ -132,9 +133,136 @@ TEST(MinHeapImplTest, InsertMany) {
 
 }
 
+TEST(LoadBalancerTest, ReservationSpreadsBurst) {
+    LoadBalancer lb{BalancePolicy::MIN_LOAD};
+    lb.RegisterServerInfo(1, "localhost:9001", 100);
+    lb.RegisterServerInfo(2, "localhost:9002", 100);
+    lb.RegisterServerInfo(3, "localhost:9003", 130);
+
+    // 两次上报之间的登录不再全部落在同一个服务器上
+    std::map<uint32_t, int> hits;
+    for (int i = 0; i < 90; ++i) {
+        auto [si, updated] = lb.GetMinimalLoadServerInfo();
+        ASSERT_TRUE(si.has_value());
+        ++hits[si->id];
+    }
+    // 100 + 45, 100 + 45, 130 + 0 -> 30次之后三者持平，之后平均分配
+    ASSERT_EQ(hits[1], 40);
+    ASSERT_EQ(hits[2], 40);
+    ASSERT_EQ(hits[3], 10);
+
+    // 上报负载后预留数清零
+    lb.UpdateServerLoad(1, 0);
+    auto [si, updated] = lb.GetMinimalLoadServerInfo();
+    ASSERT_EQ(si->id, 1);
+    ASSERT_EQ(si->reserved, 1);
+}
+
+TEST(LoadBalancerTest, DrainingServerIsLastResort) {
+    for (auto policy : {BalancePolicy::MIN_LOAD, BalancePolicy::TWO_CHOICES}) {
+        LoadBalancer lb{policy};
+        lb.RegisterServerInfo(1, "localhost:9001", 0, true);
+        lb.RegisterServerInfo(2, "localhost:9002", 1000);
+        for (int i = 0; i < 100; ++i) {
+            ASSERT_EQ(lb.GetMinimalLoadServerInfo().first->id, 2);
+        }
+        lb.RemoveServer(2);
+        ASSERT_EQ(lb.GetMinimalLoadServerInfo().first->id, 1);
+    }
+}
+
+TEST(LoadBalancerTest, TwoChoicesSpreadsBurst) {
+    LoadBalancer lb{BalancePolicy::TWO_CHOICES};
+    for (uint32_t id = 0; id < 8; ++id) {
+        lb.RegisterServerInfo(id, "localhost:" + std::to_string(9000 + id), 0);
+    }
+    for (int i = 0; i < 8000; ++i) {
+        ASSERT_TRUE(lb.GetMinimalLoadServerInfo().first.has_value());
+    }
+    std::vector<ServerInfo> out;
+    lb.CopyServerInfoList(out);
+    ASSERT_EQ(out.size(), 8);
+    for (auto &si : out) {
+        // 两个选择下最大负载与平均值的差距很小
+        ASSERT_GT(si.reserved, 950);
+        ASSERT_LT(si.reserved, 1050);
+    }
+}
+
+TEST(LoadBalancerTest, SaturatedHandlerIsAvoided) {
+    LoadBalancer lb{BalancePolicy::MIN_LOAD};
+    ServerMetrics saturated;
+    saturated.queue_depth = 5000;
+    saturated.p99_us = 200000;
+    lb.RegisterServerInfo(1, "localhost:9001", 100);
+    lb.RegisterServerInfo(2, "localhost:9002", 20000);
+    // 会话数很少，但处理线程已经饱和
+    lb.UpdateServerLoad(1, 100, false, saturated);
+    for (int i = 0; i < 1000; ++i) {
+        ASSERT_EQ(lb.GetMinimalLoadServerInfo().first->id, 2);
+    }
+    // 恢复之后重新被选择
+    lb.UpdateServerLoad(1, 100);
+    ASSERT_EQ(lb.GetMinimalLoadServerInfo().first->id, 1);
+}
+
+TEST(LoadBalancerTest, CapacityWeightsSessions) {
+    LoadBalancer lb{BalancePolicy::MIN_LOAD};
+    ServerMetrics big;
+    big.capacity = 300;
+    lb.RegisterServerInfo(1, "localhost:9001", 0, false, big);
+    lb.RegisterServerInfo(2, "localhost:9002", 0);
+    std::map<uint32_t, int> hits;
+    for (int i = 0; i < 4000; ++i) {
+        ++hits[lb.GetMinimalLoadServerInfo().first->id];
+    }
+    // 容量为3倍的服务器分到3倍的登录
+    ASSERT_NEAR(hits[1], 3000, 1);
+    ASSERT_NEAR(hits[2], 1000, 1);
+}
+
+TEST(LoadBalancerTest, RestoredServersAreProvisional) {
+    LoadBalancer lb(BalancePolicy::MIN_LOAD);
+    lb.RegisterServerInfo(3, "localhost:1237", 500);  // 重启之后已经重新登记的服务器
+
+    uint64_t now = chatroom::GetTimestampMs();
+    vector<ServerInfo> snapshot;
+    snapshot.emplace_back(1, "localhost:1235", 100);
+    snapshot.back().last_ts = now - 10 * 1000;
+    snapshot.emplace_back(2, "localhost:1236", 200);
+    snapshot.back().last_ts = now - SERVER_TIMEOUT;  // 已经过期
+    snapshot.emplace_back(3, "localhost:1237", 0);   // 已经存在，不会被覆盖
+    snapshot.back().last_ts = now;
+    ASSERT_EQ(lb.RestoreServers(snapshot), 1);
+
+    // 恢复之后立即可以被选择
+    auto [si, expired] = lb.GetMinimalLoadServerInfo();
+    ASSERT_TRUE(si.has_value());
+    ASSERT_EQ(si->id, 1);
+    ASSERT_TRUE(si->provisional);
+    ASSERT_EQ(si->last_ts, now - 10 * 1000);
+
+    vector<ServerInfo> out;
+    lb.CopyServerInfoList(out);
+    ASSERT_EQ(out.size(), 2);
+    for (auto &item : out) {
+        ASSERT_EQ(item.provisional, item.id == 1);
+        if (item.id == 3) {
+            ASSERT_EQ(item.load, 500);
+        }
+    }
+
+    // 重新上报之后转为正常
+    ASSERT_TRUE(lb.UpdateServerLoad(1, 150));
+    lb.CopyServerInfoList(out);
+    for (auto &item : out) {
+        ASSERT_FALSE(item.provisional);
+    }
+}
+
 // TODO(user): 未来加上线程安全测试！
 
 int main(int argc, char** argv) {
     testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
-}
\ No newline at end of file
+}
@@ -0,0 +1,154 @@
+// 状态服务CheckMinimalLoadServer的压测工具（类似ghz）
+// 用法: bench_status_rpc [sync|async|<host:port>] [concurrency] [duration_sec] [threads]
+//  - sync/async: 在进程内启动一个同步/异步模式的状态服务（不连接Redis，登记8个虚拟的后台服务器，
+//    主线程每100ms为每个服务器上报一次负载，模拟后台服务器的上报与查询竞争）；
+//  - host:port: 压测一个已经在运行的状态服务。
+//  concurrency个调用者（默认1000）平均分配到threads个线程（默认为CPU核数），每个线程有自己的Channel和CompletionQueue，
+//  每个调用者的请求完成后立即发出下一个请求。持续duration_sec秒（默认10s）后输出RPS、延迟的百分位数和失败的请求数。
+
+#include <grpcpp/create_channel.h>
+#include <grpcpp/security/credentials.h>
+#include <grpcpp/support/channel_arguments.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "protocpp/status.grpc.pb.h"
+#include "protocpp/status.pb.h"
+#include "status/load_balancer.hpp"
+#include "status/status_class.hpp"
+#include "utils/latency_histogram.hpp"
+
+using namespace chatroom::status;
+using chatroom::LatencyHistogram;
+using Clock = std::chrono::steady_clock;
+
+constexpr const char *LOCAL_ADDR = "127.0.0.1:50151";
+constexpr uint32_t LOCAL_SERVERS = 8;
+
+struct Caller {
+    std::unique_ptr<grpc::ClientContext> ctx;
+    MinimalLoadServerReq req;
+    ServerAddrResp resp;
+    grpc::Status status;
+    std::unique_ptr<grpc::ClientAsyncResponseReader<ServerAddrResp>> reader;
+    Clock::time_point start;
+};
+
+struct DriverResult {
+    uint64_t ok{0};
+    uint64_t failed{0};
+};
+
+static void Issue(StatusService::Stub *stub, grpc::CompletionQueue *cq, Caller *caller) {
+    caller->ctx = std::make_unique<grpc::ClientContext>();  // ClientContext不能复用
+    caller->start = Clock::now();
+    caller->reader = stub->PrepareAsyncCheckMinimalLoadServer(caller->ctx.get(), caller->req, cq);
+    caller->reader->StartCall();
+    caller->reader->Finish(&caller->resp, &caller->status, caller);
+}
+
+static void DriverThread(const std::string &addr, uint32_t callers, Clock::time_point deadline,
+                         LatencyHistogram &latency, DriverResult &result) {
+    // 每个线程使用独立的子通道池，即独立的TCP连接
+    grpc::ChannelArguments args;
+    args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+    auto stub = StatusService::NewStub(grpc::CreateCustomChannel(addr, grpc::InsecureChannelCredentials(), args));
+    grpc::CompletionQueue cq;
+    std::vector<Caller> pool(callers);
+    for (auto &caller : pool) {
+        Issue(stub.get(), &cq, &caller);
+    }
+    uint32_t outstanding = callers;
+    void *tag;
+    bool ok;
+    while (outstanding > 0 && cq.Next(&tag, &ok)) {
+        auto *caller = static_cast<Caller *>(tag);
+        auto now = Clock::now();
+        if (ok && caller->status.ok()) {
+            ++result.ok;
+            latency.Record(std::chrono::duration_cast<std::chrono::microseconds>(now - caller->start).count());
+        } else {
+            ++result.failed;
+        }
+        if (now < deadline) {
+            Issue(stub.get(), &cq, caller);
+        } else {
+            --outstanding;
+        }
+    }
+    cq.Shutdown();
+    while (cq.Next(&tag, &ok)) {
+    }
+}
+
+int main(int argc, char **argv) {
+    std::string target = argc > 1 ? argv[1] : "async";
+    uint32_t concurrency = argc > 2 ? std::stoul(argv[2]) : 1000;
+    uint32_t duration = argc > 3 ? std::stoul(argv[3]) : 10;
+    uint32_t threads = argc > 4 ? std::stoul(argv[4]) : std::max(1U, std::thread::hardware_concurrency());
+    threads = std::clamp(threads, 1U, concurrency);
+
+    // 进程内的状态服务
+    std::unique_ptr<LoadBalancer> balancer;
+    std::unique_ptr<StatusRPCManager> rpc;
+    std::thread server_th;
+    std::string addr = target;
+    if (target == "sync" || target == "async") {
+        addr = LOCAL_ADDR;
+        balancer = std::make_unique<LoadBalancer>();
+        for (uint32_t id = 0; id < LOCAL_SERVERS; ++id) {
+            balancer->RegisterServerInfo(id, "10.0.0." + std::to_string(id) + ":1235", 0);
+        }
+        rpc = std::make_unique<StatusRPCManager>(nullptr, balancer.get(), nullptr, target == "async");
+        server_th = std::thread([&] { rpc->Run(addr); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));  // 等待服务启动
+    }
+
+    std::printf("target %s, %u callers on %u threads, %u s\n", target.c_str(), concurrency, threads, duration);
+    auto beg = Clock::now();
+    auto deadline = beg + std::chrono::seconds(duration);
+    std::vector<LatencyHistogram> latencies(threads);
+    std::vector<DriverResult> results(threads);
+    std::vector<std::thread> drivers;
+    for (uint32_t t = 0; t < threads; ++t) {
+        uint32_t callers = concurrency / threads + (t < concurrency % threads ? 1 : 0);
+        drivers.emplace_back(DriverThread, std::cref(addr), callers, deadline, std::ref(latencies[t]),
+                             std::ref(results[t]));
+    }
+    if (balancer) {
+        // 模拟后台服务器的负载上报
+        uint32_t tick = 0;
+        while (Clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            for (uint32_t id = 0; id < LOCAL_SERVERS; ++id) {
+                balancer->UpdateServerLoad(id, 1000 + (tick + id) % 100);
+            }
+            ++tick;
+        }
+    }
+    for (auto &th : drivers) th.join();
+    double sec = std::chrono::duration<double>(Clock::now() - beg).count();
+
+    LatencyHistogram total;
+    DriverResult sum;
+    for (uint32_t t = 0; t < threads; ++t) {
+        latencies[t].TakeInto(total);
+        sum.ok += results[t].ok;
+        sum.failed += results[t].failed;
+    }
+    std::printf("%.0f rps, p50 %lu us, p90 %lu us, p99 %lu us, p99.9 %lu us, %lu ok, %lu failed\n",
+                static_cast<double>(sum.ok) / sec, total.Percentile(0.5), total.Percentile(0.9),
+                total.Percentile(0.99), total.Percentile(0.999), sum.ok, sum.failed);
+
+    if (rpc) {
+        rpc->Stop();
+        server_th.join();
+    }
+    return 0;
+}
@@ -0,0 +1,102 @@
+// SessionManager会话表的并发基准测试
+// 预先插入1M个会话，16个线程执行混合操作：90%查找、5%插入、5%删除（插入和删除的是预填充范围之外的UID），
+// 分别测试原来的实现（一个互斥锁保护的unordered_map）与ShardedMap（64个分片）。
+// 值为shared_ptr，与SessionManager中一样，查找需要拷贝并增加引用计数。
+// 输出吞吐量，并检查结束时的元素个数与插入/删除的次数一致。
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "utils/sharded_map.hpp"
+
+constexpr uint64_t PREFILL = 1000000;
+constexpr int THREADS = 16;
+constexpr int OPS_PER_THREAD = 1000000;
+
+using Value = std::shared_ptr<int>;
+
+class MutexMap {
+   public:
+    bool TryEmplace(uint64_t key, Value value) {
+        std::unique_lock lock(mtx_);
+        return map_.try_emplace(key, std::move(value)).second;
+    }
+
+    bool Erase(uint64_t key) {
+        std::unique_lock lock(mtx_);
+        return map_.erase(key) == 1;
+    }
+
+    bool Find(uint64_t key, Value &out) {
+        std::unique_lock lock(mtx_);
+        auto it = map_.find(key);
+        if (it == map_.end()) return false;
+        out = it->second;
+        return true;
+    }
+
+    std::size_t Size() {
+        std::unique_lock lock(mtx_);
+        return map_.size();
+    }
+
+   private:
+    std::mutex mtx_;
+    std::unordered_map<uint64_t, Value> map_;
+};
+
+template <typename Map>
+static void Run(const char *name) {
+    auto map = std::make_unique<Map>();
+    auto value = std::make_shared<int>(0);
+    for (uint64_t i = 0; i < PREFILL; ++i) {
+        map->TryEmplace(i, value);
+    }
+
+    std::atomic<int64_t> delta{0};
+    auto beg = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < THREADS; ++t) {
+        workers.emplace_back([&, t] {
+            std::mt19937_64 rng(t);
+            int64_t local_delta = 0;
+            uint64_t found = 0;
+            Value out;
+            // 每个线程插入/删除自己的UID区间，避免线程之间的插入和删除互相抵消
+            uint64_t own_base = PREFILL + static_cast<uint64_t>(t) * OPS_PER_THREAD;
+            for (int i = 0; i < OPS_PER_THREAD; ++i) {
+                uint64_t r = rng();
+                uint32_t op = r % 100;
+                if (op < 90) {
+                    found += map->Find((r >> 8) % PREFILL, out);
+                } else if (op < 95) {
+                    local_delta += map->TryEmplace(own_base + (r >> 8) % 1024, value);
+                } else {
+                    local_delta -= map->Erase(own_base + (r >> 8) % 1024);
+                }
+            }
+            delta.fetch_add(local_delta);
+            if (found == 0) std::printf("unexpected: no lookups hit\n");
+        });
+    }
+    for (auto &th : workers) th.join();
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - beg).count();
+
+    std::size_t expect = PREFILL + delta.load();
+    std::printf("%-8s %d threads: %7.2f Mops/s, size %zu (expected %zu)%s\n", name, THREADS,
+                static_cast<double>(THREADS) * OPS_PER_THREAD / sec / 1e6, map->Size(), expect,
+                map->Size() == expect ? "" : "  MISMATCH");
+}
+
+int main() {
+    Run<MutexMap>("mutex");
+    Run<ShardedMap<uint64_t, Value>>("sharded");
+    return 0;
+}